@@ -0,0 +1,696 @@
+#include "system.h"
+#include "client.h"
+#include "channel.h"
+#include "message_parser.h"
+#include "protocol_executor.h"
+
+#include <new>
+#include <chrono>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+/**
+ * Replays a corpus of sequenced server messages through Channel::Receive() and the message parser.
+ *
+ * A corpus file is a sequence of records, each record is a 32-bit little-endian datagram length
+ * followed by the datagram data (including the sequence and acknowledge numbers).
+ * If no corpus file is supplied, a synthetic one is generated. It contains serverdata, baselines,
+ * delta and non-delta frames with game commands, compressed and fragmented packets.
+ */
+
+class NullConsole : public Console
+{
+	void VPrintf( const char *, va_list ) override {}
+};
+
+class TaggedConsole : public Console
+{
+	const char *tag;
+	void VPrintf( const char *format, va_list va ) override {
+		fputs( tag, stdout );
+		fputs( ": ", stdout );
+		vfprintf( stdout, format, va );
+	}
+
+public:
+	TaggedConsole( const char *tag_ ) : tag( tag_ ) {}
+};
+
+template <typename T, typename... Args>
+static T *New( Args... args ) {
+	void *mem = malloc( sizeof( T ) );
+
+	if( !mem ) {
+		abort();
+	}
+
+	return new(mem)T( args... );
+}
+
+template <typename T>
+static void Delete( T *object ) {
+	object->~T();
+	free( object );
+}
+
+class Corpus
+{
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+	unsigned numRecords;
+
+	void Reserve( size_t newSize ) {
+		if( newSize <= capacity ) {
+			return;
+		}
+
+		capacity = newSize * 2;
+		data = (uint8_t *)realloc( data, capacity );
+
+		if( !data ) {
+			abort();
+		}
+	}
+
+public:
+	Corpus() : data( nullptr ), size( 0 ), capacity( 0 ), numRecords( 0 ) {}
+
+	~Corpus() {
+		free( data );
+	}
+
+	const uint8_t *Data() const { return data; }
+	size_t Size() const { return size; }
+	unsigned NumRecords() const { return numRecords; }
+
+	void AddRecord( const uint8_t *recordData, unsigned recordSize ) {
+		Reserve( size + 4 + recordSize );
+
+		for( unsigned i = 0; i < 4; ++i ) {
+			data[size++] = (uint8_t)( ( recordSize >> ( 8 * i ) ) & 0xFF );
+		}
+
+		memcpy( data + size, recordData, recordSize );
+		size += recordSize;
+		numRecords++;
+	}
+
+	// Returns a record data pointer and the record size at the supplied offset and advances the offset
+	const uint8_t *NextRecord( size_t *offset, unsigned *recordSize ) const {
+		if( *offset + 4 > size ) {
+			return nullptr;
+		}
+
+		const uint8_t *p = data + *offset;
+		*recordSize = p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( (unsigned)p[3] << 24 );
+
+		if( *offset + 4 + *recordSize > size ) {
+			return nullptr;
+		}
+
+		*offset += 4 + *recordSize;
+		return p + 4;
+	}
+
+	bool Load( const char *filename );
+	bool Save( const char *filename ) const;
+};
+
+bool Corpus::Load( const char *filename ) {
+	FILE *fp = fopen( filename, "rb" );
+
+	if( !fp ) {
+		return false;
+	}
+
+	fseek( fp, 0, SEEK_END );
+	long fileSize = ftell( fp );
+	fseek( fp, 0, SEEK_SET );
+
+	if( fileSize <= 0 ) {
+		fclose( fp );
+		return false;
+	}
+
+	Reserve( (size_t)fileSize );
+	size = fread( data, 1, (size_t)fileSize, fp );
+	fclose( fp );
+
+	if( size != (size_t)fileSize ) {
+		return false;
+	}
+
+	// Validate records and count them
+	size_t offset = 0;
+	unsigned recordSize;
+	numRecords = 0;
+
+	while( NextRecord( &offset, &recordSize ) ) {
+		if( recordSize > MAX_MSGLEN ) {
+			return false;
+		}
+		numRecords++;
+	}
+
+	return offset == size;
+}
+
+bool Corpus::Save( const char *filename ) const {
+	FILE *fp = fopen( filename, "wb" );
+
+	if( !fp ) {
+		return false;
+	}
+
+	bool result = fwrite( data, 1, size, fp ) == size;
+	return !fclose( fp ) && result;
+}
+
+/**
+ * Generates a synthetic but realistic stream of a server messages for the protocol 2.1.
+ */
+class CorpusBuilder
+{
+	static constexpr auto SVC_SERVERCMD = 2;
+	static constexpr auto SVC_SERVERDATA = 3;
+	static constexpr auto SVC_SPAWNBASELINE = 4;
+	static constexpr auto SVC_PLAYERINFO = 6;
+	static constexpr auto SVC_PACKETENTITIES = 7;
+	static constexpr auto SVC_GAMECOMMANDS = 8;
+	static constexpr auto SVC_MATCH = 9;
+	static constexpr auto SVC_SERVERCS = 11;
+	static constexpr auto SVC_FRAME = 12;
+
+	static constexpr auto SV_BITFLAGS_RELIABLE = 1 << 1;
+	static constexpr auto FRAMESNAP_FLAG_DELTA = 1 << 0;
+	static constexpr auto FRAMESNAP_FLAG_MULTIPOV = 1 << 2;
+
+	static constexpr auto U_ORIGIN1 = 1 << 0;
+	static constexpr auto U_ORIGIN2 = 1 << 1;
+	static constexpr auto U_ORIGIN3 = 1 << 2;
+	static constexpr auto U_ANGLE1 = 1 << 3;
+	static constexpr auto U_ANGLE2 = 1 << 4;
+	static constexpr auto U_EVENT = 1 << 5;
+	static constexpr auto U_MOREBITS1 = 1 << 7;
+	static constexpr auto U_NUMBER16 = 1 << 8;
+	static constexpr auto U_FRAME8 = 1 << 9;
+	static constexpr auto U_MODEL = 1 << 11;
+	static constexpr auto U_TYPE = 1 << 12;
+	static constexpr auto U_MOREBITS2 = 1 << 15;
+	static constexpr auto U_SOLID = 1 << 21;
+
+	// Messages larger than this are compressed by the server
+	static constexpr unsigned COMPRESSION_THRESHOLD = 256;
+	static constexpr unsigned FRAGMENT_SIZE = 1200;
+
+	Corpus *corpus;
+	Message *payload;
+	Message *datagram;
+
+	int sequenceNum;
+	const unsigned numEntities;
+	const unsigned numPlayers;
+
+	void WriteEntityBits( Message &message, unsigned number, unsigned bits );
+	void WriteBaseline( unsigned number );
+	void WritePlayerState( unsigned playerNum, bool delta, unsigned frameNum );
+	void WriteFrame( unsigned frameNum, bool delta );
+	void AddSequencedMessage( bool allowCompression );
+
+public:
+	CorpusBuilder( Corpus *corpus_, unsigned numEntities_, unsigned numPlayers_ )
+		: corpus( corpus_ ), sequenceNum( 0 ), numEntities( numEntities_ ), numPlayers( numPlayers_ ) {
+		payload = New<Message>();
+		datagram = New<Message>();
+	}
+
+	~CorpusBuilder() {
+		Delete( payload );
+		Delete( datagram );
+	}
+
+	void Build( unsigned numFrames );
+};
+
+void CorpusBuilder::WriteEntityBits( Message &message, unsigned number, unsigned bits ) {
+	if( number > 0xFF ) {
+		bits |= U_NUMBER16;
+	}
+
+	if( bits & 0xFFFF0000u ) {
+		bits |= U_MOREBITS2;
+	}
+
+	if( bits & 0xFFFFFF00u ) {
+		bits |= U_MOREBITS1;
+	}
+
+	message.WriteByte( bits & 0xFF );
+
+	if( bits & U_MOREBITS1 ) {
+		message.WriteByte( ( bits >> 8 ) & 0xFF );
+	}
+
+	if( bits & U_MOREBITS2 ) {
+		message.WriteByte( ( bits >> 16 ) & 0xFF );
+	}
+
+	if( bits & U_NUMBER16 ) {
+		message.WriteShort( (int)number );
+	} else {
+		message.WriteByte( (int)number );
+	}
+}
+
+void CorpusBuilder::WriteBaseline( unsigned number ) {
+	Message &message = *payload;
+	message.WriteByte( SVC_SPAWNBASELINE );
+	WriteEntityBits( message, number, U_TYPE | U_SOLID | U_MODEL | U_ORIGIN1 | U_ORIGIN2 | U_ORIGIN3 );
+	message.WriteByte( 1 );
+	message.WriteShort( ( number % 8 ) ? 1 : 31 );
+	message.WriteShort( (int)( number % 64 ) );
+
+	for( int i = 0; i < 3; ++i ) {
+		message.WriteInt3( (int)( number * 16 + i ) );
+	}
+}
+
+void CorpusBuilder::WritePlayerState( unsigned playerNum, bool delta, unsigned frameNum ) {
+	Message &message = *payload;
+	message.WriteByte( SVC_PLAYERINFO );
+
+	// Origins and a morebits flag
+	message.WriteByte( 0x8E );
+
+	if( delta ) {
+		// View angles
+		message.WriteByte( 0x40 );
+	} else {
+		// View angles, a player number and corresponding morebits flags
+		message.WriteByte( 0xC0 );
+		message.WriteByte( 0x80 );
+		message.WriteByte( 0x10 );
+	}
+
+	for( int i = 0; i < 3; ++i ) {
+		message.WriteInt3( (int)( frameNum * 8 + playerNum + i ) );
+	}
+
+	for( int i = 0; i < 3; ++i ) {
+		message.WriteShort( (int)( frameNum + i ) );
+	}
+
+	if( !delta ) {
+		message.WriteByte( (int)playerNum );
+	}
+
+	// Stats bits (a delta frame carries only few changed stats)
+	const uint32_t statBits[2] = { delta ? 0x3u : 0xFFFFu, delta ? 0u : 0x3u };
+	message.WriteLong( (int)statBits[0] );
+	message.WriteLong( (int)statBits[1] );
+
+	for( int i = 0; i < 64; ++i ) {
+		if( statBits[i >> 5] & ( 1u << ( i & 31 ) ) ) {
+			message.WriteShort( (int)( ( frameNum + i ) & 0x7FFF ) );
+		}
+	}
+}
+
+void CorpusBuilder::WriteFrame( unsigned frameNum, bool delta ) {
+	Message &message = *payload;
+	const bool multipov = numPlayers > 1;
+
+	message.WriteByte( SVC_FRAME );
+	const unsigned lengthOffset = message.CurrSize();
+	message.WriteShort( 0 );
+	message.WriteLong( (int)( frameNum * 16 ) );
+	message.WriteLong( (int)frameNum );
+	message.WriteLong( delta ? (int)frameNum - 1 : 0 );
+	message.WriteLong( 0 );
+	message.WriteByte( ( delta ? FRAMESNAP_FLAG_DELTA : 0 ) | ( multipov ? FRAMESNAP_FLAG_MULTIPOV : 0 ) );
+	message.WriteByte( 0 );
+
+	message.WriteByte( SVC_GAMECOMMANDS );
+
+	if( !( frameNum % 4 ) ) {
+		message.WriteShort( 0 );
+		message.WriteString( ( frameNum % 8 ) ? "ti \"1 2 3\"" : "mm \"Hello, world!\"" );
+
+		if( multipov ) {
+			// Targets bitset
+			message.WriteByte( 1 );
+			message.WriteByte( 0x01 );
+		}
+	}
+	message.WriteShort( -1 );
+
+	// Area bits
+	message.WriteByte( 1 );
+	message.WriteByte( 0xFF );
+
+	// Game state
+	message.WriteByte( SVC_MATCH );
+	message.WriteByte( delta ? 0 : 0xFF );
+	message.WriteShort( delta ? 0x1 : 0xFFFF );
+
+	if( !delta ) {
+		for( int i = 0; i < 8; ++i ) {
+			message.WriteLong( (int)( frameNum + i ) );
+		}
+	}
+
+	for( int i = 0; i < ( delta ? 1 : 16 ); ++i ) {
+		message.WriteShort( (int)( frameNum & 0x7FFF ) );
+	}
+
+	for( unsigned i = 0; i < numPlayers; ++i ) {
+		WritePlayerState( i, delta, frameNum );
+	}
+	message.WriteByte( 0 );
+
+	message.WriteByte( SVC_PACKETENTITIES );
+
+	for( unsigned i = 0; i < numEntities; ++i ) {
+		const unsigned number = i + 1;
+
+		// Only moving entities are transmitted in delta frames
+		if( delta && ( number % 3 ) ) {
+			continue;
+		}
+
+		unsigned bits = U_ORIGIN1 | U_ORIGIN2 | U_ANGLE1;
+
+		if( !( ( number + frameNum ) % 16 ) ) {
+			bits |= U_EVENT;
+		}
+
+		if( !delta ) {
+			bits |= U_ORIGIN3 | U_ANGLE2 | U_FRAME8;
+		}
+
+		WriteEntityBits( message, number, bits );
+
+		if( bits & U_FRAME8 ) {
+			message.WriteByte( (int)( frameNum & 0xFF ) );
+		}
+
+		message.WriteInt3( (int)( frameNum * 4 + number ) );
+		message.WriteInt3( (int)( frameNum * 2 + number ) );
+
+		if( !delta ) {
+			message.WriteInt3( (int)number );
+		}
+
+		// Baselines of every 8th entity are brush models that have 16-bit angles
+		const bool bmodel = !( number % 8 );
+
+		for( int j = 0; j < ( delta ? 1 : 2 ); ++j ) {
+			if( bmodel ) {
+				message.WriteShort( (int)( frameNum & 0x7FFF ) );
+			} else {
+				message.WriteByte( (int)( frameNum & 0xFF ) );
+			}
+		}
+
+		if( bits & U_EVENT ) {
+			message.WriteByte( 1 );
+		}
+	}
+
+	// A zero entity number terminates the list
+	message.WriteByte( 0 );
+	message.WriteByte( 0 );
+
+	const unsigned length = message.CurrSize() - lengthOffset - 2;
+	message.Buffer()[lengthOffset + 0] = (uint8_t)( length & 0xFF );
+	message.Buffer()[lengthOffset + 1] = (uint8_t)( ( length >> 8 ) & 0xFF );
+}
+
+void CorpusBuilder::AddSequencedMessage( bool allowCompression ) {
+	const uint8_t *data = payload->Buffer();
+	unsigned dataSize = payload->CurrSize();
+	bool compressed = false;
+
+	uint8_t compressedData[MAX_MSGLEN];
+
+	if( allowCompression && dataSize > COMPRESSION_THRESHOLD ) {
+		unsigned long compressedSize = sizeof( compressedData );
+
+		if( compress( compressedData, &compressedSize, data, dataSize ) != Z_OK ) {
+			abort();
+		}
+
+		if( compressedSize < dataSize ) {
+			data = compressedData;
+			dataSize = (unsigned)compressedSize;
+			compressed = true;
+		}
+	}
+
+	sequenceNum++;
+	const int ack = compressed ? (int)FRAGMENT_BIT : 0;
+
+	if( dataSize <= FRAGMENT_SIZE ) {
+		datagram->Clear();
+		datagram->WriteLong( sequenceNum );
+		datagram->WriteLong( ack );
+		datagram->WriteData( data, dataSize );
+		corpus->AddRecord( datagram->Buffer(), datagram->CurrSize() );
+		return;
+	}
+
+	for( unsigned offset = 0; offset < dataSize; offset += FRAGMENT_SIZE ) {
+		const unsigned length = dataSize - offset < FRAGMENT_SIZE ? dataSize - offset : FRAGMENT_SIZE;
+		const bool last = offset + length == dataSize;
+
+		datagram->Clear();
+		datagram->WriteLong( (int)( sequenceNum | FRAGMENT_BIT ) );
+		datagram->WriteLong( ack );
+		datagram->WriteShort( (int)offset );
+		datagram->WriteShort( (int)( length | ( last ? FRAGMENT_LAST : 0 ) ) );
+		datagram->WriteData( data + offset, length );
+		corpus->AddRecord( datagram->Buffer(), datagram->CurrSize() );
+	}
+}
+
+void CorpusBuilder::Build( unsigned numFrames ) {
+	payload->Clear();
+	payload->WriteByte( SVC_SERVERDATA );
+	payload->WriteLong( PROTOCOL21 );
+	payload->WriteLong( 1 );
+	payload->WriteShort( 16 );
+	payload->WriteString( "basewsw" );
+	payload->WriteString( "basewsw" );
+	payload->WriteShort( 0 );
+	payload->WriteString( "wbomb1" );
+	payload->WriteByte( SV_BITFLAGS_RELIABLE );
+	payload->WriteShort( 0 );
+	AddSequencedMessage( false );
+
+	payload->Clear();
+	payload->WriteByte( SVC_SERVERCS );
+	payload->WriteString( "cs 0 \"Benchmark server\" 1 \"wbomb1\" 2 \"bomb\"" );
+
+	for( unsigned i = 0; i < numEntities; ++i ) {
+		WriteBaseline( i + 1 );
+	}
+	AddSequencedMessage( true );
+
+	for( unsigned frameNum = 1; frameNum <= numFrames; ++frameNum ) {
+		payload->Clear();
+
+		if( !( frameNum % 64 ) ) {
+			payload->WriteByte( SVC_SERVERCMD );
+			payload->WriteString( "pr \"Periodic server message\n\"" );
+		}
+
+		// Emulate a client that has lost frames periodically and requests a non-delta frame
+		WriteFrame( frameNum, ( frameNum % 100 ) != 1 );
+		AddSequencedMessage( true );
+	}
+}
+
+class ParserBenchmark
+{
+	GenericClientProtocolExecutor *executor;
+	NetworkAddress serverAddress;
+
+public:
+	explicit ParserBenchmark( Client *client_ );
+
+	bool Run( const Corpus &corpus, unsigned iterations );
+};
+
+ParserBenchmark::ParserBenchmark( Client *client_ )
+	: executor( GenericClientProtocolExecutor::ForReplay( client_ ) ),
+	serverAddress( UnresolvedAddress( "127.0.0.1:44400" ).ToResolvedAddress() ) {}
+
+bool ParserBenchmark::Run( const Corpus &corpus, unsigned iterations ) {
+	if( !executor ) {
+		printf( "Cannot create a protocol executor\n" );
+		return false;
+	}
+
+	typedef std::chrono::steady_clock Clock;
+	const MessageParser::ParseStats startStats = executor->ReplayParser()->GetParseStats();
+
+	uint64_t totalMessages = 0;
+	uint64_t totalBytes = 0;
+	Clock::duration totalDuration( 0 );
+
+	for( unsigned i = 0; i < iterations; ++i ) {
+		executor->ResetForReplay( serverAddress );
+
+		const auto startTime = Clock::now();
+		size_t offset = 0;
+		unsigned recordSize;
+
+		while( const uint8_t *record = corpus.NextRecord( &offset, &recordSize ) ) {
+			executor->ReplayDatagram( record, recordSize );
+			totalBytes += recordSize;
+			totalMessages++;
+		}
+
+		totalDuration += Clock::now() - startTime;
+	}
+
+	const MessageParser::ParseStats &endStats = executor->ReplayParser()->GetParseStats();
+	const uint64_t frames = endStats.frames - startStats.frames;
+	const uint64_t entities = endStats.entities - startStats.entities;
+	const uint64_t playerStates = endStats.playerStates - startStats.playerStates;
+
+	const double nanos = (double)std::chrono::duration_cast<std::chrono::nanoseconds>( totalDuration ).count();
+	const double seconds = nanos * 1e-9;
+
+	printf( "Iterations: %u, messages: %u, corpus size: %u bytes\n", iterations, corpus.NumRecords(), (unsigned)corpus.Size() );
+	printf( "Parsed frames: %" PRIu64 ", entities: %" PRIu64 ", player states: %" PRIu64 "\n", frames, entities, playerStates );
+	printf( "Total time: %.3f ms\n", nanos * 1e-6 );
+	printf( "Messages/s: %.0f\n", totalMessages / seconds );
+	printf( "Bytes/s: %.0f (%.2f MiB/s)\n", totalBytes / seconds, totalBytes / seconds / ( 1024.0 * 1024.0 ) );
+
+	if( totalMessages ) {
+		printf( "ns per message: %.2f\n", nanos / totalMessages );
+	}
+
+	// Entities and player states are parsed within the same messages, so these costs are amortized:
+	// each of them is the whole time divided by a count of the item kind, and they do not add up
+	if( frames ) {
+		printf( "ns per frame (amortized): %.2f\n", nanos / frames );
+	}
+
+	if( entities ) {
+		printf( "ns per entity (amortized): %.2f\n", nanos / entities );
+	}
+
+	if( playerStates ) {
+		printf( "ns per player state (amortized): %.2f\n", nanos / playerStates );
+	}
+
+	return true;
+}
+
+static void PrintUsage( const char *program ) {
+	printf( "Usage: %s [options]\n", program );
+	printf( "  -c <file>   A corpus file to replay (a synthetic corpus is generated otherwise)\n" );
+	printf( "  -w <file>   Save the synthetic corpus to the file and exit\n" );
+	printf( "  -i <num>    A number of iterations (default 100)\n" );
+	printf( "  -f <num>    A number of frames in the synthetic corpus (default 1000)\n" );
+	printf( "  -e <num>    A number of entities in the synthetic corpus (default 256)\n" );
+	printf( "  -p <num>    A number of player states per frame in the synthetic corpus (default 1)\n" );
+	printf( "  -v          Print the client console output\n" );
+}
+
+int main( int argc, const char **argv ) {
+	const char *corpusFile = nullptr;
+	const char *outputFile = nullptr;
+	unsigned iterations = 100;
+	unsigned numFrames = 1000;
+	unsigned numEntities = 256;
+	unsigned numPlayers = 1;
+	bool verbose = false;
+
+	for( int i = 1; i < argc; ++i ) {
+		if( !strcmp( argv[i], "-v" ) ) {
+			verbose = true;
+			continue;
+		}
+
+		if( !strcmp( argv[i], "-h" ) || i + 1 >= argc ) {
+			PrintUsage( argv[0] );
+			return !strcmp( argv[i], "-h" ) ? 0 : 1;
+		}
+
+		const char *option = argv[i];
+		const char *value = argv[++i];
+
+		if( !strcmp( option, "-c" ) ) {
+			corpusFile = value;
+		} else if( !strcmp( option, "-w" ) ) {
+			outputFile = value;
+		} else if( !strcmp( option, "-i" ) ) {
+			iterations = (unsigned)atoi( value );
+		} else if( !strcmp( option, "-f" ) ) {
+			numFrames = (unsigned)atoi( value );
+		} else if( !strcmp( option, "-e" ) ) {
+			numEntities = (unsigned)atoi( value );
+		} else if( !strcmp( option, "-p" ) ) {
+			numPlayers = (unsigned)atoi( value );
+		} else {
+			PrintUsage( argv[0] );
+			return 1;
+		}
+	}
+
+	if( numEntities >= 1024 || !numPlayers || numPlayers > MAX_SERVER_CLIENTS ) {
+		printf( "Illegal synthetic corpus parameters\n" );
+		return 1;
+	}
+
+	System::Init( New<TaggedConsole>( "System" ) );
+	System *system = System::Instance();
+
+	Corpus *corpus = New<Corpus>();
+
+	if( corpusFile ) {
+		if( !corpus->Load( corpusFile ) ) {
+			printf( "Cannot load a corpus file `%s`\n", corpusFile );
+			return 1;
+		}
+	} else {
+		CorpusBuilder *builder = New<CorpusBuilder>( corpus, numEntities, numPlayers );
+		builder->Build( numFrames );
+		Delete( builder );
+	}
+
+	int result = 0;
+
+	if( outputFile ) {
+		if( !corpus->Save( outputFile ) ) {
+			printf( "Cannot save the corpus to `%s`\n", outputFile );
+			result = 1;
+		}
+	} else {
+		// Pin the system to the current thread
+		system->Frame( 0 );
+
+		// A parsing of the corpus should not spam the output by default
+		Console *clientConsole = verbose ? (Console *)New<TaggedConsole>( "Client" ) : New<NullConsole>();
+		Client *client = system->NewClient( clientConsole );
+
+		if( !client ) {
+			result = 1;
+		} else {
+			ParserBenchmark benchmark( client );
+			result = benchmark.Run( *corpus, iterations ) ? 0 : 1;
+			system->DeleteClient( client );
+		}
+	}
+
+	Delete( corpus );
+	System::Shutdown();
+	return result;
+}
@@ -0,0 +1,136 @@
+#ifndef LIBQFAKECLIENT_ADDRESS_RESOLVER_H
+#define LIBQFAKECLIENT_ADDRESS_RESOLVER_H
+
+#include "network_address.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <stdint.h>
+
+class Console;
+class System;
+
+/**
+ * Resolves host names on a background thread, so lookups do not block the network loop.
+ * Results are cached for a TTL, failures are cached for a shorter time.
+ * Completions (including ones that are served from the cache) are delivered to callbacks
+ * in the System thread during System::Frame() calls.
+ */
+class AddressResolver
+{
+	friend class System;
+
+public:
+	static constexpr unsigned MAX_HOST_CHARS = UnresolvedAddress::MAX_HOST_CHARS;
+
+	/**
+	 * Receives a result of a lookup. The address is null if the host cannot be resolved.
+	 * The port of the address is set to the requested one.
+	 */
+	typedef void ( *Callback )( void *owner, uint32_t requestId, const NetworkAddress *address );
+
+	/**
+	 * Performs a blocking lookup of a host name on the resolver thread (a port is not set).
+	 * Might be replaced by a stub for testing.
+	 */
+	typedef bool ( *LookupFunction )( const char *host, NetworkAddress *address );
+
+private:
+	struct Request {
+		Request *next;
+		void *owner;
+		Callback callback;
+		uint32_t id;
+		uint16_t port;
+		bool succeeded;
+		NetworkAddress address;
+		char host[MAX_HOST_CHARS];
+	};
+
+	struct CacheEntry {
+		uint64_t expiresAt;
+		NetworkAddress address;
+		bool succeeded;
+		char host[MAX_HOST_CHARS];
+	};
+
+	static constexpr unsigned CACHE_SIZE = 64;
+
+	System *system;
+	Console *console;
+
+	// Protects the queues, the cache, the lookup function and the fields of the current request
+	std::mutex mutex;
+	std::condition_variable requestAdded;
+	std::thread thread;
+
+	Request *firstPendingRequest;
+	Request *lastPendingRequest;
+	Request *firstCompletedRequest;
+	Request *lastCompletedRequest;
+	// Completed requests that are being delivered in Frame() (callbacks might cancel requests of other owners)
+	Request *firstDeliveredRequest;
+	// A request that is being looked up without holding the lock
+	Request *currentRequest;
+	bool isCurrentRequestCancelled;
+	bool stopRequested;
+
+	LookupFunction lookupFunction;
+
+	CacheEntry cache[CACHE_SIZE];
+	unsigned successTtl;
+	unsigned failureTtl;
+
+	uint32_t lastRequestId;
+
+	AddressResolver( System *system_, Console *console_ );
+	~AddressResolver();
+
+	static AddressResolver *New( System *system, Console *console );
+	static void Delete( AddressResolver *resolver );
+
+	void Run();
+
+	void ClearCache();
+	const CacheEntry *FindInCache( const char *host ) const;
+	void AddToCache( const Request *request );
+
+	void Complete( Request *request );
+
+	/**
+	 * Delivers completions to callbacks
+	 */
+	void Frame();
+
+	static bool LookupWithGetaddrinfo( const char *host, NetworkAddress *address );
+
+public:
+	/**
+	 * Starts resolving a host name.
+	 * Should be called in the System thread, or before the System is pinned to a thread.
+	 * @return A non-zero request id that is passed to the callback, or zero if the request cannot be started.
+	 */
+	uint32_t Resolve( const char *host, uint16_t port, void *owner, Callback callback );
+
+	/**
+	 * Drops all requests of the owner, callbacks are not called for these requests since then.
+	 * Should be called before destruction of the owner.
+	 */
+	void CancelRequests( void *owner );
+
+	/**
+	 * Sets times of keeping successful and failed lookup results in millis.
+	 */
+	void SetTtl( unsigned successTtl_, unsigned failureTtl_ ) {
+		this->successTtl = successTtl_;
+		this->failureTtl = failureTtl_;
+	}
+
+	/**
+	 * Replaces the lookup function (null restores the default one). The cache is cleared.
+	 */
+	void SetLookupFunction( LookupFunction lookupFunction_ );
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef LIBQFAKECLIENT_ALLOCATOR_H
+#define LIBQFAKECLIENT_ALLOCATOR_H
+
+#include "common.h"
+
+#include <mutex>
+
+/**
+ * An interface of a memory allocator the library allocates its own objects with.
+ * Implementations must be thread-safe as demo playback, address resolution and demo writing
+ * allocate and release memory in their own threads.
+ */
+class Allocator
+{
+public:
+	virtual ~Allocator() {}
+
+	/**
+	 * Allocates a block that is aligned at least for any fundamental type.
+	 * @return A new block, or null if the allocation has failed.
+	 */
+	virtual void *Alloc( size_t size ) = 0;
+
+	/**
+	 * Releases a block that has been returned by Alloc() (null is allowed).
+	 */
+	virtual void Free( void *p ) = 0;
+};
+
+/**
+ * Sets an allocator that is used for all objects the library creates (clients, executors, server lists, etc).
+ * The call must be performed before System::Init(), and the allocator must stay valid till System::Shutdown()
+ * and destruction of all objects that have been created by the library (e.g. demo players).
+ * Consoles and listeners that are passed to the library are still released using free(),
+ * so they should be allocated using malloc() regardless of this setting.
+ * @param allocator An allocator to use, null restores using malloc() and free().
+ */
+void SetGlobalAllocator( Allocator *allocator );
+
+/**
+ * Allocates memory using the global allocator.
+ */
+void *QAlloc( size_t size );
+
+/**
+ * Releases memory that has been allocated by QAlloc().
+ */
+void QFree( void *p );
+
+/**
+ * Parameters of an {@link ArenaAllocator}.
+ */
+struct ArenaSettings {
+	// A size of the reserved address range (rounded up to a huge page size)
+	size_t reservedBytes;
+	// Try backing the arena by explicit huge pages, fall back to transparent huge pages if there are none
+	bool useHugePages;
+	// Fault in the entire arena on creation so clients never page fault later
+	bool prefault;
+
+	ArenaSettings();
+};
+
+/**
+ * A default implementation of {@link Allocator} that carves all objects out of a single reserved range.
+ * The range is split into 64 KiB units. Small blocks (up to 32 KiB) are served from units
+ * that are dedicated to a single power-of-two size class, larger objects occupy runs of units.
+ * Released blocks and runs are kept for reuse and are never returned to the OS,
+ * so memory use of a fleet stays predictable and TLB reach is maximal if huge pages are available.
+ * Allocations that do not fit the arena are served by malloc().
+ */
+class ArenaAllocator final : public Allocator
+{
+public:
+	struct Stats {
+		size_t reservedBytes;
+		// Bytes of units that have been taken from the range at least once
+		size_t carvedBytes;
+		// Bytes of runs and size classes that are currently allocated
+		size_t allocatedBytes;
+		// Allocations that have been passed to malloc() due to the range exhaustion
+		uint64_t fallbackAllocations;
+		// Whether the range is backed by explicit huge pages
+		bool hasExplicitHugePages;
+	};
+
+private:
+	static constexpr size_t UNIT_SIZE = 64 * 1024;
+	static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+	static constexpr unsigned MIN_BLOCK_SIZE_LOG2 = 4;
+	static constexpr unsigned NUM_SIZE_CLASSES = 12;
+	static constexpr size_t MAX_SMALL_BLOCK_SIZE = (size_t)1 << ( MIN_BLOCK_SIZE_LOG2 + NUM_SIZE_CLASSES - 1 );
+
+	// A unit that belongs to a size class has this bit set in its info, the low bits are the class
+	static constexpr uint32_t SMALL_UNIT_BIT = 1u << 31;
+
+	struct FreeBlock {
+		FreeBlock *next;
+	};
+
+	// A header of a released run that is stored in the run itself
+	struct FreeRun {
+		FreeRun *next;
+		size_t numUnits;
+	};
+
+	uint8_t *base;
+	size_t numUnits;
+	// A number of units from the range start that have been carved
+	size_t numCarvedUnits;
+	// A run length (in units) for a first unit of a run or a size class for a unit of small blocks
+	uint32_t *unitInfo;
+
+	FreeBlock *freeBlocks[NUM_SIZE_CLASSES];
+	FreeRun *freeRuns;
+
+	Stats stats;
+
+	std::mutex mutex;
+
+	ArenaAllocator( uint8_t *base_, size_t reservedBytes, uint32_t *unitInfo_, bool hasExplicitHugePages );
+	~ArenaAllocator() override;
+
+	static unsigned SizeClassFor( size_t size );
+
+	void *AllocRun( size_t numUnitsToAlloc );
+	void ReleaseRun( size_t firstUnit );
+	void *AllocSmallBlock( unsigned sizeClass );
+
+public:
+	/**
+	 * Reserves an arena.
+	 * @return A new allocator, or null if the address range cannot be reserved.
+	 */
+	static ArenaAllocator *New( const ArenaSettings &settings );
+
+	/**
+	 * Deletes an arena releasing the entire range.
+	 * No blocks of the arena must be used at the moment of the call.
+	 */
+	static void Delete( ArenaAllocator *allocator );
+
+	void *Alloc( size_t size ) override;
+	void Free( void *p ) override;
+
+	Stats GetStats();
+};
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef LIBQFAKECLIENT_BOT_SCHEDULER_H
+#define LIBQFAKECLIENT_BOT_SCHEDULER_H
+
+#include "common.h"
+
+class Client;
+class Console;
+class System;
+
+/**
+ * A declarative description of a bot behavior. Durations are in milliseconds.
+ * A script might be parsed from a line of `key=value` tokens, for example:
+ * `join="team alpha" chat="gg" chat_rate=6 chat_jitter=0.25 session=60000 reconnect_delay=5000 reconnects=3`
+ */
+struct BotScript {
+	static constexpr unsigned MAX_COMMAND_CHARS = 64;
+	static constexpr unsigned MAX_CHAT_CHARS = 128;
+	static constexpr unsigned UNLIMITED = ~0u;
+
+	// A game command that is sent once the bot has entered the game (e.g. "join"). Empty means none.
+	char joinCommand[MAX_COMMAND_CHARS];
+	// A chat message text (a message sequence number is appended to make messages distinguishable).
+	// Quotes are dropped from it when a message is sent.
+	char chatText[MAX_CHAT_CHARS];
+
+	// A mean rate of chat messages while the bot is in the game and is not idle. Zero disables chatting.
+	float chatMessagesPerMinute;
+	// A maximal relative deviation of an interval between chat messages in [0, 1] (the mean rate is preserved)
+	float chatJitter;
+
+	// A first connection attempt is made at a random moment within this period after the bot has been added
+	unsigned startSpread;
+	// A connection attempt fails if the bot has not entered the game within this period
+	unsigned connectTimeout;
+	// How long the bot stays in the game before a scripted disconnection. Zero means staying forever.
+	unsigned sessionDuration;
+	// A pause between a disconnection (a scripted or a failed one) and the next connection attempt
+	unsigned reconnectDelay;
+	// A number of reconnections after the first connection attempt, or UNLIMITED
+	unsigned maxReconnects;
+	// The bot stops chatting for idleDuration every idleInterval in the game. Zero values disable idle periods.
+	unsigned idleInterval;
+	unsigned idleDuration;
+
+	BotScript();
+
+	/**
+	 * Overrides fields that are mentioned in the text, other fields keep their values.
+	 * @return False if the text contains an unknown key or an illegal value (a problem is printed to the console).
+	 */
+	bool Parse( const char *text, Console *console );
+};
+
+/**
+ * Drives many clients according to {@link BotScript} scripts for load testing.
+ * Bots are woken up at exact moments of their next actions using a timer heap, so the cost of a frame
+ * is proportional to a number of due actions and not to a number of bots.
+ * Random choices are made by per-bot generators derived from a seed, so a traffic pattern is reproducible.
+ * The scheduler is run by {@link System} frames and must be used from the System thread.
+ */
+class BotScheduler
+{
+	friend class System;
+
+public:
+	/**
+	 * Aggregated counters of all bots of the scheduler
+	 */
+	struct Stats {
+		uint64_t connectAttempts;
+		uint64_t connectionsEstablished;
+		uint64_t connectTimeouts;
+		// Bots that have been disconnected without a script action
+		uint64_t droppedConnections;
+		uint64_t scriptedDisconnects;
+		uint64_t joinCommands;
+		uint64_t chatMessages;
+		uint64_t idlePeriods;
+
+		// Current numbers of bots in each phase
+		unsigned numWaiting;
+		unsigned numConnecting;
+		unsigned numActive;
+		unsigned numIdle;
+		unsigned numFinished;
+	};
+
+private:
+	enum BotState : uint8_t {
+		BOT_WAITING,
+		BOT_CONNECTING,
+		BOT_ACTIVE,
+		BOT_IDLE,
+		BOT_FINISHED
+	};
+
+	// A minimal interval of checking whether a connecting or playing bot is still in the expected state
+	static constexpr unsigned STATE_CHECK_INTERVAL = 250;
+
+	static constexpr unsigned MAX_ADDRESS_CHARS = 64;
+
+	struct Bot {
+		Client *client;
+		BotScript script;
+		char address[MAX_ADDRESS_CHARS];
+
+		uint64_t randomState;
+
+		// An end of the current phase (a connection deadline, a session end, or an idle period end)
+		uint64_t phaseEndsAt;
+		uint64_t nextChatAt;
+		uint64_t nextIdleAt;
+
+		unsigned numReconnects;
+		unsigned numChatMessages;
+		BotState state;
+	};
+
+	struct TimerEntry {
+		uint64_t dueAt;
+		unsigned botIndex;
+	};
+
+	System *system;
+	Console *console;
+
+	Bot *bots;
+	unsigned numBots;
+	unsigned maxBots;
+
+	// A binary min-heap by due time, every bot that has not finished its script has exactly one entry
+	TimerEntry *timers;
+	unsigned numTimers;
+
+	uint64_t seed;
+
+	Stats stats;
+
+	BotScheduler( System *system_, Console *console_, Bot *bots_, TimerEntry *timers_, unsigned maxBots_, uint64_t seed_ );
+	~BotScheduler();
+
+	static BotScheduler *New( System *system, Console *console, unsigned maxBots, uint64_t seed );
+	static void Delete( BotScheduler *scheduler );
+
+	void PushTimer( uint64_t dueAt, unsigned botIndex );
+	void PopTimer();
+
+	uint64_t NextChatInterval( Bot *bot );
+
+	void SetState( Bot *bot, BotState state );
+
+	/**
+	 * Executes due actions of a bot.
+	 * @return A moment of the next wakeup, or zero if the bot has finished its script.
+	 */
+	uint64_t RunBot( Bot *bot, uint64_t now );
+
+	uint64_t StartConnecting( Bot *bot, uint64_t now );
+	uint64_t ScheduleReconnection( Bot *bot, uint64_t now );
+	uint64_t RunActiveBot( Bot *bot, uint64_t now );
+
+	void Frame();
+
+public:
+	/**
+	 * Creates a new client driven by the script.
+	 * The scheduler takes ownership of the console (the client owns it as usual).
+	 * @param name A player name of the bot.
+	 * @param address A server address that is passed to the "connect" command.
+	 * @return A zero-based index of the bot, or -1 if a bot cannot be added (the console is deleted in this case).
+	 */
+	int AddBot( Console *botConsole, const char *name, const char *address, const BotScript &script );
+
+	unsigned NumBots() const { return numBots; }
+
+	/**
+	 * Returns a client of a bot (it should not be deleted by the caller), or null if the index is out of range.
+	 */
+	Client *BotClient( unsigned index ) { return index < numBots ? bots[index].client : nullptr; }
+
+	const Stats &GetStats() const { return stats; }
+};
+
+#endif
@@ -95,6 +95,7 @@ class Channel
 {
 	friend class Client;
 	friend class CommandBuffer;
+	friend class GenericClientProtocolExecutor;
 
 	Console *console;
 	System *system;
@@ -2,9 +2,11 @@
 #define LIBQFAKECLIENT_CLIENT_H
 
 #include "channel.h"
+#include "event_stream.h"
 #include "message_parser.h"
 #include "network_address.h"
 #include "protocol_executor.h"
+#include "world_state_snapshot.h"
 #include <stdlib.h>
 
 class ClientListener
@@ -18,6 +20,17 @@ public:
 	virtual void PrintChatMessage( const char *from, const char *message ) = 0;
 	virtual void PrintTeamChatMessage( const char *from, const char *message ) = 0;
 	virtual void PrintTVChatMessage( const char *from, const char *message ) = 0;
+	// Receives game commands addressed to a particular player in multiview mode.
+	// This is optional, and listeners that do not override it silently drop these commands.
+	virtual void ExecuteTargetedCommand( int /*clientNum*/, const char * /*command*/ ) {}
+	// Receives configstrings that have been changed by a server message (indices are in ascending order).
+	// This is optional, and values might be retrieved via Client::ConfigString() later as well.
+	virtual void OnConfigStringsChanged( const uint16_t * /*indices*/, const char *const * /*values*/,
+										 unsigned /*numChanged*/ ) {}
+	// Receives scoreboard entries that have been changed by a scoreboard update (client numbers are in ascending order).
+	// Entries of players that are no longer listed have zero flags. This is optional as well.
+	virtual void OnScoreboardChanged( const uint8_t * /*clientNums*/, const ScoreboardEntry * /*entries*/,
+									  unsigned /*numChanged*/ ) {}
 };
 
 class Client
@@ -26,12 +39,34 @@ class Client
 	friend class CommandBuffer;
 	friend class CommandHandlersRegistry;
 	friend class MessageParser;
+	friend class DemoPlayer;
+	friend class GenericClientProtocolExecutor;
 
 	Console *console;
 	System *system;
 	ClientListener *listener;
 	GenericClientProtocolExecutor *protocolExecutor;
 
+	// An optional stream that receives text and scoreboard events instead of the listener (it is not owned by the client)
+	ClientEventStream *eventStream;
+	uint16_t eventStreamClientId;
+
+	// An optional source of inputs that are sent every user command tick of the System (it is owned by the client)
+	UserCommandGenerator *userCommandGenerator;
+
+	// An optional observer of game commands received from a server
+	void *serverCommandObserverOwner;
+	void ( *serverCommandObserver )( void *owner, Client *client, const char *command );
+
+	// An optional publisher of world state snapshots for other threads (it is owned by the client)
+	WorldStatePublisher *worldStatePublisher;
+
+	// Offline clients are owned by demo players, they are not registered in the System and are not pinned to its thread
+	bool offline;
+
+	// An index of the client in System tables, or -1 if the client is not registered
+	int systemSlot;
+
 	int oldProtocolVersion;
 	int protocolVersion;
 
@@ -46,10 +81,27 @@ class Client
 	void AttachExecutor();
 	void DetachExecutor();
 
-	void PrintMissingListenerWarning( const char *function );
+	// Prints a warning and the data that should have been passed to a listener.
+	// This is compiled out if the library is built with LIBQFAKECLIENT_QUIET_MISSING_LISTENERS.
+#ifndef _MSC_VER
+	void PrintMissingListenerWarning( const char *function, const char *format, ... )
+		__attribute__( ( format( printf, 3, 4 ) ) );
+#else
+	void PrintMissingListenerWarning( const char *function, _Printf_format_string_ const char *format, ... );
+#endif
+
+	void PostEvent( ClientEvent::Type type, const char *from, const char *text );
 
 	void CheckThread( const char *function );
 
+	void UserCommandsFrame( unsigned numTicks, unsigned tickMillis );
+
+	/**
+	 * Publishes an executor state and a moment of the next frame to the System tables frame sweeps use.
+	 * @param frameDeadline A moment the next frame should run at (zero to run it as soon as possible).
+	 */
+	void UpdateFrameSchedule( int state, uint64_t frameDeadline );
+
 public:
 	void ExecuteCommand( const char *command );
 	void Reset();
@@ -61,6 +113,67 @@ public:
 
 	void SetListener( ClientListener *listener_ );
 
+	/**
+	 * Sets a player name that is used for next connections.
+	 */
+	void SetName( const char *name_ );
+
+	/**
+	 * Returns true if the client is connected and has entered the game.
+	 */
+	bool HasEnteredGame() const;
+
+	/**
+	 * Returns true if the client is not connected and does not try to connect (including resolving a server address).
+	 */
+	bool IsDisconnected() const;
+
+	/**
+	 * Sends a game command (e.g. "say hello") to a server the client is connected to.
+	 */
+	void SendGameCommand( const char *command );
+
+	/**
+	 * Routes chat, centered and MOTD messages and scoreboard changes to an event stream instead of the listener.
+	 * The stream is not owned by the client and might be shared by clients of the same System.
+	 * @param clientId_ An id that is reported in events of this client.
+	 * Pass null to route messages to the listener again.
+	 */
+	void SetEventStream( ClientEventStream *eventStream_, uint16_t clientId_ = 0 ) {
+		this->eventStream = eventStream_;
+		this->eventStreamClientId = clientId_;
+	}
+
+	/**
+	 * Makes the client send generated inputs at the rate set by System::SetUserCommandRate() while it is in the game.
+	 * The client takes ownership of the generator. Pass null to send only dummy moves with frame acknowledgements again.
+	 */
+	void SetUserCommandGenerator( UserCommandGenerator *generator_ );
+
+	/**
+	 * Makes the client publish a snapshot of its world state after each parsed message,
+	 * so other threads might read it via WorldStatePublisher::Read() without synchronizing with the System thread.
+	 * Publication costs a copy of changed configstrings and takes several megabytes for two snapshot buffers.
+	 * @return The publisher (an existing one if the publication has been already enabled), or null on allocation failure.
+	 */
+	WorldStatePublisher *EnableWorldStatePublication();
+
+	/**
+	 * Stops publication and deletes the publisher. Readers must not use the publisher since then.
+	 */
+	void DisableWorldStatePublication();
+
+	WorldStatePublisher *WorldStatePublisherInstance() { return worldStatePublisher; }
+
+	/**
+	 * Sets a callback that receives every game command from a server before the command is handled.
+	 * There is a single observer per client. Pass null to remove the observer.
+	 */
+	void SetServerCommandObserver( void *owner, void ( *observer )( void *owner, Client *client, const char *command ) ) {
+		this->serverCommandObserverOwner = owner;
+		this->serverCommandObserver = observer;
+	}
+
 	void SetShownPlayerName( const char *name );
 	void SetMessageOfTheDay( const char *motd );
 
@@ -68,6 +181,34 @@ public:
 	void PrintChatMessage( const char *from, const char *message );
 	void PrintTeamChatMessage( const char *from, const char *message );
 	void PrintTVChatMessage( const char *from, const char *message );
+	void ExecuteTargetedCommand( int clientNum, const char *command );
+	void NotifyConfigStringsChanged( const uint16_t *indices, const char *const *values, unsigned numChanged );
+	void NotifyScoreboardChanged( const uint8_t *clientNums, const ScoreboardEntry *entries, unsigned numChanged );
+
+	void NotifyServerCommand( const char *command ) {
+		if( serverCommandObserver ) {
+			serverCommandObserver( serverCommandObserverOwner, this, command );
+		}
+	}
+
+	// Returns stats of a player (a client number is zero-based) if the player state has been present in the last frame.
+	// A regular client gets only its own player state, use "multiview 1" command to get states of all players.
+	const short *PlayerStats( int clientNum ) const;
+
+	// Returns a configstring value, or null if the index is out of range or the client is not connected.
+	const char *ConfigString( unsigned index ) const;
+	// Returns a counter that is incremented on every change of the configstring value.
+	// Consumers might compare it to a previously seen value to check whether they should update derived data.
+	uint32_t ConfigStringVersion( unsigned index ) const;
+
+	// Returns structured data of a connected player (a client number is zero-based), or null if there is no such player.
+	// Entries are updated only when player info configstrings change, so they are cheap to query per message.
+	const PlayerRosterEntry *RosterEntry( int clientNum ) const;
+	// Returns a zero-based client number of a player with the given shown name (as in chat messages), or -1.
+	int FindPlayerByName( const char *name ) const;
+
+	// Returns a scoreboard entry of a player (a client number is zero-based) as of the last `scb` update, or null.
+	const ScoreboardEntry *GetScoreboardEntry( int clientNum ) const;
 };
 
 #endif
@@ -7,6 +7,8 @@ class GenericClientProtocolExecutor;
 
 class CommandBuffer
 {
+	friend class GenericClientProtocolExecutor;
+
 	Message message;
 	int sequenceNum;
 
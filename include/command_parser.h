@@ -5,20 +5,90 @@
 
 #include <stdint.h>
 
+/**
+ * Splits a command line into tokens in a single linear pass on construction.
+ * The input is copied once, and tokens are terminated in place, so each token is addressed by an offset and a length.
+ * Tokens might be consumed sequentially via {@link GetCommand()} / {@link GetArg()}
+ * or accessed randomly via {@link NumArgs()} / {@link Arg()} (the latter refer to the current command).
+ * Commands are separated by '\n' or ';' characters outside of quotes.
+ */
 class CommandParser
 {
-	char tokenBuffer[MAX_STRING_CHARS + 1];
-	const char *cmdCharsPtr;
-	const char *argCharsPtr;
+	// Fits the longest string a server message might contain
+	static constexpr unsigned MAX_INPUT_CHARS = MAX_MSG_STRING_CHARS;
+	// A token takes at least a single character. Excessive tokens of a malformed input are dropped.
+	static constexpr unsigned MAX_TOKENS = MAX_INPUT_CHARS / 2 + 2;
+	// Vectorized scanning might read this amount of bytes past the input end
+	static constexpr unsigned SCAN_PADDING = 16;
 
-	const char *GetBasicArg( const char *tokenStart, unsigned *tokenLength = nullptr, uint32_t *tokenHash = nullptr );
-	const char *GetQuotedArg( const char *tokenStart, unsigned *tokenLength = nullptr, uint32_t *tokenHash = nullptr );
+	static constexpr uint16_t SEPARATOR_OFFSET = 0xFFFF;
+
+	static_assert( MAX_INPUT_CHARS + SCAN_PADDING < SEPARATOR_OFFSET, "Offsets do not fit uint16_t" );
+
+	struct Token {
+		// SEPARATOR_OFFSET for a commands separator
+		uint16_t offset;
+		uint16_t length;
+	};
+
+	// The padding holds the input terminator as well
+	char chars[MAX_INPUT_CHARS + SCAN_PADDING];
+	Token tokens[MAX_TOKENS];
+	unsigned numTokens;
+
+	unsigned currToken;
+	// Argument tokens of the current command are [argsStart, argsEnd)
+	unsigned argsStart;
+	unsigned argsEnd;
+	bool hasCurrCommand;
+
+	void Tokenize( const char *input );
+
+	void AddToken( const char *start, const char *end ) {
+		Token *token = &tokens[numTokens++];
+		token->offset = (uint16_t)( start - chars );
+		token->length = (uint16_t)( end - start );
+	}
+
+	void AddSeparator() {
+		Token *token = &tokens[numTokens++];
+		token->offset = SEPARATOR_OFFSET;
+		token->length = 0;
+	}
+
+	static bool IsSeparator( const Token &token ) { return token.offset == SEPARATOR_OFFSET; }
+
+	const char *TokenData( const Token &token, unsigned *tokenLength, uint32_t *tokenHash ) const;
 
 public:
-	CommandParser( const char *input_ ) : cmdCharsPtr( input_ ) {}
+	CommandParser( const char *input_ );
 
+	/**
+	 * Starts the next command skipping unread arguments of the current one.
+	 * @return A command name, an empty string for an empty command, or null if there are no more commands.
+	 */
 	const char *GetCommand( unsigned *tokenLength = nullptr, uint32_t *tokenHash = nullptr );
+
+	/**
+	 * Returns the next argument of the current command, or null if there are no more arguments.
+	 */
 	const char *GetArg( unsigned *tokenLength = nullptr, uint32_t *tokenHash = nullptr );
+
+	/**
+	 * Returns a number of arguments of the current command (not including the command name).
+	 */
+	unsigned NumArgs() const { return argsEnd - argsStart; }
+
+	/**
+	 * Returns an argument of the current command by its index without affecting sequential reading.
+	 * @return An argument token, or null if the index is out of range.
+	 */
+	const char *Arg( unsigned index, unsigned *tokenLength = nullptr, uint32_t *tokenHash = nullptr ) const {
+		if( index >= argsEnd - argsStart ) {
+			return nullptr;
+		}
+		return TokenData( tokens[argsStart + index], tokenLength, tokenHash );
+	}
 };
 
 inline void AddCharToHash( uint32_t *hash, char c ) {
@@ -28,4 +98,13 @@ inline void AddCharToHash( uint32_t *hash, char c ) {
 uint32_t GetStringHashAndLength( const char *s, unsigned *length = nullptr );
 uint32_t GetStringHashForGivenLength( const char *s, unsigned length );
 
+// Compile-time counterparts of the functions above (must produce the same values)
+constexpr uint32_t GetConstStringHash( const char *s, uint32_t hash = 0 ) {
+	return *s ? GetConstStringHash( s + 1, hash * 31 + (uint32_t)( ( *s << 24 ) ^ ~0 ) + (uint32_t)*s ) : hash;
+}
+
+constexpr unsigned GetConstStringLength( const char *s ) {
+	return *s ? 1 + GetConstStringLength( s + 1 ) : 0;
+}
+
 #endif
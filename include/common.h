@@ -4,8 +4,13 @@
 #include <stdint.h>
 #include <stddef.h>
 
-// Max fake client instances supported by this library
-constexpr const unsigned MAX_FAKE_CLIENT_INSTANCES = 4;
+// Max fake client instances supported by this library.
+// Load tests might raise the limit at build time (every client uses a socket, so check the file descriptors limit too).
+#ifndef LIBQFAKECLIENT_MAX_CLIENTS
+#define LIBQFAKECLIENT_MAX_CLIENTS 4
+#endif
+
+constexpr const unsigned MAX_FAKE_CLIENT_INSTANCES = LIBQFAKECLIENT_MAX_CLIENTS;
 
 // Max clients on a game server
 constexpr const unsigned MAX_SERVER_CLIENTS = 256;
@@ -67,4 +72,17 @@ inline void QStrncpyz( char *dest, const char *src, size_t bufferSize ) {
 	}
 }
 
+// A splitmix64 generator. Load generation facilities use it to make random choices reproducible by a seed.
+inline uint64_t NextRandom64( uint64_t *state ) {
+	uint64_t z = ( *state += 0x9E3779B97F4A7C15ull );
+	z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ull;
+	z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBull;
+	return z ^ ( z >> 31 );
+}
+
+// Returns a random value in [0, 1)
+inline double NextRandomFraction( uint64_t *state ) {
+	return (double)( NextRandom64( state ) >> 11 ) * ( 1.0 / 9007199254740992.0 );
+}
+
 #endif
@@ -0,0 +1,119 @@
+#ifndef LIBQFAKECLIENT_CONNECTION_RAMP_H
+#define LIBQFAKECLIENT_CONNECTION_RAMP_H
+
+#include "common.h"
+
+/**
+ * Parameters of a {@link ConnectionRamp}. Durations are in milliseconds.
+ */
+struct ConnectionRampSettings {
+	// A sustained rate of admitted connection attempts (it is raised to 0.01 if it is lower)
+	float admissionsPerSecond;
+	// A number of attempts that might be admitted at once after a quiet period
+	unsigned admissionBurst;
+	// A maximal number of clients that are between an admission and entering the game
+	unsigned maxConcurrentHandshakes;
+	// A delay before the first retry of a rejected or timed out attempt, it is doubled for every next retry
+	unsigned initialBackoff;
+	unsigned maxBackoff;
+	// A maximal relative reduction of a backoff delay in [0, 1] that desynchronizes retrying clients
+	float backoffJitter;
+	// A handshake slot is released if the client has not entered the game within this period
+	unsigned handshakeTimeout;
+
+	ConnectionRampSettings()
+		: admissionsPerSecond( 50.0f ),
+		admissionBurst( 10 ),
+		maxConcurrentHandshakes( 64 ),
+		initialBackoff( 1000 ),
+		maxBackoff( 30000 ),
+		backoffJitter( 0.5f ),
+		handshakeTimeout( 15000 ) {}
+};
+
+/**
+ * Admits connection attempts of clients of the System at a limited rate.
+ * Clients that are connecting without a ramp retry requests every TIMEOUT independently,
+ * so bringing up many clients at once produces bursts that get rejected by a server.
+ * A client that uses the ramp waits for an admission before sending a challenge request,
+ * occupies a handshake slot until it enters the game, and waits for an exponentially growing,
+ * randomly shortened delay before a next attempt if a request is rejected or is not answered.
+ * The ramp is used only in the System thread.
+ */
+class ConnectionRamp
+{
+public:
+	enum Phase {
+		// From a challenge request to a challenge response
+		PHASE_CHALLENGE,
+		// From a connection request to a connection acknowledgement
+		PHASE_CONNECT,
+		// From a serverdata request to the end of configstrings
+		PHASE_LOAD,
+		// From a "begin" command to an acknowledgement of the first frame
+		PHASE_ENTER,
+		NUM_PHASES
+	};
+
+	struct PhaseStats {
+		uint64_t attempts;
+		uint64_t successes;
+		uint64_t rejects;
+		uint64_t timeouts;
+	};
+
+	struct Stats {
+		PhaseStats phases[NUM_PHASES];
+		uint64_t admissions;
+		uint64_t retries;
+		uint64_t completedHandshakes;
+		// Clients that currently occupy handshake slots
+		unsigned numConcurrentHandshakes;
+	};
+
+private:
+	ConnectionRampSettings settings;
+
+	double tokens;
+	uint64_t tokensUpdatedAt;
+
+	uint64_t randomState;
+
+	Stats stats;
+
+	// Distinguishes ramps that have been enabled at different times
+	unsigned id;
+
+public:
+	ConnectionRamp( const ConnectionRampSettings &settings_, uint64_t seed, unsigned id_ );
+
+	unsigned Id() const { return id; }
+
+	/**
+	 * Tries to admit a connection attempt.
+	 * @return True if the caller has got a handshake slot and should start the handshake now.
+	 */
+	bool TryAdmit( uint64_t millis );
+
+	/**
+	 * Releases a handshake slot of an admitted client.
+	 * @param hasEnteredGame Whether the slot is released due to a successful completion of the handshake.
+	 */
+	void ReleaseSlot( bool hasEnteredGame );
+
+	/**
+	 * Returns a delay before a next attempt of a client that has already made the given number of retries.
+	 */
+	unsigned NextBackoff( unsigned numRetries );
+
+	void AddPhaseAttempt( Phase phase ) { stats.phases[phase].attempts++; }
+	void AddPhaseSuccess( Phase phase ) { stats.phases[phase].successes++; }
+	void AddPhaseReject( Phase phase ) { stats.phases[phase].rejects++; }
+	void AddPhaseTimeout( Phase phase ) { stats.phases[phase].timeouts++; }
+
+	unsigned HandshakeTimeout() const { return settings.handshakeTimeout; }
+
+	const Stats &GetStats() const { return stats; }
+};
+
+#endif
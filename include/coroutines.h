@@ -0,0 +1,380 @@
+#ifndef LIBQFAKECLIENT_COROUTINES_H
+#define LIBQFAKECLIENT_COROUTINES_H
+
+#if __cplusplus < 202002L
+#error This header requires C++20 (link with the qfakeclient_coroutines target that is built with BUILD_COROUTINES=ON)
+#endif
+
+#include "client.h"
+#include "server_list.h"
+#include "system.h"
+
+#include <coroutine>
+#include <utility>
+#include <stdlib.h>
+
+class CoroutineScheduler;
+
+template <typename T> class Task;
+
+/**
+ * A base of promises of {@link Task} coroutines.
+ */
+class TaskPromiseBase
+{
+	friend class CoroutineScheduler;
+	template <typename T> friend class Task;
+
+protected:
+	// A coroutine that awaits this one (if any)
+	std::coroutine_handle<> continuation;
+
+	// Set for root tasks that are owned by a scheduler
+	CoroutineScheduler *scheduler;
+	TaskPromiseBase *prevRoot;
+	TaskPromiseBase *nextRoot;
+	std::coroutine_handle<> rootHandle;
+
+	struct FinalAwaiter {
+		bool await_ready() const noexcept { return false; }
+
+		template <typename Promise>
+		std::coroutine_handle<> await_suspend( std::coroutine_handle<Promise> handle ) noexcept {
+			return handle.promise().OnFinished();
+		}
+
+		void await_resume() const noexcept {}
+	};
+
+	std::coroutine_handle<> OnFinished() noexcept;
+
+public:
+	TaskPromiseBase() : scheduler( nullptr ), prevRoot( nullptr ), nextRoot( nullptr ) {}
+
+	// Tasks are lazy, they start when they are awaited or spawned
+	std::suspend_always initial_suspend() const noexcept { return {}; }
+	FinalAwaiter final_suspend() const noexcept { return {}; }
+
+	// The library does not use exceptions
+	void unhandled_exception() const noexcept { abort(); }
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase
+{
+	T value {};
+
+public:
+	void return_value( T value_ ) { this->value = std::move( value_ ); }
+	T TakeValue() { return std::move( value ); }
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+	void return_void() const noexcept {}
+	void TakeValue() const noexcept {}
+};
+
+/**
+ * A lazily started coroutine that might be awaited by another task or spawned by a {@link CoroutineScheduler}.
+ * Tasks are resumed only in System::Frame() calls and never block the System thread.
+ */
+template <typename T = void>
+class [[nodiscard]] Task
+{
+	friend class CoroutineScheduler;
+
+public:
+	struct promise_type : public TaskPromise<T> {
+		Task get_return_object() {
+			return Task( std::coroutine_handle<promise_type>::from_promise( *this ) );
+		}
+	};
+
+private:
+	std::coroutine_handle<promise_type> handle;
+
+	explicit Task( std::coroutine_handle<promise_type> handle_ ) : handle( handle_ ) {}
+
+public:
+	Task( Task &&that ) noexcept : handle( std::exchange( that.handle, nullptr ) ) {}
+
+	Task &operator=( Task &&that ) noexcept {
+		if( this != &that ) {
+			if( handle ) {
+				handle.destroy();
+			}
+			handle = std::exchange( that.handle, nullptr );
+		}
+		return *this;
+	}
+
+	Task( const Task & ) = delete;
+	Task &operator=( const Task & ) = delete;
+
+	~Task() {
+		if( handle ) {
+			handle.destroy();
+		}
+	}
+
+	bool await_ready() const noexcept { return false; }
+
+	std::coroutine_handle<> await_suspend( std::coroutine_handle<> awaiting ) noexcept {
+		handle.promise().continuation = awaiting;
+		return handle;
+	}
+
+	T await_resume() { return handle.promise().TakeValue(); }
+};
+
+/**
+ * A result of awaiting a game command from a server.
+ */
+struct ServerCommandResult {
+	// False if the command has not been received in time
+	bool received;
+	// The full command line (with arguments)
+	char command[MAX_MSG_STRING_CHARS];
+};
+
+/**
+ * A result of awaiting a server info response.
+ */
+struct ServerInfoResult {
+	// False if the response has not been received in time
+	bool received;
+	BufferAndLength<64> serverName;
+	BufferAndLength<32> gametype;
+	BufferAndLength<32> mapName;
+	uint8_t maxClients;
+	uint8_t numClients;
+	uint8_t numBots;
+	bool needPassword;
+};
+
+class AwaitableServerListListener;
+
+/**
+ * Runs {@link Task} coroutines in the System thread.
+ * The scheduler adds a System frame hook, and resumes coroutines whose awaited conditions hold
+ * or whose timeouts have expired at the end of every System::Frame() call.
+ * A suspended coroutine costs only its frame, so thousands of bot scripts might run as coroutines.
+ * Clients and listeners that are awaited must outlive the awaiting coroutines.
+ */
+class CoroutineScheduler
+{
+	friend class TaskPromiseBase;
+	friend class AwaitableServerListListener;
+
+public:
+	/**
+	 * A base of awaiters that suspend a coroutine until a condition holds or a timeout expires.
+	 */
+	class Waiter
+	{
+		friend class CoroutineScheduler;
+
+	protected:
+		enum Kind : uint8_t {
+			POLLED,
+			SERVER_COMMAND,
+			SERVER_INFO
+		};
+
+		CoroutineScheduler *scheduler;
+		Waiter *prev;
+		Waiter *next;
+		std::coroutine_handle<> handle;
+		uint64_t deadline;
+		Kind kind;
+		bool isLinked;
+		// Set by event callbacks for waiters that are not polled
+		bool isSignaled;
+		bool isTimedOut;
+
+		Waiter( CoroutineScheduler *scheduler_, unsigned timeout, Kind kind_ = POLLED );
+
+		// Checks whether the coroutine should be resumed (without a timeout)
+		virtual bool IsReady() { return isSignaled; }
+
+		void Suspend( std::coroutine_handle<> handle_ );
+
+	public:
+		virtual ~Waiter();
+
+		Waiter( const Waiter & ) = delete;
+		Waiter &operator=( const Waiter & ) = delete;
+
+		bool await_ready() { return IsReady(); }
+		void await_suspend( std::coroutine_handle<> handle_ ) { Suspend( handle_ ); }
+	};
+
+	class SleepAwaiter : public Waiter
+	{
+		friend class CoroutineScheduler;
+
+		bool IsReady() override { return false; }
+
+		SleepAwaiter( CoroutineScheduler *scheduler_, unsigned millis ) : Waiter( scheduler_, millis ) {}
+
+	public:
+		bool await_ready() const { return false; }
+		void await_resume() const {}
+	};
+
+	class GameAwaiter : public Waiter
+	{
+		friend class CoroutineScheduler;
+
+		Client *client;
+
+		bool IsReady() override { return client->HasEnteredGame() || client->IsDisconnected(); }
+
+		GameAwaiter( CoroutineScheduler *scheduler_, Client *client_, unsigned timeout )
+			: Waiter( scheduler_, timeout ), client( client_ ) {}
+
+	public:
+		// True if the client has entered the game
+		bool await_resume() const { return client->HasEnteredGame(); }
+	};
+
+	class ServerCommandAwaiter : public Waiter
+	{
+		friend class CoroutineScheduler;
+
+		Client *client;
+		const char *name;
+		unsigned nameLength;
+		ServerCommandResult result;
+
+		ServerCommandAwaiter( CoroutineScheduler *scheduler_, Client *client_, const char *name_, unsigned timeout );
+
+	public:
+		~ServerCommandAwaiter() override;
+
+		void await_suspend( std::coroutine_handle<> handle_ );
+		ServerCommandResult await_resume() const { return result; }
+	};
+
+	class ServerInfoAwaiter : public Waiter
+	{
+		friend class CoroutineScheduler;
+
+		NetworkAddress address;
+		ServerInfoResult result;
+
+		ServerInfoAwaiter( CoroutineScheduler *scheduler_, const NetworkAddress &address_, unsigned timeout );
+
+	public:
+		ServerInfoResult await_resume() const { return result; }
+	};
+
+private:
+	System *system;
+
+	// Suspended awaiters in the order of suspension
+	Waiter *firstWaiter;
+	Waiter *lastWaiter;
+
+	TaskPromiseBase *firstRoot;
+	// Root tasks that have finished and should be destroyed in the next Frame() call
+	TaskPromiseBase *firstFinishedRoot;
+	unsigned numRoots;
+
+	static void FrameHook( void *scheduler );
+	void Frame();
+
+	void Link( Waiter *waiter );
+	void Unlink( Waiter *waiter );
+
+	void OnRootFinished( TaskPromiseBase *promise );
+	void DestroyFinishedRoots();
+
+	static void OnServerCommand( void *scheduler, Client *client, const char *command );
+	void OnServerInfo( const PolledGameServer &server );
+	// Removes the command observer of the client if there are no more awaiters of its commands
+	void CheckServerCommandObserver( Client *client, const Waiter *leavingWaiter );
+
+	explicit CoroutineScheduler( System *system_ );
+	~CoroutineScheduler();
+
+public:
+	/**
+	 * Creates a scheduler that resumes coroutines in Frame() calls of the system.
+	 * @return A new scheduler, or null if the system cannot add a frame hook.
+	 */
+	static CoroutineScheduler *New( System *system );
+
+	/**
+	 * Deletes a scheduler destroying all its tasks.
+	 */
+	static void Delete( CoroutineScheduler *scheduler );
+
+	/**
+	 * Starts a task that is owned by the scheduler. The task runs immediately till its first suspension.
+	 */
+	void Spawn( Task<void> &&task );
+
+	/**
+	 * Returns a number of spawned tasks that have not finished yet.
+	 */
+	unsigned NumTasks() const { return numRoots; }
+
+	uint64_t Millis() const { return system->Millis(); }
+
+	/**
+	 * Suspends a coroutine for the given time.
+	 */
+	SleepAwaiter Sleep( unsigned millis ) { return SleepAwaiter( this, millis ); }
+
+	/**
+	 * Executes a `connect` command immediately and returns an awaiter of entering the game.
+	 * The awaiter yields false if the connection attempt fails or the timeout expires.
+	 */
+	GameAwaiter Connect( Client *client, const char *address, unsigned timeout );
+
+	/**
+	 * Returns an awaiter of entering the game that yields false if the client gets disconnected or the timeout expires.
+	 */
+	GameAwaiter WaitForGame( Client *client, unsigned timeout ) { return GameAwaiter( this, client, timeout ); }
+
+	/**
+	 * Returns an awaiter of a game command from a server (e.g. "scb" or "pr"), matched by the command name.
+	 * Note that the scheduler replaces a server command observer of the client while there are such awaiters.
+	 * @param name A command name that must stay valid till the awaiter is resumed.
+	 */
+	ServerCommandAwaiter WaitForServerCommand( Client *client, const char *name, unsigned timeout ) {
+		return ServerCommandAwaiter( this, client, name, timeout );
+	}
+
+	/**
+	 * Returns an awaiter of a server info response for the address.
+	 * Responses are reported by an {@link AwaitableServerListListener} that is used for updating the server list.
+	 */
+	ServerInfoAwaiter WaitForServerInfo( const NetworkAddress &address, unsigned timeout ) {
+		return ServerInfoAwaiter( this, address, timeout );
+	}
+};
+
+/**
+ * A listener of server list updates that resumes coroutines awaiting server info responses
+ * and forwards updates to another listener (if any).
+ */
+class AwaitableServerListListener : public ServerListListener
+{
+	CoroutineScheduler *scheduler;
+	ServerListListener *listener;
+
+public:
+	AwaitableServerListListener( CoroutineScheduler *scheduler_, ServerListListener *listener_ = nullptr )
+		: scheduler( scheduler_ ), listener( listener_ ) {}
+
+	void OnServerAdded( const PolledGameServer &server ) override;
+	void OnServerRemoved( const PolledGameServer &server ) override;
+	void OnServerUpdated( const PolledGameServer &server ) override;
+};
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef LIBQFAKECLIENT_DEMO_PLAYER_H
+#define LIBQFAKECLIENT_DEMO_PLAYER_H
+
+#include "channel.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <stddef.h>
+
+class Client;
+class ClientListener;
+class Console;
+class GenericClientProtocolExecutor;
+class System;
+
+/**
+ * Plays a demo file back by feeding recorded server messages to a message parser of an offline client.
+ * The file is memory-mapped, and no sockets are involved.
+ * Parsed data is reported via the regular {@link ClientListener} callbacks.
+ * A player is not bound to the System thread, different players might be used by different threads.
+ */
+class DemoPlayer
+{
+	Console *console;
+	Client *client;
+	GenericClientProtocolExecutor *executor;
+
+	const uint8_t *data;
+	size_t dataSize;
+	size_t offset;
+
+	// Zero means playing as fast as possible
+	float timeScale;
+	std::chrono::steady_clock::time_point startedAt;
+	uint64_t firstServerTime;
+	bool hasFirstServerTime;
+
+	bool finished;
+
+	Message message;
+
+	DemoPlayer( Console *console_, Client *client_, const uint8_t *data_, size_t dataSize_ );
+	~DemoPlayer();
+
+	bool IsNextMessageDue();
+	bool PlayNextMessage();
+
+public:
+	/**
+	 * Creates a new player for the specified demo file.
+	 * The player takes ownership of the console and the listener (as a {@link Client} does).
+	 * @return A new player, or null if the file cannot be mapped.
+	 */
+	static DemoPlayer *New( Console *console, System *system, ClientListener *listener, const char *filename );
+	static void Delete( DemoPlayer *player );
+
+	/**
+	 * Sets a rate of the playback relative to the recorded rate. A zero value means playing as fast as possible.
+	 */
+	void SetTimeScale( float timeScale_ );
+
+	/**
+	 * Plays all messages that are due according to the time scale (or a single message if there is no time scale).
+	 * A message is due once the server time of the previous one has been reached.
+	 * @return False if the playback has finished.
+	 */
+	bool Frame();
+
+	/**
+	 * Plays the demo to the end, sleeping between frames if there is a time scale.
+	 */
+	void Run();
+
+	bool HasFinished() const { return finished; }
+
+	const Client *GetClient() const { return client; }
+};
+
+/**
+ * Plays many demos back in parallel using a fixed number of threads.
+ */
+class DemoPlaybackPool
+{
+	static constexpr unsigned MAX_THREADS = 64;
+
+	struct Job {
+		Job *next;
+		Console *console;
+		ClientListener *listener;
+		float timeScale;
+		char filename[1];
+	};
+
+	System *system;
+
+	std::thread threads[MAX_THREADS];
+	unsigned numThreads;
+
+	std::mutex mutex;
+	std::condition_variable jobAdded;
+	std::condition_variable jobCompleted;
+
+	Job *firstJob;
+	Job *lastJob;
+	// Queued and running jobs
+	unsigned numPendingJobs;
+	bool stopRequested;
+
+	DemoPlaybackPool( System *system_, unsigned numThreads_ );
+	~DemoPlaybackPool();
+
+	void Run();
+
+public:
+	/**
+	 * Creates a new pool. The number of threads is clamped to a reasonable range.
+	 * A zero number of threads means using all hardware threads.
+	 */
+	static DemoPlaybackPool *New( System *system, unsigned numThreads = 0 );
+
+	/**
+	 * Waits for completion of all added demos and deletes the pool.
+	 */
+	static void Delete( DemoPlaybackPool *pool );
+
+	/**
+	 * Queues a demo for playback. The pool takes ownership of the console and the listener.
+	 * The listener is called from a pool thread.
+	 * @return False if the job cannot be queued (the console and the listener are deleted in this case).
+	 */
+	bool Add( const char *filename, Console *console, ClientListener *listener, float timeScale = 0.0f );
+
+	/**
+	 * Waits for completion of all added demos.
+	 */
+	void WaitForCompletion();
+};
+
+#endif
@@ -0,0 +1,167 @@
+#ifndef LIBQFAKECLIENT_DEMO_RECORDER_H
+#define LIBQFAKECLIENT_DEMO_RECORDER_H
+
+#include "channel.h"
+#include "spsc_queue.h"
+
+#include <atomic>
+#include <thread>
+#include <stdio.h>
+
+class Console;
+class DemoWriter;
+class System;
+
+/**
+ * Records sequenced server messages to a qfusion-compatible demo file.
+ * A demo file is a sequence of messages prefixed by a 32-bit message length and terminated by a -1 length.
+ * Messages are accumulated in large chunks that are written to the file by a {@link DemoWriter} thread,
+ * so recording never performs syscalls in the network thread.
+ * A recorder must be used only by the thread the system is pinned to.
+ */
+class DemoRecorder
+{
+	friend class DemoWriter;
+
+public:
+	static constexpr unsigned MAX_META_DATA_SIZE = 16 * 1024;
+
+private:
+	static constexpr unsigned CHUNK_SIZE = 128 * 1024;
+	static constexpr unsigned MAX_CHUNKS = 64;
+	static constexpr unsigned FLUSH_INTERVAL = 5000;
+
+	struct Chunk {
+		unsigned size;
+		uint8_t data[CHUNK_SIZE];
+	};
+
+	Console *console;
+	DemoWriter *writer;
+	FILE *file;
+
+	// Chunks that should be written to the file (filled by the recorder, consumed by the writer)
+	SpscQueue<Chunk *, MAX_CHUNKS> filledChunks;
+	// Chunks that have been written and might be reused (filled by the writer, consumed by the recorder)
+	SpscQueue<Chunk *, MAX_CHUNKS> freeChunks;
+
+	Chunk *currChunk;
+	unsigned numAllocatedChunks;
+
+	// Set by the recorder when the final chunk has been queued
+	std::atomic<bool> stopped;
+	// Set by the writer on a file output error
+	std::atomic<bool> failed;
+
+	uint64_t bytesRecorded;
+	uint64_t lastFlushAt;
+	uint64_t startedAt;
+
+	// A file offset of the real meta data size field in the demo header
+	int64_t metaDataOffset;
+	unsigned metaDataSize;
+	char metaData[MAX_META_DATA_SIZE];
+
+	bool waitingForNonDeltaFrame;
+	bool overflowWarningShown;
+
+	Message message;
+
+	DemoRecorder( Console *console_, DemoWriter *writer_, FILE *file_ );
+	~DemoRecorder();
+
+	void PushCurrChunk();
+	void Flush();
+
+public:
+	/**
+	 * Creates a new recorder that writes a demo to the specified file.
+	 * @return A new recorder, or null if the file cannot be opened or there are too many active recorders.
+	 */
+	static DemoRecorder *New( Console *console, System *system, const char *filename );
+
+	/**
+	 * Finishes the recording. The recorder should not be accessed after this call.
+	 * The recorder is going to be deleted by the writer thread once all pending data has been written.
+	 */
+	static void Stop( DemoRecorder *recorder );
+
+	/**
+	 * A demo should start with a non-delta frame. Messages are not recorded until this flag is cleared.
+	 */
+	bool IsWaitingForNonDeltaFrame() const { return waitingForNonDeltaFrame; }
+	void SetWaitingForNonDeltaFrame( bool waiting ) { waitingForNonDeltaFrame = waiting; }
+
+	bool HasFailed() const { return failed.load( std::memory_order_relaxed ); }
+
+	uint64_t StartedAt() const { return startedAt; }
+
+	/**
+	 * Returns a cleared scratch message that might be used for composing demo-specific messages.
+	 */
+	Message &PrepareMessage() {
+		message.Clear();
+		return message;
+	}
+
+	/**
+	 * Records a message. The data must not include sequence/acknowledge numbers
+	 * and must be decompressed and reassembled from fragments.
+	 */
+	void RecordMessage( const uint8_t *data, unsigned size );
+	void RecordMessage( Message &message_ ) { RecordMessage( message_.Buffer(), message_.CurrSize() ); }
+
+	/**
+	 * Returns a file offset the next recorded message data is going to be written at.
+	 */
+	uint64_t NextMessageDataOffset() const { return bytesRecorded + 4; }
+
+	/**
+	 * Sets a file offset of the svc_demoinfo real meta data size field that is going to be patched on stop.
+	 */
+	void SetMetaDataOffset( int64_t offset ) { metaDataOffset = offset; }
+
+	/**
+	 * Appends a key-value pair to the demo meta data. Should be called before Stop().
+	 */
+	void SetMetaKeyValue( const char *key, const char *value );
+
+	/**
+	 * Flushes a partially filled chunk periodically, so a demo file is kept reasonably up-to-date.
+	 */
+	void Frame( uint64_t millis );
+};
+
+/**
+ * A background thread that writes data of all active demo recorders.
+ */
+class DemoWriter
+{
+	friend class DemoRecorder;
+
+	static constexpr unsigned MAX_RECORDERS = 1024;
+	static constexpr unsigned IDLE_SLEEP_MILLIS = 5;
+
+	std::atomic<DemoRecorder *> recorders[MAX_RECORDERS];
+	std::atomic<bool> stopRequested;
+	std::thread thread;
+
+	DemoWriter();
+	~DemoWriter();
+
+	bool Register( DemoRecorder *recorder );
+
+	void Run();
+	bool WriteChunks( DemoRecorder *recorder );
+	void Finish( DemoRecorder *recorder );
+
+public:
+	static DemoWriter *New();
+
+	/**
+	 * Waits for writing all pending data of stopped recorders, stops the thread and deletes the writer.
+	 */
+	static void Delete( DemoWriter *writer );
+};
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef LIBQFAKECLIENT_EVENT_STREAM_H
+#define LIBQFAKECLIENT_EVENT_STREAM_H
+
+#include <atomic>
+#include <stdint.h>
+
+/**
+ * A text event reported by a client.
+ */
+struct ClientEvent {
+	enum Type : uint16_t {
+		CHAT,
+		TEAM_CHAT,
+		TV_CHAT,
+		CENTERED_MESSAGE,
+		MESSAGE_OF_THE_DAY,
+		// A changed scoreboard row, the text is "<clientNum> <score> <ping> <kills> <deaths> <team> <flags>"
+		SCOREBOARD,
+		// Posted by an ObserverFarm when a client starts or stops observing a server.
+		// The text is the server address, the sender is the server name.
+		OBSERVER_ATTACHED,
+		OBSERVER_DETACHED
+	};
+
+	Type type;
+	// An id that has been supplied on attaching the stream to a client
+	uint16_t clientId;
+	// System millis at the moment of the event
+	uint64_t timestamp;
+	// A sender name for chat events, an empty string otherwise
+	const char *from;
+	const char *text;
+};
+
+/**
+ * A single-producer single-consumer ring of client events.
+ * Events are appended by clients on the System thread without calling a listener,
+ * and a consumer drains them in batches from its own thread.
+ * A stream might be shared by all clients of the System (they are executed by the same thread).
+ * Events are dropped if the consumer cannot keep up.
+ */
+class ClientEventStream
+{
+	static constexpr unsigned CACHE_LINE_SIZE = 64;
+	static constexpr uint16_t RECORD_WRAP = 0xFFFF;
+
+	struct RecordHeader {
+		// A full size of the record including this header and padding
+		uint32_t size;
+		uint16_t type;
+		uint16_t clientId;
+		uint64_t timestamp;
+		uint16_t fromLength;
+		uint16_t textLength;
+		uint32_t padding;
+	};
+
+	static_assert( sizeof( RecordHeader ) % 8 == 0, "The header size must keep records aligned" );
+
+	// Byte counters that grow monotonically and wrap around (as in SpscQueue)
+	std::atomic<unsigned> head;
+	uint8_t headPadding[CACHE_LINE_SIZE - sizeof( std::atomic<unsigned> )];
+	std::atomic<unsigned> tail;
+	uint8_t tailPadding[CACHE_LINE_SIZE - sizeof( std::atomic<unsigned> )];
+
+	std::atomic<uint64_t> numDroppedEvents;
+
+	uint8_t *data;
+	unsigned capacity;
+	// A head counter value the previously fetched batch ends at (accessed only by the consumer)
+	unsigned batchEnd;
+
+	ClientEventStream( uint8_t *data_, unsigned capacity_ );
+	~ClientEventStream();
+
+public:
+	static constexpr unsigned DEFAULT_CAPACITY = 256 * 1024;
+
+	/**
+	 * Creates a new stream. The capacity is rounded up to a power of two.
+	 */
+	static ClientEventStream *New( unsigned capacity = DEFAULT_CAPACITY );
+	static void Delete( ClientEventStream *stream );
+
+	/**
+	 * Appends an event. Must be called only by the producer thread.
+	 * Texts that do not fit a reasonable fraction of the ring are truncated.
+	 * @return False if the event has been dropped since the ring is full.
+	 */
+	bool TryAppend( ClientEvent::Type type, uint16_t clientId, uint64_t timestamp, const char *from, const char *text );
+
+	/**
+	 * Fetches next events. Must be called only by the consumer thread.
+	 * Strings of fetched events remain valid until the next call, the space is released for the producer then.
+	 * @return A number of fetched events.
+	 */
+	unsigned FetchBatch( ClientEvent *events, unsigned maxEvents );
+
+	uint64_t NumDroppedEvents() const { return numDroppedEvents.load( std::memory_order_relaxed ); }
+};
+
+#endif
@@ -5,8 +5,40 @@
 
 class Console;
 class Client;
+class DemoRecorder;
 class GenericClientProtocolExecutor;
 class Message;
+struct UserCommand;
+
+/**
+ * Structured data of a player decoded from a player info configstring.
+ */
+struct PlayerRosterEntry {
+	static constexpr unsigned MAX_NAME_CHARS = 64;
+
+	enum : uint8_t {
+		// The player info configstring is present
+		FLAG_CONNECTED = 1 << 0,
+		// The entry describes the player the client is connected as
+		FLAG_LOCAL = 1 << 1,
+		// A player state of the player has been present in the last parsed frame (so the team is known)
+		FLAG_HAS_PLAYER_STATE = 1 << 2
+	};
+
+	// A name as it is shown (with color tokens)
+	char name[MAX_NAME_CHARS];
+	// A name without color tokens in lower case, intended for matching
+	char normalizedName[MAX_NAME_CHARS];
+	uint32_t nameHash;
+	uint32_t normalizedNameHash;
+	uint8_t nameLength;
+	uint8_t normalizedNameLength;
+	// 0 for spectators, 1 for players of a team-less gametype, 2 and 3 for alpha and beta teams
+	int8_t team;
+	uint8_t flags;
+	// Incremented on every change of the entry data
+	uint32_t version;
+};
 
 class ClientWorldState
 {
@@ -30,6 +62,22 @@ public:
 	unsigned configStringsStride;
 	unsigned maxConfigStrings;
 
+	// A bit per configstring that is set when the configstring has been changed since the last TakeDirtyConfigStrings() call
+	uint64_t *configStringsDirtyBits;
+	// A counter per configstring that is incremented on every change of the configstring value
+	uint32_t *configStringVersions;
+	// A bit per configstring that might be non-empty, so clearing skips configstrings that have never been set
+	uint64_t *configStringsUsedBits;
+	bool hasDirtyConfigStrings;
+
+	// Entries indexed by zero-based client numbers (MAX_SERVER_CLIENTS)
+	PlayerRosterEntry *roster;
+	unsigned firstPlayerInfoConfigString;
+
+	// Configstrings that define columns of the `scb` command payload
+	unsigned scoreboardLayoutConfigString;
+	unsigned scoreboardTitlesConfigString;
+
 	ClientWorldState()
 		: protocol( 0 ),
 		playerNum( 0 ),
@@ -40,23 +88,95 @@ public:
 		game( nullptr ),
 		level( nullptr ),
 		stats( nullptr ),
-		configStrings( nullptr ) {}
+		configStrings( nullptr ),
+		configStringsDirtyBits( nullptr ),
+		configStringVersions( nullptr ),
+		configStringsUsedBits( nullptr ),
+		hasDirtyConfigStrings( false ),
+		roster( nullptr ),
+		firstPlayerInfoConfigString( 0 ),
+		scoreboardLayoutConfigString( 0 ),
+		scoreboardTitlesConfigString( 0 ) {}
 
 	virtual ~ClientWorldState() {};
 
 	virtual bool IsConnectionReliable() const = 0;
 
+	// Client numbers are zero-based (unlike the playerNum that is an entity number)
+	virtual bool HasPlayerState( int clientNum ) const = 0;
+
+	const short *PlayerStats( int clientNum ) const {
+		return HasPlayerState( clientNum ) ? stats + clientNum * statsStride : nullptr;
+	}
+
 	virtual void Clear();
 
 	char *ConfigStringsData() { return configStrings; }
 	unsigned ConfigStringsStride() const { return configStringsStride; }
 	unsigned MaxConfigStrings() const { return maxConfigStrings; }
 
+	/**
+	 * Sets a configstring value truncating it to the configstring size if needed.
+	 * Nothing is written if the value is unchanged, otherwise the configstring is marked as dirty and its version is incremented.
+	 * @return True if the value has been changed.
+	 */
+	bool SetConfigString( unsigned index, const char *value, unsigned length );
+
+	/**
+	 * Sets all configstrings that might be non-empty to empty ones (they are marked as dirty as usual).
+	 * This touches only configstrings that have been set since the last clearing.
+	 */
+	void ClearConfigStrings();
+
+	uint32_t ConfigStringVersion( unsigned index ) const {
+		return index < maxConfigStrings ? configStringVersions[index] : 0;
+	}
+
+	bool HasDirtyConfigStrings() const { return hasDirtyConfigStrings; }
+
+	/**
+	 * Fetches indices of changed configstrings in ascending order and clears their dirty marks.
+	 * @return A number of fetched indices. If it is equal to maxIndices, there might be more dirty configstrings left.
+	 */
+	unsigned TakeDirtyConfigStrings( uint16_t *indices, unsigned maxIndices );
+
+	/**
+	 * Clears dirty marks of all configstrings without reporting them.
+	 */
+	void DiscardDirtyConfigStrings();
+
+	/**
+	 * Returns a roster entry of a connected player (a client number is zero-based), or null if there is no such player.
+	 */
+	const PlayerRosterEntry *RosterEntry( int clientNum ) const {
+		if( (unsigned)clientNum >= MAX_SERVER_CLIENTS || !roster ) {
+			return nullptr;
+		}
+		const PlayerRosterEntry *entry = &roster[clientNum];
+		return ( entry->flags & PlayerRosterEntry::FLAG_CONNECTED ) ? entry : nullptr;
+	}
+
+	/**
+	 * Finds a connected player by a name as it is shown (e.g. a chat message sender name).
+	 * @return A zero-based client number, or -1 if there is no such player.
+	 */
+	int FindPlayerByName( const char *name ) const;
+
+	/**
+	 * Updates the team of a player as it is known from the player state.
+	 * Should be called for all players on every parsed frame.
+	 */
+	void SetPlayerTeam( unsigned clientNum, int team, bool hasPlayerState );
+
 	int PlayerNum() const { return playerNum; }
 	int SpawnCount() const { return spawnCount; }
 
 	static ClientWorldState *New( int protocolVersion, Console *debugConsole = nullptr );
 	static void Delete( ClientWorldState *worldState );
+
+protected:
+	// Decodes a changed player info configstring
+	void UpdateRosterEntry( unsigned clientNum, const char *playerInfo );
 };
 
 class MessageParser
@@ -65,7 +185,19 @@ class MessageParser
 	// Might and should be hidden by a world state subtype in a derived class, that's why it is private.
 	ClientWorldState *worldState;
 
+public:
+	// Cumulative counters of parsed data, intended for benchmarks and diagnostics
+	struct ParseStats {
+		uint64_t frames;
+		uint64_t nonDeltaFrames;
+		uint64_t entities;
+		uint64_t playerStates;
+		uint64_t gameCommands;
+	};
+
 protected:
+	ParseStats parseStats;
+
 	Console *console;
 	// Its obvious that we should use a GenericClientProtocolExecutor reference here,
 	// but it introduces an initialization dependency loop. Use client->executor instead.
@@ -78,14 +210,52 @@ protected:
 
 public:
 	MessageParser( Console *console_, ClientWorldState *worldState_, Client *client_ )
-		: console( console_ ), worldState( worldState_ ), client( client_ ) {}
+		: worldState( worldState_ ), console( console_ ), client( client_ ) {
+		memset( &parseStats, 0, sizeof( parseStats ) );
+	}
 
 	virtual ~MessageParser() {}
 
 	static MessageParser *New( int protocolVersion, Client *client, ClientWorldState *worldState, Console *console, Console *debugConsole = nullptr );
 	static void Delete( MessageParser *parser );
 
+	// Resets a parser state bound to a particular connection
+	virtual void Reset() = 0;
+
 	virtual void Parse( Message &message ) = 0;
+
+	/**
+	 * Writes a usercmd packet that also acknowledges the last received frame.
+	 * Returns false if the values cannot be represented in the protocol.
+	 */
+	virtual bool WriteMove( Message &message, int64_t lastFrame, uint64_t serverTime ) = 0;
+
+	/**
+	 * Writes a usercmd packet that carries actual inputs and also acknowledges the last received frame.
+	 * Commands are delta-compressed against each other, and their server time stamps are spaced by the tick duration.
+	 * @param commandsHead A sequence number of the next command after the supplied ones.
+	 * @param lastCommandServerTime An estimated server time of the last command.
+	 * Returns false if the values cannot be represented in the protocol.
+	 */
+	virtual bool WriteUserCommands( Message &message, int64_t lastFrame, uint32_t commandsHead,
+									const UserCommand *commands, unsigned numCommands,
+									uint64_t lastCommandServerTime, unsigned tickMillis ) = 0;
+
+	/**
+	 * Writes messages that should precede recorded frames in a demo:
+	 * the server data, the demo info, configstrings, spawn baselines and the game entering command.
+	 */
+	virtual void WriteDemoHeader( DemoRecorder *recorder ) = 0;
+
+	/**
+	 * Adds server-specific key-value pairs to the demo meta data.
+	 */
+	virtual void WriteDemoMetaData( DemoRecorder *recorder ) = 0;
+
+	const ParseStats &GetParseStats() const { return parseStats; }
+
+	// A server time of the last parsed frame
+	uint64_t LastServerTime() const { return serverTime; }
 };
 
 #endif
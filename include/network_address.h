@@ -8,6 +8,7 @@
 
 class alignas ( 8 )NetworkAddress
 {
+	friend class AddressResolver;
 	friend class Channel;
 	friend class Client;
 	friend class System;
@@ -105,7 +106,7 @@ public:
 		const uint8_t *data = addressData;
 		uint32_t result = ~( 0u ^ ( portData[0] | ( portData[1] << 24 ) ) );
 
-		result = result * 17 + ( ( data[0] << 24 ) | ( data[1] << 16 ) | ( data[2] << 8 ) | data[0] );
+		result = result * 17 + ( ( data[0] << 24 ) | ( data[1] << 16 ) | ( data[2] << 8 ) | data[3] );
 		return result;
 	}
 
@@ -140,9 +141,19 @@ class UnresolvedAddress
 {
 	friend class AddressResolver;
 
+public:
+	// Includes the terminating zero (a host name is limited to 253 characters)
+	static constexpr unsigned MAX_HOST_CHARS = 256;
+
+private:
 	NetworkAddress address;
 	bool hasParsingErrors;
 	bool isResolved;
+	// A host name and a port if the address is not a numeric one
+	uint16_t port;
+	char host[MAX_HOST_CHARS];
+
+	static bool IsValidHostName( const char *string, size_t length );
 
 public:
 	UnresolvedAddress( const char *string );
@@ -152,6 +163,15 @@ public:
 	inline bool IsResolved() const { return isResolved; }
 
 	NetworkAddress ToResolvedAddress() const;
+
+	/**
+	 * Returns a host name that should be resolved (an empty string for resolved addresses).
+	 */
+	const char *Host() const { return host; }
+	/**
+	 * Returns a port that should be used with a resolved host.
+	 */
+	uint16_t HostPort() const { return port; }
 };
 
 #endif
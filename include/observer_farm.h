@@ -0,0 +1,187 @@
+#ifndef LIBQFAKECLIENT_OBSERVER_FARM_H
+#define LIBQFAKECLIENT_OBSERVER_FARM_H
+
+#include "common.h"
+#include "event_stream.h"
+#include "network_address.h"
+#include "server_list.h"
+
+class Client;
+class Console;
+class System;
+
+/**
+ * Parameters of an {@link ObserverFarm}. Durations are in milliseconds.
+ */
+struct ObserverFarmSettings {
+	static constexpr unsigned MAX_NAME_CHARS = 32;
+
+	// A server is observed if it has at least this number of human players (observers are not counted)
+	unsigned minPlayers;
+	// A global budget of observer connections (clients are limited by MAX_FAKE_CLIENT_INSTANCES as well)
+	unsigned maxConnections;
+	// An observer leaves a server that has had fewer than minPlayers players for this period
+	unsigned leaveDelay;
+	// A connection attempt fails if the observer has not entered the game within this period
+	unsigned connectTimeout;
+	// A server is not connected to for this period after a failed or dropped connection
+	unsigned retryDelay;
+	// A player name of observers
+	char playerName[MAX_NAME_CHARS];
+
+	ObserverFarmSettings();
+};
+
+/**
+ * Keeps a spectator connection on every populated server of the server list.
+ * The farm receives server list updates, connects an observer to each server that has enough players
+ * (the most populated servers are preferred if the connection budget is exhausted),
+ * and disconnects observers from servers that have become empty or have left the list.
+ * All observers post chat, scoreboard and other events to a single {@link ClientEventStream}
+ * using their slot numbers as client ids. A slot is reused for other servers, so the stream
+ * also receives OBSERVER_ATTACHED and OBSERVER_DETACHED events that tell which server a slot observes.
+ * The farm is run by {@link System} frames and must be used from the System thread.
+ */
+class ObserverFarm
+{
+	friend class System;
+
+public:
+	struct Stats {
+		uint64_t connectAttempts;
+		uint64_t connectionsEstablished;
+		uint64_t connectTimeouts;
+		// Observers that have been disconnected by servers
+		uint64_t droppedConnections;
+		// Observers that have left servers that have become empty or have been removed from the list
+		uint64_t departures;
+
+		// Current numbers of servers and observers
+		unsigned numTrackedServers;
+		unsigned numConnecting;
+		unsigned numObserving;
+		// Servers that should be observed but are not due to the budget or retry delays
+		unsigned numUnobservedServers;
+	};
+
+private:
+	// A minimal interval of checking observer states and server populations
+	static constexpr unsigned STATE_CHECK_INTERVAL = 250;
+
+	enum ObserverState : uint8_t {
+		OBSERVER_FREE,
+		OBSERVER_CONNECTING,
+		OBSERVER_ACTIVE
+	};
+
+	struct Observer {
+		// Created on a first use and kept for next servers
+		Client *client;
+		uint64_t connectDeadline;
+		// An index of the observed server in the tracked servers array
+		unsigned serverIndex;
+		ObserverState state;
+	};
+
+	struct TrackedServer {
+		NetworkAddress address;
+		// A moment the server population has dropped below the threshold at (zero if it is not below)
+		uint64_t emptySince;
+		uint64_t retryAt;
+		char name[64];
+		// A formatted address that is passed to the "connect" command and is reported in events
+		char addressString[64];
+		// Human players (bots and the own observer are not counted)
+		unsigned numPlayers;
+		// An index of the observer slot, or -1
+		int observerIndex;
+	};
+
+	/**
+	 * Forwards server list updates to the farm and to an optional listener of the embedder.
+	 * It is owned by the server list.
+	 */
+	class ServerListHook : public ServerListListener
+	{
+		ObserverFarm *farm;
+		ServerListListener *listener;
+
+	public:
+		ServerListHook( ObserverFarm *farm_, ServerListListener *listener_ ) : farm( farm_ ), listener( listener_ ) {}
+		~ServerListHook() override;
+
+		void OnServerAdded( const PolledGameServer &server ) override;
+		void OnServerRemoved( const PolledGameServer &server ) override;
+		void OnServerUpdated( const PolledGameServer &server ) override;
+	};
+
+	System *system;
+	Console *console;
+	ClientEventStream *stream;
+
+	ObserverFarmSettings settings;
+
+	Observer *observers;
+
+	// Sized by the server list limit, and grows if the limit is raised later (observers refer to servers by index)
+	TrackedServer *servers;
+	unsigned numServers;
+	unsigned serversCapacity;
+
+	uint64_t lastCheckAt;
+
+	Stats stats;
+
+	ObserverFarm( System *system_, Console *console_, ClientEventStream *stream_,
+				  const ObserverFarmSettings &settings_, Observer *observers_,
+				  TrackedServer *servers_, unsigned serversCapacity_ );
+	~ObserverFarm();
+
+	/**
+	 * @param maxServers A maximal number of servers of the server list the farm receives updates from.
+	 */
+	static ObserverFarm *New( System *system, Console *console, ClientEventStream *stream,
+							  const ObserverFarmSettings &settings, unsigned maxServers );
+	static void Delete( ObserverFarm *farm );
+
+	/**
+	 * Creates a listener that should be passed to System::StartUpdatingServerList().
+	 * @param listener An optional listener of the embedder that receives all updates as well (it becomes owned).
+	 */
+	ServerListListener *NewServerListListener( ServerListListener *listener );
+
+	static TrackedServer *AllocServers( unsigned capacity );
+	bool GrowServers();
+
+	TrackedServer *FindServer( const NetworkAddress &address );
+	void UpdateServer( const PolledGameServer &server );
+	void RemoveServer( const PolledGameServer &server );
+
+	Client *ObserverClient( unsigned observerIndex );
+
+	void Attach( unsigned observerIndex, unsigned serverIndex, uint64_t now );
+	/**
+	 * Disconnects an observer.
+	 * @param retryDelay A delay before the server might be observed again.
+	 */
+	void Detach( unsigned observerIndex, unsigned retryDelay );
+
+	void PostEvent( ClientEvent::Type type, unsigned observerIndex, const TrackedServer &server );
+
+	void Frame();
+	void CheckObservers( uint64_t now );
+	void AttachObservers( uint64_t now );
+
+public:
+	/**
+	 * Returns a client of an observer slot (it should not be deleted by the caller),
+	 * or null if the slot is out of range or has not been used yet.
+	 */
+	Client *SlotClient( unsigned observerIndex ) {
+		return observerIndex < settings.maxConnections ? observers[observerIndex].client : nullptr;
+	}
+
+	const Stats &GetStats() const { return stats; }
+};
+
+#endif
@@ -2,13 +2,18 @@
 #define LIBQFAKECLIENT_PROTOCOL_EXECUTOR_H
 
 #include <limits>
+#include <string.h>
 #include "network_address.h"
 #include "command_buffer.h"
+#include "connection_ramp.h"
+#include "scoreboard.h"
+#include "user_command.h"
 
 class Client;
 class ClientWorldState;
 class CommandParser;
 class Console;
+class DemoRecorder;
 class MessageParser;
 class System;
 
@@ -50,16 +55,65 @@ public:
 
 class GenericClientProtocolExecutor;
 
-class CommandHandlersRegistry
+/**
+ * An immutable table of commands that are built into every executor.
+ * Names are placed by a perfect hash that is verified at compile time, so a lookup is a single probe.
+ * Tables are constant-initialized and shared by all executors.
+ */
+class StaticCommandTable
 {
 public:
 	typedef void (GenericClientProtocolExecutor::*CommandHandler)( CommandParser & );
 
+	struct Entry {
+		const char *name;
+		// A null handler means the command is known but ignored
+		CommandHandler handler;
+		uint32_t nameHash;
+		unsigned nameLength;
+	};
+
+private:
+	const Entry *slots;
+	uint32_t multiplier;
+	unsigned slotBits;
+
+public:
+	constexpr StaticCommandTable( const Entry *slots_, uint32_t multiplier_, unsigned slotBits_ )
+		: slots( slots_ ), multiplier( multiplier_ ), slotBits( slotBits_ ) {}
+
+	static constexpr unsigned SlotForHash( uint32_t nameHash, uint32_t multiplier, unsigned slotBits ) {
+		return (unsigned)( ( nameHash * multiplier ) >> ( 32 - slotBits ) );
+	}
+
+	const Entry *Find( const char *name, unsigned nameLength, uint32_t nameHash ) const {
+		const Entry *entry = &slots[SlotForHash( nameHash, multiplier, slotBits )];
+
+		if( entry->nameHash != nameHash || entry->nameLength != nameLength || !entry->name ) {
+			return nullptr;
+		}
+
+		return !memcmp( entry->name, name, nameLength ) ? entry : nullptr;
+	}
+};
+
+/**
+ * Dispatches commands to handlers of an executor.
+ * Built-in commands are looked up in a shared {@link StaticCommandTable}.
+ * Commands registered at runtime form a small per-executor overlay that is checked first,
+ * so they might also disable or replace built-in ones.
+ */
+class CommandHandlersRegistry
+{
+public:
+	typedef StaticCommandTable::CommandHandler CommandHandler;
+
 private:
 	GenericClientProtocolExecutor *executor;
 	const char *tag;
+	const StaticCommandTable *builtinCommands;
 
-	static constexpr auto MAX_HANDLERS = 48;
+	static constexpr auto MAX_HANDLERS = 16;
 	static_assert( MAX_HANDLERS <= std::numeric_limits<int8_t>::max(), "Cannot use a int8_t for an entry index\n" );
 
 	// We use indices instead of pointers to save some memory.
@@ -83,13 +137,16 @@ private:
 	int8_t firstFreeEntry;
 	int8_t firstUsedEntry;
 
-	static constexpr auto HASH_TABLE_SIZE = 89; // A prime number
+	static constexpr auto HASH_TABLE_SIZE = 17; // A prime number
 	int8_t hashTable[HASH_TABLE_SIZE];
 
 	uint32_t currGenerationTag;
 
+	const HashEntry *FindRegistered( const char *name, unsigned nameLength, uint32_t nameHash ) const;
+
 public:
-	CommandHandlersRegistry( GenericClientProtocolExecutor *executor_, const char *tag_ );
+	CommandHandlersRegistry( GenericClientProtocolExecutor *executor_, const char *tag_,
+							 const StaticCommandTable *builtinCommands_ );
 
 	// Looks like there is no covariance in pointers to methods,
 	// so GenericClientProtocolExecutor methods are not compatible with AbstractClientProtocolExecutor ones
@@ -108,10 +165,16 @@ class GenericClientProtocolExecutor : public AbstractClientProtocolExecutor, Cha
 {
 	friend class CommandBuffer;
 	friend class Client;
+	friend class System;
+	friend class DemoPlayer;
+	friend struct BuiltinServerCommands;
+	friend struct BuiltinClientCommands;
 
 protected:
 	enum ClientState {
 		CA_DISCONNECTED,
+		// Waiting for an admission by the connection ramp (or for a backoff delay expiration)
+		CA_WAITING_FOR_ADMISSION,
 		CA_SETUP,
 		CA_CHALLENGING,
 		CA_CONNECTING,
@@ -136,13 +199,61 @@ protected:
 	uint64_t resendAt;
 	uint64_t lastSentAt;
 
+	// Whether the client should ask a server for multiple points of view (states of all players) on entering the game
+	bool multiview;
+
+	// An offline executor is driven by a demo player and never sends anything
+	bool offline;
+
+	// An active demo recorder (if any)
+	DemoRecorder *demoRecorder;
+	// A parser counter value before parsing the current message, used to detect a non-delta frame in it
+	uint64_t nonDeltaFramesBeforeMessage;
+
+	Scoreboard scoreboard;
+	// Versions of the layout configstrings the scoreboard columns have been set for
+	uint32_t scoreboardLayoutVersion;
+	uint32_t scoreboardTitlesVersion;
+
+	// Whether the client occupies a handshake slot of the System connection ramp
+	bool holdsRampSlot;
+	unsigned rampId;
+	// Retries of the current connection that have been made due to ramp backoffs
+	unsigned numRampRetries;
+	uint64_t rampSlotReleaseAt;
+
+	// A sequence number of the next generated user command (the dummy move uses 2 as well)
+	uint32_t userCommandsHead;
+	bool hasSentUserCommands;
+	UserCommand lastUserCommand;
+	// When the last acknowledged server time has been changed
+	uint64_t serverTimeUpdatedAt;
+
 	NetworkAddress currServerAddress;
 
+	// A request of the System address resolver for a host name passed to `connect` (if any)
+	uint32_t resolutionRequestId;
+
+	// A next executor in the System pool of executors that are ready for reuse
+	GenericClientProtocolExecutor *nextInPool;
+
 	void SetState( ClientState clientState_, uint64_t resendAt_ = 0 ) {
 		this->clientState = clientState_;
 		this->resendAt = resendAt_;
+		WakeUp();
 	}
 
+	/**
+	 * Requests running a frame of the client in the next System frame.
+	 * This should be called on any event that might bring a frame deadline of the executor closer.
+	 */
+	void WakeUp();
+
+	/**
+	 * Returns a moment the next Frame() call has something to do at (the maximal value if it is never).
+	 */
+	uint64_t NextFrameAt() const;
+
 	uint64_t Millis() const { return system->Millis(); }
 
 	GenericClientProtocolExecutor( Client *client_,
@@ -150,6 +261,15 @@ protected:
 								   MessageParser *messageParser_,
 								   int protocolVersion_ );
 
+	// Sets fields that are not restored by Reset() to initial values
+	void ResetSessionFields();
+
+	/**
+	 * Prepares an executor that has been taken from the System pool for serving another client.
+	 * The executor must have been reset when it has been put to the pool.
+	 */
+	void Recycle( Client *client_ );
+
 	char name[MAX_STRING_CHARS];
 	char password[MAX_STRING_CHARS];
 	char challenge[MAX_STRING_CHARS];
@@ -167,9 +287,34 @@ protected:
 	void Command_Connect( const UnresolvedAddress &unresolvedAddress );
 	void Command_Connect( const NetworkAddress &address );
 
+	static void OnConnectAddressResolved( void *owner, uint32_t requestId, const NetworkAddress *address );
+	void CancelAddressResolution();
+
 	void Command_Disconnect( CommandParser &parser );
 	void Command_Disconnect();
 
+	void Command_Multiview( CommandParser &parser );
+
+	void Command_Record( CommandParser &parser );
+	void Command_Stop( CommandParser &parser );
+
+	void StopRecording();
+
+	/**
+	 * Sends a challenge request, or waits for an admission if the System has a connection ramp
+	 */
+	void StartHandshake();
+	/**
+	 * Returns the ramp the client occupies a slot of, or null (the slot is forgotten if the ramp has been replaced)
+	 */
+	ConnectionRamp *AdmittedRamp();
+	/**
+	 * Releases a handshake slot and waits for a backoff delay after a failed request of an admitted client
+	 */
+	void RetryHandshakeLater( ConnectionRamp::Phase phase, bool rejected );
+	void ReleaseRampSlot( bool hasEnteredGame );
+	void CheckRampSlotTimeout();
+
 	void DoChallengeRequest();
 	void DoConnectRequest();
 	void DoDisconnectRequest();
@@ -179,6 +324,9 @@ protected:
 #endif
 
 	void Send() {
+		if( offline ) {
+			return;
+		}
 		channel.Send();
 		lastSentAt = Millis();
 	}
@@ -263,6 +411,11 @@ protected:
 	 */
 	void ServerCommand_Motd( CommandParser &parser );
 
+	/**
+	 * Decodes a scoreboard update sent by a server and reports changed entries
+	 */
+	void ServerCommand_Scb( CommandParser &parser );
+
 	typedef void (Client::*ClientChatHandler)( const char *, const char * );
 	void HandleServerChatCommand( CommandParser &parser, ClientChatHandler handler );
 
@@ -272,7 +425,33 @@ protected:
 	void EnqueueCommand( _Printf_format_string_ const char *format, ... );
 #endif
 
-	void AddMove( Message &message, int64_t lastFrame, uint64_t serverTime );
+	bool AddMove( Message &message, int64_t lastFrame, uint64_t serverTime );
+
+	uint64_t EstimatedServerTime() const;
+
+	/**
+	 * Sends generated inputs of the last ticks if the client is in the game
+	 */
+	void SendUserCommands( const UserCommand *commands, unsigned numCommands, unsigned tickMillis );
+
+	static constexpr unsigned MAX_CONFIGSTRINGS_IN_BATCH = 1024;
+
+	/**
+	 * Reports configstrings that have been changed by the last parsed message to the client listener in batches.
+	 */
+	void NotifyConfigStringsChanged();
+
+	/**
+	 * Publishes a snapshot of the world state if the client has enabled the publication.
+	 */
+	void PublishWorldState();
+
+	/**
+	 * Makes the executor consume recorded server messages instead of talking to a server.
+	 * Nothing is sent since then, and commands that manage a connection are ignored.
+	 * Game commands addressed to any player are routed to the client listener (as in multiview mode).
+	 */
+	void EnterOfflineMode();
 
 public:
 	~GenericClientProtocolExecutor() override;
@@ -295,7 +474,32 @@ public:
 	void Frame() override;
 
 	void ExecuteCommandFromServer( const char *command );
+
+	/**
+	 * Executes a game command that is addressed to players marked in the supplied bitset.
+	 * A multiview client routes the command to the client listener for each target,
+	 * otherwise the command is executed only if the client itself is a target.
+	 */
+	void ExecuteTargetedCommandFromServer( const char *command, const uint8_t *targets, unsigned numTargetBytes );
 	void ExecuteCommandFromClient( const char *command ) override;
+
+	/**
+	 * Returns an executor of the client for replaying captured server traffic (creates it if needed).
+	 * Replay calls bypass a handshake, so these are meant only for tools that are built along with the library.
+	 */
+	static GenericClientProtocolExecutor *ForReplay( Client *client );
+
+	/**
+	 * Resets the executor and makes its channel accept sequenced messages from the address starting from the first one.
+	 */
+	void ResetForReplay( const NetworkAddress &serverAddress );
+
+	/**
+	 * Passes a datagram to the channel as if it has been received from the replayed server.
+	 */
+	void ReplayDatagram( const uint8_t *data, unsigned dataSize );
+
+	const MessageParser *ReplayParser() const { return messageParser; }
 };
 
 #endif
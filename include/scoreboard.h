@@ -0,0 +1,92 @@
+#ifndef LIBQFAKECLIENT_SCOREBOARD_H
+#define LIBQFAKECLIENT_SCOREBOARD_H
+
+#include "common.h"
+
+/**
+ * A row of a decoded scoreboard. Fields that are not present in the gametype layout are zero.
+ */
+struct ScoreboardEntry {
+	enum : uint8_t {
+		// The player is listed in the scoreboard
+		FLAG_PRESENT = 1 << 0,
+		// The player is listed as a spectator (or a player waiting/connecting)
+		FLAG_SPECTATOR = 1 << 1,
+		FLAG_READY = 1 << 2,
+		// The player is dead and waits for a respawn
+		FLAG_GHOSTING = 1 << 3
+	};
+
+	int32_t score;
+	int16_t ping;
+	int16_t kills;
+	int16_t deaths;
+	// 0 for spectators, 1 for players of a team-less gametype, 2 and 3 for alpha and beta teams
+	int8_t team;
+	uint8_t flags;
+};
+
+/**
+ * Decodes `scb` server command payloads into a compact per-player table and tracks changes between updates.
+ * Columns of player rows are defined by a gametype, so the decoder relies on the scoreboard layout and titles configstrings
+ * (a layout looks like "%n 112 %s 52 %i 52 %l 48 %r l1", titles look like "Name Clan Score Ping R").
+ */
+class Scoreboard
+{
+	enum ColumnKind : uint8_t {
+		COLUMN_IGNORED,
+		COLUMN_PLAYER_NUM,
+		COLUMN_SCORE,
+		COLUMN_KILLS,
+		COLUMN_DEATHS,
+		COLUMN_PING,
+		COLUMN_READY
+	};
+
+	static constexpr unsigned MAX_COLUMNS = 32;
+
+	ColumnKind columns[MAX_COLUMNS];
+	unsigned numColumns;
+
+	ScoreboardEntry entries[MAX_SERVER_CLIENTS];
+	ScoreboardEntry newEntries[MAX_SERVER_CLIENTS];
+
+	uint8_t changedClientNums[MAX_SERVER_CLIENTS];
+	ScoreboardEntry changedEntries[MAX_SERVER_CLIENTS];
+
+	void SetDefaultLayout();
+
+	ScoreboardEntry *NewEntryForToken( const char *token, bool *ghosting );
+
+public:
+	Scoreboard() { Clear(); }
+
+	void Clear();
+
+	/**
+	 * Sets columns of player rows. Should be called before the first update and on every change of the layout configstrings.
+	 * A default deathmatch layout is used if the layout is empty.
+	 */
+	void SetLayout( const char *layout, const char *titles );
+
+	/**
+	 * Decodes a scoreboard message and compares it to the previous one.
+	 * @return A number of changed entries that are available via ChangedClientNums() and ChangedEntries().
+	 */
+	unsigned Update( const char *message );
+
+	const uint8_t *ChangedClientNums() const { return changedClientNums; }
+	const ScoreboardEntry *ChangedEntries() const { return changedEntries; }
+
+	/**
+	 * Returns an entry of a player listed in the scoreboard (a client number is zero-based), or null.
+	 */
+	const ScoreboardEntry *Entry( int clientNum ) const {
+		if( (unsigned)clientNum >= MAX_SERVER_CLIENTS || !( entries[clientNum].flags & ScoreboardEntry::FLAG_PRESENT ) ) {
+			return nullptr;
+		}
+		return &entries[clientNum];
+	}
+};
+
+#endif
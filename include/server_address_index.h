@@ -0,0 +1,91 @@
+#ifndef LIBQFAKECLIENT_SERVER_ADDRESS_INDEX_H
+#define LIBQFAKECLIENT_SERVER_ADDRESS_INDEX_H
+
+#include "network_address.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+class PolledGameServer;
+
+/**
+ * A compact form of an IPv4 or IPv6 address with a port.
+ * IPv4 addresses are stored as IPv4-mapped IPv6 ones, so keys of different families never match.
+ */
+struct ServerAddressKey {
+	// 16 bytes of an address and 2 bytes of a port in the network byte order
+	uint8_t bytes[18];
+
+	static ServerAddressKey FromIpV4Data( const uint8_t *addressBytes, const uint8_t *portBytes );
+	static ServerAddressKey FromIpV6Data( const uint8_t *addressBytes, const uint8_t *portBytes );
+	static ServerAddressKey FromAddress( const NetworkAddress &address );
+
+	bool operator==( const ServerAddressKey &that ) const {
+		return !memcmp( bytes, that.bytes, sizeof( bytes ) );
+	}
+
+	uint64_t Hash() const;
+};
+
+/**
+ * A resizable open-addressing hash table of polled servers keyed by their addresses.
+ * Slots are split in groups of 16 that have a control byte per slot (an empty or a deleted mark,
+ * or 7 bits of a key hash), so a probe of a group tests all its control bytes at once
+ * using SSE2 (or a portable fallback), and keys are compared only for matching control bytes.
+ * Keys are stored in the table, so a lookup does not touch servers.
+ */
+class ServerAddressIndex
+{
+	static constexpr unsigned GROUP_SIZE = 16;
+	static constexpr unsigned MIN_CAPACITY = 64;
+
+	static constexpr uint8_t EMPTY = 0x80;
+	static constexpr uint8_t DELETED = 0xFE;
+
+	// A single allocation that holds control bytes, keys and values of all slots
+	uint8_t *controlBytes;
+	ServerAddressKey *keys;
+	PolledGameServer **values;
+
+	size_t capacity;
+	size_t size;
+	size_t numDeleted;
+
+	// Returns a bitmask of slots of the group that have the control byte
+	static uint32_t MatchGroup( const uint8_t *group, uint8_t controlByte );
+	// Returns a bitmask of slots of the group that are empty or deleted
+	static uint32_t MatchFreeSlots( const uint8_t *group );
+
+	size_t FindSlot( const ServerAddressKey &key, uint64_t hash ) const;
+	size_t FindFreeSlot( uint64_t hash ) const;
+
+	bool Rehash( size_t newCapacity );
+
+public:
+	ServerAddressIndex();
+	~ServerAddressIndex();
+
+	ServerAddressIndex( const ServerAddressIndex & ) = delete;
+	ServerAddressIndex &operator=( const ServerAddressIndex & ) = delete;
+
+	size_t Size() const { return size; }
+
+	/**
+	 * Returns a server with the address, or null if there is no such server.
+	 */
+	PolledGameServer *Find( const ServerAddressKey &key ) const;
+
+	/**
+	 * Adds a server that must not be present in the index.
+	 * @return False if the index cannot grow.
+	 */
+	bool Insert( const ServerAddressKey &key, PolledGameServer *server );
+
+	/**
+	 * Removes a server with the address (if any).
+	 */
+	void Remove( const ServerAddressKey &key );
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "network_address.h"
 #include "channel.h"
+#include "server_address_index.h"
 
 class AbstractPool;
 
@@ -251,10 +252,7 @@ class PolledGameServer : public PooledItem
 	friend class ServerList;
 
 	Links<PolledGameServer> serversListLinks;
-	Links<PolledGameServer> hashBinLinks;
 
-	uint32_t addressHash;
-	unsigned hashBinIndex;
 	NetworkAddress networkAddress;
 
 	ServerInfo *currInfo;
@@ -330,6 +328,8 @@ class ServerInfoParser;
 
 class ServerList
 {
+	friend class System;
+
 	Message message;
 
 	System *system;
@@ -345,12 +345,13 @@ class ServerList
 	void *playerInfoPool;
 	void *polledServersPool;
 
-	static constexpr unsigned HASH_MAP_SIZE = 97;
-	Links<PolledGameServer> *serversHashBins[HASH_MAP_SIZE];
+	ServerAddressIndex serversIndex;
 
 	int64_t lastMasterServersPollAt;
 	unsigned lastMasterServerIndex;
 
+	int64_t lastPoolsCompactionAt;
+
 	unsigned serverInstanceIdCounter;
 	int protocol;
 
@@ -362,12 +363,7 @@ class ServerList
 	void ParseGetServersExtResponse( const NetworkAddress &address );
 	void OnServerIpV4AddressBytesReceived( const uint8_t *addressBytes, const uint8_t *portBytes );
 	void OnServerIpV6AddressBytesReceived( const uint8_t *addressBytes, const uint8_t *portBytes );
-	void AddNewIpV4Server( const uint8_t *addressBytes, const uint8_t *portBytes,
-						   uint32_t addressHash, unsigned hashBinIndex );
-	void AddNewIpV6Server( const uint8_t *addressBytes, const uint8_t *portBytes,
-						   uint32_t addressHash, unsigned hashBinIndex );
-	void LinkServerToHashBin( PolledGameServer *server, uint32_t addressHash, unsigned hashBinIndex );
-	void UnlinkServerFromHashBin( PolledGameServer *server );
+	void AddNewServer( const ServerAddressKey &key, const NetworkAddress &address );
 
 	inline ServerInfo *AllocServerInfo();
 	inline PlayerInfo *AllocPlayerInfo();
@@ -403,6 +399,8 @@ class ServerList
 	void DropTimedOutServers();
 	void DropServer( PolledGameServer *server );
 
+	void CompactifyPools();
+
 public:
 	ServerList( System *system_, Socket *ipV4Socket_, Socket *ipV6Socket_, int protocol_, ServerListListener *listener_ );
 	~ServerList();
@@ -412,6 +410,16 @@ public:
 		this->showPlayerInfo = showPlayerInfo_;
 	}
 
+	static constexpr unsigned DEFAULT_MAX_SERVERS = 256;
+	static constexpr unsigned DEFAULT_MAX_SERVER_INFOS = 768;
+	static constexpr unsigned DEFAULT_MAX_PLAYER_INFOS = 2048;
+
+	/**
+	 * Sets maximal numbers of polled servers and pooled server and player infos.
+	 * Servers that are received from master servers after reaching the limit are ignored.
+	 */
+	void SetLimits( unsigned maxServers, unsigned maxServerInfos, unsigned maxPlayerInfos );
+
 	static void SocketCallback( void *owner, const NetworkAddress &address, unsigned dataSize );
 	inline uint8_t *SocketBuffer() { return message.Buffer(); }
 	inline unsigned BufferSize() { return message.MaxSize(); }
@@ -3,6 +3,8 @@
 
 #include "network_address.h"
 
+#include <stdint.h>
+
 class Socket
 {
 	friend class System;
@@ -0,0 +1,72 @@
+#ifndef LIBQFAKECLIENT_SPSC_QUEUE_H
+#define LIBQFAKECLIENT_SPSC_QUEUE_H
+
+#include <atomic>
+#include <stdint.h>
+
+/**
+ * A bounded lock-free queue for a single producer thread and a single consumer thread.
+ * Values are copied in and out, so it is intended to be used for pointers and small POD structs.
+ * @tparam T A type of queue values.
+ * @tparam Capacity A maximal number of values in the queue. Must be a power of two.
+ */
+template <typename T, unsigned Capacity>
+class SpscQueue
+{
+	static_assert( Capacity && !( Capacity & ( Capacity - 1 ) ), "The capacity must be a power of two" );
+
+	static constexpr unsigned CACHE_LINE_SIZE = 64;
+
+	// Counters grow monotonically and wrap around, a difference of counters is a number of values in the queue.
+	// Keep the counters on separate cache lines since they are modified by different threads.
+	std::atomic<unsigned> head;
+	uint8_t headPadding[CACHE_LINE_SIZE - sizeof( std::atomic<unsigned> )];
+	std::atomic<unsigned> tail;
+	uint8_t tailPadding[CACHE_LINE_SIZE - sizeof( std::atomic<unsigned> )];
+
+	T values[Capacity];
+
+public:
+	SpscQueue() : head( 0 ), tail( 0 ) {}
+
+	/**
+	 * Tries to add a value to the queue. Must be called only by the producer thread.
+	 * @return False if the queue is full.
+	 */
+	bool TryPush( const T &value ) {
+		const unsigned currTail = tail.load( std::memory_order_relaxed );
+
+		if( currTail - head.load( std::memory_order_acquire ) >= Capacity ) {
+			return false;
+		}
+
+		values[currTail & ( Capacity - 1 )] = value;
+		tail.store( currTail + 1, std::memory_order_release );
+		return true;
+	}
+
+	/**
+	 * Tries to remove a value from the queue. Must be called only by the consumer thread.
+	 * @return False if the queue is empty.
+	 */
+	bool TryPop( T *value ) {
+		const unsigned currHead = head.load( std::memory_order_relaxed );
+
+		if( currHead == tail.load( std::memory_order_acquire ) ) {
+			return false;
+		}
+
+		*value = values[currHead & ( Capacity - 1 )];
+		head.store( currHead + 1, std::memory_order_release );
+		return true;
+	}
+
+	/**
+	 * Checks whether the queue is empty. The result is exact only if called by the consumer thread.
+	 */
+	bool IsEmpty() const {
+		return head.load( std::memory_order_acquire ) == tail.load( std::memory_order_acquire );
+	}
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef LIBQFAKECLIENT_STATIC_LISTENERS_H
+#define LIBQFAKECLIENT_STATIC_LISTENERS_H
+
+#include "client.h"
+#include "console.h"
+#include "server_list.h"
+
+#include <stdarg.h>
+#include <utility>
+
+/**
+ * Adapters of listener and console interfaces to policies with non-virtual methods.
+ * A policy is a plain class whose methods have the same names and signatures as methods of an interface.
+ * An adapter is final and forwards each callback directly to its policy, so the library performs
+ * a single indirect call per callback, and the policy methods are inlined into it.
+ * Policies might derive from the default ones below and redefine only callbacks they are interested in,
+ * other callbacks become empty functions (e.g. a load generator might drop all chat messages this way).
+ * Adapters are owned by the library like other listeners, so allocate them using malloc() and placement new.
+ */
+
+/**
+ * A default policy of {@link StaticClientListener} that ignores all callbacks.
+ */
+struct ClientListenerPolicy {
+	void SetShownPlayerName( const char * ) {}
+	void SetMessageOfTheDay( const char * ) {}
+	void PrintCenteredMessage( const char * ) {}
+	void PrintChatMessage( const char *, const char * ) {}
+	void PrintTeamChatMessage( const char *, const char * ) {}
+	void PrintTVChatMessage( const char *, const char * ) {}
+	void ExecuteTargetedCommand( int, const char * ) {}
+	void OnConfigStringsChanged( const uint16_t *, const char *const *, unsigned ) {}
+	void OnScoreboardChanged( const uint8_t *, const ScoreboardEntry *, unsigned ) {}
+};
+
+template <typename Policy>
+class StaticClientListener final : public ClientListener
+{
+	Policy policy;
+
+public:
+	template <typename... Args>
+	explicit StaticClientListener( Args &&... args ) : policy( std::forward<Args>( args )... ) {}
+
+	Policy &GetPolicy() { return policy; }
+	const Policy &GetPolicy() const { return policy; }
+
+	void SetShownPlayerName( const char *name ) override {
+		policy.SetShownPlayerName( name );
+	}
+
+	void SetMessageOfTheDay( const char *motd ) override {
+		policy.SetMessageOfTheDay( motd );
+	}
+
+	void PrintCenteredMessage( const char *message ) override {
+		policy.PrintCenteredMessage( message );
+	}
+
+	void PrintChatMessage( const char *from, const char *message ) override {
+		policy.PrintChatMessage( from, message );
+	}
+
+	void PrintTeamChatMessage( const char *from, const char *message ) override {
+		policy.PrintTeamChatMessage( from, message );
+	}
+
+	void PrintTVChatMessage( const char *from, const char *message ) override {
+		policy.PrintTVChatMessage( from, message );
+	}
+
+	void ExecuteTargetedCommand( int clientNum, const char *command ) override {
+		policy.ExecuteTargetedCommand( clientNum, command );
+	}
+
+	void OnConfigStringsChanged( const uint16_t *indices, const char *const *values, unsigned numChanged ) override {
+		policy.OnConfigStringsChanged( indices, values, numChanged );
+	}
+
+	void OnScoreboardChanged( const uint8_t *clientNums, const ScoreboardEntry *entries, unsigned numChanged ) override {
+		policy.OnScoreboardChanged( clientNums, entries, numChanged );
+	}
+};
+
+/**
+ * A default policy of {@link StaticServerListListener} that ignores all callbacks.
+ */
+struct ServerListListenerPolicy {
+	void OnServerAdded( const PolledGameServer & ) {}
+	void OnServerRemoved( const PolledGameServer & ) {}
+	void OnServerUpdated( const PolledGameServer & ) {}
+};
+
+template <typename Policy>
+class StaticServerListListener final : public ServerListListener
+{
+	Policy policy;
+
+public:
+	template <typename... Args>
+	explicit StaticServerListListener( Args &&... args ) : policy( std::forward<Args>( args )... ) {}
+
+	Policy &GetPolicy() { return policy; }
+	const Policy &GetPolicy() const { return policy; }
+
+	void OnServerAdded( const PolledGameServer &server ) override {
+		policy.OnServerAdded( server );
+	}
+
+	void OnServerRemoved( const PolledGameServer &server ) override {
+		policy.OnServerRemoved( server );
+	}
+
+	void OnServerUpdated( const PolledGameServer &server ) override {
+		policy.OnServerUpdated( server );
+	}
+};
+
+/**
+ * A policy of {@link StaticConsole} that discards all output.
+ */
+struct NullConsolePolicy {
+	void VPrintf( const char *, va_list ) {}
+};
+
+/**
+ * A console that forwards output to a policy.
+ * Printf() calls the policy directly instead of dispatching to VPrintf() virtually once again.
+ */
+template <typename Policy>
+class StaticConsole final : public Console
+{
+	Policy policy;
+
+public:
+	template <typename... Args>
+	explicit StaticConsole( Args &&... args ) : policy( std::forward<Args>( args )... ) {}
+
+	Policy &GetPolicy() { return policy; }
+	const Policy &GetPolicy() const { return policy; }
+
+	void Printf( const char *format, ... ) override {
+		va_list va;
+		va_start( va, format );
+		policy.VPrintf( format, va );
+		va_end( va );
+	}
+
+	void VPrintf( const char *format, va_list va ) override {
+		policy.VPrintf( format, va );
+	}
+};
+
+#endif
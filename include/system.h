@@ -11,13 +11,31 @@
 
 class Socket;
 class Client;
+class GenericClientProtocolExecutor;
 
 class ServerList;
 class ServerListListener;
 
+class DemoWriter;
+
+class AddressResolver;
+
+class BotScheduler;
+
+class ObserverFarm;
+struct ObserverFarmSettings;
+class ClientEventStream;
+
+class ConnectionRamp;
+struct ConnectionRampSettings;
+
 class System
 {
 	friend class ServerList;
+	friend class DemoRecorder;
+	friend class BotScheduler;
+	friend class ObserverFarm;
+	friend class Client;
 
 	Console *console;
 
@@ -26,6 +44,19 @@ class System
 
 	Client *clients[MAX_FAKE_CLIENT_INSTANCES];
 
+	// Hot scheduling state of clients, indexed as the clients array.
+	// Frame sweeps read only these tables and touch clients that have something to do,
+	// so idle clients (that are mostly waiting for data) cost a few bytes of memory traffic per frame.
+	// Entries are updated by clients, see Client::UpdateFrameSchedule().
+	uint8_t clientStates[MAX_FAKE_CLIENT_INSTANCES];
+	// A moment a client should run its next frame at (the maximal value for idle clients and empty slots)
+	uint64_t clientFrameDeadlines[MAX_FAKE_CLIENT_INSTANCES];
+
+	// Executors of reset clients that are kept for reuse (with their world states and parsers)
+	GenericClientProtocolExecutor *firstPooledExecutor;
+	unsigned numPooledExecutors;
+	unsigned maxPooledExecutors;
+
 	struct ListenedSocket {
 		Socket *socket;
 		void *owner;
@@ -43,25 +74,79 @@ class System
 	ListenedSocket listenedSockets[MAX_SOCKETS];
 	unsigned numListenedSockets;
 
+	struct FrameHook {
+		void *owner;
+		void (*callback)( void * );
+	};
+
+	static constexpr unsigned MAX_FRAME_HOOKS = 8;
+
+	FrameHook frameHooks[MAX_FRAME_HOOKS];
+	unsigned numFrameHooks;
+
 	static constexpr unsigned MAX_MASTER_SERVERS = 4;
 	NetworkAddress masterServers[MAX_MASTER_SERVERS];
 	unsigned numMasterServers;
+	// Resolutions of master server host names that are in progress (they are going to occupy master server slots)
+	uint32_t masterServerRequestIds[MAX_MASTER_SERVERS];
+	unsigned numMasterServerRequests;
 
 	ServerList *serverList;
 	bool pendingShowEmptyServersOption;
 	bool pendingShowPlayerInfoOption;
+	unsigned pendingMaxServers;
+	unsigned pendingMaxServerInfos;
+	unsigned pendingMaxPlayerInfos;
+
+	BotScheduler *botScheduler;
+
+	ObserverFarm *observerFarm;
+
+	ConnectionRamp *connectionRamp;
+	unsigned numEnabledConnectionRamps;
+
+	// A rate that has been set by SetUserCommandRate() but has not been applied in the System thread yet (or -1)
+	std::atomic<int> pendingUserCommandRate;
+	// User command ticks are counted from the moment the rate has been set to keep the rate exact over time
+	unsigned userCommandRate;
+	uint64_t userCommandTicksStartedAt;
+	uint64_t numUserCommandTicks;
 
 	std::thread::id pinnedToThreadId;
 
+	// Created lazily on a first demo recording start
+	DemoWriter *demoWriter;
+
+	// Created lazily on a first host name lookup
+	AddressResolver *addressResolver;
+
 	System( Console *globalConsole );
 	~System();
 
 	void TimeFrame( unsigned maxMillis );
 	void NetPollFrame( unsigned maxMillis );
 	void ClientsFrame( unsigned maxMillis );
+	void UserCommandsFrame();
 
 	void OnSocketReadable( ListenedSocket *listenedSocket );
 
+	static void OnMasterServerAddressResolved( void *owner, uint32_t requestId, const NetworkAddress *address );
+
+	DemoWriter *DemoWriterInstance();
+
+	/**
+	 * Takes a pooled executor of the protocol version or creates a new one.
+	 * @return An executor that serves the client, or null on failure.
+	 */
+	GenericClientProtocolExecutor *AcquireExecutor( Client *client, int protocolVersion );
+	/**
+	 * Resets a released executor and keeps it in the pool, or deletes it if the pool is full.
+	 */
+	void ReleaseExecutor( GenericClientProtocolExecutor *executor );
+	void DeletePooledExecutors( unsigned numToKeep );
+
+	void DeleteConnectionRamp();
+
 public:
 	/**
 	 * Initializes the global System instance.
@@ -108,6 +193,15 @@ public:
 	 */
 	void DeleteClient( Client *client );
 
+	/**
+	 * Sets a maximal number of protocol executors that are kept for reuse after clients disconnect or get deleted.
+	 * Reusing an executor avoids allocation of its world state and parser and registration of its commands,
+	 * that matters for reconnection storms of many bots. The default capacity is MAX_FAKE_CLIENT_INSTANCES.
+	 * It's safely to call the function from an arbitrary thread if calling System::Instance() is legal.
+	 * @param capacity A new capacity (zero disables the pool). Pooled executors above it are deleted.
+	 */
+	void SetExecutorPoolCapacity( unsigned capacity );
+
 	/**
 	 * Adds a socket that gets tested for ingoing UDP messages in Frame() calls
 	 * This call must be performed in the same thread the system is pinned to by a first Frame() call.
@@ -123,6 +217,21 @@ public:
 	 */
 	bool RemoveListenedSocket( Socket *socket );
 
+	/**
+	 * Adds a callback that is called at the end of every Frame() call after all other subsystems.
+	 * This lets extensions (e.g. schedulers of coroutines) run in the System thread without their own loops.
+	 * It's safe to call the function from an arbitrary thread if calling System::Instance() is legal.
+	 * @return True if the hook addition succeeded, false if there are too many hooks or the owner already has a hook.
+	 */
+	bool AddFrameHook( void *owner, void ( *callback )( void * ) );
+
+	/**
+	 * Removes a hook that has been added by AddFrameHook().
+	 * It's safe to call the function from an arbitrary thread (including a hook callback) if calling System::Instance() is legal.
+	 * @return True if the removal succeeded (there was a hook of the owner), false otherwise.
+	 */
+	bool RemoveFrameHook( void *owner );
+
 	/**
 	 * Adds a master server address that might be used in server list updates.
 	 * It's safe to call the function from an arbitrary thread if calling System::Instance() is legal.
@@ -131,6 +240,13 @@ public:
 	 */
 	bool AddMasterServer( const NetworkAddress &address );
 
+	/**
+	 * Adds a master server address that is given as a string (possibly a host name and a port).
+	 * A host name is resolved asynchronously, and the address gets added in a Frame() call.
+	 * @return True if the addition succeeded or the resolution has been started.
+	 */
+	bool AddMasterServer( const char *addressString );
+
 	/**
 	 * Removes a master server address. The address might no longer be used in server list updates.
 	 * It's safe to call the function from an arbitrary thread if calling System::Instance() is legal.
@@ -150,6 +266,7 @@ public:
 	 * A duplicated call without StopServerListUpdates() in-between leads to an abortion.
 	 * It's safe to call the function from an arbitrary thread if calling System::Instance() is legal.
 	 * @param listener A {@link ServerListListener} that gets notified about server status updates. Must not be null.
+	 * The listener becomes owned by the server list if the call succeeds.
 	 * @return True if start of the polling succeeded.
 	 */
 	bool StartUpdatingServerList( ServerListListener *listener );
@@ -164,6 +281,18 @@ public:
 	 */
 	void SetServerListUpdateOptions( bool showEmpty, bool showPlayerInfo );
 
+	/**
+	 * Sets limits of the server list memory use.
+	 * Defaults are 256 servers, 768 server infos and 2048 player infos.
+	 * Like update options, the limits are kept for following StartUpdatingServerList() calls.
+	 * An observer farm sizes its table of tracked servers by the servers limit as well.
+	 * It's safe to call the function from an arbitrary thread if calling System::Instance() is legal.
+	 * @param maxServers A maximal number of polled servers.
+	 * @param maxServerInfos A maximal number of server infos (a server keeps up to 2 infos, and more are used while parsing).
+	 * @param maxPlayerInfos A maximal number of player infos of all servers.
+	 */
+	void SetServerListLimits( unsigned maxServers, unsigned maxServerInfos, unsigned maxPlayerInfos );
+
 	/**
 	 * Stops updating the server list.
 	 * This call is idempotent and is allowed to be called without a prior StartUpdatingServerList() call.
@@ -171,6 +300,79 @@ public:
 	 */
 	void StopUpdatingServerList();
 
+	/**
+	 * Starts running scripted bots in Frame() calls.
+	 * Note that this call is not idempotent.
+	 * A duplicated call without StopBotScheduler() in-between leads to an abortion.
+	 * @param maxBots A maximal number of bots (clients are also limited by MAX_FAKE_CLIENT_INSTANCES).
+	 * @param seed A seed of random choices, the same seed leads to the same timing of bot actions.
+	 * @return A scheduler that bots should be added to, or null if it cannot be created.
+	 */
+	BotScheduler *StartBotScheduler( unsigned maxBots, uint64_t seed );
+
+	/**
+	 * Stops the bot scheduler and deletes clients of all its bots.
+	 * This call is idempotent and is allowed to be called without a prior StartBotScheduler() call.
+	 */
+	void StopBotScheduler();
+
+	/**
+	 * Starts keeping observers on populated servers of the server list in Frame() calls.
+	 * The farm starts updating the server list itself, so the server list must not be updated yet.
+	 * Note that this call is not idempotent.
+	 * A duplicated call without StopObserverFarm() in-between leads to an abortion.
+	 * @param stream A stream that receives events of all observers. Must not be null. It is not owned by the farm.
+	 * @param listener An optional {@link ServerListListener} that receives server list updates as well.
+	 * It becomes owned by the server list as if it were passed to StartUpdatingServerList().
+	 * @return The farm, or null if it cannot be created or the server list cannot be updated.
+	 */
+	ObserverFarm *StartObserverFarm( const ObserverFarmSettings &settings, ClientEventStream *stream,
+									 ServerListListener *listener = nullptr );
+
+	/**
+	 * Stops the observer farm, deletes clients of all its observers and stops updating the server list.
+	 * This call is idempotent and is allowed to be called without a prior StartObserverFarm() call.
+	 */
+	void StopObserverFarm();
+
+	/**
+	 * Makes clients wait for an admission by a {@link ConnectionRamp} on connection attempts.
+	 * An already enabled ramp is replaced (handshakes in progress do not occupy slots of the new one).
+	 * Clients use the ramp in their frames, so the call must be performed in the thread the system is pinned to.
+	 * @param seed A seed of backoff delays.
+	 * @return True if the ramp has been enabled.
+	 */
+	bool EnableConnectionRamp( const ConnectionRampSettings &settings, uint64_t seed = 0 );
+
+	/**
+	 * Lets clients connect immediately again.
+	 * This call is idempotent and is allowed to be called without a prior EnableConnectionRamp() call.
+	 * The call must be performed in the thread the system is pinned to as well.
+	 */
+	void DisableConnectionRamp();
+
+	/**
+	 * Returns the active connection ramp (that provides per-phase statistics), or null if there is no ramp.
+	 */
+	ConnectionRamp *ConnectionRampInstance() { return connectionRamp; }
+
+	/**
+	 * Returns the resolver of host names, creates it on a first call.
+	 * The resolver might be configured for testing via AddressResolver::SetLookupFunction().
+	 * @return The resolver, or null if its creation has failed.
+	 */
+	AddressResolver *AddressResolverInstance();
+
+	/**
+	 * Sets a rate of sending generated inputs by clients that have a {@link UserCommandGenerator}.
+	 * All clients are ticked in a single pass, so their packets are sent back-to-back once per tick.
+	 * Frame() calls should be frequent enough for the rate (their maxMillis should not exceed the tick duration).
+	 * It's safe to call the function from an arbitrary thread if calling System::Instance() is legal.
+	 * The rate is applied by a next Frame() call.
+	 * @param ticksPerSecond A rate (e.g. 60 or 125), zero disables sending inputs.
+	 */
+	void SetUserCommandRate( unsigned ticksPerSecond );
+
 	/**
 	 * Runs the system and all attached clients.
 	 * Note that the system becomes pinned to the current thread,
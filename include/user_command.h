@@ -0,0 +1,112 @@
+#ifndef LIBQFAKECLIENT_USER_COMMAND_H
+#define LIBQFAKECLIENT_USER_COMMAND_H
+
+#include "common.h"
+
+// Clients send inputs of several ticks in a single packet if a System frame has been late
+constexpr const unsigned MAX_USER_COMMANDS_IN_MOVE = 8;
+
+/**
+ * An input of a player for a single client tick (as in `usercmd_t`).
+ * Angles are 16-bit fractions of a full turn, moves are in [-127, 127].
+ */
+struct UserCommand {
+	enum : uint8_t {
+		BUTTON_ATTACK = 1 << 0,
+		BUTTON_WALK = 1 << 1,
+		BUTTON_SPECIAL = 1 << 2
+	};
+
+	int16_t angles[3];
+	int8_t forwardMove;
+	int8_t sideMove;
+	int8_t upMove;
+	uint8_t buttons;
+
+	static int16_t AngleToShort( float degrees ) {
+		return (int16_t)( (int)( degrees * ( 65536.0f / 360.0f ) ) & 65535 );
+	}
+};
+
+/**
+ * Parameters of synthetic inputs produced by a {@link UserCommandGenerator}.
+ */
+struct UserCommandPattern {
+	enum Kind : uint8_t {
+		// Stand still looking in the same direction
+		IDLE,
+		// Run forward turning smoothly and changing the turn direction randomly
+		RANDOM_WALK,
+		// Run forward strafing from side to side and jumping periodically
+		STRAFE,
+		// Repeat supplied commands in a loop
+		REPLAY
+	};
+
+	Kind kind;
+	// RANDOM_WALK: a maximal yaw change per tick in degrees
+	float maxTurnPerTick;
+	// RANDOM_WALK: a mean number of ticks between changes of the turn direction
+	unsigned turnChangeTicks;
+	// RANDOM_WALK: a probability of holding the attack button in a tick
+	float attackProbability;
+	// STRAFE: a number of ticks of strafing to the same side
+	unsigned strafeTicks;
+	// STRAFE: a number of ticks between jumps, zero disables jumping
+	unsigned jumpTicks;
+	// A seed of random choices, the same seed leads to the same inputs
+	uint64_t seed;
+
+	UserCommandPattern()
+		: kind( RANDOM_WALK ),
+		maxTurnPerTick( 3.0f ),
+		turnChangeTicks( 60 ),
+		attackProbability( 0.0f ),
+		strafeTicks( 30 ),
+		jumpTicks( 0 ),
+		seed( 0 ) {}
+};
+
+/**
+ * Produces a stream of user commands according to a pattern.
+ * A generator is attached to a {@link Client} that sends generated commands
+ * at the rate set by System::SetUserCommandRate() while the client is in the game.
+ */
+class UserCommandGenerator
+{
+	UserCommandPattern pattern;
+
+	// Owned commands for the REPLAY pattern
+	UserCommand *replayCommands;
+	unsigned numReplayCommands;
+
+	uint64_t randomState;
+	uint64_t numTicks;
+
+	float yaw;
+	float turnPerTick;
+	unsigned ticksTillTurnChange;
+
+	UserCommandGenerator( const UserCommandPattern &pattern_, UserCommand *replayCommands_, unsigned numReplayCommands_ );
+	~UserCommandGenerator();
+
+	void GenerateRandomWalk( UserCommand *command );
+	void GenerateStrafe( UserCommand *command );
+
+public:
+	/**
+	 * Creates a new generator.
+	 * @param replayCommands Commands that are copied for the REPLAY pattern (a replay of recorded inputs).
+	 * @return A new generator, or null if the pattern is REPLAY and there are no commands, or on allocation failure.
+	 */
+	static UserCommandGenerator *New( const UserCommandPattern &pattern,
+									  const UserCommand *replayCommands = nullptr, unsigned numReplayCommands = 0 );
+	static void Delete( UserCommandGenerator *generator );
+
+	/**
+	 * Produces commands for the next ticks.
+	 */
+	void Generate( UserCommand *commands, unsigned numCommands );
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef LIBQFAKECLIENT_WORLD_STATE_SNAPSHOT_H
+#define LIBQFAKECLIENT_WORLD_STATE_SNAPSHOT_H
+
+#include "common.h"
+
+#include <atomic>
+#include <stdint.h>
+
+class ClientWorldState;
+
+/**
+ * A consistent copy of the world state of a client as of a parsed server message.
+ * Snapshots are filled by {@link WorldStatePublisher::Read()} and are owned by reader threads.
+ * A snapshot keeps its configstrings between reads, so a repeated read copies only changed ones.
+ * Note that a snapshot takes several megabytes, allocate it once per reader thread.
+ */
+class WorldStateSnapshot
+{
+	friend class WorldStatePublisher;
+
+public:
+	// Limits that are large enough for all supported protocols
+	static constexpr unsigned MAX_CONFIGSTRINGS = 4256;
+	static constexpr unsigned MAX_STATS = 64;
+
+private:
+	// Identifies a world state the snapshot has been copied from (zero means there are no valid configstrings)
+	uint32_t sourceId;
+
+	uint64_t version;
+	int64_t lastFrame;
+	uint64_t serverTime;
+
+	int protocol;
+	int playerNum;
+	int spawnCount;
+	bool hasEnteredGame;
+	bool hasStats;
+
+	short stats[MAX_STATS];
+
+	char motd[MAX_STRING_CHARS + 1];
+	char game[MAX_STRING_CHARS + 1];
+	char level[MAX_STRING_CHARS + 1];
+
+	unsigned numConfigStrings;
+	uint32_t configStringVersions[MAX_CONFIGSTRINGS];
+	char configStrings[MAX_CONFIGSTRINGS][MAX_CONFIGSTRING_CHARS];
+
+	WorldStateSnapshot();
+
+	// Copies configstrings that have different versions, or all of them if the snapshot is not valid.
+	// Strings that are longer than MAX_CONFIGSTRING_CHARS - 1 are truncated.
+	void CopyConfigStrings( const char *strings, unsigned stride, const uint32_t *versions, unsigned num, bool copyAll );
+
+public:
+	static WorldStateSnapshot *New();
+	static void Delete( WorldStateSnapshot *snapshot );
+
+	/**
+	 * Returns a number of the publication the snapshot has been copied from (zero if it has not been read yet).
+	 * Readers might compare it to a previously seen value to skip processing of unchanged state.
+	 */
+	uint64_t Version() const { return version; }
+
+	int64_t LastFrame() const { return lastFrame; }
+	uint64_t ServerTime() const { return serverTime; }
+
+	int Protocol() const { return protocol; }
+	int PlayerNum() const { return playerNum; }
+	int SpawnCount() const { return spawnCount; }
+	bool HasEnteredGame() const { return hasEnteredGame; }
+
+	/**
+	 * Returns stats of the own player, or null if the player state has not been present in the last frame.
+	 */
+	const short *Stats() const { return hasStats ? stats : nullptr; }
+
+	const char *Motd() const { return motd; }
+	const char *Game() const { return game; }
+	const char *Level() const { return level; }
+
+	unsigned NumConfigStrings() const { return numConfigStrings; }
+
+	const char *ConfigString( unsigned index ) const {
+		return index < numConfigStrings ? configStrings[index] : nullptr;
+	}
+
+	uint32_t ConfigStringVersion( unsigned index ) const {
+		return index < numConfigStrings ? configStringVersions[index] : 0;
+	}
+};
+
+/**
+ * Publishes the world state of a client for reading by arbitrary threads.
+ * The client thread writes a new snapshot after each parsed message into one of two buffers
+ * (the one that is not published) and then publishes it. Each buffer is guarded by a sequence counter,
+ * so a reader copies the last published buffer and retries only if the writer has lapped it twice meanwhile.
+ * Neither the writer nor readers ever take a lock.
+ */
+class WorldStatePublisher
+{
+	friend class Client;
+	friend class GenericClientProtocolExecutor;
+
+	static constexpr unsigned CACHE_LINE_SIZE = 64;
+
+	struct Buffer {
+		// Odd while the buffer is being written
+		std::atomic<uint64_t> sequence;
+		uint8_t padding[CACHE_LINE_SIZE - sizeof( std::atomic<uint64_t> )];
+		WorldStateSnapshot snapshot;
+	};
+
+	// A version of the last publication, its buffer is `buffers[publishedVersion % 2]`
+	std::atomic<uint64_t> publishedVersion;
+	uint8_t padding[CACHE_LINE_SIZE - sizeof( std::atomic<uint64_t> )];
+
+	Buffer buffers[2];
+
+	// Accessed only by the writer. Configstring versions are comparable only within the same world state.
+	uint32_t sourceId;
+	bool isSourceChanged;
+
+	WorldStatePublisher();
+
+	/**
+	 * Should be called when the client replaces its world state (e.g. on a protocol executor change).
+	 */
+	void OnSourceChanged() { isSourceChanged = true; }
+
+	/**
+	 * Writes a new snapshot of the world state and publishes it. Must be called only by the client thread.
+	 */
+	void Publish( const ClientWorldState &worldState, int64_t lastFrame, uint64_t serverTime, bool hasEnteredGame );
+
+public:
+	static WorldStatePublisher *New();
+	static void Delete( WorldStatePublisher *publisher );
+
+	/**
+	 * Copies the last published snapshot. Might be called from arbitrary threads concurrently.
+	 * @return False if nothing has been published yet.
+	 */
+	bool Read( WorldStateSnapshot *snapshot ) const;
+
+	/**
+	 * Returns a version of the last publication (zero if nothing has been published yet).
+	 * Checking it is cheap, so readers might poll it and call Read() only on a change.
+	 */
+	uint64_t PublishedVersion() const { return publishedVersion.load( std::memory_order_acquire ); }
+};
+
+#endif
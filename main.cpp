@@ -2,6 +2,7 @@
 #include "client.h"
 #include "server_list.h"
 
+#include <new>
 #include <stdio.h>
 
 class TaggedConsole : public Console
@@ -37,13 +38,9 @@ int main( int argc, const char **argv ) {
 	System::Init( globalConsole );
 	System *system = System::Instance();
 
-	UnresolvedAddress master1Address( "188.226.221.185:27950" );
-	assert( master1Address.IsValidAsString() && master1Address.IsResolved() );
-	UnresolvedAddress master2Address( "92.62.40.72:27950" );
-	assert( master2Address.IsValidAsString() && master2Address.IsResolved() );
-
-	assert( system->AddMasterServer( master1Address.ToResolvedAddress() ) );
-	assert( system->AddMasterServer( master2Address.ToResolvedAddress() ) );
+	// Host names are accepted as well, they get resolved in Frame() calls
+	assert( system->AddMasterServer( "188.226.221.185:27950" ) );
+	assert( system->AddMasterServer( "92.62.40.72:27950" ) );
 
 	system->SetServerListUpdateOptions( false, true );
 
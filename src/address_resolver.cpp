@@ -0,0 +1,333 @@
+#include "address_resolver.h"
+#include "allocator.h"
+#include "console.h"
+#include "system.h"
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <netdb.h>
+#include <sys/socket.h>
+#else
+#error There is no Windows-compatible version yet
+#endif
+
+AddressResolver::AddressResolver( System *system_, Console *console_ )
+	: system( system_ ),
+	console( console_ ),
+	firstPendingRequest( nullptr ),
+	lastPendingRequest( nullptr ),
+	firstCompletedRequest( nullptr ),
+	lastCompletedRequest( nullptr ),
+	firstDeliveredRequest( nullptr ),
+	currentRequest( nullptr ),
+	isCurrentRequestCancelled( false ),
+	stopRequested( false ),
+	lookupFunction( &LookupWithGetaddrinfo ),
+	successTtl( 5 * 60 * 1000 ),
+	failureTtl( 10 * 1000 ),
+	lastRequestId( 0 ) {
+	ClearCache();
+	thread = std::thread( &AddressResolver::Run, this );
+}
+
+AddressResolver::~AddressResolver() {
+	{
+		std::lock_guard<std::mutex> lock( mutex );
+		stopRequested = true;
+	}
+	requestAdded.notify_one();
+	// Note that this waits for completion of the current lookup
+	thread.join();
+
+	for( Request *list: { firstPendingRequest, firstCompletedRequest } ) {
+		while( Request *request = list ) {
+			list = request->next;
+			QFree( request );
+		}
+	}
+}
+
+AddressResolver *AddressResolver::New( System *system, Console *console ) {
+	void *mem = QAlloc( sizeof( AddressResolver ) );
+
+	if( !mem ) {
+		console->Printf( "AddressResolver::New(): cannot allocate memory for a resolver\n" );
+		return nullptr;
+	}
+
+	return new(mem)AddressResolver( system, console );
+}
+
+void AddressResolver::Delete( AddressResolver *resolver ) {
+	if( resolver ) {
+		resolver->~AddressResolver();
+		QFree( resolver );
+	}
+}
+
+bool AddressResolver::LookupWithGetaddrinfo( const char *host, NetworkAddress *address ) {
+	addrinfo hints;
+	memset( &hints, 0, sizeof( hints ) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	addrinfo *results;
+
+	if( getaddrinfo( host, nullptr, &hints, &results ) != 0 ) {
+		return false;
+	}
+
+	// Prefer IP v4 addresses as most servers do not listen on IP v6 ones
+	const addrinfo *chosen = nullptr;
+
+	for( const addrinfo *info = results; info; info = info->ai_next ) {
+		if( info->ai_family == AF_INET ) {
+			chosen = info;
+			break;
+		}
+
+		if( info->ai_family == AF_INET6 && !chosen ) {
+			chosen = info;
+		}
+	}
+
+	if( chosen ) {
+		address->Clear();
+		memcpy( address->AsGenericSockaddr(), chosen->ai_addr, chosen->ai_addrlen );
+	}
+
+	freeaddrinfo( results );
+	return chosen != nullptr;
+}
+
+void AddressResolver::SetLookupFunction( LookupFunction lookupFunction_ ) {
+	std::lock_guard<std::mutex> lock( mutex );
+	this->lookupFunction = lookupFunction_ ? lookupFunction_ : &LookupWithGetaddrinfo;
+	ClearCache();
+}
+
+void AddressResolver::ClearCache() {
+	// An entry that has an empty host and has expired is never matched
+	for( CacheEntry &entry: cache ) {
+		entry.expiresAt = 0;
+		entry.succeeded = false;
+		entry.host[0] = '\0';
+	}
+}
+
+const AddressResolver::CacheEntry *AddressResolver::FindInCache( const char *host ) const {
+	const uint64_t millis = system->Millis();
+
+	for( const CacheEntry &entry: cache ) {
+		if( entry.expiresAt > millis && !strcmp( entry.host, host ) ) {
+			return &entry;
+		}
+	}
+
+	return nullptr;
+}
+
+void AddressResolver::AddToCache( const Request *request ) {
+	// Replace an entry of the same host, or an entry that expires first
+	CacheEntry *chosen = &cache[0];
+
+	for( CacheEntry &entry: cache ) {
+		if( !strcmp( entry.host, request->host ) ) {
+			chosen = &entry;
+			break;
+		}
+
+		if( entry.expiresAt < chosen->expiresAt ) {
+			chosen = &entry;
+		}
+	}
+
+	chosen->expiresAt = system->Millis() + ( request->succeeded ? successTtl : failureTtl );
+	chosen->address = request->address;
+	chosen->succeeded = request->succeeded;
+	memcpy( chosen->host, request->host, sizeof( chosen->host ) );
+}
+
+uint32_t AddressResolver::Resolve( const char *host, uint16_t port, void *owner, Callback callback ) {
+	const size_t hostLength = strlen( host );
+
+	if( !hostLength || hostLength >= MAX_HOST_CHARS ) {
+		console->Printf( "AddressResolver::Resolve(): illegal host name length\n" );
+		return 0;
+	}
+
+	Request *request = (Request *)QAlloc( sizeof( Request ) );
+
+	if( !request ) {
+		console->Printf( "AddressResolver::Resolve(): cannot allocate memory for a request\n" );
+		return 0;
+	}
+
+	if( !++lastRequestId ) {
+		lastRequestId = 1;
+	}
+
+	request->next = nullptr;
+	request->owner = owner;
+	request->callback = callback;
+	request->id = lastRequestId;
+	request->port = port;
+	request->succeeded = false;
+	new( &request->address )NetworkAddress();
+	memcpy( request->host, host, hostLength + 1 );
+
+	{
+		std::lock_guard<std::mutex> lock( mutex );
+
+		// Cached results are delivered in the next frame as well, so callers handle a single flow
+		if( const CacheEntry *entry = FindInCache( host ) ) {
+			request->succeeded = entry->succeeded;
+			request->address = entry->address;
+			Complete( request );
+			return request->id;
+		}
+
+		if( lastPendingRequest ) {
+			lastPendingRequest->next = request;
+		} else {
+			firstPendingRequest = request;
+		}
+		lastPendingRequest = request;
+	}
+
+	requestAdded.notify_one();
+	return request->id;
+}
+
+void AddressResolver::Complete( Request *request ) {
+	request->next = nullptr;
+
+	if( lastCompletedRequest ) {
+		lastCompletedRequest->next = request;
+	} else {
+		firstCompletedRequest = request;
+	}
+	lastCompletedRequest = request;
+}
+
+void AddressResolver::CancelRequests( void *owner ) {
+	std::lock_guard<std::mutex> lock( mutex );
+
+	if( currentRequest && currentRequest->owner == owner ) {
+		isCurrentRequestCancelled = true;
+	}
+
+	// These requests are freed in Frame()
+	for( Request *request = firstDeliveredRequest; request; request = request->next ) {
+		if( request->owner == owner ) {
+			request->callback = nullptr;
+		}
+	}
+
+	Request **lists[] = { &firstPendingRequest, &firstCompletedRequest };
+	Request **lastRequests[] = { &lastPendingRequest, &lastCompletedRequest };
+
+	for( unsigned i = 0; i < 2; ++i ) {
+		Request **link = lists[i];
+		Request *prev = nullptr;
+
+		while( Request *request = *link ) {
+			if( request->owner != owner ) {
+				prev = request;
+				link = &request->next;
+				continue;
+			}
+
+			*link = request->next;
+			QFree( request );
+		}
+
+		*lastRequests[i] = prev;
+	}
+}
+
+void AddressResolver::Run() {
+	for(;; ) {
+		Request *request;
+		LookupFunction lookup;
+
+		{
+			std::unique_lock<std::mutex> lock( mutex );
+			requestAdded.wait( lock, [this]() { return firstPendingRequest || stopRequested; } );
+
+			if( stopRequested ) {
+				return;
+			}
+
+			request = firstPendingRequest;
+			firstPendingRequest = request->next;
+
+			if( !firstPendingRequest ) {
+				lastPendingRequest = nullptr;
+			}
+
+			currentRequest = request;
+			isCurrentRequestCancelled = false;
+			lookup = lookupFunction;
+		}
+
+		NetworkAddress address;
+		const bool succeeded = lookup( request->host, &address );
+
+		std::lock_guard<std::mutex> lock( mutex );
+		currentRequest = nullptr;
+
+		if( isCurrentRequestCancelled ) {
+			QFree( request );
+			continue;
+		}
+
+		request->succeeded = succeeded;
+		request->address = address;
+		Complete( request );
+	}
+}
+
+void AddressResolver::Frame() {
+	std::unique_lock<std::mutex> lock( mutex );
+
+	if( !firstCompletedRequest ) {
+		return;
+	}
+
+	firstDeliveredRequest = firstCompletedRequest;
+	firstCompletedRequest = nullptr;
+	lastCompletedRequest = nullptr;
+
+	for( const Request *request = firstDeliveredRequest; request; request = request->next ) {
+		if( !FindInCache( request->host ) ) {
+			AddToCache( request );
+		}
+	}
+
+	while( Request *request = firstDeliveredRequest ) {
+		firstDeliveredRequest = request->next;
+		const Callback callback = request->callback;
+
+		if( callback ) {
+			// Callbacks are allowed to call the resolver
+			lock.unlock();
+
+			if( request->succeeded ) {
+				NetworkAddress address( request->address );
+				// The port is at the same offset for both families
+				address.u.in4.sin_port = htons( request->port );
+				callback( request->owner, request->id, &address );
+			} else {
+				callback( request->owner, request->id, nullptr );
+			}
+
+			lock.lock();
+		}
+
+		QFree( request );
+	}
+}
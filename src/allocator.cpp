@@ -0,0 +1,291 @@
+#include "allocator.h"
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#else
+#error There is no Windows-compatible version yet
+#endif
+
+static Allocator *globalAllocator = nullptr;
+
+void SetGlobalAllocator( Allocator *allocator ) {
+	globalAllocator = allocator;
+}
+
+void *QAlloc( size_t size ) {
+	if( globalAllocator ) {
+		return globalAllocator->Alloc( size );
+	}
+	return malloc( size );
+}
+
+void QFree( void *p ) {
+	if( globalAllocator ) {
+		globalAllocator->Free( p );
+	} else {
+		free( p );
+	}
+}
+
+ArenaSettings::ArenaSettings() {
+	// The range is only reserved, so it costs nothing until it is used
+	reservedBytes = (size_t)1 << 30;
+	useHugePages = true;
+	prefault = false;
+}
+
+ArenaAllocator::ArenaAllocator( uint8_t *base_, size_t reservedBytes, uint32_t *unitInfo_, bool hasExplicitHugePages )
+	: base( base_ ),
+	numUnits( reservedBytes / UNIT_SIZE ),
+	numCarvedUnits( 0 ),
+	unitInfo( unitInfo_ ),
+	freeRuns( nullptr ) {
+	memset( freeBlocks, 0, sizeof( freeBlocks ) );
+
+	stats.reservedBytes = reservedBytes;
+	stats.carvedBytes = 0;
+	stats.allocatedBytes = 0;
+	stats.fallbackAllocations = 0;
+	stats.hasExplicitHugePages = hasExplicitHugePages;
+}
+
+ArenaAllocator::~ArenaAllocator() {
+	munmap( base, numUnits * UNIT_SIZE );
+	free( unitInfo );
+}
+
+// Maps an anonymous range that is aligned on a huge page boundary (so transparent huge pages might back it)
+static uint8_t *MapAlignedRange( size_t size, size_t alignment ) {
+	const int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+	void *mapping = mmap( nullptr, size + alignment, PROT_READ | PROT_WRITE, flags, -1, 0 );
+
+	if( mapping == MAP_FAILED ) {
+		return nullptr;
+	}
+
+	uint8_t *const mappingStart = (uint8_t *)mapping;
+	uint8_t *const mappingEnd = mappingStart + size + alignment;
+	uint8_t *const start = (uint8_t *)( ( (uintptr_t)mappingStart + alignment - 1 ) & ~( (uintptr_t)alignment - 1 ) );
+
+	// Trim the excess
+	if( start != mappingStart ) {
+		munmap( mappingStart, start - mappingStart );
+	}
+	if( start + size != mappingEnd ) {
+		munmap( start + size, mappingEnd - ( start + size ) );
+	}
+
+	return start;
+}
+
+ArenaAllocator *ArenaAllocator::New( const ArenaSettings &settings ) {
+	const size_t reservedBytes = ( settings.reservedBytes + HUGE_PAGE_SIZE - 1 ) & ~( HUGE_PAGE_SIZE - 1 );
+
+	if( !reservedBytes || reservedBytes / UNIT_SIZE >= SMALL_UNIT_BIT ) {
+		return nullptr;
+	}
+
+	uint8_t *base = nullptr;
+	bool hasExplicitHugePages = false;
+
+#ifdef MAP_HUGETLB
+	if( settings.useHugePages ) {
+		// Huge pages are reserved by the call, so it fails early if there are not enough free ones
+		void *mapping = mmap( nullptr, reservedBytes, PROT_READ | PROT_WRITE,
+							  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+		if( mapping != MAP_FAILED ) {
+			base = (uint8_t *)mapping;
+			hasExplicitHugePages = true;
+		}
+	}
+#endif
+
+	if( !base ) {
+		if( !( base = MapAlignedRange( reservedBytes, HUGE_PAGE_SIZE ) ) ) {
+			return nullptr;
+		}
+#ifdef MADV_HUGEPAGE
+		if( settings.useHugePages ) {
+			madvise( base, reservedBytes, MADV_HUGEPAGE );
+		}
+#endif
+	}
+
+	if( settings.prefault ) {
+		for( size_t offset = 0; offset < reservedBytes; offset += 4096 ) {
+			base[offset] = 0;
+		}
+	}
+
+	void *mem = malloc( sizeof( ArenaAllocator ) );
+	auto *unitInfo = (uint32_t *)malloc( ( reservedBytes / UNIT_SIZE ) * sizeof( uint32_t ) );
+
+	if( !mem || !unitInfo ) {
+		munmap( base, reservedBytes );
+		free( mem );
+		free( unitInfo );
+		return nullptr;
+	}
+
+	return new(mem)ArenaAllocator( base, reservedBytes, unitInfo, hasExplicitHugePages );
+}
+
+void ArenaAllocator::Delete( ArenaAllocator *allocator ) {
+	if( allocator ) {
+		allocator->~ArenaAllocator();
+		free( allocator );
+	}
+}
+
+unsigned ArenaAllocator::SizeClassFor( size_t size ) {
+	if( size <= ( (size_t)1 << MIN_BLOCK_SIZE_LOG2 ) ) {
+		return 0;
+	}
+
+	// A ceiling of log2 of the size
+	const unsigned log2 = 64 - (unsigned)__builtin_clzll( (unsigned long long)( size - 1 ) );
+	return log2 - MIN_BLOCK_SIZE_LOG2;
+}
+
+void *ArenaAllocator::AllocRun( size_t numUnitsToAlloc ) {
+	// Find the best fit among released runs
+	FreeRun **bestLink = nullptr;
+
+	for( FreeRun **link = &freeRuns; *link; link = &( *link )->next ) {
+		const size_t runUnits = ( *link )->numUnits;
+
+		if( runUnits >= numUnitsToAlloc && ( !bestLink || runUnits < ( *bestLink )->numUnits ) ) {
+			bestLink = link;
+			if( runUnits == numUnitsToAlloc ) {
+				break;
+			}
+		}
+	}
+
+	uint8_t *run;
+
+	if( bestLink ) {
+		FreeRun *freeRun = *bestLink;
+		*bestLink = freeRun->next;
+		run = (uint8_t *)freeRun;
+
+		if( freeRun->numUnits > numUnitsToAlloc ) {
+			auto *tail = (FreeRun *)( run + numUnitsToAlloc * UNIT_SIZE );
+			tail->numUnits = freeRun->numUnits - numUnitsToAlloc;
+			tail->next = freeRuns;
+			freeRuns = tail;
+		}
+	} else {
+		if( numUnits - numCarvedUnits < numUnitsToAlloc ) {
+			return nullptr;
+		}
+
+		run = base + numCarvedUnits * UNIT_SIZE;
+		numCarvedUnits += numUnitsToAlloc;
+
+		if( numCarvedUnits * UNIT_SIZE > stats.carvedBytes ) {
+			stats.carvedBytes = numCarvedUnits * UNIT_SIZE;
+		}
+	}
+
+	unitInfo[( run - base ) / UNIT_SIZE] = (uint32_t)numUnitsToAlloc;
+	stats.allocatedBytes += numUnitsToAlloc * UNIT_SIZE;
+	return run;
+}
+
+void ArenaAllocator::ReleaseRun( size_t firstUnit ) {
+	const size_t runUnits = unitInfo[firstUnit];
+	stats.allocatedBytes -= runUnits * UNIT_SIZE;
+
+	// Released runs are always below the carved boundary, so the boundary might be moved back safely
+	if( firstUnit + runUnits == numCarvedUnits ) {
+		numCarvedUnits = firstUnit;
+		return;
+	}
+
+	auto *run = (FreeRun *)( base + firstUnit * UNIT_SIZE );
+	run->numUnits = runUnits;
+	run->next = freeRuns;
+	freeRuns = run;
+}
+
+void *ArenaAllocator::AllocSmallBlock( unsigned sizeClass ) {
+	const size_t blockSize = (size_t)1 << ( sizeClass + MIN_BLOCK_SIZE_LOG2 );
+
+	if( !freeBlocks[sizeClass] ) {
+		auto *unit = (uint8_t *)AllocRun( 1 );
+
+		if( !unit ) {
+			return nullptr;
+		}
+
+		// Blocks of the unit are accounted individually
+		unitInfo[( unit - base ) / UNIT_SIZE] = SMALL_UNIT_BIT | sizeClass;
+		stats.allocatedBytes -= UNIT_SIZE;
+
+		// Link blocks so they are taken in the address order
+		for( size_t offset = UNIT_SIZE; offset; ) {
+			offset -= blockSize;
+			auto *block = (FreeBlock *)( unit + offset );
+			block->next = freeBlocks[sizeClass];
+			freeBlocks[sizeClass] = block;
+		}
+	}
+
+	FreeBlock *block = freeBlocks[sizeClass];
+	freeBlocks[sizeClass] = block->next;
+	stats.allocatedBytes += blockSize;
+	return block;
+}
+
+void *ArenaAllocator::Alloc( size_t size ) {
+	std::lock_guard<std::mutex> lock( mutex );
+
+	void *p;
+	if( size <= MAX_SMALL_BLOCK_SIZE ) {
+		p = AllocSmallBlock( SizeClassFor( size ) );
+	} else {
+		p = AllocRun( ( size + UNIT_SIZE - 1 ) / UNIT_SIZE );
+	}
+
+	if( p ) {
+		return p;
+	}
+
+	stats.fallbackAllocations++;
+	return malloc( size );
+}
+
+void ArenaAllocator::Free( void *p ) {
+	auto *bytes = (uint8_t *)p;
+
+	// Blocks that have been allocated by malloc() on the range exhaustion (or a null pointer)
+	if( bytes < base || bytes >= base + numUnits * UNIT_SIZE ) {
+		free( p );
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock( mutex );
+
+	const size_t unit = (size_t)( bytes - base ) / UNIT_SIZE;
+	const uint32_t info = unitInfo[unit];
+
+	if( info & SMALL_UNIT_BIT ) {
+		const unsigned sizeClass = info & ~SMALL_UNIT_BIT;
+		auto *block = (FreeBlock *)bytes;
+		block->next = freeBlocks[sizeClass];
+		freeBlocks[sizeClass] = block;
+		stats.allocatedBytes -= (size_t)1 << ( sizeClass + MIN_BLOCK_SIZE_LOG2 );
+	} else {
+		ReleaseRun( unit );
+	}
+}
+
+ArenaAllocator::Stats ArenaAllocator::GetStats() {
+	std::lock_guard<std::mutex> lock( mutex );
+	return stats;
+}
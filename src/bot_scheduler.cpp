@@ -0,0 +1,427 @@
+#include "bot_scheduler.h"
+#include "allocator.h"
+#include "client.h"
+#include "command_parser.h"
+#include "console.h"
+#include "system.h"
+
+#include <algorithm>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+BotScript::BotScript() {
+	joinCommand[0] = '\0';
+	QStrncpyz( chatText, "Hello", MAX_CHAT_CHARS );
+	chatMessagesPerMinute = 0.0f;
+	chatJitter = 0.0f;
+	startSpread = 0;
+	connectTimeout = 10000;
+	sessionDuration = 0;
+	reconnectDelay = 3000;
+	maxReconnects = 0;
+	idleInterval = 0;
+	idleDuration = 0;
+}
+
+static bool ParseUnsigned( const char *value, unsigned *result ) {
+	char *endptr;
+	unsigned long parsed = strtoul( value, &endptr, 10 );
+
+	if( !*value || *endptr || parsed > ~0u ) {
+		return false;
+	}
+
+	*result = (unsigned)parsed;
+	return true;
+}
+
+static bool ParseFloat( const char *value, float min, float max, float *result ) {
+	char *endptr;
+	float parsed = strtof( value, &endptr );
+
+	if( !*value || *endptr || !( parsed >= min && parsed <= max ) ) {
+		return false;
+	}
+
+	*result = parsed;
+	return true;
+}
+
+bool BotScript::Parse( const char *text, Console *console ) {
+	CommandParser parser( text );
+	char key[32];
+
+	// The whole text is a single "command", tokens are read sequentially from its name on
+	const char *token = parser.GetCommand();
+
+	for(; token; token = parser.GetArg() ) {
+		if( !*token ) {
+			continue;
+		}
+
+		const char *separator = strchr( token, '=' );
+
+		if( !separator || separator == token || (size_t)( separator - token ) >= sizeof( key ) ) {
+			console->Printf( "BotScript::Parse(): illegal token `%s`\n", token );
+			return false;
+		}
+
+		memcpy( key, token, separator - token );
+		key[separator - token] = '\0';
+
+		const char *value = separator + 1;
+
+		// A quoted value is a separate token
+		if( !*value ) {
+			if( !( value = parser.GetArg() ) ) {
+				console->Printf( "BotScript::Parse(): a value of `%s` is missing\n", key );
+				return false;
+			}
+		}
+
+		bool ok = true;
+
+		if( !strcmp( key, "join" ) ) {
+			QStrncpyz( joinCommand, value, MAX_COMMAND_CHARS );
+		} else if( !strcmp( key, "chat" ) ) {
+			QStrncpyz( chatText, value, MAX_CHAT_CHARS );
+		} else if( !strcmp( key, "chat_rate" ) ) {
+			ok = ParseFloat( value, 0.0f, 60000.0f, &chatMessagesPerMinute );
+		} else if( !strcmp( key, "chat_jitter" ) ) {
+			ok = ParseFloat( value, 0.0f, 1.0f, &chatJitter );
+		} else if( !strcmp( key, "start_spread" ) ) {
+			ok = ParseUnsigned( value, &startSpread );
+		} else if( !strcmp( key, "connect_timeout" ) ) {
+			ok = ParseUnsigned( value, &connectTimeout );
+		} else if( !strcmp( key, "session" ) ) {
+			ok = ParseUnsigned( value, &sessionDuration );
+		} else if( !strcmp( key, "reconnect_delay" ) ) {
+			ok = ParseUnsigned( value, &reconnectDelay );
+		} else if( !strcmp( key, "reconnects" ) ) {
+			if( !strcmp( value, "unlimited" ) ) {
+				maxReconnects = UNLIMITED;
+			} else {
+				ok = ParseUnsigned( value, &maxReconnects );
+			}
+		} else if( !strcmp( key, "idle_interval" ) ) {
+			ok = ParseUnsigned( value, &idleInterval );
+		} else if( !strcmp( key, "idle" ) ) {
+			ok = ParseUnsigned( value, &idleDuration );
+		} else {
+			console->Printf( "BotScript::Parse(): unknown key `%s`\n", key );
+			return false;
+		}
+
+		if( !ok ) {
+			console->Printf( "BotScript::Parse(): illegal value `%s` of `%s`\n", value, key );
+			return false;
+		}
+	}
+
+	return true;
+}
+
+BotScheduler::BotScheduler( System *system_, Console *console_, Bot *bots_, TimerEntry *timers_,
+							unsigned maxBots_, uint64_t seed_ )
+	: system( system_ ),
+	console( console_ ),
+	bots( bots_ ),
+	numBots( 0 ),
+	maxBots( maxBots_ ),
+	timers( timers_ ),
+	numTimers( 0 ),
+	seed( seed_ ) {
+	memset( &stats, 0, sizeof( stats ) );
+}
+
+BotScheduler::~BotScheduler() {
+	for( unsigned i = 0; i < numBots; ++i ) {
+		system->DeleteClient( bots[i].client );
+	}
+
+	QFree( bots );
+	QFree( timers );
+}
+
+BotScheduler *BotScheduler::New( System *system, Console *console, unsigned maxBots, uint64_t seed ) {
+	void *mem = QAlloc( sizeof( BotScheduler ) );
+	Bot *bots = (Bot *)QAlloc( maxBots * sizeof( Bot ) );
+	TimerEntry *timers = (TimerEntry *)QAlloc( maxBots * sizeof( TimerEntry ) );
+
+	if( !mem || !bots || !timers ) {
+		console->Printf( "BotScheduler::New(): cannot allocate memory for %u bots\n", maxBots );
+		QFree( mem );
+		QFree( bots );
+		QFree( timers );
+		return nullptr;
+	}
+
+	return new(mem)BotScheduler( system, console, bots, timers, maxBots, seed );
+}
+
+void BotScheduler::Delete( BotScheduler *scheduler ) {
+	if( scheduler ) {
+		scheduler->~BotScheduler();
+		QFree( scheduler );
+	}
+}
+
+void BotScheduler::PushTimer( uint64_t dueAt, unsigned botIndex ) {
+	unsigned index = numTimers++;
+
+	while( index ) {
+		unsigned parent = ( index - 1 ) / 2;
+
+		if( timers[parent].dueAt <= dueAt ) {
+			break;
+		}
+
+		timers[index] = timers[parent];
+		index = parent;
+	}
+
+	timers[index].dueAt = dueAt;
+	timers[index].botIndex = botIndex;
+}
+
+void BotScheduler::PopTimer() {
+	const TimerEntry last = timers[--numTimers];
+	unsigned index = 0;
+
+	for(;; ) {
+		unsigned child = 2 * index + 1;
+
+		if( child >= numTimers ) {
+			break;
+		}
+
+		if( child + 1 < numTimers && timers[child + 1].dueAt < timers[child].dueAt ) {
+			child++;
+		}
+
+		if( last.dueAt <= timers[child].dueAt ) {
+			break;
+		}
+
+		timers[index] = timers[child];
+		index = child;
+	}
+
+	timers[index] = last;
+}
+
+uint64_t BotScheduler::NextChatInterval( Bot *bot ) {
+	double interval = 60000.0 / bot->script.chatMessagesPerMinute;
+	// Deviate symmetrically, so the mean rate stays the same
+	interval *= 1.0 + bot->script.chatJitter * ( 2.0 * NextRandomFraction( &bot->randomState ) - 1.0 );
+	return interval > 1.0 ? (uint64_t)interval : 1;
+}
+
+void BotScheduler::SetState( Bot *bot, BotState state ) {
+	unsigned *counters[] = {
+		&stats.numWaiting, &stats.numConnecting, &stats.numActive, &stats.numIdle, &stats.numFinished
+	};
+
+	( *counters[bot->state] )--;
+	( *counters[state] )++;
+	bot->state = state;
+}
+
+int BotScheduler::AddBot( Console *botConsole, const char *name, const char *address, const BotScript &script ) {
+	system->CheckThread( "BotScheduler::AddBot()" );
+
+	if( numBots == maxBots ) {
+		console->Printf( "BotScheduler::AddBot(): too many bots\n" );
+		botConsole->~Console();
+		free( botConsole );
+		return -1;
+	}
+
+	if( strlen( address ) >= MAX_ADDRESS_CHARS ) {
+		console->Printf( "BotScheduler::AddBot(): the address `%s` is too long\n", address );
+		botConsole->~Console();
+		free( botConsole );
+		return -1;
+	}
+
+	Client *client = system->NewClient( botConsole );
+
+	if( !client ) {
+		console->Printf( "BotScheduler::AddBot(): cannot create a client (the limit is %u)\n", MAX_FAKE_CLIENT_INSTANCES );
+		botConsole->~Console();
+		free( botConsole );
+		return -1;
+	}
+
+	client->SetName( name );
+
+	const unsigned index = numBots++;
+	Bot *bot = &bots[index];
+	bot->client = client;
+	bot->script = script;
+	QStrncpyz( bot->address, address, MAX_ADDRESS_CHARS );
+	// Derive a generator state from the seed and the bot index, so choices of a bot do not depend on other bots
+	bot->randomState = seed ^ ( (uint64_t)index * 0xD1B54A32D192ED03ull );
+	bot->phaseEndsAt = 0;
+	bot->nextChatAt = 0;
+	bot->nextIdleAt = 0;
+	bot->numReconnects = 0;
+	bot->numChatMessages = 0;
+	bot->state = BOT_WAITING;
+	stats.numWaiting++;
+
+	uint64_t startAt = system->Millis();
+
+	if( script.startSpread ) {
+		startAt += NextRandom64( &bot->randomState ) % script.startSpread;
+	}
+
+	PushTimer( startAt, index );
+	return (int)index;
+}
+
+void BotScheduler::Frame() {
+	const uint64_t now = system->Millis();
+
+	while( numTimers && timers[0].dueAt <= now ) {
+		const unsigned botIndex = timers[0].botIndex;
+		PopTimer();
+
+		if( uint64_t nextWakeupAt = RunBot( &bots[botIndex], now ) ) {
+			PushTimer( nextWakeupAt, botIndex );
+		}
+	}
+}
+
+uint64_t BotScheduler::RunBot( Bot *bot, uint64_t now ) {
+	switch( bot->state ) {
+		case BOT_WAITING:
+			return StartConnecting( bot, now );
+
+		case BOT_CONNECTING:
+			if( bot->client->HasEnteredGame() ) {
+				stats.connectionsEstablished++;
+
+				if( bot->script.joinCommand[0] ) {
+					bot->client->SendGameCommand( bot->script.joinCommand );
+					stats.joinCommands++;
+				}
+
+				SetState( bot, BOT_ACTIVE );
+				bot->phaseEndsAt = bot->script.sessionDuration ? now + bot->script.sessionDuration : 0;
+				bot->nextChatAt = bot->script.chatMessagesPerMinute > 0 ? now + NextChatInterval( bot ) : 0;
+				bot->nextIdleAt = bot->script.idleInterval && bot->script.idleDuration ? now + bot->script.idleInterval : 0;
+				return RunActiveBot( bot, now );
+			}
+
+			if( now >= bot->phaseEndsAt ) {
+				stats.connectTimeouts++;
+				bot->client->ExecuteCommand( "disconnect" );
+				return ScheduleReconnection( bot, now );
+			}
+
+			return std::min( now + STATE_CHECK_INTERVAL, bot->phaseEndsAt );
+
+		case BOT_ACTIVE:
+		case BOT_IDLE:
+			if( !bot->client->HasEnteredGame() ) {
+				stats.droppedConnections++;
+				bot->client->ExecuteCommand( "disconnect" );
+				return ScheduleReconnection( bot, now );
+			}
+
+			if( bot->phaseEndsAt && now >= bot->phaseEndsAt ) {
+				stats.scriptedDisconnects++;
+				bot->client->ExecuteCommand( "disconnect" );
+				return ScheduleReconnection( bot, now );
+			}
+
+			return RunActiveBot( bot, now );
+
+		default:
+			return 0;
+	}
+}
+
+uint64_t BotScheduler::StartConnecting( Bot *bot, uint64_t now ) {
+	char command[MAX_ADDRESS_CHARS + 16];
+	snprintf( command, sizeof( command ), "connect \"%s\"", bot->address );
+
+	stats.connectAttempts++;
+	bot->client->ExecuteCommand( command );
+
+	SetState( bot, BOT_CONNECTING );
+	bot->phaseEndsAt = now + bot->script.connectTimeout;
+	return std::min( now + STATE_CHECK_INTERVAL, bot->phaseEndsAt );
+}
+
+uint64_t BotScheduler::ScheduleReconnection( Bot *bot, uint64_t now ) {
+	if( bot->script.maxReconnects != BotScript::UNLIMITED && bot->numReconnects >= bot->script.maxReconnects ) {
+		SetState( bot, BOT_FINISHED );
+		return 0;
+	}
+
+	bot->numReconnects++;
+	SetState( bot, BOT_WAITING );
+	// Never return a zero that means "finished"
+	return now + bot->script.reconnectDelay + 1;
+}
+
+uint64_t BotScheduler::RunActiveBot( Bot *bot, uint64_t now ) {
+	// An idle bot keeps an end of the idle period in nextIdleAt
+	if( bot->nextIdleAt && now >= bot->nextIdleAt ) {
+		if( bot->state == BOT_ACTIVE ) {
+			SetState( bot, BOT_IDLE );
+			stats.idlePeriods++;
+			// The next moment of interest is the idle period end
+			bot->nextIdleAt = now + bot->script.idleDuration;
+		} else {
+			SetState( bot, BOT_ACTIVE );
+			bot->nextIdleAt = now + bot->script.idleInterval;
+			// Do not send accumulated messages at once
+			if( bot->nextChatAt ) {
+				bot->nextChatAt = now + NextChatInterval( bot );
+			}
+		}
+	}
+
+	if( bot->state == BOT_ACTIVE && bot->nextChatAt && now >= bot->nextChatAt ) {
+		// Quotes cannot be escaped in game commands, and a quote in the text would terminate the quoted argument
+		char text[BotScript::MAX_CHAT_CHARS];
+		unsigned textLen = 0;
+		for( const char *s = bot->script.chatText; *s && textLen < sizeof( text ) - 1; ++s ) {
+			if( *s != '"' ) {
+				text[textLen++] = *s;
+			}
+		}
+		text[textLen] = '\0';
+
+		char command[BotScript::MAX_CHAT_CHARS + 32];
+		snprintf( command, sizeof( command ), "say \"%s #%u\"", text, ++bot->numChatMessages );
+		bot->client->SendGameCommand( command );
+		stats.chatMessages++;
+
+		// Schedule relatively to the planned moment and not to the actual one, so frame delays do not affect the rate.
+		// A bot that has fallen behind for more than an interval does not try to catch up.
+		const uint64_t interval = NextChatInterval( bot );
+		bot->nextChatAt = bot->nextChatAt + interval > now ? bot->nextChatAt + interval : now + interval;
+	}
+
+	uint64_t wakeupAt = now + STATE_CHECK_INTERVAL;
+
+	if( bot->phaseEndsAt ) {
+		wakeupAt = std::min( wakeupAt, bot->phaseEndsAt );
+	}
+
+	if( bot->nextIdleAt ) {
+		wakeupAt = std::min( wakeupAt, bot->nextIdleAt );
+	}
+
+	if( bot->state == BOT_ACTIVE && bot->nextChatAt ) {
+		wakeupAt = std::min( wakeupAt, bot->nextChatAt );
+	}
+
+	return wakeupAt;
+}
@@ -171,6 +171,7 @@ void Message::WriteInt3( int c ) {
 		buffer[currSize + 0] = (uint8_t)( c & 0xFF );
 		buffer[currSize + 1] = (uint8_t)( ( c >> 8 ) & 0xFF );
 		buffer[currSize + 2] = (uint8_t)( ( c >> 16 ) & 0xFF );
+		currSize += 3;
 	} else {
 		console->Printf( "Message::WriteInt3(): buffer overflow\n" );
 		abort();
@@ -199,7 +200,7 @@ void Message::WriteFloat( float f ) {
 
 void Message::WriteData( const void *buffer, unsigned length ) {
 	if( currSize + length <= maxSize ) {
-		memcpy( this->buffer, buffer, length );
+		memcpy( this->buffer + currSize, buffer, length );
 		currSize += length;
 	} else {
 		console->Printf( "Message::WriteData(): buffer overflow on an attempt to write %d bytes\n", length );
@@ -269,7 +270,8 @@ Message &Channel::PrepareNonSequencedOutgoingMessage() {
 }
 
 bool Channel::PrepareForAddress( const NetworkAddress &address ) {
-	if( address == currServerAddress ) {
+	// The socket is released on disconnection, so a reconnection to the same address must prepare it again
+	if( socket && address == currServerAddress ) {
 		console->Printf( "Channel::PrepareSocket(): already using the address\n" );
 		return true;
 	}
@@ -295,7 +297,7 @@ bool Channel::PrepareSocket( const NetworkAddress &address ) {
 	if( socket ) {
 		if( socket->IsIpV4Socket() ^ address.IsIpV4Address() ) {
 			system->DeleteSocket( socket );
-			socket = system->NewSocket( socket->IsIpV4Socket() );
+			socket = system->NewSocket( address.IsIpV4Address() );
 		}
 	} else {
 		socket = system->NewSocket( address.IsIpV4Address() );
@@ -354,6 +356,16 @@ void Channel::Receive( const NetworkAddress &from, const uint8_t *data, unsigned
 	}
 
 	ingoingMessage.Clear();
+
+	// The data is received to the message buffer directly unless it is supplied by an external source
+	if( data != ingoingMessage.buffer ) {
+		if( dataSize > sizeof( ingoingMessage.buffer ) ) {
+			console->Printf( "Channel::Receive(): the data size %d exceeds the message buffer size\n", dataSize );
+			return;
+		}
+		memcpy( ingoingMessage.buffer, data, dataSize );
+	}
+
 	ingoingMessage.currSize = dataSize;
 
 	int sequenceNum = ingoingMessage.ReadLong();
@@ -389,6 +401,11 @@ void Channel::Receive( const NetworkAddress &from, const uint8_t *data, unsigned
 		int fragmentStart = ingoingMessage.ReadShort();
 		int fragmentLength = ingoingMessage.ReadShort();
 
+		// A first fragment of a new message
+		if( !fragmentStart ) {
+			totalFragmentSize = 0;
+		}
+
 		// Discard a packet if a fragment has arrived out of order
 		if( fragmentStart != totalFragmentSize ) {
 			ingoingMessage.Clear();
@@ -400,6 +417,13 @@ void Channel::Receive( const NetworkAddress &from, const uint8_t *data, unsigned
 			fragmentLength &= ~FRAGMENT_LAST;
 			last = true;
 		}
+
+		if( fragmentLength > (int)ingoingMessage.BytesLeft() || totalFragmentSize + fragmentLength > (int)MAX_MSGLEN ) {
+			console->Printf( "Channel::Receive(): illegal fragment length %d\n", fragmentLength );
+			ingoingMessage.Clear();
+			totalFragmentSize = 0;
+			return;
+		}
 		memcpy( fragmentBuffer + totalFragmentSize, ingoingMessage.Buffer() + ingoingMessage.ReadCount(), (unsigned)fragmentLength );
 		totalFragmentSize += fragmentLength;
 
@@ -410,6 +434,7 @@ void Channel::Receive( const NetworkAddress &from, const uint8_t *data, unsigned
 		memcpy( ingoingMessage.buffer, fragmentBuffer, (unsigned)totalFragmentSize );
 		ingoingMessage.readCount = 0;
 		ingoingMessage.currSize = (unsigned)totalFragmentSize;
+		totalFragmentSize = 0;
 	}
 
 	unsigned bytesLeft = ingoingMessage.currSize - ingoingMessage.readCount;
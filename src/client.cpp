@@ -1,10 +1,21 @@
 #include "client.h"
 
+#include <stdarg.h>
+#include <stdio.h>
+
 Client::Client( Console *console_, System *system_ )
 	: console( console_ ),
 	system( system_ ),
 	listener( nullptr ),
 	protocolExecutor( nullptr ),
+	eventStream( nullptr ),
+	eventStreamClientId( 0 ),
+	userCommandGenerator( nullptr ),
+	serverCommandObserverOwner( nullptr ),
+	serverCommandObserver( nullptr ),
+	worldStatePublisher( nullptr ),
+	offline( false ),
+	systemSlot( -1 ),
 	oldProtocolVersion( PROTOCOL21 ),
 	protocolVersion( PROTOCOL21 ) {
 	name[0] = 0;
@@ -19,6 +30,9 @@ Client::~Client() {
 		free( listener );
 	}
 
+	UserCommandGenerator::Delete( userCommandGenerator );
+	WorldStatePublisher::Delete( worldStatePublisher );
+
 	if( console ) {
 		console->~Console();
 		free( console );
@@ -30,8 +44,14 @@ void Client::Reset() {
 
 	if( protocolExecutor ) {
 		DetachExecutor();
-		GenericClientProtocolExecutor::Delete( protocolExecutor );
+		// Offline clients are not bound to the System thread, so their executors are not pooled
+		if( offline ) {
+			GenericClientProtocolExecutor::Delete( protocolExecutor );
+		} else {
+			system->ReleaseExecutor( protocolExecutor );
+		}
 		protocolExecutor = nullptr;
+		UpdateFrameSchedule( GenericClientProtocolExecutor::CA_DISCONNECTED, std::numeric_limits<uint64_t>::max() );
 	}
 
 	oldProtocolVersion = protocolVersion;
@@ -39,15 +59,35 @@ void Client::Reset() {
 }
 
 void Client::CheckThread( const char *function ) {
+	if( offline ) {
+		return;
+	}
+
 	this->system->CheckThread( function );
 }
 
 void Client::Frame() {
 	CheckThread( "Client::Frame()" );
 
+	if( !protocolExecutor ) {
+		return;
+	}
+
+	protocolExecutor->Frame();
+
+	// The frame might have reset the client
 	if( protocolExecutor ) {
-		protocolExecutor->Frame();
+		UpdateFrameSchedule( protocolExecutor->clientState, protocolExecutor->NextFrameAt() );
+	}
+}
+
+void Client::UpdateFrameSchedule( int state, uint64_t frameDeadline ) {
+	if( systemSlot < 0 ) {
+		return;
 	}
+
+	system->clientStates[systemSlot] = (uint8_t)state;
+	system->clientFrameDeadlines[systemSlot] = frameDeadline;
 }
 
 void Client::DetachExecutor() {
@@ -58,7 +98,11 @@ bool Client::CheckExecutor() {
 		return true;
 	}
 
-	protocolExecutor = GenericClientProtocolExecutor::New( console, this, system, protocolVersion );
+	if( offline ) {
+		protocolExecutor = GenericClientProtocolExecutor::New( console, this, system, protocolVersion );
+	} else {
+		protocolExecutor = system->AcquireExecutor( this, protocolVersion );
+	}
 
 	if( !protocolExecutor ) {
 		return false;
@@ -71,6 +115,11 @@ bool Client::CheckExecutor() {
 void Client::AttachExecutor() {
 	protocolExecutor->SetName( this->name );
 	protocolExecutor->SetPassword( this->password );
+
+	// The executor has its own world state
+	if( worldStatePublisher ) {
+		worldStatePublisher->OnSourceChanged();
+	}
 }
 
 void Client::ExecuteCommand( const char *command ) {
@@ -81,8 +130,84 @@ void Client::ExecuteCommand( const char *command ) {
 	}
 }
 
-void Client::PrintMissingListenerWarning( const char *function ) {
+void Client::SetUserCommandGenerator( UserCommandGenerator *generator_ ) {
+	UserCommandGenerator::Delete( this->userCommandGenerator );
+	this->userCommandGenerator = generator_;
+}
+
+void Client::UserCommandsFrame( unsigned numTicks, unsigned tickMillis ) {
+	if( !userCommandGenerator || !protocolExecutor || !HasEnteredGame() ) {
+		return;
+	}
+
+	UserCommand commands[MAX_USER_COMMANDS_IN_MOVE];
+	userCommandGenerator->Generate( commands, numTicks );
+	protocolExecutor->SendUserCommands( commands, numTicks, tickMillis );
+}
+
+WorldStatePublisher *Client::EnableWorldStatePublication() {
+	CheckThread( "Client::EnableWorldStatePublication()" );
+
+	if( !worldStatePublisher ) {
+		worldStatePublisher = WorldStatePublisher::New();
+	}
+
+	return worldStatePublisher;
+}
+
+void Client::DisableWorldStatePublication() {
+	CheckThread( "Client::DisableWorldStatePublication()" );
+
+	WorldStatePublisher::Delete( worldStatePublisher );
+	worldStatePublisher = nullptr;
+}
+
+void Client::SetName( const char *name_ ) {
+	QStrncpyz( this->name, name_, MAX_STRING_CHARS );
+
+	if( protocolExecutor ) {
+		protocolExecutor->SetName( this->name );
+	}
+}
+
+bool Client::HasEnteredGame() const {
+	return protocolExecutor && protocolExecutor->clientState == GenericClientProtocolExecutor::CA_ACTIVE;
+}
+
+bool Client::IsDisconnected() const {
+	if( !protocolExecutor ) {
+		return true;
+	}
+
+	return protocolExecutor->clientState == GenericClientProtocolExecutor::CA_DISCONNECTED &&
+		   !protocolExecutor->resolutionRequestId;
+}
+
+void Client::SendGameCommand( const char *command ) {
+	CheckThread( "Client::SendGameCommand()" );
+
+	if( !protocolExecutor ) {
+		console->Printf( "Client::SendGameCommand(): not connected\n" );
+		return;
+	}
+
+	protocolExecutor->EnqueueCommand( "%s", command );
+}
+
+void Client::PrintMissingListenerWarning( const char *function, const char *format, ... ) {
+#ifndef LIBQFAKECLIENT_QUIET_MISSING_LISTENERS
 	console->Printf( "Warning: %s: client listener is not set\n", function );
+
+	va_list va;
+	va_start( va, format );
+	console->VPrintf( format, va );
+	va_end( va );
+#endif
+}
+
+void Client::PostEvent( ClientEvent::Type type, const char *from, const char *text ) {
+	// Events that do not fit the stream are dropped (and counted by the stream), the consumer is not waited for
+	eventStream->TryAppend( type, eventStreamClientId, system->Millis(), from, text );
 }
 
 void Client::SetListener( ClientListener *listener_ ) {
@@ -97,52 +222,140 @@ void Client::SetShownPlayerName( const char *name ) {
 	if( listener ) {
 		listener->SetShownPlayerName( name );
 	} else {
-		PrintMissingListenerWarning( "Client::SetShownPlayerName()" );
-		console->Printf( "Shown player name: `%s`\n", name );
+		PrintMissingListenerWarning( "Client::SetShownPlayerName()", "Shown player name: `%s`\n", name );
 	}
 }
 
 void Client::SetMessageOfTheDay( const char *motd ) {
-	if( listener ) {
+	if( eventStream ) {
+		PostEvent( ClientEvent::MESSAGE_OF_THE_DAY, "", motd );
+	} else if( listener ) {
 		listener->SetMessageOfTheDay( motd );
 	} else {
-		PrintMissingListenerWarning( "Client::SetMessageOfTheDay()" );
-		console->Printf( "Message of the day: `%s`\n", motd );
+		PrintMissingListenerWarning( "Client::SetMessageOfTheDay()", "Message of the day: `%s`\n", motd );
 	}
 }
 
 void Client::PrintCenteredMessage( const char *message ) {
-	if( listener ) {
+	if( eventStream ) {
+		PostEvent( ClientEvent::CENTERED_MESSAGE, "", message );
+	} else if( listener ) {
 		listener->PrintCenteredMessage( message );
 	} else {
-		PrintMissingListenerWarning( "Client::PrintCenteredMessage()" );
-		console->Printf( "Centered message: `%s`\n", message );
+		PrintMissingListenerWarning( "Client::PrintCenteredMessage()", "Centered message: `%s`\n", message );
 	}
 }
 
 void Client::PrintChatMessage( const char *from, const char *message ) {
-	if( listener ) {
+	if( eventStream ) {
+		PostEvent( ClientEvent::CHAT, from, message );
+	} else if( listener ) {
 		listener->PrintChatMessage( from, message );
 	} else {
-		PrintMissingListenerWarning( "Client::PrintChatMessage()" );
-		console->Printf( "Chat from `%s`: `%s`\n", from, message );
+		PrintMissingListenerWarning( "Client::PrintChatMessage()", "Chat from `%s`: `%s`\n", from, message );
 	}
 }
 
 void Client::PrintTeamChatMessage( const char *from, const char *message ) {
-	if( listener ) {
+	if( eventStream ) {
+		PostEvent( ClientEvent::TEAM_CHAT, from, message );
+	} else if( listener ) {
 		listener->PrintTeamChatMessage( from, message );
 	} else {
-		PrintMissingListenerWarning( "Client::PrintTeamChatMessage()" );
-		console->Printf( "Team chat from `%s`: `%s`\n", from, message );
+		PrintMissingListenerWarning( "Client::PrintTeamChatMessage()", "Team chat from `%s`: `%s`\n", from, message );
 	}
 }
 
 void Client::PrintTVChatMessage( const char *from, const char *message ) {
-	if( listener ) {
+	if( eventStream ) {
+		PostEvent( ClientEvent::TV_CHAT, from, message );
+	} else if( listener ) {
 		listener->PrintTVChatMessage( from, message );
 	} else {
-		PrintMissingListenerWarning( "Client::PrintTVChatMessage()" );
-		console->Printf( "TV chat from `%s`: `%s`\n", from, message );
+		PrintMissingListenerWarning( "Client::PrintTVChatMessage()", "TV chat from `%s`: `%s`\n", from, message );
+	}
+}
+
+void Client::ExecuteTargetedCommand( int clientNum, const char *command ) {
+	if( listener ) {
+		listener->ExecuteTargetedCommand( clientNum, command );
+	} else {
+		PrintMissingListenerWarning( "Client::ExecuteTargetedCommand()", "Command for client #%d: `%s`\n", clientNum, command );
+	}
+}
+
+void Client::NotifyConfigStringsChanged( const uint16_t *indices, const char *const *values, unsigned numChanged ) {
+	// Do not print missing listener warnings, the callback is optional
+	if( listener ) {
+		listener->OnConfigStringsChanged( indices, values, numChanged );
 	}
 }
+
+void Client::NotifyScoreboardChanged( const uint8_t *clientNums, const ScoreboardEntry *entries, unsigned numChanged ) {
+	if( eventStream ) {
+		char text[64];
+
+		for( unsigned i = 0; i < numChanged; ++i ) {
+			const ScoreboardEntry &entry = entries[i];
+			snprintf( text, sizeof( text ), "%d %d %d %d %d %d %u", (int)clientNums[i], (int)entry.score, (int)entry.ping,
+					  (int)entry.kills, (int)entry.deaths, (int)entry.team, (unsigned)entry.flags );
+			PostEvent( ClientEvent::SCOREBOARD, "", text );
+		}
+	} else if( listener ) {
+		listener->OnScoreboardChanged( clientNums, entries, numChanged );
+	}
+}
+
+const short *Client::PlayerStats( int clientNum ) const {
+	if( !protocolExecutor ) {
+		return nullptr;
+	}
+
+	return protocolExecutor->worldState->PlayerStats( clientNum );
+}
+
+const char *Client::ConfigString( unsigned index ) const {
+	if( !protocolExecutor ) {
+		return nullptr;
+	}
+
+	const ClientWorldState *worldState = protocolExecutor->worldState;
+
+	if( index >= worldState->MaxConfigStrings() ) {
+		return nullptr;
+	}
+
+	return worldState->configStrings + index * worldState->ConfigStringsStride();
+}
+
+uint32_t Client::ConfigStringVersion( unsigned index ) const {
+	if( !protocolExecutor ) {
+		return 0;
+	}
+
+	return protocolExecutor->worldState->ConfigStringVersion( index );
+}
+
+const PlayerRosterEntry *Client::RosterEntry( int clientNum ) const {
+	if( !protocolExecutor ) {
+		return nullptr;
+	}
+
+	return protocolExecutor->worldState->RosterEntry( clientNum );
+}
+
+int Client::FindPlayerByName( const char *name ) const {
+	if( !protocolExecutor ) {
+		return -1;
+	}
+
+	return protocolExecutor->worldState->FindPlayerByName( name );
+}
+
+const ScoreboardEntry *Client::GetScoreboardEntry( int clientNum ) const {
+	if( !protocolExecutor ) {
+		return nullptr;
+	}
+
+	return protocolExecutor->scoreboard.Entry( clientNum );
+}
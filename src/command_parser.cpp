@@ -1,247 +1,215 @@
 #include "command_parser.h"
 
-#include <assert.h>
 #include <string.h>
-#include <algorithm>
 
-template <typename T1, typename T2>
-static inline size_t MinSize( T1 a, T2 b ) {
-	return std::min( (size_t)a, (size_t)b );
-};
+#if defined( __SSE2__ ) && defined( __GNUC__ )
+#include <emmintrin.h>
+#define LIBQFAKECLIENT_SSE2_SCAN
+#endif
 
-const char *CommandParser::GetCommand( unsigned *tokenLength, uint32_t *tokenHash ) {
-	if( !cmdCharsPtr ) {
-		return nullptr;
-	}
+// A token that is not quoted ends at whitespace, a quote, a commands separator or the input end.
+// Note that a '\n' separator and the input terminator are whitespace chars too.
+static inline bool IsTokenEnd( char ch ) {
+	return (uint8_t)ch <= ' ' || ch == '"' || ch == ';';
+}
 
-	argCharsPtr = nullptr;
+#ifdef LIBQFAKECLIENT_SSE2_SCAN
 
-	// Make sure that length pointer is not null in the contained code
-	unsigned length;
+// Scanners might read up to 15 bytes past the input terminator, this is covered by the parser chars padding.
 
-	if( !tokenLength ) {
-		tokenLength = &length;
-	}
+static inline const char *FindTokenEnd( const char *p ) {
+	const __m128i space = _mm_set1_epi8( ' ' );
+	const __m128i quote = _mm_set1_epi8( '"' );
+	const __m128i semicolon = _mm_set1_epi8( ';' );
 
-	// Strip whitespace
-	char ch;
+	for(;; p += 16 ) {
+		const __m128i chars = _mm_loadu_si128( (const __m128i *)p );
+		// An unsigned "less or equal" comparison
+		__m128i mask = _mm_cmpeq_epi8( _mm_max_epu8( chars, space ), space );
+		mask = _mm_or_si128( mask, _mm_cmpeq_epi8( chars, quote ) );
+		mask = _mm_or_si128( mask, _mm_cmpeq_epi8( chars, semicolon ) );
 
-	while( ( ch = *cmdCharsPtr ) ) {
-		if( ch > ' ' ) {
-			break;
+		if( const int bits = _mm_movemask_epi8( mask ) ) {
+			return p + __builtin_ctz( (unsigned)bits );
 		}
-		cmdCharsPtr++;
 	}
+}
 
-	switch( ch ) {
-		case '\0':
-			cmdCharsPtr = nullptr;
+static inline const char *FindClosingQuote( const char *p ) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i quote = _mm_set1_epi8( '"' );
 
-			if( tokenLength ) {
-				*tokenLength = 0;
-			}
+	for(;; p += 16 ) {
+		const __m128i chars = _mm_loadu_si128( (const __m128i *)p );
+		const __m128i mask = _mm_or_si128( _mm_cmpeq_epi8( chars, zero ), _mm_cmpeq_epi8( chars, quote ) );
 
-			if( tokenHash ) {
-				*tokenHash = 0;
-			}
-			return nullptr;
-		case '\n':
-		case ';':
+		if( const int bits = _mm_movemask_epi8( mask ) ) {
+			return p + __builtin_ctz( (unsigned)bits );
+		}
+	}
+}
 
-			if( tokenLength ) {
-				*tokenLength = 0;
-			}
+#else
 
-			if( tokenHash ) {
-				*tokenHash = 0;
-			}
-			// Skip the char
-			cmdCharsPtr++;
-			return "";
-		default:
-			break;
+static inline const char *FindTokenEnd( const char *p ) {
+	while( !IsTokenEnd( *p ) ) {
+		p++;
+	}
+	return p;
+}
+
+static inline const char *FindClosingQuote( const char *p ) {
+	while( *p && *p != '"' ) {
+		p++;
 	}
+	return p;
+}
 
-	const char *const start = cmdCharsPtr;
+#endif
 
-	if( !tokenHash ) {
-		while( ( ch = *cmdCharsPtr ) ) {
-			if( ch <= ' ' || ch == '\n' || ch == ';' || ch == '"' ) {
-				break;
+CommandParser::CommandParser( const char *input_ )
+	: numTokens( 0 ), currToken( 0 ), argsStart( 0 ), argsEnd( 0 ), hasCurrCommand( false ) {
+	Tokenize( input_ );
+}
+
+void CommandParser::Tokenize( const char *input ) {
+	// Server strings always fit. Only commands of the client itself might be longer, these are truncated.
+	const size_t inputLength = strnlen( input, MAX_INPUT_CHARS );
+	memcpy( chars, input, inputLength );
+	// Terminate the input and initialize the padding that might be touched by vectorized scanning
+	memset( chars + inputLength, 0, SCAN_PADDING );
+
+	char *p = chars;
+	bool isQuoted = false;
+
+	while( numTokens < MAX_TOKENS ) {
+		if( isQuoted ) {
+			char *const start = p;
+			p = const_cast<char *>( FindClosingQuote( p ) );
+			AddToken( start, p );
+			isQuoted = false;
+
+			if( !*p ) {
+				return;
 			}
-			cmdCharsPtr++;
+			// Terminate the token in place
+			*p++ = '\0';
+			continue;
 		}
-	} else {
-		*tokenHash = 0;
 
-		while( ( ch = *cmdCharsPtr ) ) {
-			if( ch <= ' ' || ch == '\n' || ch == ';' || ch == '"' ) {
-				break;
-			}
-			cmdCharsPtr++;
+		// Skip whitespace except separators
+		char ch;
 
-			if( cmdCharsPtr - start <= sizeof( tokenBuffer ) ) {
-				AddCharToHash( tokenHash, ch );
-			}
+		while( ( ch = *p ) && (uint8_t)ch <= ' ' && ch != '\n' ) {
+			p++;
 		}
-	}
 
-	switch( ch ) {
-		case '\0':
-			*tokenLength = (unsigned)MinSize( cmdCharsPtr - start, sizeof( tokenBuffer ) );
-			cmdCharsPtr = nullptr;
-			argCharsPtr = nullptr;
-			return start;
-		case '\n':
-		case ';':
-			*tokenLength = (unsigned)MinSize( cmdCharsPtr - start, sizeof( tokenBuffer ) );
-			QStrncpyz( tokenBuffer, start, *tokenLength );
-			return tokenBuffer;
-		default:
-			break;
-	}
+		switch( ch ) {
+			case '\0':
+				return;
+			case '\n':
+			case ';':
+				AddSeparator();
+				p++;
+				continue;
+			case '"':
+				isQuoted = true;
+				p++;
+				continue;
+			default:
+				break;
+		}
 
-	*tokenLength = (unsigned)MinSize( cmdCharsPtr - start, sizeof( tokenBuffer ) );
-	QStrncpyz( tokenBuffer, start, *tokenLength );
-	argCharsPtr = cmdCharsPtr;
-	return tokenBuffer;
-}
+		char *const start = p;
+		p = const_cast<char *>( FindTokenEnd( p ) );
+		AddToken( start, p );
 
-const char *CommandParser::GetArg( unsigned int *tokenLength, uint32_t *tokenHash ) {
-	if( !cmdCharsPtr || !argCharsPtr ) {
-		return nullptr;
-	}
+		ch = *p;
+
+		if( !ch ) {
+			return;
+		}
 
-	unsigned length;
+		// Terminate the token in place. The terminating char is handled right here.
+		*p++ = '\0';
 
-	if( !tokenLength ) {
-		tokenLength = &length;
+		if( ch == '"' ) {
+			isQuoted = true;
+		} else if( ch == '\n' || ch == ';' ) {
+			if( numTokens < MAX_TOKENS ) {
+				AddSeparator();
+			}
+		}
 	}
+}
 
-	if( tokenHash ) {
-		*tokenHash = 0;
+const char *CommandParser::TokenData( const Token &token, unsigned *tokenLength, uint32_t *tokenHash ) const {
+	if( tokenLength ) {
+		*tokenLength = token.length;
 	}
 
-	// Skip whitespace
-	char ch;
+	const char *data = chars + token.offset;
 
-	while( ( ch = *argCharsPtr ) ) {
-		if( ch > ' ' || ch == '\n' || ch == ';' ) {
-			break;
-		}
-		argCharsPtr++;
-		cmdCharsPtr++;
+	// Hashes are requested rarely (mostly for command names), so these are computed on demand
+	if( tokenHash ) {
+		*tokenHash = GetStringHashForGivenLength( data, token.length );
 	}
 
-	switch( ch ) {
-		case '\0':
-			cmdCharsPtr = nullptr;
-			argCharsPtr = nullptr;
-			return nullptr;
-		case '\n':
-		case ';':
-			argCharsPtr = nullptr;
-			// Skip the separator
-			cmdCharsPtr++;
-			return nullptr;
-		case '"':
-			// Skip first "
-			argCharsPtr++;
-			cmdCharsPtr++;
-			return GetQuotedArg( argCharsPtr, tokenLength, tokenHash );
-		default:
-			return GetBasicArg( argCharsPtr, tokenLength, tokenHash );
-	}
+	return data;
 }
 
-const char *CommandParser::GetBasicArg( const char *argStart, unsigned *argLength, uint32_t *argHash ) {
-	assert( argCharsPtr );
-	assert( cmdCharsPtr );
-
-	while( char ch = *argCharsPtr ) {
-		argCharsPtr++;
-		cmdCharsPtr++;
+const char *CommandParser::GetCommand( unsigned *tokenLength, uint32_t *tokenHash ) {
+	if( hasCurrCommand ) {
+		// Skip unread arguments and the separator of the current command
+		currToken = argsEnd;
 
-		if( ch <= ' ' ) {
-			*argLength = (unsigned)MinSize( argCharsPtr - 1u - argStart, sizeof( tokenBuffer ) );
-			QStrncpyz( tokenBuffer, argStart, *argLength );
-			return tokenBuffer;
+		if( currToken < numTokens ) {
+			currToken++;
 		}
+	}
 
-		if( ch == '\n' || ch == ';' ) {
-			*argLength = (unsigned)MinSize( argCharsPtr - 1u - argStart, sizeof( tokenBuffer ) );
-			QStrncpyz( tokenBuffer, argStart, *argLength );
-			argCharsPtr = nullptr;
-			return tokenBuffer;
-		}
+	hasCurrCommand = true;
 
-		if( ch == '"' ) {
-			*argLength = (unsigned)MinSize( argCharsPtr - 1u - argStart, sizeof( tokenBuffer ) );
-			QStrncpyz( tokenBuffer, argStart, *argLength );
-			// Start with '"' at next GetArg() call
-			argCharsPtr--;
-			cmdCharsPtr--;
-			return tokenBuffer;
-		}
+	if( currToken == numTokens || IsSeparator( tokens[currToken] ) ) {
+		argsStart = argsEnd = currToken;
 
-		if( argHash ) {
-			AddCharToHash( argHash, ch );
+		if( tokenLength ) {
+			*tokenLength = 0;
 		}
-	}
 
-	// Roll back for convenience
-	argCharsPtr--;
-	// We have reached the string end
-	cmdCharsPtr = nullptr;
-
-	// The token is terminated by a trailing zero.
-	// Do not make a copy in this case, return a pointer to the token part of the cmdCharsPtr.
-	// The only exception is way too large token (a caller expects tokens of a limited size).
-	if( argCharsPtr - argStart < sizeof( tokenBuffer ) ) {
-		if( argLength ) {
-			*argLength = (unsigned)( argCharsPtr - argStart + 1 );
+		if( tokenHash ) {
+			*tokenHash = 0;
 		}
-		// This is the last arg for the command
-		argCharsPtr = nullptr;
-		return argStart;
+
+		return currToken < numTokens ? "" : nullptr;
 	}
 
-	size_t length = MinSize( argCharsPtr - argStart + 1, sizeof( tokenBuffer ) );
-	QStrncpyz( tokenBuffer, argStart, length );
+	const Token &name = tokens[currToken++];
 
-	if( argLength ) {
-		*argLength = (unsigned)length;
-	}
-	// This is the last arg for the command
-	argCharsPtr = nullptr;
-	return tokenBuffer;
-}
+	argsStart = currToken;
+	argsEnd = currToken;
 
-const char *CommandParser::GetQuotedArg( const char *argStart, unsigned *argLength, uint32_t *argHash ) {
-	assert( argCharsPtr );
-	assert( cmdCharsPtr );
+	while( argsEnd < numTokens && !IsSeparator( tokens[argsEnd] ) ) {
+		argsEnd++;
+	}
 
-	while( char ch = *argCharsPtr ) {
-		argCharsPtr++;
-		cmdCharsPtr++;
+	return TokenData( name, tokenLength, tokenHash );
+}
 
-		if( ch == '"' ) {
-			*argLength = (unsigned)MinSize( sizeof( tokenBuffer ) - 1u, argCharsPtr - argStart - 1 );
-			QStrncpyz( tokenBuffer, argStart, *argLength );
-			return tokenBuffer;
+const char *CommandParser::GetArg( unsigned *tokenLength, uint32_t *tokenHash ) {
+	if( currToken >= argsEnd ) {
+		if( tokenLength ) {
+			*tokenLength = 0;
 		}
 
-		if( argHash ) {
-			AddCharToHash( argHash, ch );
+		if( tokenHash ) {
+			*tokenHash = 0;
 		}
+
+		return nullptr;
 	}
 
-	*argLength = (unsigned)MinSize( sizeof( tokenBuffer ) - 1u, argCharsPtr - argStart - 1 );
-	QStrncpyz( tokenBuffer, argStart + 1, *argLength );
-	// We have reached the string end, there are no further commands
-	cmdCharsPtr = nullptr;
-	argCharsPtr = nullptr;
-	return tokenBuffer;
+	return TokenData( tokens[currToken++], tokenLength, tokenHash );
 }
 
 uint32_t GetStringHashAndLength( const char *s, unsigned *length ) {
@@ -0,0 +1,78 @@
+#include "connection_ramp.h"
+
+#include <string.h>
+
+ConnectionRamp::ConnectionRamp( const ConnectionRampSettings &settings_, uint64_t seed, unsigned id_ )
+	: settings( settings_ ),
+	tokens( settings_.admissionBurst ),
+	tokensUpdatedAt( 0 ),
+	randomState( seed ),
+	id( id_ ) {
+	memset( &stats, 0, sizeof( stats ) );
+
+	if( !settings.admissionBurst ) {
+		settings.admissionBurst = 1;
+		tokens = 1;
+	}
+
+	// Negated comparisons also catch NaN values
+	if( !( settings.admissionsPerSecond >= 0.01f ) ) {
+		settings.admissionsPerSecond = 0.01f;
+	}
+
+	if( !( settings.backoffJitter >= 0.0f ) ) {
+		settings.backoffJitter = 0.0f;
+	} else if( settings.backoffJitter > 1.0f ) {
+		settings.backoffJitter = 1.0f;
+	}
+}
+
+bool ConnectionRamp::TryAdmit( uint64_t millis ) {
+	if( stats.numConcurrentHandshakes >= settings.maxConcurrentHandshakes ) {
+		return false;
+	}
+
+	// Refill the token bucket
+	if( millis > tokensUpdatedAt ) {
+		tokens += ( millis - tokensUpdatedAt ) * ( settings.admissionsPerSecond * 0.001 );
+
+		if( tokens > settings.admissionBurst ) {
+			tokens = settings.admissionBurst;
+		}
+	}
+	tokensUpdatedAt = millis;
+
+	if( tokens < 1.0 ) {
+		return false;
+	}
+
+	tokens -= 1.0;
+	stats.admissions++;
+	stats.numConcurrentHandshakes++;
+	return true;
+}
+
+void ConnectionRamp::ReleaseSlot( bool hasEnteredGame ) {
+	stats.numConcurrentHandshakes--;
+
+	if( hasEnteredGame ) {
+		stats.completedHandshakes++;
+	}
+}
+
+unsigned ConnectionRamp::NextBackoff( unsigned numRetries ) {
+	stats.retries++;
+
+	uint64_t backoff = settings.maxBackoff;
+
+	if( numRetries < 32 ) {
+		backoff = (uint64_t)settings.initialBackoff << numRetries;
+
+		if( backoff > settings.maxBackoff ) {
+			backoff = settings.maxBackoff;
+		}
+	}
+
+	// Shorten the delay randomly, so clients that have failed at the same moment do not retry at the same moment
+	return (unsigned)( backoff * ( 1.0 - settings.backoffJitter * NextRandomFraction( &randomState ) ) );
+}
@@ -0,0 +1,347 @@
+#include "coroutines.h"
+#include "allocator.h"
+
+#include <new>
+#include <stdio.h>
+#include <string.h>
+
+std::coroutine_handle<> TaskPromiseBase::OnFinished() noexcept {
+	if( continuation ) {
+		return continuation;
+	}
+
+	if( scheduler ) {
+		scheduler->OnRootFinished( this );
+	}
+
+	return std::noop_coroutine();
+}
+
+CoroutineScheduler::Waiter::Waiter( CoroutineScheduler *scheduler_, unsigned timeout, Kind kind_ )
+	: scheduler( scheduler_ ),
+	prev( nullptr ),
+	next( nullptr ),
+	deadline( scheduler_->Millis() + timeout ),
+	kind( kind_ ),
+	isLinked( false ),
+	isSignaled( false ),
+	isTimedOut( false ) {}
+
+CoroutineScheduler::Waiter::~Waiter() {
+	// A coroutine might be destroyed while it is suspended (e.g. on the scheduler deletion)
+	if( isLinked ) {
+		scheduler->Unlink( this );
+	}
+}
+
+void CoroutineScheduler::Waiter::Suspend( std::coroutine_handle<> handle_ ) {
+	this->handle = handle_;
+	scheduler->Link( this );
+}
+
+CoroutineScheduler::ServerCommandAwaiter::ServerCommandAwaiter( CoroutineScheduler *scheduler_, Client *client_,
+																const char *name_, unsigned timeout )
+	: Waiter( scheduler_, timeout, SERVER_COMMAND ), client( client_ ), name( name_ ) {
+	nameLength = (unsigned)strlen( name_ );
+	result.received = false;
+	result.command[0] = '\0';
+}
+
+CoroutineScheduler::ServerCommandAwaiter::~ServerCommandAwaiter() {
+	if( isLinked ) {
+		scheduler->Unlink( this );
+		scheduler->CheckServerCommandObserver( client, this );
+	}
+}
+
+void CoroutineScheduler::ServerCommandAwaiter::await_suspend( std::coroutine_handle<> handle_ ) {
+	client->SetServerCommandObserver( scheduler, &CoroutineScheduler::OnServerCommand );
+	Suspend( handle_ );
+}
+
+CoroutineScheduler::ServerInfoAwaiter::ServerInfoAwaiter( CoroutineScheduler *scheduler_,
+														  const NetworkAddress &address_, unsigned timeout )
+	: Waiter( scheduler_, timeout, SERVER_INFO ), address( address_ ) {
+	result.received = false;
+	result.maxClients = 0;
+	result.numClients = 0;
+	result.numBots = 0;
+	result.needPassword = false;
+}
+
+CoroutineScheduler::CoroutineScheduler( System *system_ )
+	: system( system_ ),
+	firstWaiter( nullptr ),
+	lastWaiter( nullptr ),
+	firstRoot( nullptr ),
+	firstFinishedRoot( nullptr ),
+	numRoots( 0 ) {}
+
+CoroutineScheduler::~CoroutineScheduler() {
+	system->RemoveFrameHook( this );
+
+	DestroyFinishedRoots();
+
+	// Destruction of suspended coroutines unlinks their awaiters
+	while( TaskPromiseBase *promise = firstRoot ) {
+		firstRoot = promise->nextRoot;
+		promise->rootHandle.destroy();
+	}
+}
+
+CoroutineScheduler *CoroutineScheduler::New( System *system ) {
+	void *mem = QAlloc( sizeof( CoroutineScheduler ) );
+
+	if( !mem ) {
+		return nullptr;
+	}
+
+	auto *scheduler = new(mem)CoroutineScheduler( system );
+
+	if( !system->AddFrameHook( scheduler, &CoroutineScheduler::FrameHook ) ) {
+		scheduler->~CoroutineScheduler();
+		QFree( mem );
+		return nullptr;
+	}
+
+	return scheduler;
+}
+
+void CoroutineScheduler::Delete( CoroutineScheduler *scheduler ) {
+	if( scheduler ) {
+		scheduler->~CoroutineScheduler();
+		QFree( scheduler );
+	}
+}
+
+void CoroutineScheduler::Spawn( Task<void> &&task ) {
+	auto handle = std::exchange( task.handle, nullptr );
+
+	if( !handle ) {
+		return;
+	}
+
+	TaskPromiseBase *promise = &handle.promise();
+	promise->scheduler = this;
+	promise->rootHandle = handle;
+	promise->prevRoot = nullptr;
+	promise->nextRoot = firstRoot;
+
+	if( firstRoot ) {
+		firstRoot->prevRoot = promise;
+	}
+
+	firstRoot = promise;
+	numRoots++;
+
+	handle.resume();
+}
+
+void CoroutineScheduler::OnRootFinished( TaskPromiseBase *promise ) {
+	if( promise->prevRoot ) {
+		promise->prevRoot->nextRoot = promise->nextRoot;
+	} else {
+		firstRoot = promise->nextRoot;
+	}
+
+	if( promise->nextRoot ) {
+		promise->nextRoot->prevRoot = promise->prevRoot;
+	}
+
+	numRoots--;
+
+	// The coroutine frame cannot be destroyed while the coroutine is being suspended, defer it
+	promise->prevRoot = nullptr;
+	promise->nextRoot = firstFinishedRoot;
+	firstFinishedRoot = promise;
+}
+
+void CoroutineScheduler::DestroyFinishedRoots() {
+	while( TaskPromiseBase *promise = firstFinishedRoot ) {
+		firstFinishedRoot = promise->nextRoot;
+		promise->rootHandle.destroy();
+	}
+}
+
+void CoroutineScheduler::Link( Waiter *waiter ) {
+	waiter->prev = lastWaiter;
+	waiter->next = nullptr;
+
+	if( lastWaiter ) {
+		lastWaiter->next = waiter;
+	} else {
+		firstWaiter = waiter;
+	}
+
+	lastWaiter = waiter;
+	waiter->isLinked = true;
+}
+
+void CoroutineScheduler::Unlink( Waiter *waiter ) {
+	if( waiter->prev ) {
+		waiter->prev->next = waiter->next;
+	} else {
+		firstWaiter = waiter->next;
+	}
+
+	if( waiter->next ) {
+		waiter->next->prev = waiter->prev;
+	} else {
+		lastWaiter = waiter->prev;
+	}
+
+	waiter->prev = nullptr;
+	waiter->next = nullptr;
+	waiter->isLinked = false;
+}
+
+void CoroutineScheduler::FrameHook( void *scheduler ) {
+	( (CoroutineScheduler *)scheduler )->Frame();
+}
+
+void CoroutineScheduler::Frame() {
+	const uint64_t millis = system->Millis();
+
+	// Detach waiters that should be resumed first, as resumed coroutines suspend again on new awaiters.
+	// Reuse the `next` link for the list of detached waiters.
+	Waiter *firstReady = nullptr;
+	Waiter *lastReady = nullptr;
+
+	for( Waiter *waiter = firstWaiter; waiter; ) {
+		Waiter *nextWaiter = waiter->next;
+
+		if( !waiter->IsReady() ) {
+			if( millis < waiter->deadline ) {
+				waiter = nextWaiter;
+				continue;
+			}
+			waiter->isTimedOut = true;
+		}
+
+		Unlink( waiter );
+
+		if( lastReady ) {
+			lastReady->next = waiter;
+		} else {
+			firstReady = waiter;
+		}
+		lastReady = waiter;
+
+		waiter = nextWaiter;
+	}
+
+	while( Waiter *waiter = firstReady ) {
+		firstReady = waiter->next;
+		waiter->next = nullptr;
+
+		if( waiter->kind == Waiter::SERVER_COMMAND ) {
+			CheckServerCommandObserver( ( (ServerCommandAwaiter *)waiter )->client, waiter );
+		}
+
+		// Note that the waiter is destroyed during resumption
+		waiter->handle.resume();
+	}
+
+	DestroyFinishedRoots();
+}
+
+CoroutineScheduler::GameAwaiter CoroutineScheduler::Connect( Client *client, const char *address, unsigned timeout ) {
+	char command[MAX_STRING_CHARS];
+	snprintf( command, sizeof( command ), "connect %s", address );
+	client->ExecuteCommand( command );
+
+	return GameAwaiter( this, client, timeout );
+}
+
+void CoroutineScheduler::OnServerCommand( void *scheduler_, Client *client, const char *command ) {
+	auto *scheduler = (CoroutineScheduler *)scheduler_;
+
+	for( Waiter *waiter = scheduler->firstWaiter; waiter; waiter = waiter->next ) {
+		if( waiter->kind != Waiter::SERVER_COMMAND || waiter->isSignaled ) {
+			continue;
+		}
+
+		auto *commandWaiter = (ServerCommandAwaiter *)waiter;
+
+		if( commandWaiter->client != client ) {
+			continue;
+		}
+
+		const unsigned nameLength = commandWaiter->nameLength;
+
+		if( strncmp( command, commandWaiter->name, nameLength ) != 0 ) {
+			continue;
+		}
+
+		if( command[nameLength] != '\0' && command[nameLength] != ' ' ) {
+			continue;
+		}
+
+		QStrncpyz( commandWaiter->result.command, command, sizeof( commandWaiter->result.command ) );
+		commandWaiter->result.received = true;
+		commandWaiter->isSignaled = true;
+	}
+}
+
+void CoroutineScheduler::CheckServerCommandObserver( Client *client, const Waiter *leavingWaiter ) {
+	for( Waiter *waiter = firstWaiter; waiter; waiter = waiter->next ) {
+		if( waiter != leavingWaiter && waiter->kind == Waiter::SERVER_COMMAND ) {
+			if( ( (ServerCommandAwaiter *)waiter )->client == client ) {
+				return;
+			}
+		}
+	}
+
+	client->SetServerCommandObserver( nullptr, nullptr );
+}
+
+void CoroutineScheduler::OnServerInfo( const PolledGameServer &server ) {
+	if( !server.CurrInfo() ) {
+		return;
+	}
+
+	for( Waiter *waiter = firstWaiter; waiter; waiter = waiter->next ) {
+		if( waiter->kind != Waiter::SERVER_INFO || waiter->isSignaled ) {
+			continue;
+		}
+
+		auto *infoWaiter = (ServerInfoAwaiter *)waiter;
+
+		if( infoWaiter->address != server.Address() ) {
+			continue;
+		}
+
+		ServerInfoResult *result = &infoWaiter->result;
+		result->received = true;
+		result->serverName = server.ServerName();
+		result->gametype = server.Gametype();
+		result->mapName = server.MapName();
+		result->maxClients = server.MaxClients();
+		result->numClients = server.NumClients();
+		result->numBots = server.NumBots();
+		result->needPassword = server.NeedPassword();
+		infoWaiter->isSignaled = true;
+	}
+}
+
+void AwaitableServerListListener::OnServerAdded( const PolledGameServer &server ) {
+	scheduler->OnServerInfo( server );
+
+	if( listener ) {
+		listener->OnServerAdded( server );
+	}
+}
+
+void AwaitableServerListListener::OnServerRemoved( const PolledGameServer &server ) {
+	if( listener ) {
+		listener->OnServerRemoved( server );
+	}
+}
+
+void AwaitableServerListListener::OnServerUpdated( const PolledGameServer &server ) {
+	scheduler->OnServerInfo( server );
+
+	if( listener ) {
+		listener->OnServerUpdated( server );
+	}
+}
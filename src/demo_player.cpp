@@ -0,0 +1,347 @@
+#include "demo_player.h"
+#include "allocator.h"
+#include "client.h"
+#include "console.h"
+#include "message_parser.h"
+#include "protocol_executor.h"
+#include "system.h"
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#error There is no Windows-compatible version yet
+#endif
+
+static void DeleteConsoleAndListener( Console *console, ClientListener *listener ) {
+	if( listener ) {
+		listener->~ClientListener();
+		free( listener );
+	}
+
+	if( console ) {
+		console->~Console();
+		free( console );
+	}
+}
+
+static const uint8_t *MapFile( Console *console, const char *filename, size_t *size ) {
+	int fd = open( filename, O_RDONLY );
+
+	if( fd < 0 ) {
+		console->Printf( "DemoPlayer::New(): cannot open `%s`\n", filename );
+		return nullptr;
+	}
+
+	struct stat st;
+
+	if( fstat( fd, &st ) < 0 || st.st_size <= 0 ) {
+		console->Printf( "DemoPlayer::New(): `%s` is not a regular non-empty file\n", filename );
+		close( fd );
+		return nullptr;
+	}
+
+	void *data = mmap( nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	// The mapping remains valid after closing the descriptor
+	close( fd );
+
+	if( data == MAP_FAILED ) {
+		console->Printf( "DemoPlayer::New(): cannot map `%s`\n", filename );
+		return nullptr;
+	}
+
+	// Messages are read strictly sequentially
+	madvise( data, (size_t)st.st_size, MADV_SEQUENTIAL );
+
+	*size = (size_t)st.st_size;
+	return (const uint8_t *)data;
+}
+
+DemoPlayer::DemoPlayer( Console *console_, Client *client_, const uint8_t *data_, size_t dataSize_ )
+	: console( console_ ),
+	client( client_ ),
+	executor( client_->protocolExecutor ),
+	data( data_ ),
+	dataSize( dataSize_ ),
+	offset( 0 ),
+	timeScale( 0.0f ),
+	firstServerTime( 0 ),
+	hasFirstServerTime( false ),
+	finished( false ) {}
+
+DemoPlayer::~DemoPlayer() {
+	// The client owns the console
+	client->~Client();
+	QFree( client );
+
+	munmap( (void *)data, dataSize );
+}
+
+DemoPlayer *DemoPlayer::New( Console *console, System *system, ClientListener *listener, const char *filename ) {
+	size_t dataSize;
+	const uint8_t *data = MapFile( console, filename, &dataSize );
+
+	if( !data ) {
+		DeleteConsoleAndListener( console, listener );
+		return nullptr;
+	}
+
+	void *clientMem = QAlloc( sizeof( Client ) );
+	void *playerMem = QAlloc( sizeof( DemoPlayer ) );
+
+	if( !clientMem || !playerMem ) {
+		console->Printf( "DemoPlayer::New(): cannot allocate memory for a player\n" );
+		QFree( clientMem );
+		QFree( playerMem );
+		munmap( (void *)data, dataSize );
+		DeleteConsoleAndListener( console, listener );
+		return nullptr;
+	}
+
+	Client *client = new(clientMem)Client( console, system );
+	client->offline = true;
+	client->SetListener( listener );
+
+	if( !client->CheckExecutor() ) {
+		console->Printf( "DemoPlayer::New(): cannot create a protocol executor\n" );
+		client->~Client();
+		QFree( client );
+		QFree( playerMem );
+		munmap( (void *)data, dataSize );
+		return nullptr;
+	}
+
+	client->protocolExecutor->EnterOfflineMode();
+	return new(playerMem)DemoPlayer( console, client, data, dataSize );
+}
+
+void DemoPlayer::Delete( DemoPlayer *player ) {
+	if( player ) {
+		player->~DemoPlayer();
+		QFree( player );
+	}
+}
+
+void DemoPlayer::SetTimeScale( float timeScale_ ) {
+	timeScale = timeScale_ > 0.0f ? timeScale_ : 0.0f;
+	// Restart the time tracking from the current frame
+	hasFirstServerTime = false;
+}
+
+bool DemoPlayer::IsNextMessageDue() {
+	if( timeScale <= 0.0f ) {
+		return true;
+	}
+
+	const uint64_t serverTime = executor->messageParser->LastServerTime();
+
+	// Header messages precede the first frame
+	if( !serverTime ) {
+		return true;
+	}
+
+	const auto now = std::chrono::steady_clock::now();
+
+	if( !hasFirstServerTime ) {
+		firstServerTime = serverTime;
+		startedAt = now;
+		hasFirstServerTime = true;
+		return true;
+	}
+
+	const auto elapsedMillis = std::chrono::duration_cast<std::chrono::milliseconds>( now - startedAt ).count();
+	return (double)( serverTime - firstServerTime ) <= (double)elapsedMillis * timeScale;
+}
+
+bool DemoPlayer::PlayNextMessage() {
+	if( offset + 4 > dataSize ) {
+		console->Printf( "DemoPlayer: unexpected end of the demo file\n" );
+		finished = true;
+		return false;
+	}
+
+	const uint8_t *p = data + offset;
+	const int32_t length = (int32_t)( p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( (uint32_t)p[3] << 24 ) );
+
+	if( length == -1 ) {
+		finished = true;
+		return false;
+	}
+
+	if( length < 0 || (unsigned)length > MAX_MSGLEN || offset + 4 + length > dataSize ) {
+		console->Printf( "DemoPlayer: illegal message length %d at offset %u\n", (int)length, (unsigned)offset );
+		finished = true;
+		return false;
+	}
+
+	message.Clear();
+	message.WriteData( p + 4, (unsigned)length );
+	offset += 4 + length;
+
+	executor->OnIngoingSequencedMessage( message );
+	return true;
+}
+
+bool DemoPlayer::Frame() {
+	if( finished ) {
+		return false;
+	}
+
+	if( timeScale <= 0.0f ) {
+		return PlayNextMessage();
+	}
+
+	while( IsNextMessageDue() ) {
+		if( !PlayNextMessage() ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void DemoPlayer::Run() {
+	while( Frame() ) {
+		if( timeScale > 0.0f ) {
+			std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+		}
+	}
+}
+
+DemoPlaybackPool::DemoPlaybackPool( System *system_, unsigned numThreads_ )
+	: system( system_ ),
+	numThreads( numThreads_ ),
+	firstJob( nullptr ),
+	lastJob( nullptr ),
+	numPendingJobs( 0 ),
+	stopRequested( false ) {
+	for( unsigned i = 0; i < numThreads; ++i ) {
+		threads[i] = std::thread( &DemoPlaybackPool::Run, this );
+	}
+}
+
+DemoPlaybackPool::~DemoPlaybackPool() {
+	WaitForCompletion();
+
+	{
+		std::lock_guard<std::mutex> lock( mutex );
+		stopRequested = true;
+	}
+	jobAdded.notify_all();
+
+	for( unsigned i = 0; i < numThreads; ++i ) {
+		threads[i].join();
+	}
+}
+
+DemoPlaybackPool *DemoPlaybackPool::New( System *system, unsigned numThreads ) {
+	if( !numThreads ) {
+		numThreads = std::thread::hardware_concurrency();
+	}
+
+	if( !numThreads ) {
+		numThreads = 1;
+	} else if( numThreads > MAX_THREADS ) {
+		numThreads = MAX_THREADS;
+	}
+
+	void *mem = QAlloc( sizeof( DemoPlaybackPool ) );
+
+	if( !mem ) {
+		return nullptr;
+	}
+
+	return new(mem)DemoPlaybackPool( system, numThreads );
+}
+
+void DemoPlaybackPool::Delete( DemoPlaybackPool *pool ) {
+	if( pool ) {
+		pool->~DemoPlaybackPool();
+		QFree( pool );
+	}
+}
+
+bool DemoPlaybackPool::Add( const char *filename, Console *console, ClientListener *listener, float timeScale ) {
+	const size_t filenameLength = strlen( filename );
+	Job *job = (Job *)QAlloc( sizeof( Job ) + filenameLength );
+
+	if( !job ) {
+		console->Printf( "DemoPlaybackPool::Add(): cannot allocate memory for a job\n" );
+		DeleteConsoleAndListener( console, listener );
+		return false;
+	}
+
+	job->next = nullptr;
+	job->console = console;
+	job->listener = listener;
+	job->timeScale = timeScale;
+	memcpy( job->filename, filename, filenameLength + 1 );
+
+	{
+		std::lock_guard<std::mutex> lock( mutex );
+
+		if( lastJob ) {
+			lastJob->next = job;
+		} else {
+			firstJob = job;
+		}
+		lastJob = job;
+		numPendingJobs++;
+	}
+
+	jobAdded.notify_one();
+	return true;
+}
+
+void DemoPlaybackPool::WaitForCompletion() {
+	std::unique_lock<std::mutex> lock( mutex );
+
+	jobCompleted.wait( lock, [this]() { return !numPendingJobs; } );
+}
+
+void DemoPlaybackPool::Run() {
+	for(;; ) {
+		Job *job;
+
+		{
+			std::unique_lock<std::mutex> lock( mutex );
+			jobAdded.wait( lock, [this]() { return firstJob || stopRequested; } );
+
+			if( !firstJob ) {
+				return;
+			}
+
+			job = firstJob;
+			firstJob = job->next;
+
+			if( !firstJob ) {
+				lastJob = nullptr;
+			}
+		}
+
+		if( DemoPlayer *player = DemoPlayer::New( job->console, system, job->listener, job->filename ) ) {
+			player->SetTimeScale( job->timeScale );
+			player->Run();
+			DemoPlayer::Delete( player );
+		}
+
+		QFree( job );
+
+		bool isLastJob;
+
+		{
+			std::lock_guard<std::mutex> lock( mutex );
+			isLastJob = !--numPendingJobs;
+		}
+
+		if( isLastJob ) {
+			jobCompleted.notify_all();
+		}
+	}
+}
@@ -0,0 +1,314 @@
+#include "demo_recorder.h"
+#include "allocator.h"
+#include "console.h"
+#include "system.h"
+
+#include <new>
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+
+DemoRecorder::DemoRecorder( Console *console_, DemoWriter *writer_, FILE *file_ )
+	: console( console_ ),
+	writer( writer_ ),
+	file( file_ ),
+	currChunk( nullptr ),
+	numAllocatedChunks( 0 ),
+	stopped( false ),
+	failed( false ),
+	bytesRecorded( 0 ),
+	lastFlushAt( 0 ),
+	startedAt( 0 ),
+	metaDataOffset( -1 ),
+	metaDataSize( 0 ),
+	waitingForNonDeltaFrame( true ),
+	overflowWarningShown( false ) {}
+
+DemoRecorder::~DemoRecorder() {
+	Chunk *chunk;
+
+	while( freeChunks.TryPop( &chunk ) ) {
+		QFree( chunk );
+	}
+
+	while( filledChunks.TryPop( &chunk ) ) {
+		QFree( chunk );
+	}
+
+	if( currChunk ) {
+		QFree( currChunk );
+	}
+
+	if( file ) {
+		fclose( file );
+	}
+}
+
+DemoRecorder *DemoRecorder::New( Console *console, System *system, const char *filename ) {
+	DemoWriter *writer = system->DemoWriterInstance();
+
+	if( !writer ) {
+		console->Printf( "DemoRecorder::New(): cannot start the demo writer\n" );
+		return nullptr;
+	}
+
+	FILE *file = fopen( filename, "wb" );
+
+	if( !file ) {
+		console->Printf( "DemoRecorder::New(): cannot open `%s` for writing\n", filename );
+		return nullptr;
+	}
+
+	// Chunks are written by large blocks anyway, do not use an intermediate buffer
+	setvbuf( file, nullptr, _IONBF, 0 );
+
+	void *mem = QAlloc( sizeof( DemoRecorder ) );
+
+	if( !mem ) {
+		console->Printf( "DemoRecorder::New(): cannot allocate memory for a recorder\n" );
+		fclose( file );
+		return nullptr;
+	}
+
+	DemoRecorder *recorder = new(mem)DemoRecorder( console, writer, file );
+	recorder->startedAt = system->Millis();
+	recorder->lastFlushAt = recorder->startedAt;
+
+	if( !writer->Register( recorder ) ) {
+		console->Printf( "DemoRecorder::New(): too many active demo recorders\n" );
+		recorder->~DemoRecorder();
+		QFree( recorder );
+		return nullptr;
+	}
+
+	return recorder;
+}
+
+void DemoRecorder::Stop( DemoRecorder *recorder ) {
+	recorder->Flush();
+	// The writer finishes the file and deletes the recorder after this store
+	recorder->stopped.store( true, std::memory_order_release );
+}
+
+void DemoRecorder::PushCurrChunk() {
+	if( !currChunk ) {
+		return;
+	}
+
+	// The queue capacity matches the maximal number of allocated chunks, so it never overflows
+	if( !filledChunks.TryPush( currChunk ) ) {
+		abort();
+	}
+
+	currChunk = nullptr;
+}
+
+void DemoRecorder::Flush() {
+	if( currChunk && currChunk->size ) {
+		PushCurrChunk();
+	}
+}
+
+void DemoRecorder::Frame( uint64_t millis ) {
+	if( millis - lastFlushAt >= FLUSH_INTERVAL ) {
+		Flush();
+		lastFlushAt = millis;
+	}
+}
+
+void DemoRecorder::RecordMessage( const uint8_t *data, unsigned size ) {
+	if( failed.load( std::memory_order_relaxed ) ) {
+		return;
+	}
+
+	const unsigned recordSize = size + 4;
+
+	if( recordSize > CHUNK_SIZE ) {
+		console->Printf( "DemoRecorder::RecordMessage(): the message size %u is too large\n", size );
+		failed.store( true, std::memory_order_relaxed );
+		return;
+	}
+
+	if( currChunk && currChunk->size + recordSize > CHUNK_SIZE ) {
+		PushCurrChunk();
+	}
+
+	if( !currChunk ) {
+		if( !freeChunks.TryPop( &currChunk ) ) {
+			if( numAllocatedChunks == MAX_CHUNKS ) {
+				// The writer cannot keep up. Do not block the network thread, fail the recording instead.
+				if( !overflowWarningShown ) {
+					console->Printf( "DemoRecorder::RecordMessage(): too much pending data, the recording has failed\n" );
+					overflowWarningShown = true;
+				}
+				failed.store( true, std::memory_order_relaxed );
+				return;
+			}
+
+			currChunk = (Chunk *)QAlloc( sizeof( Chunk ) );
+
+			if( !currChunk ) {
+				console->Printf( "DemoRecorder::RecordMessage(): cannot allocate a chunk\n" );
+				failed.store( true, std::memory_order_relaxed );
+				return;
+			}
+			numAllocatedChunks++;
+		}
+		currChunk->size = 0;
+	}
+
+	uint8_t *p = currChunk->data + currChunk->size;
+	p[0] = (uint8_t)( size & 0xFF );
+	p[1] = (uint8_t)( ( size >> 8 ) & 0xFF );
+	p[2] = (uint8_t)( ( size >> 16 ) & 0xFF );
+	p[3] = (uint8_t)( ( size >> 24 ) & 0xFF );
+	memcpy( p + 4, data, size );
+
+	currChunk->size += recordSize;
+	bytesRecorded += recordSize;
+}
+
+void DemoRecorder::SetMetaKeyValue( const char *key, const char *value ) {
+	const size_t keyLength = strlen( key );
+	const size_t valueLength = strlen( value );
+
+	if( metaDataSize + keyLength + valueLength + 2 > MAX_META_DATA_SIZE ) {
+		console->Printf( "DemoRecorder::SetMetaKeyValue(): meta data overflow on `%s` key\n", key );
+		return;
+	}
+
+	memcpy( metaData + metaDataSize, key, keyLength + 1 );
+	metaDataSize += keyLength + 1;
+	memcpy( metaData + metaDataSize, value, valueLength + 1 );
+	metaDataSize += valueLength + 1;
+}
+
+DemoWriter *DemoWriter::New() {
+	void *mem = QAlloc( sizeof( DemoWriter ) );
+
+	if( !mem ) {
+		return nullptr;
+	}
+
+	return new(mem)DemoWriter;
+}
+
+void DemoWriter::Delete( DemoWriter *writer ) {
+	if( writer ) {
+		writer->~DemoWriter();
+		QFree( writer );
+	}
+}
+
+DemoWriter::DemoWriter() : stopRequested( false ) {
+	for( auto &recorder: recorders ) {
+		recorder.store( nullptr, std::memory_order_relaxed );
+	}
+
+	thread = std::thread( &DemoWriter::Run, this );
+}
+
+DemoWriter::~DemoWriter() {
+	stopRequested.store( true, std::memory_order_release );
+	thread.join();
+}
+
+bool DemoWriter::Register( DemoRecorder *recorder ) {
+	for( auto &slot: recorders ) {
+		DemoRecorder *expected = nullptr;
+
+		if( slot.compare_exchange_strong( expected, recorder, std::memory_order_acq_rel ) ) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void DemoWriter::Run() {
+	for(;; ) {
+		// Read the flag before checking recorders, so all recorders stopped before the request are finished
+		const bool shouldStop = stopRequested.load( std::memory_order_acquire );
+		bool hasRecorders = false;
+		bool hasWritten = false;
+
+		for( auto &slot: recorders ) {
+			DemoRecorder *recorder = slot.load( std::memory_order_acquire );
+
+			if( !recorder ) {
+				continue;
+			}
+
+			// Test the flag before taking chunks, so the final chunk is not missed
+			const bool stopped = recorder->stopped.load( std::memory_order_acquire );
+			hasWritten |= WriteChunks( recorder );
+
+			if( stopped ) {
+				Finish( recorder );
+				slot.store( nullptr, std::memory_order_release );
+			} else {
+				hasRecorders = true;
+			}
+		}
+
+		if( shouldStop && !hasRecorders ) {
+			return;
+		}
+
+		if( !hasWritten ) {
+			std::this_thread::sleep_for( std::chrono::milliseconds( (unsigned)IDLE_SLEEP_MILLIS ) );
+		}
+	}
+}
+
+bool DemoWriter::WriteChunks( DemoRecorder *recorder ) {
+	bool hasWritten = false;
+	DemoRecorder::Chunk *chunk;
+
+	while( recorder->filledChunks.TryPop( &chunk ) ) {
+		if( !recorder->failed.load( std::memory_order_relaxed ) ) {
+			if( fwrite( chunk->data, 1, chunk->size, recorder->file ) != chunk->size ) {
+				recorder->failed.store( true, std::memory_order_relaxed );
+			}
+		}
+
+		// The queue capacity matches the maximal number of allocated chunks, so it never overflows
+		if( !recorder->freeChunks.TryPush( chunk ) ) {
+			abort();
+		}
+
+		hasWritten = true;
+	}
+
+	return hasWritten;
+}
+
+void DemoWriter::Finish( DemoRecorder *recorder ) {
+	FILE *file = recorder->file;
+
+	if( !recorder->failed.load( std::memory_order_relaxed ) ) {
+		const uint8_t terminator[4] = { 0xFF, 0xFF, 0xFF, 0xFF };
+		fwrite( terminator, 1, 4, file );
+
+		if( recorder->metaDataOffset >= 0 && recorder->metaDataSize ) {
+			// The real size does not include the last zero byte (this follows the original implementation)
+			const unsigned realSize = recorder->metaDataSize - 1;
+			const uint8_t realSizeData[4] = {
+				(uint8_t)( realSize & 0xFF ), (uint8_t)( ( realSize >> 8 ) & 0xFF ),
+				(uint8_t)( ( realSize >> 16 ) & 0xFF ), (uint8_t)( ( realSize >> 24 ) & 0xFF )
+			};
+
+			// Skip the real size and the max size fields
+			if( !fseek( file, (long)recorder->metaDataOffset, SEEK_SET ) ) {
+				fwrite( realSizeData, 1, 4, file );
+
+				if( !fseek( file, 4, SEEK_CUR ) ) {
+					fwrite( recorder->metaData, 1, realSize, file );
+				}
+			}
+		}
+	}
+
+	recorder->~DemoRecorder();
+	QFree( recorder );
+}
@@ -0,0 +1,126 @@
+#include "event_stream.h"
+#include "allocator.h"
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+ClientEventStream::ClientEventStream( uint8_t *data_, unsigned capacity_ )
+	: head( 0 ), tail( 0 ), numDroppedEvents( 0 ), data( data_ ), capacity( capacity_ ), batchEnd( 0 ) {}
+
+ClientEventStream::~ClientEventStream() {
+	QFree( data );
+}
+
+ClientEventStream *ClientEventStream::New( unsigned capacity ) {
+	unsigned roundedCapacity = 4096;
+
+	while( roundedCapacity < capacity && roundedCapacity < ( 1u << 30 ) ) {
+		roundedCapacity <<= 1;
+	}
+
+	void *mem = QAlloc( sizeof( ClientEventStream ) );
+	uint8_t *data = (uint8_t *)QAlloc( roundedCapacity );
+
+	if( !mem || !data ) {
+		QFree( mem );
+		QFree( data );
+		return nullptr;
+	}
+
+	return new(mem)ClientEventStream( data, roundedCapacity );
+}
+
+void ClientEventStream::Delete( ClientEventStream *stream ) {
+	if( stream ) {
+		stream->~ClientEventStream();
+		QFree( stream );
+	}
+}
+
+bool ClientEventStream::TryAppend( ClientEvent::Type type, uint16_t clientId, uint64_t timestamp,
+								   const char *from, const char *text ) {
+	// A record should not take more than a quarter of the ring, so the ring never stalls on a single large record
+	const unsigned maxStringsLength = capacity / 4 - (unsigned)sizeof( RecordHeader ) - 2;
+
+	unsigned fromLength = (unsigned)strlen( from );
+	unsigned textLength = (unsigned)strlen( text );
+
+	if( fromLength > maxStringsLength / 2 ) {
+		fromLength = maxStringsLength / 2;
+	}
+
+	if( fromLength + textLength > maxStringsLength ) {
+		textLength = maxStringsLength - fromLength;
+	}
+
+	const unsigned recordSize = ( (unsigned)sizeof( RecordHeader ) + fromLength + textLength + 2 + 7 ) & ~7u;
+
+	const unsigned currTail = tail.load( std::memory_order_relaxed );
+	const unsigned freeSpace = capacity - ( currTail - head.load( std::memory_order_acquire ) );
+	const unsigned tailOffset = currTail & ( capacity - 1 );
+	const unsigned contiguousSpace = capacity - tailOffset;
+
+	// A record is never split, skip the rest of the ring if it does not fit
+	const unsigned skippedSpace = contiguousSpace < recordSize ? contiguousSpace : 0;
+
+	if( freeSpace < recordSize + skippedSpace ) {
+		numDroppedEvents.fetch_add( 1, std::memory_order_relaxed );
+		return false;
+	}
+
+	unsigned newTail = currTail;
+
+	if( skippedSpace ) {
+		// Records are aligned, so there is always a space for a header size field
+		RecordHeader *wrap = (RecordHeader *)( data + tailOffset );
+		wrap->size = skippedSpace;
+		wrap->type = RECORD_WRAP;
+		newTail += skippedSpace;
+	}
+
+	uint8_t *p = data + ( newTail & ( capacity - 1 ) );
+	RecordHeader *header = (RecordHeader *)p;
+	header->size = recordSize;
+	header->type = (uint16_t)type;
+	header->clientId = clientId;
+	header->timestamp = timestamp;
+	header->fromLength = (uint16_t)fromLength;
+	header->textLength = (uint16_t)textLength;
+
+	char *strings = (char *)( p + sizeof( RecordHeader ) );
+	memcpy( strings, from, fromLength );
+	strings[fromLength] = '\0';
+	memcpy( strings + fromLength + 1, text, textLength );
+	strings[fromLength + 1 + textLength] = '\0';
+
+	tail.store( newTail + recordSize, std::memory_order_release );
+	return true;
+}
+
+unsigned ClientEventStream::FetchBatch( ClientEvent *events, unsigned maxEvents ) {
+	// Release the space of the previous batch
+	head.store( batchEnd, std::memory_order_release );
+
+	const unsigned currTail = tail.load( std::memory_order_acquire );
+	unsigned numEvents = 0;
+
+	while( batchEnd != currTail && numEvents < maxEvents ) {
+		const uint8_t *p = data + ( batchEnd & ( capacity - 1 ) );
+		const RecordHeader *header = (const RecordHeader *)p;
+		batchEnd += header->size;
+
+		if( header->type == RECORD_WRAP ) {
+			continue;
+		}
+
+		ClientEvent *event = &events[numEvents++];
+		event->type = (ClientEvent::Type)header->type;
+		event->clientId = header->clientId;
+		event->timestamp = header->timestamp;
+		event->from = (const char *)( p + sizeof( RecordHeader ) );
+		event->text = event->from + header->fromLength + 1;
+	}
+
+	return numEvents;
+}
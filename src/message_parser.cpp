@@ -1,16 +1,26 @@
 #include "channel.h"
+#include "allocator.h"
 #include "client.h"
 #include "command_parser.h"
 #include "common.h"
 #include "console.h"
+#include "demo_recorder.h"
 #include "message_parser.h"
+#include "user_command.h"
+#include "world_state_snapshot.h"
 
 #include <initializer_list>
 #include <new>
 #include <limits>
 #include <inttypes.h>
 #include <stdlib.h>
+#include <stdio.h>
 
+/**
+ * Protocol traits: constants and primitive encoding rules of a particular protocol version.
+ * A message parser and a world state are instantiated for each supported traits type,
+ * so the protocol version is checked only once on the parser creation.
+ */
 struct Constants21 {
 	static constexpr auto PROTOCOL = PROTOCOL21;
 	static constexpr auto MAX_CONFIGSTRINGS = 4256;
@@ -23,10 +33,45 @@ struct Constants21 {
 
 	static constexpr auto STAT_TEAM = 9;
 
+	static constexpr auto MAX_EDICTS = 1024;
+	static constexpr auto UPDATE_BACKUP = 32;
+	static constexpr auto UPDATE_MASK = UPDATE_BACKUP - 1;
+	static constexpr auto MAX_PARSE_ENTITIES = 16384;
+
+	// Server time is transmitted as a 32-bit integer in 2.1 (newer protocols use 64-bit values)
+	static uint64_t ReadServerTime( Message &message ) { return (uint64_t)message.ReadLong(); }
+	static void WriteServerTime( Message &message, uint64_t serverTime ) { message.WriteLong( (int)serverTime ); }
+	static constexpr uint64_t MAX_SERVER_TIME = (uint64_t)std::numeric_limits<int>::max();
+	static constexpr int64_t MAX_FRAME_NUM = std::numeric_limits<int>::max();
+
 	static constexpr auto SV_BITFLAGS_RELIABLE = 1 << 1;
 	static constexpr auto SV_BITFLAGS_HTTP = 1 << 3;
 	static constexpr auto SV_BITFLAGS_BASEURL = 1 << 4;
 
+	// A move is a frame number, a usercmd number of the last command, a number of commands,
+	// and delta-compressed commands (a bits byte, present fields and a server time each)
+	static void WriteMoveHeader( Message &message, int64_t lastFrame, uint32_t commandsHead, unsigned numCommands ) {
+		message.WriteLong( (int)lastFrame );
+		message.WriteLong( (int)commandsHead );
+		message.WriteByte( (int)numCommands );
+	}
+
+	// Bits of fields that are present in a delta-compressed usercmd
+	static constexpr auto UCMD_ANGLE1 = 1 << 0;
+	static constexpr auto UCMD_FORWARD = 1 << 3;
+	static constexpr auto UCMD_SIDE = 1 << 4;
+	static constexpr auto UCMD_UP = 1 << 5;
+	static constexpr auto UCMD_BUTTONS = 1 << 6;
+
+	static constexpr auto CS_HOSTNAME = 0;
+	static constexpr auto CS_MAPNAME = 6;
+	static constexpr auto CS_GAMETYPENAME = 12;
+	static constexpr auto CS_SCB_PLAYERTAB_LAYOUT = 16;
+	static constexpr auto CS_SCB_PLAYERTAB_TITLES = 17;
+	// Follows models, sounds, images, skin files, light styles (256 of each) and items
+	static constexpr auto CS_ITEMS = 1312;
+	static constexpr auto CS_PLAYERINFOS = CS_ITEMS + MAX_ITEMS;
+
 	enum {
 		SVC_BAD,
 
@@ -47,44 +92,149 @@ struct Constants21 {
 	};
 };
 
-class ClientWorldState21 : public ClientWorldState, Constants21
+template <typename> class MessageParserImpl;
+
+template <typename Protocol>
+class ClientWorldStateImpl : public ClientWorldState, Protocol
 {
-	friend class MessageParser21;
+	template <typename> friend class MessageParserImpl;
 
 public:
+	using Protocol::MAX_CONFIGSTRINGS;
+	using Protocol::CS_PLAYERINFOS;
+	using Protocol::CS_SCB_PLAYERTAB_LAYOUT;
+	using Protocol::CS_SCB_PLAYERTAB_TITLES;
+	using Protocol::PS_MAX_STATS;
+	using Protocol::MAX_GAME_STATS;
+	using Protocol::MAX_GAME_LONGSTATS;
+	using Protocol::MAX_EDICTS;
+	using Protocol::UPDATE_BACKUP;
+	using Protocol::UPDATE_MASK;
+	using Protocol::MAX_PARSE_ENTITIES;
+	using Protocol::SV_BITFLAGS_RELIABLE;
+
+	// Spawn baselines are kept in the wire format for writing demo headers.
+	// A baseline is a delta from a null state, so its encoding is always short.
+	static constexpr unsigned MAX_BASELINE_DATA_SIZE = 128;
+
 	char downloadUrlBuffer[MAX_STRING_CHARS + 1];
 
 	char motdBuffer[MAX_STRING_CHARS + 1];
+	char baseGameBuffer[MAX_STRING_CHARS + 1];
 	char gameBuffer[MAX_STRING_CHARS + 1];
 	char levelBuffer[MAX_STRING_CHARS + 1];
 
+	int snapFrameTime;
+
 	short statsBuffer[MAX_SERVER_CLIENTS][PS_MAX_STATS];
+	// Whether a player state of a client has been present in the last parsed frame.
+	// There is only a single one for a regular client, multiview clients get states of all players.
+	bool hasPlayerStateBuffer[MAX_SERVER_CLIENTS];
 	char configStringsBuffer[MAX_CONFIGSTRINGS][MAX_CONFIGSTRING_CHARS];
+	uint64_t configStringsDirtyBitsBuffer[( MAX_CONFIGSTRINGS + 63 ) / 64];
+	uint32_t configStringVersionsBuffer[MAX_CONFIGSTRINGS];
+	uint64_t configStringsUsedBitsBuffer[( MAX_CONFIGSTRINGS + 63 ) / 64];
+	PlayerRosterEntry rosterBuffer[MAX_SERVER_CLIENTS];
+
+	static_assert( CS_PLAYERINFOS + MAX_SERVER_CLIENTS <= MAX_CONFIGSTRINGS, "Player infos are out of configstrings range" );
+	static_assert( MAX_CONFIGSTRINGS <= WorldStateSnapshot::MAX_CONFIGSTRINGS, "Published snapshots cannot hold all configstrings" );
+	static_assert( PS_MAX_STATS <= WorldStateSnapshot::MAX_STATS, "Published snapshots cannot hold all stats" );
+
+	static_assert( ( UPDATE_BACKUP & UPDATE_MASK ) == 0, "UPDATE_BACKUP must be a power of two" );
+	static_assert( ( MAX_PARSE_ENTITIES & ( MAX_PARSE_ENTITIES - 1 ) ) == 0, "MAX_PARSE_ENTITIES must be a power of two" );
+
+	// We do not need a complete entity state, only fields that affect reading of further deltas
+	struct EntitySnapshot {
+		uint16_t number;
+		int16_t solid;
+	};
 
-	ClientWorldState21() {
+	struct PlayerSnapshot {
+		int playerNum;
+		short stats[PS_MAX_STATS];
+	};
+
+	struct Snapshot {
+		int64_t frameNum;
+		uint64_t serverTime;
+		int ucmdExecuted;
+		// An index in the parseEntities ring (not masked)
+		unsigned firstEntity;
+		unsigned numEntities;
+		unsigned numPlayers;
+		int gameLongStats[MAX_GAME_LONGSTATS];
+		short gameStats[MAX_GAME_STATS];
+		PlayerSnapshot players[MAX_SERVER_CLIENTS];
+		bool valid;
+	};
+
+	// Decoded frames indexed by frame number (masked by UPDATE_MASK)
+	Snapshot snapshots[UPDATE_BACKUP];
+	EntitySnapshot parseEntities[MAX_PARSE_ENTITIES];
+	unsigned parseEntitiesHead;
+	EntitySnapshot baselines[MAX_EDICTS];
+	uint8_t baselinesData[MAX_EDICTS][MAX_BASELINE_DATA_SIZE];
+	uint8_t baselinesDataSize[MAX_EDICTS];
+	// A number of the last frame that has been parsed successfully
+	int64_t lastSnapshotFrame;
+
+	ClientWorldStateImpl() {
 		ClientWorldState::motd = motdBuffer;
 		ClientWorldState::game = gameBuffer;
 		ClientWorldState::stats = &statsBuffer[0][0];
 		ClientWorldState::configStrings = &configStringsBuffer[0][0];
 		ClientWorldState::configStringsStride = MAX_CONFIGSTRING_CHARS;
 		ClientWorldState::maxConfigStrings = MAX_CONFIGSTRINGS;
+		ClientWorldState::configStringsDirtyBits = configStringsDirtyBitsBuffer;
+		ClientWorldState::configStringVersions = configStringVersionsBuffer;
+		ClientWorldState::configStringsUsedBits = configStringsUsedBitsBuffer;
+
+		ClientWorldState::roster = rosterBuffer;
+		ClientWorldState::firstPlayerInfoConfigString = CS_PLAYERINFOS;
+		ClientWorldState::scoreboardLayoutConfigString = CS_SCB_PLAYERTAB_LAYOUT;
+		ClientWorldState::scoreboardTitlesConfigString = CS_SCB_PLAYERTAB_TITLES;
+
+		memset( configStringsDirtyBitsBuffer, 0, sizeof( configStringsDirtyBitsBuffer ) );
+		memset( configStringVersionsBuffer, 0, sizeof( configStringVersionsBuffer ) );
+		// Configstrings are not initialized yet, so the first clearing should visit all of them
+		memset( configStringsUsedBitsBuffer, 0xFF, sizeof( configStringsUsedBitsBuffer ) );
+		memset( rosterBuffer, 0, sizeof( rosterBuffer ) );
 
 		downloadUrlBuffer[0] = 0;
 		motdBuffer[0] = 0;
+		baseGameBuffer[0] = 0;
 		gameBuffer[0] = 0;
 		levelBuffer[0] = 0;
+		snapFrameTime = 0;
+
+		ClearSnapshots();
 	}
 
 	void Clear() override;
+	void ClearSnapshots();
+
+	Snapshot *SnapshotForFrame( int64_t frameNum ) {
+		return &snapshots[frameNum & UPDATE_MASK];
+	}
+
+	EntitySnapshot *ParseEntityAt( unsigned index ) {
+		return &parseEntities[index & ( MAX_PARSE_ENTITIES - 1 )];
+	}
 
 	bool IsConnectionReliable() const override {
 		return ( bitFlags & SV_BITFLAGS_RELIABLE ) != 0;
 	}
 
-	~ClientWorldState21() {}
+	bool HasPlayerState( int clientNum ) const override {
+		return (unsigned)clientNum < MAX_SERVER_CLIENTS && hasPlayerStateBuffer[clientNum];
+	}
+
+	~ClientWorldStateImpl() {}
 };
 
-void ClientWorldState21::Clear() {
+
+template <typename Protocol>
+void ClientWorldStateImpl<Protocol>::Clear() {
 	ClientWorldState::Clear();
 
 	stats = &statsBuffer[0][0];
@@ -93,6 +243,15 @@ void ClientWorldState21::Clear() {
 	configStrings = &configStringsBuffer[0][0];
 	configStringsStride = MAX_CONFIGSTRING_CHARS;
 	maxConfigStrings = MAX_CONFIGSTRINGS;
+	// Dirty marks and versions are kept, so consumers get notified of configstrings that are cleared on reset
+	configStringsDirtyBits = configStringsDirtyBitsBuffer;
+	configStringVersions = configStringVersionsBuffer;
+	configStringsUsedBits = configStringsUsedBitsBuffer;
+	// Roster entries are updated along with player info configstrings
+	roster = rosterBuffer;
+	firstPlayerInfoConfigString = CS_PLAYERINFOS;
+	scoreboardLayoutConfigString = CS_SCB_PLAYERTAB_LAYOUT;
+	scoreboardTitlesConfigString = CS_SCB_PLAYERTAB_TITLES;
 
 	downloadUrl = downloadUrlBuffer;
 	downloadUrlBuffer[0] = 0;
@@ -100,11 +259,30 @@ void ClientWorldState21::Clear() {
 	motd = motdBuffer;
 	motdBuffer[0] = 0;
 
+	baseGameBuffer[0] = 0;
+	snapFrameTime = 0;
+
 	game = gameBuffer;
 	gameBuffer[0] = 0;
 
 	level = levelBuffer;
 	levelBuffer[0] = 0;
+
+	ClearSnapshots();
+}
+
+template <typename Protocol>
+void ClientWorldStateImpl<Protocol>::ClearSnapshots() {
+	for( Snapshot &snapshot: snapshots ) {
+		snapshot.valid = false;
+		snapshot.frameNum = -1;
+	}
+
+	parseEntitiesHead = 0;
+	lastSnapshotFrame = -1;
+	memset( hasPlayerStateBuffer, 0, sizeof( hasPlayerStateBuffer ) );
+	memset( baselines, 0, sizeof( baselines ) );
+	memset( baselinesDataSize, 0, sizeof( baselinesDataSize ) );
 }
 
 struct ConsolePtr {
@@ -146,33 +324,311 @@ void ClientWorldState::Clear() {
 	configStrings = nullptr;
 	configStringsStride = 0;
 	maxConfigStrings = 0;
+	configStringsDirtyBits = nullptr;
+	configStringVersions = nullptr;
+	configStringsUsedBits = nullptr;
+	roster = nullptr;
+	firstPlayerInfoConfigString = 0;
+	scoreboardLayoutConfigString = 0;
+	scoreboardTitlesConfigString = 0;
 }
 
-ClientWorldState *ClientWorldState::New( int protocolVersion, Console *debugConsole ) {
-	if( protocolVersion != Constants21::PROTOCOL ) {
-		ConsolePtr( debugConsole ).Printf( "Only 2.1 protocol is supported at this moment\n" );
-		return nullptr;
+bool ClientWorldState::SetConfigString( unsigned index, const char *value, unsigned length ) {
+	if( index >= maxConfigStrings ) {
+		return false;
+	}
+
+	if( length >= configStringsStride ) {
+		length = configStringsStride - 1;
+	}
+
+	char *configString = configStrings + index * configStringsStride;
+
+	if( configString[length] == '\0' && !memcmp( configString, value, length ) ) {
+		return false;
+	}
+
+	memcpy( configString, value, length );
+	configString[length] = '\0';
+
+	configStringsDirtyBits[index / 64] |= (uint64_t)1 << ( index % 64 );
+	configStringVersions[index]++;
+	hasDirtyConfigStrings = true;
+
+	if( length ) {
+		configStringsUsedBits[index / 64] |= (uint64_t)1 << ( index % 64 );
+	}
+
+	if( index - firstPlayerInfoConfigString < MAX_SERVER_CLIENTS && roster ) {
+		UpdateRosterEntry( index - firstPlayerInfoConfigString, configString );
+	}
+
+	return true;
+}
+
+/**
+ * Finds a value of an info string key (info strings look like "\key1\value1\key2\value2").
+ * @return A pointer to the value that is terminated by a backslash or a zero char, or null if the key is not found.
+ */
+static const char *FindInfoValue( const char *info, const char *key, unsigned keyLength, unsigned *valueLength ) {
+	const char *p = info;
+
+	for(;; ) {
+		if( *p == '\\' ) {
+			p++;
+		}
+
+		const char *keyStart = p;
+
+		while( *p && *p != '\\' ) {
+			p++;
+		}
+
+		if( !*p ) {
+			return nullptr;
+		}
+
+		const bool matches = ( p - keyStart ) == keyLength && !memcmp( keyStart, key, keyLength );
+		const char *valueStart = ++p;
+
+		while( *p && *p != '\\' ) {
+			p++;
+		}
+
+		if( matches ) {
+			*valueLength = (unsigned)( p - valueStart );
+			return valueStart;
+		}
+
+		if( !*p ) {
+			return nullptr;
+		}
+	}
+}
+
+void ClientWorldState::UpdateRosterEntry( unsigned clientNum, const char *playerInfo ) {
+	PlayerRosterEntry *entry = &roster[clientNum];
+	const int8_t team = entry->team;
+	const uint8_t stateFlags = (uint8_t)( entry->flags & PlayerRosterEntry::FLAG_HAS_PLAYER_STATE );
+	const uint32_t version = entry->version + 1;
+
+	memset( entry, 0, sizeof( PlayerRosterEntry ) );
+	entry->version = version;
+
+	if( !*playerInfo ) {
+		return;
+	}
+
+	// The team is not a part of the player info, keep the value known from player states
+	entry->team = team;
+	entry->flags = (uint8_t)( PlayerRosterEntry::FLAG_CONNECTED | stateFlags );
+
+	if( (int)clientNum + 1 == playerNum ) {
+		entry->flags |= PlayerRosterEntry::FLAG_LOCAL;
+	}
+
+	unsigned nameLength;
+	const char *name = FindInfoValue( playerInfo, "name", 4, &nameLength );
+
+	if( !name ) {
+		return;
+	}
+
+	if( nameLength >= PlayerRosterEntry::MAX_NAME_CHARS ) {
+		nameLength = PlayerRosterEntry::MAX_NAME_CHARS - 1;
+	}
+
+	memcpy( entry->name, name, nameLength );
+	entry->name[nameLength] = '\0';
+	entry->nameLength = (uint8_t)nameLength;
+	entry->nameHash = GetStringHashForGivenLength( entry->name, nameLength );
+
+	// Strip color tokens (^0 - ^9) and unescape carets (^^)
+	unsigned normalizedLength = 0;
+
+	for( unsigned i = 0; i < nameLength; ++i ) {
+		char ch = name[i];
+
+		if( ch == '^' && i + 1 < nameLength ) {
+			const char next = name[i + 1];
+
+			if( next >= '0' && next <= '9' ) {
+				i++;
+				continue;
+			}
+
+			if( next == '^' ) {
+				i++;
+			}
+		}
+
+		if( ch >= 'A' && ch <= 'Z' ) {
+			ch += 'a' - 'A';
+		}
+		entry->normalizedName[normalizedLength++] = ch;
+	}
+
+	entry->normalizedName[normalizedLength] = '\0';
+	entry->normalizedNameLength = (uint8_t)normalizedLength;
+	entry->normalizedNameHash = GetStringHashForGivenLength( entry->normalizedName, normalizedLength );
+}
+
+int ClientWorldState::FindPlayerByName( const char *name ) const {
+	if( !roster ) {
+		return -1;
+	}
+
+	unsigned length;
+	const uint32_t hash = GetStringHashAndLength( name, &length );
+
+	for( unsigned i = 0; i < MAX_SERVER_CLIENTS; ++i ) {
+		const PlayerRosterEntry &entry = roster[i];
+
+		if( entry.nameHash != hash || entry.nameLength != length || !( entry.flags & PlayerRosterEntry::FLAG_CONNECTED ) ) {
+			continue;
+		}
+
+		if( !memcmp( entry.name, name, length ) ) {
+			return (int)i;
+		}
+	}
+
+	return -1;
+}
+
+void ClientWorldState::SetPlayerTeam( unsigned clientNum, int team, bool hasPlayerState ) {
+	PlayerRosterEntry *entry = &roster[clientNum];
+	const uint8_t flags = hasPlayerState
+		? (uint8_t)( entry->flags | PlayerRosterEntry::FLAG_HAS_PLAYER_STATE )
+		: (uint8_t)( entry->flags & ~PlayerRosterEntry::FLAG_HAS_PLAYER_STATE );
+
+	if( entry->team == (int8_t)team && entry->flags == flags ) {
+		return;
+	}
+
+	entry->team = (int8_t)team;
+	entry->flags = flags;
+	entry->version++;
+}
+
+void ClientWorldState::ClearConfigStrings() {
+	const unsigned numWords = ( maxConfigStrings + 63 ) / 64;
+
+	for( unsigned wordNum = 0; wordNum < numWords; ++wordNum ) {
+		uint64_t word = configStringsUsedBits[wordNum];
+		configStringsUsedBits[wordNum] = 0;
+
+		while( word ) {
+			const unsigned bitNum = (unsigned)__builtin_ctzll( word );
+			SetConfigString( wordNum * 64 + bitNum, "", 0 );
+			word &= word - 1;
+		}
+	}
+}
+
+unsigned ClientWorldState::TakeDirtyConfigStrings( uint16_t *indices, unsigned maxIndices ) {
+	if( !hasDirtyConfigStrings ) {
+		return 0;
 	}
 
-	void *mem = malloc( sizeof( ClientWorldState21 ) );
+	unsigned numIndices = 0;
+	const unsigned numWords = ( maxConfigStrings + 63 ) / 64;
+
+	for( unsigned wordNum = 0; wordNum < numWords; ++wordNum ) {
+		uint64_t word = configStringsDirtyBits[wordNum];
+
+		while( word ) {
+			if( numIndices == maxIndices ) {
+				configStringsDirtyBits[wordNum] = word;
+				return numIndices;
+			}
+
+			const unsigned bitNum = (unsigned)__builtin_ctzll( word );
+			indices[numIndices++] = (uint16_t)( wordNum * 64 + bitNum );
+			// Clear the lowest set bit
+			word &= word - 1;
+		}
+
+		configStringsDirtyBits[wordNum] = 0;
+	}
+
+	hasDirtyConfigStrings = false;
+	return numIndices;
+}
+
+void ClientWorldState::DiscardDirtyConfigStrings() {
+	if( hasDirtyConfigStrings ) {
+		memset( configStringsDirtyBits, 0, ( ( maxConfigStrings + 63 ) / 64 ) * sizeof( uint64_t ) );
+		hasDirtyConfigStrings = false;
+	}
+}
+
+template <typename Protocol>
+static ClientWorldState *NewWorldState( Console *debugConsole ) {
+	void *mem = QAlloc( sizeof( ClientWorldStateImpl<Protocol> ) );
 
 	if( !mem ) {
 		ConsolePtr( debugConsole ).Printf( "Cannot allocate memory for a ClientWorldState\n" );
 		return nullptr;
 	}
 
-	return new(mem)ClientWorldState21();
+	return new(mem)ClientWorldStateImpl<Protocol>();
+}
+
+ClientWorldState *ClientWorldState::New( int protocolVersion, Console *debugConsole ) {
+	switch( protocolVersion ) {
+		case Constants21::PROTOCOL:
+			return NewWorldState<Constants21>( debugConsole );
+		default:
+			ConsolePtr( debugConsole ).Printf( "Only 2.1 protocol is supported at this moment\n" );
+			return nullptr;
+	}
 }
 
 void ClientWorldState::Delete( ClientWorldState *worldState ) {
 	if( worldState ) {
 		worldState->~ClientWorldState();
-		free( worldState );
+		QFree( worldState );
 	}
 }
 
-class MessageParser21 : public MessageParser, Constants21
+template <typename Protocol>
+class MessageParserImpl : public MessageParser, Protocol
 {
+	using Protocol::PS_MAX_STATS;
+	using Protocol::MAX_GAME_STATS;
+	using Protocol::MAX_GAME_LONGSTATS;
+	using Protocol::MAX_ITEMS;
+	using Protocol::STAT_TEAM;
+	using Protocol::MAX_EDICTS;
+	using Protocol::UPDATE_BACKUP;
+	using Protocol::MAX_PARSE_ENTITIES;
+	using Protocol::SV_BITFLAGS_HTTP;
+	using Protocol::SV_BITFLAGS_BASEURL;
+	using Protocol::MAX_SERVER_TIME;
+	using Protocol::MAX_FRAME_NUM;
+	using Protocol::CS_HOSTNAME;
+	using Protocol::CS_MAPNAME;
+	using Protocol::CS_GAMETYPENAME;
+
+	using Protocol::UCMD_ANGLE1;
+	using Protocol::UCMD_FORWARD;
+	using Protocol::UCMD_SIDE;
+	using Protocol::UCMD_UP;
+	using Protocol::UCMD_BUTTONS;
+
+	using Protocol::SVC_CLACK;
+	using Protocol::SVC_DEMOINFO;
+	using Protocol::SVC_FRAME;
+	using Protocol::SVC_GAMECOMMANDS;
+	using Protocol::SVC_MATCH;
+	using Protocol::SVC_PACKETENTITIES;
+	using Protocol::SVC_PLAYERINFO;
+	using Protocol::SVC_SERVERCMD;
+	using Protocol::SVC_SERVERCS;
+	using Protocol::SVC_SERVERDATA;
+	using Protocol::SVC_SPAWNBASELINE;
+
 	static constexpr auto PS_M_TYPE = 1 << 0;
 	static constexpr auto PS_M_ORIGIN0 = 1 << 1;
 	static constexpr auto PS_M_ORIGIN1 = 1 << 2;
@@ -260,26 +716,35 @@ class MessageParser21 : public MessageParser, Constants21
 
 	static constexpr auto ET_INVERSE = 128;
 
-	~MessageParser21() {}
+	~MessageParserImpl() {}
+
+	typedef ClientWorldStateImpl<Protocol> WorldState;
+	typedef typename WorldState::Snapshot Snapshot;
+	typedef typename WorldState::PlayerSnapshot PlayerSnapshot;
+	typedef typename WorldState::EntitySnapshot EntitySnapshot;
+
+	struct FrameHeader {
+		unsigned length;
+		uint64_t serverTime;
+		int frame;
+		int deltaFrame;
+		int ucmdExecuted;
+		int flags;
+	};
 
 	Message initialMessage;
-	ClientWorldState21 *worldState;
+	WorldState *worldState;
 
 	int lastExecutedServerCmdNum;
 	int lastCmdAck;
-	int playerNums[MAX_SERVER_CLIENTS];
 
-	void Reset() {
+	void Reset() override {
 		serverTime = 0;
 		lastFrame = -1;
 		lastExecutedServerCmdNum = 0;
 		lastCmdAck = -1;
 		// TODO: Only currSize is set to zero in the original code
 		initialMessage.Clear();
-
-		for( int i = 0; i < MAX_SERVER_CLIENTS; ++i ) {
-			playerNums[i] = i;
-		}
 	}
 
 	void ParseDemoInfo( Message &message );
@@ -290,67 +755,84 @@ class MessageParser21 : public MessageParser, Constants21
 	void ParseSpawnBaseLine( Message &message );
 	void ParseFrame( Message &message );
 
-	void ParseFrameHeader( Message &message, int *length, uint64_t *serverTime, int *frame, int *flags );
+	void ParseFrameHeader( Message &message, FrameHeader *header );
+	const Snapshot *FindDeltaSnapshot( const FrameHeader &header );
+	void SkipFrame( Message &message, unsigned endPos );
 	void ParseGameCommands( Message &message, int frame, int flags );
 	void ParseAreaBits( Message &message );
-	void ParseDeltaGameState( Message &message );
-	void ParsePlayerStates( Message &message );
-	void ParsePlayerState( Message &message, short *oldStats, int index );
-	void ParsePacketEntities( Message &message, unsigned startPos, int snapshotLength );
+	void ParseDeltaGameState( Message &message, const Snapshot *oldSnapshot, Snapshot *newSnapshot );
+	void ParsePlayerStates( Message &message, const Snapshot *oldSnapshot, Snapshot *newSnapshot );
+	void ParsePlayerState( Message &message, const PlayerSnapshot *oldState, PlayerSnapshot *newState );
+	void ParsePacketEntities( Message &message, const Snapshot *oldSnapshot, Snapshot *newSnapshot );
 
-	void SetStat( int player, int index, short value );
+	void UpdateStats( const Snapshot *snapshot );
 
-	unsigned ReadEntityBits( Message &message );
-	void ReadDeltaEntity( Message &message );
+	void RecordAndClearIfFull( DemoRecorder *recorder, Message &message, unsigned sizeToAdd );
+
+	unsigned ReadEntityBits( Message &message, unsigned *number );
+	void ReadDeltaEntity( Message &message, unsigned number, unsigned bits, const EntitySnapshot *from, EntitySnapshot *to );
 	void ReadDummyOrigin( Message &message );
 	void ReadDummyCoord( Message &message );
 	void ReadDummyAngle( Message &message );
 	void ReadDummyAngle16( Message &message );
 
 public:
-	MessageParser21( Console *console_, Client *client_, ClientWorldState21 *worldState_ )
+	MessageParserImpl( Console *console_, Client *client_, WorldState *worldState_ )
 		: MessageParser( console_, worldState_, client_ ), worldState( worldState_ ) {
 		Reset();
 	}
 
 	void Parse( Message &message ) override;
+	bool WriteMove( Message &message, int64_t lastFrame, uint64_t serverTime ) override;
+	bool WriteUserCommands( Message &message, int64_t lastFrame, uint32_t commandsHead,
+							const UserCommand *commands, unsigned numCommands,
+							uint64_t lastCommandServerTime, unsigned tickMillis ) override;
+	void WriteDemoHeader( DemoRecorder *recorder ) override;
+	void WriteDemoMetaData( DemoRecorder *recorder ) override;
 };
 
 GenericClientProtocolExecutor *MessageParser::Executor() {
 	return client->protocolExecutor;
 }
 
-MessageParser *MessageParser::New( int protocolVersion, Client *client, ClientWorldState *worldState, Console *console, Console *debugConsole ) {
-	if( protocolVersion != Constants21::PROTOCOL ) {
-		ConsolePtr( debugConsole ).Printf( "Only 2.1 protocol is supported at this moment\n" );
-		return nullptr;
-	}
-
-	ClientWorldState21 *state21 = dynamic_cast<ClientWorldState21 *>( worldState );
+template <typename Protocol>
+static MessageParser *NewParser( Client *client, ClientWorldState *worldState, Console *console, Console *debugConsole ) {
+	auto *protocolWorldState = dynamic_cast<ClientWorldStateImpl<Protocol> *>( worldState );
 
-	if( !state21 ) {
-		ConsolePtr( debugConsole ).Printf( "Illegal client world state (should match 2.1 protocol)\n" );
+	if( !protocolWorldState ) {
+		ConsolePtr( debugConsole ).Printf( "Illegal client world state (should match the parser protocol)\n" );
 		return nullptr;
 	}
 
-	void *mem = malloc( sizeof( MessageParser21 ) );
+	void *mem = QAlloc( sizeof( MessageParserImpl<Protocol> ) );
 
 	if( !mem ) {
 		ConsolePtr( debugConsole ).Printf( "Cannot allocate memory for a MessageParser\n" );
 		return nullptr;
 	}
 
-	return new(mem)MessageParser21( console, client, state21 );
+	return new(mem)MessageParserImpl<Protocol>( console, client, protocolWorldState );
+}
+
+MessageParser *MessageParser::New( int protocolVersion, Client *client, ClientWorldState *worldState, Console *console, Console *debugConsole ) {
+	switch( protocolVersion ) {
+		case Constants21::PROTOCOL:
+			return NewParser<Constants21>( client, worldState, console, debugConsole );
+		default:
+			ConsolePtr( debugConsole ).Printf( "Only 2.1 protocol is supported at this moment\n" );
+			return nullptr;
+	}
 }
 
 void MessageParser::Delete( MessageParser *parser ) {
 	if( parser ) {
 		parser->~MessageParser();
-		free( parser );
+		QFree( parser );
 	}
 }
 
-void MessageParser21::Parse( Message &message ) {
+template <typename Protocol>
+void MessageParserImpl<Protocol>::Parse( Message &message ) {
 	for(;; ) {
 		if( !message.BytesLeft() ) {
 			return;
@@ -386,7 +868,8 @@ void MessageParser21::Parse( Message &message ) {
 	}
 }
 
-void MessageParser21::ParseDemoInfo( Message &message ) {
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ParseDemoInfo( Message &message ) {
 	message.ReadLong();
 	message.ReadLong();
 	ssize_t metaDataRealSize = message.ReadLong();
@@ -406,7 +889,8 @@ void MessageParser21::ParseDemoInfo( Message &message ) {
 	}
 }
 
-void MessageParser21::ParseClientAck( Message &message ) {
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ParseClientAck( Message &message ) {
 	const int ack = message.ReadLong();
 
 	if( ack > this->lastCmdAck ) {
@@ -417,7 +901,8 @@ void MessageParser21::ParseClientAck( Message &message ) {
 	Executor()->Activate();
 }
 
-void MessageParser21::ParseServerCmd( Message &message ) {
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ParseServerCmd( Message &message ) {
 	if( !worldState->IsConnectionReliable() ) {
 		int cmdNum = message.ReadLong();
 
@@ -434,15 +919,20 @@ void MessageParser21::ParseServerCmd( Message &message ) {
 	ParseServerCs( message );
 }
 
-void MessageParser21::ParseServerCs( Message &message ) {
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ParseServerCs( Message &message ) {
 	Executor()->ExecuteCommandFromServer( message.ReadString() );
 }
 
-void MessageParser21::ParseServerData( Message &message ) {
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ParseServerData( Message &message ) {
 	worldState->protocol = message.ReadLong();
 	worldState->spawnCount = message.ReadLong();
-	message.ReadShort(); // snap frametime
-	message.ReadString(); // base game
+	worldState->snapFrameTime = message.ReadShort();
+
+	const char *baseGame = message.ReadString();
+	strncpy( worldState->baseGameBuffer, baseGame, sizeof( worldState->baseGameBuffer ) );
+	worldState->baseGameBuffer[sizeof( worldState->baseGameBuffer ) - 1] = 0;
 
 	const char *game = message.ReadString();
 	strncpy( worldState->gameBuffer, game, sizeof( worldState->gameBuffer ) );
@@ -452,7 +942,7 @@ void MessageParser21::ParseServerData( Message &message ) {
 
 	const char *level = message.ReadString();
 	strncpy( worldState->levelBuffer, level, sizeof( worldState->levelBuffer ) );
-	worldState->gameBuffer[sizeof( worldState->levelBuffer ) - 1] = 0;
+	worldState->levelBuffer[sizeof( worldState->levelBuffer ) - 1] = 0;
 
 	int bitFlags = message.ReadByte();
 	worldState->bitFlags = bitFlags;
@@ -473,25 +963,79 @@ void MessageParser21::ParseServerData( Message &message ) {
 	}
 }
 
-void MessageParser21::ParseSpawnBaseLine( Message &message ) {
-	ReadDeltaEntity( message );
-}
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ParseSpawnBaseLine( Message &message ) {
+	const unsigned startPos = message.ReadCount();
+	unsigned number;
+	unsigned bits = ReadEntityBits( message, &number );
+
+	EntitySnapshot nullState;
+	memset( &nullState, 0, sizeof( nullState ) );
+	ReadDeltaEntity( message, number, bits, &nullState, &worldState->baselines[number] );
+
+	const unsigned dataSize = message.ReadCount() - startPos;
 
-void MessageParser21::ParseFrameHeader( Message &message, int *length, uint64_t *serverTime, int *frame, int *flags ) {
-	*length = message.ReadShort();
+	if( dataSize > WorldState::MAX_BASELINE_DATA_SIZE ) {
+		console->Printf( "MessageParser21::ParseSpawnBaseLine(): the baseline data is too large to be recorded\n" );
+		worldState->baselinesDataSize[number] = 0;
+		return;
+	}
+
+	memcpy( worldState->baselinesData[number], message.Buffer() + startPos, dataSize );
+	worldState->baselinesDataSize[number] = (uint8_t)dataSize;
+}
 
-	// Note: should read a 64-bit integer in 2.1+
-	*serverTime = (uint64_t)message.ReadLong();
-	*frame = message.ReadLong();
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ParseFrameHeader( Message &message, FrameHeader *header ) {
+	header->length = (uint16_t)message.ReadShort();
 
-	message.ReadLong(); // delta frame number
-	message.ReadLong(); // ucmd executed
+	header->serverTime = Protocol::ReadServerTime( message );
+	header->frame = message.ReadLong();
+	header->deltaFrame = message.ReadLong();
+	header->ucmdExecuted = message.ReadLong();
 
-	*flags = (uint8_t)message.ReadByte();
+	header->flags = (uint8_t)message.ReadByte();
 	message.ReadByte(); // suppressCount
 }
 
-void MessageParser21::ParseGameCommands( Message &message, int frame, int flags ) {
+template <typename Protocol>
+const typename MessageParserImpl<Protocol>::Snapshot *MessageParserImpl<Protocol>::FindDeltaSnapshot( const FrameHeader &header ) {
+	if( header.deltaFrame <= 0 ) {
+		console->Printf( "MessageParser21::FindDeltaSnapshot(): illegal delta frame %d\n", header.deltaFrame );
+		return nullptr;
+	}
+
+	// A slot of this frame is going to be overwritten by the new one
+	if( header.frame - header.deltaFrame >= UPDATE_BACKUP ) {
+		return nullptr;
+	}
+
+	const Snapshot *snapshot = worldState->SnapshotForFrame( header.deltaFrame );
+
+	if( !snapshot->valid || snapshot->frameNum != header.deltaFrame ) {
+		return nullptr;
+	}
+
+	// Entities of the delta frame have been overwritten in the ring
+	if( worldState->parseEntitiesHead - snapshot->firstEntity > MAX_PARSE_ENTITIES - MAX_EDICTS ) {
+		return nullptr;
+	}
+
+	return snapshot;
+}
+
+template <typename Protocol>
+void MessageParserImpl<Protocol>::SkipFrame( Message &message, unsigned endPos ) {
+	if( message.ReadCount() < endPos ) {
+		if( !message.Skip( endPos - message.ReadCount() ) ) {
+			console->Printf( "MessageParser21::SkipFrame(): the snapshot length exceeds the message size\n" );
+			abort();
+		}
+	}
+}
+
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ParseGameCommands( Message &message, int frame, int flags ) {
 	int prefix = (uint8_t)message.ReadByte();
 
 	if( prefix != SVC_GAMECOMMANDS ) {
@@ -499,7 +1043,8 @@ void MessageParser21::ParseGameCommands( Message &message, int frame, int flags
 		abort();
 	}
 
-	int8_t targets[MAX_SERVER_CLIENTS / 8];
+	uint8_t targets[MAX_SERVER_CLIENTS / 8];
+	const int64_t lastSnapshotFrame = worldState->lastSnapshotFrame;
 
 	for(;; ) {
 		int framediff = message.ReadShort();
@@ -508,29 +1053,37 @@ void MessageParser21::ParseGameCommands( Message &message, int frame, int flags
 			break;
 		}
 		const char *cmd = message.ReadString();
-		int numTargets = 0;
+		unsigned numTargets = 0;
 
 		if( flags & FRAMESNAP_FLAG_MULTIPOV ) {
 			memset( targets, 0, sizeof( targets ) );
-			numTargets = message.ReadByte();
-			message.ReadData( targets, (unsigned) numTargets );
+			numTargets = (uint8_t)message.ReadByte();
+
+			if( numTargets > sizeof( targets ) ) {
+				console->Printf( "MessageParser21::ParseGameCommands(): illegal targets bitset size %d\n", numTargets );
+				abort();
+			}
+			message.ReadData( targets, numTargets );
 		}
 
-		if( frame > this->lastFrame + framediff ) {
+		if( frame > lastSnapshotFrame + framediff ) {
+			parseStats.gameCommands++;
+
 			if( !numTargets ) {
 				Executor()->ExecuteCommandFromServer( cmd );
 			} else {
-				console->Printf( "Multiple targets are not supported\n" );
-				abort();
+				Executor()->ExecuteTargetedCommandFromServer( cmd, targets, numTargets );
 			}
 		}
 	}
 }
 
-void MessageParser21::ParsePlayerStates( Message &message ) {
-	short *oldStats = worldState->stats;
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ParsePlayerStates( Message &message, const Snapshot *oldSnapshot, Snapshot *newSnapshot ) {
+	PlayerSnapshot nullState;
+	memset( &nullState, 0, sizeof( nullState ) );
 
-	int players = 0;
+	unsigned players = 0;
 	int prefix;
 
 	while( ( prefix = message.ReadByte() ) != 0 ) {
@@ -538,23 +1091,35 @@ void MessageParser21::ParsePlayerStates( Message &message ) {
 			console->Printf( "MessageParser21::ParsePlayerStates(): expected SVC_PLAYERINFO, got %d\n", prefix );
 			abort();
 		}
-		ParsePlayerState( message, oldStats + playerNums[players + 1] * PS_MAX_STATS, players );
-		players++;
-	}
 
-	while( players < MAX_SERVER_CLIENTS - 1 ) {
-		SetStat( playerNums[players + 1], STAT_TEAM, 0 );
+		if( players >= MAX_SERVER_CLIENTS ) {
+			console->Printf( "MessageParser21::ParsePlayerStates(): too many player states\n" );
+			abort();
+		}
+
+		const PlayerSnapshot *oldState = &nullState;
+
+		if( oldSnapshot && players < oldSnapshot->numPlayers ) {
+			oldState = &oldSnapshot->players[players];
+		}
+
+		ParsePlayerState( message, oldState, &newSnapshot->players[players] );
 		players++;
+		parseStats.playerStates++;
 	}
+
+	newSnapshot->numPlayers = players;
 }
 
-void MessageParser21::ParseAreaBits( Message &message ) {
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ParseAreaBits( Message &message ) {
 	unsigned numBytes = (uint8_t)message.ReadByte();
 
 	message.Skip( numBytes );
 }
 
-void MessageParser21::ParsePacketEntities( Message &message, unsigned startPos, int snapshotLength ) {
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ParsePacketEntities( Message &message, const Snapshot *oldSnapshot, Snapshot *newSnapshot ) {
 	int prefix = (uint8_t)message.ReadByte();
 
 	if( prefix != SVC_PACKETENTITIES ) {
@@ -562,38 +1127,145 @@ void MessageParser21::ParsePacketEntities( Message &message, unsigned startPos,
 		abort();
 	}
 
-	unsigned bytesRead = message.ReadCount() - startPos;
-	int snapshotBytesLeft = snapshotLength - bytesRead;
+	newSnapshot->firstEntity = worldState->parseEntitiesHead;
+	newSnapshot->numEntities = 0;
 
-	if( snapshotBytesLeft > 0 ) {
-		message.Skip( (unsigned)snapshotBytesLeft );
+	constexpr unsigned NO_MORE_ENTITIES = std::numeric_limits<unsigned>::max();
+	unsigned oldIndex = 0;
+	unsigned oldNum = NO_MORE_ENTITIES;
+	const EntitySnapshot *oldState = nullptr;
+
+	// Make sure we use a pointer to a copy and not to the ring slot that might be overwritten
+	EntitySnapshot oldStateCopy;
+
+	auto advanceOldState = [&]() {
+		if( oldSnapshot && oldIndex < oldSnapshot->numEntities ) {
+			oldStateCopy = *worldState->ParseEntityAt( oldSnapshot->firstEntity + oldIndex );
+			oldState = &oldStateCopy;
+			oldNum = oldState->number;
+			oldIndex++;
+		} else {
+			oldState = nullptr;
+			oldNum = NO_MORE_ENTITIES;
+		}
+	};
+
+	auto addEntity = [&]( const EntitySnapshot &state ) {
+		*worldState->ParseEntityAt( worldState->parseEntitiesHead++ ) = state;
+		newSnapshot->numEntities++;
+		parseStats.entities++;
+	};
+
+	advanceOldState();
+
+	for(;; ) {
+		unsigned newNum;
+		unsigned bits = ReadEntityBits( message, &newNum );
+
+		if( !newNum ) {
+			break;
+		}
+
+		// One or more entities from the old frame are unchanged
+		while( oldNum < newNum ) {
+			addEntity( *oldState );
+			advanceOldState();
+		}
+
+		// The entity present in the old frame is not in the current one
+		if( bits & U_REMOVE ) {
+			if( oldNum != newNum ) {
+				console->Printf( "MessageParser21::ParsePacketEntities(): U_REMOVE: oldnum != newnum\n" );
+			} else {
+				advanceOldState();
+			}
+			continue;
+		}
+
+		EntitySnapshot newState;
+
+		if( oldNum == newNum ) {
+			// Delta from the previous state
+			ReadDeltaEntity( message, newNum, bits, oldState, &newState );
+			advanceOldState();
+		} else {
+			// Delta from the baseline
+			ReadDeltaEntity( message, newNum, bits, &worldState->baselines[newNum], &newState );
+		}
+
+		addEntity( newState );
 	}
-}
 
-void MessageParser21::ParseFrame( Message &message ) {
-	int length, frame, flags;
+	// Any remaining entities of the old frame are copied over
+	while( oldNum != NO_MORE_ENTITIES ) {
+		addEntity( *oldState );
+		advanceOldState();
+	}
+}
 
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ParseFrame( Message &message ) {
 	if( message.BytesLeft() < 2 ) {
 		console->Printf( "Can't read snapshot length\n" );
 		abort();
 	}
 
-	unsigned startPos = message.ReadCount() + 2;
-	ParseFrameHeader( message, &length, &this->serverTime, &frame, &flags );
-	ParseGameCommands( message, frame, flags );
+	FrameHeader header;
+	const unsigned startPos = message.ReadCount() + 2;
+	ParseFrameHeader( message, &header );
+	const unsigned endPos = startPos + header.length;
+
+	// Reject late and duplicated frames cheaply.
+	// Their game commands have been already executed as they are resent along with newer frames.
+	if( header.frame <= worldState->lastSnapshotFrame ) {
+		SkipFrame( message, endPos );
+		return;
+	}
+
+	const Snapshot *deltaSnapshot = nullptr;
+
+	if( header.flags & FRAMESNAP_FLAG_DELTA ) {
+		if( !( deltaSnapshot = FindDeltaSnapshot( header ) ) ) {
+			// Suck up the rest of the frame and request a non-delta one instead of producing a corrupt state
+			console->Printf( "Delta frame %d is not available, requesting a non-delta frame\n", header.deltaFrame );
+			SkipFrame( message, endPos );
+			Executor()->SendFrameAck( -1, header.serverTime );
+			return;
+		}
+	}
+
+	Snapshot *newSnapshot = worldState->SnapshotForFrame( header.frame );
+	newSnapshot->valid = false;
+	newSnapshot->frameNum = header.frame;
+	newSnapshot->serverTime = header.serverTime;
+	newSnapshot->ucmdExecuted = header.ucmdExecuted;
+
+	ParseGameCommands( message, header.frame, header.flags );
 	ParseAreaBits( message );
-	ParseDeltaGameState( message );
-	ParsePlayerStates( message );
-	ParsePacketEntities( message, startPos, length );
+	ParseDeltaGameState( message, deltaSnapshot, newSnapshot );
+	ParsePlayerStates( message, deltaSnapshot, newSnapshot );
+	ParsePacketEntities( message, deltaSnapshot, newSnapshot );
 
-	if( frame > this->lastFrame ) {
-		Executor()->SendFrameAck( frame, serverTime );
+	if( message.ReadCount() > endPos ) {
+		console->Printf( "MessageParser21::ParseFrame(): the frame data exceeds the snapshot length\n" );
+		abort();
 	}
+	SkipFrame( message, endPos );
+
+	newSnapshot->valid = true;
+	worldState->lastSnapshotFrame = header.frame;
+	parseStats.frames++;
 
-	this->lastFrame = frame;
+	if( !deltaSnapshot ) {
+		parseStats.nonDeltaFrames++;
+	}
+	UpdateStats( newSnapshot );
+
+	Executor()->SendFrameAck( header.frame, header.serverTime );
 }
 
-void MessageParser21::ParseDeltaGameState( Message &message ) {
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ParseDeltaGameState( Message &message, const Snapshot *oldSnapshot, Snapshot *newSnapshot ) {
 	int prefix = (uint8_t)message.ReadByte();
 
 	if( prefix != SVC_MATCH ) {
@@ -601,6 +1273,14 @@ void MessageParser21::ParseDeltaGameState( Message &message ) {
 		abort();
 	}
 
+	if( oldSnapshot ) {
+		memcpy( newSnapshot->gameLongStats, oldSnapshot->gameLongStats, sizeof( newSnapshot->gameLongStats ) );
+		memcpy( newSnapshot->gameStats, oldSnapshot->gameStats, sizeof( newSnapshot->gameStats ) );
+	} else {
+		memset( newSnapshot->gameLongStats, 0, sizeof( newSnapshot->gameLongStats ) );
+		memset( newSnapshot->gameStats, 0, sizeof( newSnapshot->gameStats ) );
+	}
+
 	uint8_t longStatBits = (uint8_t)message.ReadByte();
 	short statBits = (short)message.ReadShort();
 
@@ -610,7 +1290,7 @@ void MessageParser21::ParseDeltaGameState( Message &message ) {
 	if( longStatBits ) {
 		for( int i = 0, mask = 1; i < MAX_GAME_LONGSTATS; ++i, mask <<= 1 ) {
 			if( longStatBits & mask ) {
-				message.ReadLong();
+				newSnapshot->gameLongStats[i] = message.ReadLong();
 			}
 		}
 	}
@@ -618,17 +1298,38 @@ void MessageParser21::ParseDeltaGameState( Message &message ) {
 	if( statBits ) {
 		for( int i = 0, mask = 1; i < MAX_GAME_STATS; ++i, mask <<= 1 ) {
 			if( statBits & mask ) {
-				message.ReadShort();
+				newSnapshot->gameStats[i] = (short)message.ReadShort();
 			}
 		}
 	}
 }
 
-void MessageParser21::SetStat( int player, int index, short value ) {
-	worldState->statsBuffer[player][index] = value;
+template <typename Protocol>
+void MessageParserImpl<Protocol>::UpdateStats( const Snapshot *snapshot ) {
+	bool *hasPlayerState = worldState->hasPlayerStateBuffer;
+	memset( hasPlayerState, 0, sizeof( worldState->hasPlayerStateBuffer ) );
+
+	for( unsigned i = 0; i < snapshot->numPlayers; ++i ) {
+		const PlayerSnapshot &state = snapshot->players[i];
+
+		if( (unsigned)state.playerNum >= MAX_SERVER_CLIENTS ) {
+			continue;
+		}
+		memcpy( worldState->statsBuffer[state.playerNum], state.stats, sizeof( state.stats ) );
+		hasPlayerState[state.playerNum] = true;
+	}
+
+	// Players that are not present in the frame are not in game
+	for( unsigned i = 0; i < MAX_SERVER_CLIENTS; ++i ) {
+		if( !hasPlayerState[i] ) {
+			worldState->statsBuffer[i][STAT_TEAM] = 0;
+		}
+		worldState->SetPlayerTeam( i, worldState->statsBuffer[i][STAT_TEAM], hasPlayerState[i] );
+	}
 }
 
-unsigned MessageParser21::ReadEntityBits( Message &message ) {
+template <typename Protocol>
+unsigned MessageParserImpl<Protocol>::ReadEntityBits( Message &message, unsigned *number ) {
 	unsigned result = (uint8_t)message.ReadByte();
 
 	if( result & U_MOREBITS1 ) {
@@ -649,20 +1350,26 @@ unsigned MessageParser21::ReadEntityBits( Message &message ) {
 		result |= ( byte << 24 ) & 0xFF000000u;
 	}
 
-	// Read (skip) entity num
 	if( result & U_NUMBER16 ) {
 		result &= ~U_NUMBER16;
-		message.ReadShort();
+		*number = (uint16_t)message.ReadShort();
 	} else {
-		message.ReadByte();
+		*number = (uint8_t)message.ReadByte();
+	}
+
+	if( *number >= MAX_EDICTS ) {
+		console->Printf( "MessageParser21::ReadEntityBits(): illegal entity number %u\n", *number );
+		abort();
 	}
 
 	return result;
 }
 
-void MessageParser21::ReadDeltaEntity( Message &message ) {
-	unsigned bits = ReadEntityBits( message );
-	int solid = 0;
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ReadDeltaEntity( Message &message, unsigned number, unsigned bits,
+									   const EntitySnapshot *from, EntitySnapshot *to ) {
+	*to = *from;
+	to->number = (uint16_t)number;
 
 	if( bits & U_TYPE ) {
 		bits &= ~U_TYPE;
@@ -671,7 +1378,7 @@ void MessageParser21::ReadDeltaEntity( Message &message ) {
 
 	if( bits & U_SOLID ) {
 		bits &= ~U_SOLID;
-		solid = message.ReadShort();
+		to->solid = (int16_t)message.ReadShort();
 	}
 
 	for( auto modelBits: { U_MODEL, U_MODEL2 } ) {
@@ -725,7 +1432,7 @@ void MessageParser21::ReadDeltaEntity( Message &message ) {
 		if( bits & angleBits ) {
 			bits &= ~angleBits;
 
-			if( solid != SOLID_BMODEL ) {
+			if( to->solid != SOLID_BMODEL ) {
 				ReadDummyAngle( message );
 			} else {
 				ReadDummyAngle16( message );
@@ -781,25 +1488,30 @@ void MessageParser21::ReadDeltaEntity( Message &message ) {
 	assert( !bits );
 }
 
-void MessageParser21::ReadDummyOrigin( Message &message ) {
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ReadDummyOrigin( Message &message ) {
 	for( int i = 0; i < 3; ++i ) {
 		message.ReadInt3();
 	}
 }
 
-void MessageParser21::ReadDummyCoord( Message &message ) {
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ReadDummyCoord( Message &message ) {
 	message.ReadInt3();
 }
 
-void MessageParser21::ReadDummyAngle( Message &message ) {
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ReadDummyAngle( Message &message ) {
 	message.ReadByte();
 }
 
-void MessageParser21::ReadDummyAngle16( Message &message ) {
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ReadDummyAngle16( Message &message ) {
 	message.ReadShort();
 }
 
-void MessageParser21::ParsePlayerState( Message &message, short *oldStats, int index ) {
+template <typename Protocol>
+void MessageParserImpl<Protocol>::ParsePlayerState( Message &message, const PlayerSnapshot *oldState, PlayerSnapshot *newState ) {
 	int flags = (uint8_t)message.ReadByte();
 	unsigned byte;
 
@@ -879,7 +1591,9 @@ void MessageParser21::ParsePlayerState( Message &message, short *oldStats, int i
 	}
 
 	if( flags & PS_PLAYERNUM ) {
-		playerNums[index] = message.ReadByte();
+		newState->playerNum = (uint8_t)message.ReadByte();
+	} else {
+		newState->playerNum = oldState->playerNum;
 	}
 
 	if( flags & PS_VIEWHEIGHT ) {
@@ -920,15 +1634,200 @@ void MessageParser21::ParsePlayerState( Message &message, short *oldStats, int i
 
 	int statBits[SNAP_STATS_LONGS];
 
-	for( int i = 0; i < SNAP_INVENTORY_LONGS; ++i ) {
+	for( int i = 0; i < SNAP_STATS_LONGS; ++i ) {
 		statBits[i] = message.ReadLong();
 	}
 
 	for( int i = 0; i < PS_MAX_STATS; ++i ) {
 		if( statBits[i >> 5] & ( 1 << ( i & 31 ) ) ) {
-			SetStat( playerNums[i + 1], i, (short)message.ReadShort() );
+			newState->stats[i] = (short)message.ReadShort();
 		} else {
-			SetStat( playerNums[i + 1], i, oldStats[i] );
+			newState->stats[i] = oldState->stats[i];
 		}
 	}
 }
+
+template <typename Protocol>
+bool MessageParserImpl<Protocol>::WriteMove( Message &message, int64_t lastFrame, uint64_t serverTime ) {
+	if( lastFrame > MAX_FRAME_NUM ) {
+		console->Printf( "MessageParser::WriteMove(): integer overflow on `lastFrame` arg\n" );
+		return false;
+	}
+
+	if( serverTime > MAX_SERVER_TIME ) {
+		console->Printf( "MessageParser::WriteMove(): integer overflow on `serverTime` arg\n" );
+		return false;
+	}
+
+	// An idle move is a single command that has no changes against a zero one (so only its bits byte is written).
+	// Its number is constant, so a server does not take repeated idle moves for new commands.
+	constexpr uint32_t idleCommandNum = 2;
+	message.WriteByte( CLC_MOVE );
+	Protocol::WriteMoveHeader( message, lastFrame, idleCommandNum, 1 );
+	message.WriteByte( 0 );
+	Protocol::WriteServerTime( message, serverTime );
+	return true;
+}
+
+template <typename Protocol>
+bool MessageParserImpl<Protocol>::WriteUserCommands( Message &message, int64_t lastFrame, uint32_t commandsHead,
+													 const UserCommand *commands, unsigned numCommands,
+													 uint64_t lastCommandServerTime, unsigned tickMillis ) {
+	if( lastFrame > MAX_FRAME_NUM || commandsHead > (uint32_t)std::numeric_limits<int>::max() ) {
+		console->Printf( "MessageParser::WriteUserCommands(): integer overflow on `lastFrame` or `commandsHead` arg\n" );
+		return false;
+	}
+
+	if( lastCommandServerTime > MAX_SERVER_TIME ) {
+		console->Printf( "MessageParser::WriteUserCommands(): integer overflow on `lastCommandServerTime` arg\n" );
+		return false;
+	}
+
+	if( !numCommands || numCommands > std::numeric_limits<uint8_t>::max() ) {
+		console->Printf( "MessageParser::WriteUserCommands(): illegal number of commands %u\n", numCommands );
+		return false;
+	}
+
+	message.WriteByte( CLC_MOVE );
+	Protocol::WriteMoveHeader( message, lastFrame, commandsHead, numCommands );
+
+	// The first command is compressed against a zero one
+	UserCommand nullCommand;
+	memset( &nullCommand, 0, sizeof( nullCommand ) );
+	const UserCommand *prev = &nullCommand;
+
+	for( unsigned i = 0; i < numCommands; ++i ) {
+		const UserCommand *command = &commands[i];
+		int bits = 0;
+
+		for( int j = 0; j < 3; ++j ) {
+			if( command->angles[j] != prev->angles[j] ) {
+				bits |= UCMD_ANGLE1 << j;
+			}
+		}
+
+		bits |= command->forwardMove != prev->forwardMove ? UCMD_FORWARD : 0;
+		bits |= command->sideMove != prev->sideMove ? UCMD_SIDE : 0;
+		bits |= command->upMove != prev->upMove ? UCMD_UP : 0;
+		bits |= command->buttons != prev->buttons ? UCMD_BUTTONS : 0;
+
+		message.WriteByte( bits );
+
+		for( int j = 0; j < 3; ++j ) {
+			if( bits & ( UCMD_ANGLE1 << j ) ) {
+				message.WriteShort( command->angles[j] );
+			}
+		}
+
+		if( bits & UCMD_FORWARD ) {
+			message.WriteChar( command->forwardMove );
+		}
+		if( bits & UCMD_SIDE ) {
+			message.WriteChar( command->sideMove );
+		}
+		if( bits & UCMD_UP ) {
+			message.WriteChar( command->upMove );
+		}
+		if( bits & UCMD_BUTTONS ) {
+			message.WriteByte( command->buttons );
+		}
+
+		// Commands of a batch belong to consecutive ticks
+		uint64_t serverTime = lastCommandServerTime;
+		const uint64_t ticksToLast = numCommands - 1 - i;
+		if( serverTime > ticksToLast * tickMillis ) {
+			serverTime -= ticksToLast * tickMillis;
+		}
+		Protocol::WriteServerTime( message, serverTime );
+
+		prev = command;
+	}
+
+	return true;
+}
+
+template <typename Protocol>
+void MessageParserImpl<Protocol>::RecordAndClearIfFull( DemoRecorder *recorder, Message &message, unsigned sizeToAdd ) {
+	// Keep recorded messages small enough to be handled by any client
+	if( message.CurrSize() + sizeToAdd > MAX_MSGLEN / 2 ) {
+		recorder->RecordMessage( message );
+		message.Clear();
+	}
+}
+
+template <typename Protocol>
+void MessageParserImpl<Protocol>::WriteDemoHeader( DemoRecorder *recorder ) {
+	Message &message = recorder->PrepareMessage();
+
+	message.WriteByte( SVC_SERVERDATA );
+	message.WriteLong( worldState->protocol );
+	message.WriteLong( worldState->spawnCount );
+	message.WriteShort( worldState->snapFrameTime );
+	message.WriteString( worldState->baseGameBuffer );
+	message.WriteString( worldState->gameBuffer );
+	// Demos are played back from a spectator point of view
+	message.WriteShort( -1 );
+	message.WriteString( worldState->levelBuffer );
+	// Downloads are not available during a demo playback
+	message.WriteByte( worldState->bitFlags & ~SV_BITFLAGS_HTTP );
+	message.WriteShort( 0 );
+
+	constexpr unsigned metaDataMaxSize = DemoRecorder::MAX_META_DATA_SIZE;
+	message.WriteByte( SVC_DEMOINFO );
+	message.WriteLong( 3 * 4 + metaDataMaxSize );
+	// An offset of the meta data size fields relative to this field end
+	message.WriteLong( 0 );
+	// Sizes and data are patched by the recorder on stop
+	recorder->SetMetaDataOffset( recorder->NextMessageDataOffset() + message.CurrSize() );
+	message.WriteLong( 0 );
+	message.WriteLong( metaDataMaxSize );
+	for( unsigned i = 0; i < metaDataMaxSize; i += 4 ) {
+		message.WriteLong( 0 );
+	}
+
+	recorder->RecordMessage( message );
+	message.Clear();
+
+	char buffer[MAX_CONFIGSTRING_CHARS + 32];
+	for( unsigned i = 0; i < worldState->maxConfigStrings; ++i ) {
+		const char *configString = worldState->configStringsBuffer[i];
+
+		if( !*configString ) {
+			continue;
+		}
+
+		int length = snprintf( buffer, sizeof( buffer ), "cs %u \"%s\"", i, configString );
+		RecordAndClearIfFull( recorder, message, (unsigned)length + 2 );
+		message.WriteByte( SVC_SERVERCS );
+		message.WriteString( buffer );
+	}
+
+	for( unsigned i = 0; i < MAX_EDICTS; ++i ) {
+		const unsigned dataSize = worldState->baselinesDataSize[i];
+
+		if( !dataSize ) {
+			continue;
+		}
+
+		RecordAndClearIfFull( recorder, message, dataSize + 1 );
+		message.WriteByte( SVC_SPAWNBASELINE );
+		message.WriteData( worldState->baselinesData[i], dataSize );
+	}
+
+	if( message.CurrSize() ) {
+		recorder->RecordMessage( message );
+		message.Clear();
+	}
+
+	// Enter the game in a separate message (this follows the original implementation)
+	message.WriteByte( SVC_SERVERCS );
+	message.WriteString( "precache" );
+	recorder->RecordMessage( message );
+}
+
+template <typename Protocol>
+void MessageParserImpl<Protocol>::WriteDemoMetaData( DemoRecorder *recorder ) {
+	recorder->SetMetaKeyValue( "hostname", worldState->configStringsBuffer[CS_HOSTNAME] );
+	recorder->SetMetaKeyValue( "mapname", worldState->configStringsBuffer[CS_MAPNAME] );
+	recorder->SetMetaKeyValue( "gametype", worldState->configStringsBuffer[CS_GAMETYPENAME] );
+}
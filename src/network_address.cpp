@@ -16,7 +16,28 @@
 #error There is no Windows-compatible version yet
 #endif
 
+bool UnresolvedAddress::IsValidHostName( const char *string, size_t length ) {
+	if( !length || length >= MAX_HOST_CHARS || string[0] == '-' || string[0] == '.' ) {
+		return false;
+	}
+
+	for( size_t i = 0; i < length; ++i ) {
+		const char ch = string[i];
+
+		if( ( ch >= 'a' && ch <= 'z' ) || ( ch >= 'A' && ch <= 'Z' ) || ( ch >= '0' && ch <= '9' ) ) {
+			continue;
+		}
+
+		if( ch != '.' && ch != '-' && ch != '_' ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
 UnresolvedAddress::UnresolvedAddress( const char *string ) {
+	const char *firstSemicolon = nullptr;
 	const char *semicolon = nullptr;
 	const char *s = string;
 	const char *openingBracket = nullptr;
@@ -26,9 +47,14 @@ UnresolvedAddress::UnresolvedAddress( const char *string ) {
 
 	hasParsingErrors = false;
 	isResolved = false;
+	port = DEFAULT_PORT;
+	host[0] = 0;
 
 	while( *s ) {
 		if( *s == ':' ) {
+			if( !firstSemicolon ) {
+				firstSemicolon = s;
+			}
 			semicolon = s;
 		} else if( *s == '[' ) {
 			if( !openingBracket ) {
@@ -62,21 +88,46 @@ UnresolvedAddress::UnresolvedAddress( const char *string ) {
 		}
 
 		if( !semicolon ) {
-			hasParsingErrors = true;
+			// Treat the address as a host name without a port
+			if( !IsValidHostName( string, length ) ) {
+				hasParsingErrors = true;
+				return;
+			}
+
+			memcpy( host, string, length + 1 );
 			return;
 		}
 
-		// Try parse as an IP v4 address with a port
-		long port = strtol( semicolon + 1, &endptr, 10 );
+		if( semicolon == firstSemicolon ) {
+			// Try parse as an IP v4 address or a host name with a port
+			long parsedPort = strtol( semicolon + 1, &endptr, 10 );
 
-		if( port > 0 && port < std::numeric_limits<uint16_t>::max() && !endptr[0] ) {
-			memcpy( buffer, string, semicolon - string );
-			buffer[semicolon - string] = 0;
+			if( parsedPort <= 0 || parsedPort >= std::numeric_limits<uint16_t>::max() || endptr[0] ) {
+				hasParsingErrors = true;
+				return;
+			}
 
-			if( address.TryParseAs( AF_INET, (uint16_t)port, buffer ) ) {
-				isResolved = true;
+			const size_t hostLength = semicolon - string;
+
+			if( hostLength < sizeof( buffer ) ) {
+				memcpy( buffer, string, hostLength );
+				buffer[hostLength] = 0;
+
+				if( address.TryParseAs( AF_INET, (uint16_t)parsedPort, buffer ) ) {
+					isResolved = true;
+					return;
+				}
+			}
+
+			if( !IsValidHostName( string, hostLength ) ) {
+				hasParsingErrors = true;
 				return;
 			}
+
+			memcpy( host, string, hostLength );
+			host[hostLength] = 0;
+			port = (uint16_t)parsedPort;
+			return;
 		}
 
 		// Try parse as an IP v6 address without a port
@@ -85,7 +136,7 @@ UnresolvedAddress::UnresolvedAddress( const char *string ) {
 			return;
 		}
 
-		// Treat the address as unresolved one
+		hasParsingErrors = true;
 		return;
 	}
 
@@ -94,14 +145,19 @@ UnresolvedAddress::UnresolvedAddress( const char *string ) {
 		return;
 	}
 
+	if( closingBracket - openingBracket - 1 >= (ptrdiff_t)sizeof( buffer ) ) {
+		hasParsingErrors = true;
+		return;
+	}
+
 	if( semicolon > closingBracket ) {
 		// Try parse as an IP v6 address with a port
 		memcpy( buffer, openingBracket + 1, closingBracket - openingBracket - 1 );
 		buffer[closingBracket - openingBracket - 1] = 0;
-		long port = strtol( semicolon + 1, &endptr, 10 );
+		long parsedPort = strtol( semicolon + 1, &endptr, 10 );
 
-		if( port > 0 && port < std::numeric_limits<uint16_t>::max() && !endptr[0] ) {
-			if( address.TryParseAs( AF_INET6, (uint16_t)port, buffer ) ) {
+		if( parsedPort > 0 && parsedPort < std::numeric_limits<uint16_t>::max() && !endptr[0] ) {
+			if( address.TryParseAs( AF_INET6, (uint16_t)parsedPort, buffer ) ) {
 				isResolved = true;
 				return;
 			}
@@ -120,7 +176,8 @@ UnresolvedAddress::UnresolvedAddress( const char *string ) {
 		}
 	}
 
-	// Treat the address as unresolved one
+	// Host names in brackets are not allowed
+	hasParsingErrors = true;
 }
 
 NetworkAddress UnresolvedAddress::ToResolvedAddress() const {
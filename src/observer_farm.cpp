@@ -0,0 +1,453 @@
+#include "observer_farm.h"
+#include "allocator.h"
+#include "client.h"
+#include "console.h"
+#include "static_listeners.h"
+#include "system.h"
+
+#include <new>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#else
+#error There is no Windows-compatible version yet
+#endif
+
+/**
+ * Forwards output of an observer client to the system console tagged by the observer slot number.
+ */
+class ObserverConsole : public Console
+{
+	Console *target;
+	unsigned observerIndex;
+
+public:
+	ObserverConsole( Console *target_, unsigned observerIndex_ ) : target( target_ ), observerIndex( observerIndex_ ) {}
+
+	void VPrintf( const char *format, va_list va ) override {
+		char buffer[MAX_STRING_CHARS];
+		vsnprintf( buffer, sizeof( buffer ), format, va );
+		target->Printf( "[observer %u] %s", observerIndex, buffer );
+	}
+};
+
+// Observers do not handle anything that is not posted to the event stream
+typedef StaticClientListener<ClientListenerPolicy> ObserverClientListener;
+
+static void FormatAddress( const NetworkAddress &address, char *buffer, size_t bufferSize ) {
+	char host[INET6_ADDRSTRLEN];
+
+	if( const sockaddr_in *in4 = address.AsIpV4Sockaddr() ) {
+		inet_ntop( AF_INET, &in4->sin_addr, host, sizeof( host ) );
+		snprintf( buffer, bufferSize, "%s:%u", host, (unsigned)address.Port() );
+	} else if( const sockaddr_in6 *in6 = address.AsIpV6Sockaddr() ) {
+		inet_ntop( AF_INET6, &in6->sin6_addr, host, sizeof( host ) );
+		snprintf( buffer, bufferSize, "[%s]:%u", host, (unsigned)address.Port() );
+	} else {
+		buffer[0] = '\0';
+	}
+}
+
+ObserverFarmSettings::ObserverFarmSettings() {
+	minPlayers = 1;
+	maxConnections = 16;
+	leaveDelay = 30000;
+	connectTimeout = 15000;
+	retryDelay = 60000;
+	QStrncpyz( playerName, "observer", MAX_NAME_CHARS );
+}
+
+ObserverFarm::ServerListHook::~ServerListHook() {
+	if( listener ) {
+		listener->~ServerListListener();
+		free( listener );
+	}
+}
+
+void ObserverFarm::ServerListHook::OnServerAdded( const PolledGameServer &server ) {
+	farm->UpdateServer( server );
+
+	if( listener ) {
+		listener->OnServerAdded( server );
+	}
+}
+
+void ObserverFarm::ServerListHook::OnServerRemoved( const PolledGameServer &server ) {
+	farm->RemoveServer( server );
+
+	if( listener ) {
+		listener->OnServerRemoved( server );
+	}
+}
+
+void ObserverFarm::ServerListHook::OnServerUpdated( const PolledGameServer &server ) {
+	farm->UpdateServer( server );
+
+	if( listener ) {
+		listener->OnServerUpdated( server );
+	}
+}
+
+ObserverFarm::ObserverFarm( System *system_, Console *console_, ClientEventStream *stream_,
+							const ObserverFarmSettings &settings_, Observer *observers_,
+							TrackedServer *servers_, unsigned serversCapacity_ )
+	: system( system_ ),
+	console( console_ ),
+	stream( stream_ ),
+	settings( settings_ ),
+	observers( observers_ ),
+	servers( servers_ ),
+	numServers( 0 ),
+	serversCapacity( serversCapacity_ ),
+	lastCheckAt( 0 ) {
+	memset( &stats, 0, sizeof( stats ) );
+
+	for( unsigned i = 0; i < settings.maxConnections; ++i ) {
+		observers[i].client = nullptr;
+		observers[i].connectDeadline = 0;
+		observers[i].serverIndex = 0;
+		observers[i].state = OBSERVER_FREE;
+	}
+}
+
+ObserverFarm::~ObserverFarm() {
+	for( unsigned i = 0; i < settings.maxConnections; ++i ) {
+		if( observers[i].client ) {
+			system->DeleteClient( observers[i].client );
+		}
+	}
+
+	QFree( observers );
+	QFree( servers );
+}
+
+ObserverFarm *ObserverFarm::New( System *system, Console *console, ClientEventStream *stream,
+								 const ObserverFarmSettings &settings, unsigned maxServers ) {
+	if( !settings.maxConnections ) {
+		console->Printf( "ObserverFarm::New(): the connection budget is zero\n" );
+		return nullptr;
+	}
+
+	ObserverFarmSettings actualSettings( settings );
+
+	if( actualSettings.maxConnections > MAX_FAKE_CLIENT_INSTANCES ) {
+		console->Printf( "ObserverFarm::New(): the connection budget is limited to %u clients\n", MAX_FAKE_CLIENT_INSTANCES );
+		actualSettings.maxConnections = MAX_FAKE_CLIENT_INSTANCES;
+	}
+
+	const unsigned serversCapacity = maxServers ? maxServers : 1;
+
+	void *mem = QAlloc( sizeof( ObserverFarm ) );
+	Observer *observers = (Observer *)QAlloc( actualSettings.maxConnections * sizeof( Observer ) );
+	TrackedServer *servers = AllocServers( serversCapacity );
+
+	if( !mem || !observers || !servers ) {
+		console->Printf( "ObserverFarm::New(): cannot allocate memory for %u observers and %u servers\n",
+						 actualSettings.maxConnections, serversCapacity );
+		QFree( mem );
+		QFree( observers );
+		QFree( servers );
+		return nullptr;
+	}
+
+	return new(mem)ObserverFarm( system, console, stream, actualSettings, observers, servers, serversCapacity );
+}
+
+ObserverFarm::TrackedServer *ObserverFarm::AllocServers( unsigned capacity ) {
+	auto *servers = (TrackedServer *)QAlloc( capacity * sizeof( TrackedServer ) );
+
+	if( servers ) {
+		for( unsigned i = 0; i < capacity; ++i ) {
+			new( &servers[i] )TrackedServer();
+		}
+	}
+
+	return servers;
+}
+
+bool ObserverFarm::GrowServers() {
+	TrackedServer *newServers = AllocServers( serversCapacity * 2 );
+
+	if( !newServers ) {
+		return false;
+	}
+
+	for( unsigned i = 0; i < numServers; ++i ) {
+		newServers[i] = servers[i];
+	}
+
+	QFree( servers );
+	servers = newServers;
+	serversCapacity *= 2;
+	return true;
+}
+
+void ObserverFarm::Delete( ObserverFarm *farm ) {
+	if( farm ) {
+		farm->~ObserverFarm();
+		QFree( farm );
+	}
+}
+
+ServerListListener *ObserverFarm::NewServerListListener( ServerListListener *listener ) {
+	void *mem = malloc( sizeof( ServerListHook ) );
+
+	if( !mem ) {
+		console->Printf( "ObserverFarm::NewServerListListener(): cannot allocate memory for a listener\n" );
+		return nullptr;
+	}
+
+	return new(mem)ServerListHook( this, listener );
+}
+
+ObserverFarm::TrackedServer *ObserverFarm::FindServer( const NetworkAddress &address ) {
+	for( unsigned i = 0; i < numServers; ++i ) {
+		if( servers[i].address == address ) {
+			return &servers[i];
+		}
+	}
+
+	return nullptr;
+}
+
+void ObserverFarm::UpdateServer( const PolledGameServer &server ) {
+	if( !server.CurrInfo() ) {
+		return;
+	}
+
+	TrackedServer *tracked = FindServer( server.Address() );
+
+	if( !tracked ) {
+		// The server list limit might have been raised after the farm start
+		if( numServers == serversCapacity && !GrowServers() ) {
+			console->Printf( "ObserverFarm::UpdateServer(): cannot track more than %u servers\n", serversCapacity );
+			return;
+		}
+
+		tracked = &servers[numServers++];
+		tracked->address = server.Address();
+		tracked->emptySince = 0;
+		tracked->retryAt = 0;
+		tracked->observerIndex = -1;
+		FormatAddress( tracked->address, tracked->addressString, sizeof( tracked->addressString ) );
+		stats.numTrackedServers = numServers;
+	}
+
+	QStrncpyz( tracked->name, server.ServerName().Get(), sizeof( tracked->name ) );
+
+	int numPlayers = (int)server.NumClients() - (int)server.NumBots();
+
+	// The own observer is counted by the server as well
+	if( tracked->observerIndex >= 0 ) {
+		numPlayers--;
+	}
+
+	tracked->numPlayers = numPlayers > 0 ? (unsigned)numPlayers : 0;
+
+	if( tracked->numPlayers >= settings.minPlayers ) {
+		tracked->emptySince = 0;
+	} else if( !tracked->emptySince ) {
+		tracked->emptySince = system->Millis() + 1;
+	}
+}
+
+void ObserverFarm::RemoveServer( const PolledGameServer &server ) {
+	TrackedServer *tracked = FindServer( server.Address() );
+
+	if( !tracked ) {
+		return;
+	}
+
+	if( tracked->observerIndex >= 0 ) {
+		stats.departures++;
+		Detach( (unsigned)tracked->observerIndex, 0 );
+	}
+
+	// Move the last server to the freed place and fix the reference of its observer
+	const unsigned index = (unsigned)( tracked - servers );
+	const unsigned lastIndex = --numServers;
+
+	if( index != lastIndex ) {
+		servers[index] = servers[lastIndex];
+
+		if( servers[index].observerIndex >= 0 ) {
+			observers[servers[index].observerIndex].serverIndex = index;
+		}
+	}
+
+	stats.numTrackedServers = numServers;
+}
+
+Client *ObserverFarm::ObserverClient( unsigned observerIndex ) {
+	Observer *observer = &observers[observerIndex];
+
+	if( observer->client ) {
+		return observer->client;
+	}
+
+	void *consoleMem = malloc( sizeof( ObserverConsole ) );
+	void *listenerMem = malloc( sizeof( ObserverClientListener ) );
+
+	if( !consoleMem || !listenerMem ) {
+		console->Printf( "ObserverFarm::ObserverClient(): cannot allocate memory for a client\n" );
+		free( consoleMem );
+		free( listenerMem );
+		return nullptr;
+	}
+
+	Console *clientConsole = new( consoleMem )ObserverConsole( console, observerIndex );
+	Client *client = system->NewClient( clientConsole );
+
+	if( !client ) {
+		console->Printf( "ObserverFarm::ObserverClient(): cannot create a client (the limit is %u)\n", MAX_FAKE_CLIENT_INSTANCES );
+		clientConsole->~Console();
+		free( consoleMem );
+		free( listenerMem );
+		return nullptr;
+	}
+
+	client->SetName( settings.playerName );
+	client->SetListener( new( listenerMem )ObserverClientListener );
+	client->SetEventStream( stream, (uint16_t)observerIndex );
+
+	observer->client = client;
+	return client;
+}
+
+void ObserverFarm::PostEvent( ClientEvent::Type type, unsigned observerIndex, const TrackedServer &server ) {
+	stream->TryAppend( type, (uint16_t)observerIndex, system->Millis(), server.name, server.addressString );
+}
+
+void ObserverFarm::Attach( unsigned observerIndex, unsigned serverIndex, uint64_t now ) {
+	TrackedServer *server = &servers[serverIndex];
+	Client *client = ObserverClient( observerIndex );
+
+	if( !client ) {
+		server->retryAt = now + settings.retryDelay;
+		return;
+	}
+
+	char command[sizeof( server->addressString ) + 16];
+	snprintf( command, sizeof( command ), "connect \"%s\"", server->addressString );
+
+	stats.connectAttempts++;
+	client->ExecuteCommand( command );
+
+	Observer *observer = &observers[observerIndex];
+	observer->state = OBSERVER_CONNECTING;
+	observer->connectDeadline = now + settings.connectTimeout;
+	observer->serverIndex = serverIndex;
+	server->observerIndex = (int)observerIndex;
+	stats.numConnecting++;
+
+	PostEvent( ClientEvent::OBSERVER_ATTACHED, observerIndex, *server );
+}
+
+void ObserverFarm::Detach( unsigned observerIndex, unsigned retryDelay ) {
+	Observer *observer = &observers[observerIndex];
+	TrackedServer *server = &servers[observer->serverIndex];
+
+	observer->client->ExecuteCommand( "disconnect" );
+
+	if( observer->state == OBSERVER_CONNECTING ) {
+		stats.numConnecting--;
+	} else {
+		stats.numObserving--;
+	}
+
+	observer->state = OBSERVER_FREE;
+	server->observerIndex = -1;
+	server->retryAt = system->Millis() + retryDelay;
+
+	PostEvent( ClientEvent::OBSERVER_DETACHED, observerIndex, *server );
+}
+
+void ObserverFarm::Frame() {
+	const uint64_t now = system->Millis();
+
+	if( now - lastCheckAt < STATE_CHECK_INTERVAL ) {
+		return;
+	}
+
+	lastCheckAt = now;
+
+	CheckObservers( now );
+	AttachObservers( now );
+}
+
+void ObserverFarm::CheckObservers( uint64_t now ) {
+	for( unsigned i = 0; i < settings.maxConnections; ++i ) {
+		Observer *observer = &observers[i];
+
+		if( observer->state == OBSERVER_CONNECTING ) {
+			if( observer->client->HasEnteredGame() ) {
+				stats.connectionsEstablished++;
+				stats.numConnecting--;
+				stats.numObserving++;
+				observer->state = OBSERVER_ACTIVE;
+			} else if( now >= observer->connectDeadline ) {
+				stats.connectTimeouts++;
+				Detach( i, settings.retryDelay );
+				continue;
+			}
+		} else if( observer->state == OBSERVER_ACTIVE ) {
+			if( !observer->client->HasEnteredGame() ) {
+				stats.droppedConnections++;
+				Detach( i, settings.retryDelay );
+				continue;
+			}
+		} else {
+			continue;
+		}
+
+		const uint64_t emptySince = servers[observer->serverIndex].emptySince;
+
+		if( emptySince && now >= emptySince + settings.leaveDelay ) {
+			stats.departures++;
+			Detach( i, 0 );
+		}
+	}
+}
+
+void ObserverFarm::AttachObservers( uint64_t now ) {
+	unsigned nextFreeObserver = 0;
+
+	for(;; ) {
+		while( nextFreeObserver < settings.maxConnections && observers[nextFreeObserver].state != OBSERVER_FREE ) {
+			nextFreeObserver++;
+		}
+
+		// Pick the most populated server that is not observed, count other ones
+		int bestServer = -1;
+		unsigned numUnobservedServers = 0;
+
+		for( unsigned i = 0; i < numServers; ++i ) {
+			const TrackedServer &server = servers[i];
+
+			if( server.observerIndex >= 0 || server.numPlayers < settings.minPlayers ) {
+				continue;
+			}
+
+			numUnobservedServers++;
+
+			if( server.retryAt > now ) {
+				continue;
+			}
+
+			if( bestServer < 0 || server.numPlayers > servers[bestServer].numPlayers ) {
+				bestServer = (int)i;
+			}
+		}
+
+		if( bestServer < 0 || nextFreeObserver == settings.maxConnections ) {
+			stats.numUnobservedServers = numUnobservedServers;
+			return;
+		}
+
+		Attach( nextFreeObserver, (unsigned)bestServer, now );
+	}
+}
@@ -1,11 +1,17 @@
+#include "address_resolver.h"
+#include "allocator.h"
 #include "client.h"
 #include "command_parser.h"
+#include "demo_recorder.h"
 #include "message_parser.h"
 #include "protocol_executor.h"
 
+#include <algorithm>
+#include <initializer_list>
 #include <new>
 #include <limits>
 #include <stdlib.h>
+#include <time.h>
 
 AbstractClientProtocolExecutor::AbstractClientProtocolExecutor( Client *client_ )
 	: client( client_ ),
@@ -16,6 +22,141 @@ AbstractClientProtocolExecutor::AbstractClientProtocolExecutor( Client *client_
 	configStringsStride( 0 ) {
 }
 
+template <unsigned... Indices>
+struct IndexSequence {};
+
+template <unsigned N, unsigned... Indices>
+struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, Indices...> {};
+
+template <unsigned... Indices>
+struct MakeIndexSequence<0, Indices...> {
+	typedef IndexSequence<Indices...> Type;
+};
+
+typedef StaticCommandTable::Entry CommandEntry;
+
+static constexpr CommandEntry BuiltinCommand( const char *name, StaticCommandTable::CommandHandler handler ) {
+	return CommandEntry { name, handler, GetConstStringHash( name ), GetConstStringLength( name ) };
+}
+
+/**
+ * Lays out a list of commands by slots of a perfect hash table at compile time.
+ * @tparam Commands A type that provides a constexpr array of commands and parameters of the hash.
+ */
+template <typename Commands>
+struct PerfectHashLayout {
+	static constexpr unsigned NUM_COMMANDS = sizeof( Commands::commands ) / sizeof( Commands::commands[0] );
+	static constexpr unsigned NUM_SLOTS = 1u << Commands::SLOT_BITS;
+
+	static constexpr unsigned SlotOf( unsigned index ) {
+		return StaticCommandTable::SlotForHash( Commands::commands[index].nameHash, Commands::MULTIPLIER, Commands::SLOT_BITS );
+	}
+
+	static constexpr CommandEntry EntryForSlot( unsigned slot, unsigned index = 0 ) {
+		return index == NUM_COMMANDS
+			? CommandEntry { nullptr, nullptr, 0, 0 }
+			: ( SlotOf( index ) == slot ? Commands::commands[index] : EntryForSlot( slot, index + 1 ) );
+	}
+
+	static constexpr unsigned NumCommandsInSlot( unsigned slot, unsigned index = 0 ) {
+		return index == NUM_COMMANDS ? 0 : ( SlotOf( index ) == slot ? 1 : 0 ) + NumCommandsInSlot( slot, index + 1 );
+	}
+
+	static constexpr bool IsPerfect( unsigned slot = 0 ) {
+		return slot == NUM_SLOTS || ( NumCommandsInSlot( slot ) <= 1 && IsPerfect( slot + 1 ) );
+	}
+};
+
+template <typename Commands, typename Slots = typename MakeIndexSequence<PerfectHashLayout<Commands>::NUM_SLOTS>::Type>
+struct PerfectHashSlots;
+
+template <typename Commands, unsigned... Slots>
+struct PerfectHashSlots<Commands, IndexSequence<Slots...>> {
+	static constexpr CommandEntry slots[sizeof...( Slots )] = { PerfectHashLayout<Commands>::EntryForSlot( Slots )... };
+};
+
+template <typename Commands, unsigned... Slots>
+constexpr CommandEntry PerfectHashSlots<Commands, IndexSequence<Slots...>>::slots[sizeof...( Slots )];
+
+struct BuiltinServerCommands {
+	typedef GenericClientProtocolExecutor GPTE;
+
+	// Found by a brute-force search for the current set of names
+	static constexpr uint32_t MULTIPLIER = 0x9E37C7D1u;
+	static constexpr unsigned SLOT_BITS = 6;
+
+	static constexpr CommandEntry commands[] = {
+		BuiltinCommand( "challenge", &GPTE::ServerCommand_Challenge ),
+		BuiltinCommand( "client_connect", &GPTE::ServerCommand_ClientConnect ),
+		BuiltinCommand( "cs", &GPTE::ServerCommand_Cs ),
+		BuiltinCommand( "cmd", &GPTE::ServerCommand_Cmd ),
+		BuiltinCommand( "precache", &GPTE::ServerCommand_Precache ),
+		BuiltinCommand( "disconnect", &GPTE::ServerCommand_Disconnect ),
+		BuiltinCommand( "reject", &GPTE::ServerCommand_Reject ),
+		BuiltinCommand( "forcereconnect", &GPTE::ServerCommand_ForceReconnect ),
+		BuiltinCommand( "reconnect", &GPTE::ServerCommand_Reconnect ),
+
+		BuiltinCommand( "pr", &GPTE::ServerCommand_Pr ),
+		BuiltinCommand( "print", &GPTE::ServerCommand_Print ),
+		BuiltinCommand( "ch", &GPTE::ServerCommand_Ch ),
+		BuiltinCommand( "tch", &GPTE::ServerCommand_Tch ),
+		BuiltinCommand( "tvch", &GPTE::ServerCommand_Tvch ),
+		BuiltinCommand( "motd", &GPTE::ServerCommand_Motd ),
+		BuiltinCommand( "scb", &GPTE::ServerCommand_Scb ),
+
+		BuiltinCommand( "mm", nullptr ),
+		BuiltinCommand( "mapmsg", nullptr ),
+		BuiltinCommand( "plstats", nullptr ),
+		BuiltinCommand( "obry", nullptr ),
+		BuiltinCommand( "ti", nullptr ),
+		BuiltinCommand( "cvarinfo", nullptr ),
+		BuiltinCommand( "demoget", nullptr ),
+		BuiltinCommand( "cha", nullptr ),
+		BuiltinCommand( "chr", nullptr ),
+		BuiltinCommand( "mecu", nullptr ),
+		BuiltinCommand( "meop", nullptr ),
+		BuiltinCommand( "memo", nullptr ),
+		BuiltinCommand( "changing", nullptr ),
+		BuiltinCommand( "cp", nullptr ),
+		BuiltinCommand( "cpf", nullptr ),
+		BuiltinCommand( "aw", nullptr ),
+		BuiltinCommand( "qm", nullptr )
+	};
+};
+
+struct BuiltinClientCommands {
+	typedef GenericClientProtocolExecutor GPTE;
+
+	// Found by a brute-force search for the current set of names
+	static constexpr uint32_t MULTIPLIER = 0x9E3779BBu;
+	static constexpr unsigned SLOT_BITS = 3;
+
+	static constexpr CommandEntry commands[] = {
+		BuiltinCommand( "connect", &GPTE::Command_Connect ),
+		BuiltinCommand( "disconnect", &GPTE::Command_Disconnect ),
+		BuiltinCommand( "multiview", &GPTE::Command_Multiview ),
+		BuiltinCommand( "record", &GPTE::Command_Record ),
+		BuiltinCommand( "stop", &GPTE::Command_Stop ),
+#ifndef PUBLIC_BUILD
+		BuiltinCommand( "test_listener", &GPTE::Command_TestListener ),
+#endif
+	};
+};
+
+constexpr CommandEntry BuiltinServerCommands::commands[];
+constexpr CommandEntry BuiltinClientCommands::commands[];
+
+static_assert( PerfectHashLayout<BuiltinServerCommands>::IsPerfect(), "Server command names collide, find another multiplier" );
+static_assert( PerfectHashLayout<BuiltinClientCommands>::IsPerfect(), "Client command names collide, find another multiplier" );
+
+static constexpr StaticCommandTable builtinServerCommands( PerfectHashSlots<BuiltinServerCommands>::slots,
+														  BuiltinServerCommands::MULTIPLIER,
+														  BuiltinServerCommands::SLOT_BITS );
+
+static constexpr StaticCommandTable builtinClientCommands( PerfectHashSlots<BuiltinClientCommands>::slots,
+														  BuiltinClientCommands::MULTIPLIER,
+														  BuiltinClientCommands::SLOT_BITS );
+
 GenericClientProtocolExecutor::GenericClientProtocolExecutor( Client *client_,
 															  ClientWorldState *worldState_,
 															  MessageParser *messageParser_,
@@ -23,55 +164,16 @@ GenericClientProtocolExecutor::GenericClientProtocolExecutor( Client *client_,
 	: AbstractClientProtocolExecutor( client_ ),
 	channel( console, system, this ),
 	commandBuffer( console, system, this ),
-	serverCommandHandlers( this, "trying to execute a server command" ),
-	clientCommandHandlers( this, "trying to execute a command" ),
+	serverCommandHandlers( this, "trying to execute a server command", &builtinServerCommands ),
+	clientCommandHandlers( this, "trying to execute a command", &builtinClientCommands ),
 	protocolVersion( protocolVersion_ ),
 	worldState( worldState_ ),
 	messageParser( messageParser_ ) {
 
-	// Should be set by the client later
-	name[0] = 0;
-	password[0] = 0;
-
-	typedef GenericClientProtocolExecutor GPTE;
+	ResetSessionFields();
 
-	// Register persistent server commands
-
-	serverCommandHandlers.Register( "challenge", &GPTE::ServerCommand_Challenge );
-	serverCommandHandlers.Register( "client_connect", &GPTE::ServerCommand_ClientConnect );
-	serverCommandHandlers.Register( "cs", &GPTE::ServerCommand_Cs );
-	serverCommandHandlers.Register( "cmd", &GPTE::ServerCommand_Cmd );
-	serverCommandHandlers.Register( "precache", &GPTE::ServerCommand_Precache );
-	serverCommandHandlers.Register( "disconnect", &GPTE::ServerCommand_Disconnect );
-	serverCommandHandlers.Register( "reject", &GPTE::ServerCommand_Reject );
-	serverCommandHandlers.Register( "forcereconnect", &GPTE::ServerCommand_ForceReconnect );
-	serverCommandHandlers.Register( "reconnect", &GPTE::ServerCommand_Reconnect );
-
-	serverCommandHandlers.Register( "pr", &GPTE::ServerCommand_Pr );
-	serverCommandHandlers.Register( "print", &GPTE::ServerCommand_Print );
-	serverCommandHandlers.Register( "ch", &GPTE::ServerCommand_Ch );
-	serverCommandHandlers.Register( "tch", &GPTE::ServerCommand_Tch );
-	serverCommandHandlers.Register( "tvch", &GPTE::ServerCommand_Tvch );
-	serverCommandHandlers.Register( "motd", &GPTE::ServerCommand_Motd );
-
-	serverCommandHandlers.Register( "mm", nullptr );
-	serverCommandHandlers.Register( "mapmsg", nullptr );
-	serverCommandHandlers.Register( "plstats", nullptr );
-	serverCommandHandlers.Register( "scb", nullptr );
-	serverCommandHandlers.Register( "obry", nullptr );
-	serverCommandHandlers.Register( "ti", nullptr );
-	serverCommandHandlers.Register( "cvarinfo", nullptr );
-	serverCommandHandlers.Register( "demoget", nullptr );
-	serverCommandHandlers.Register( "cha", nullptr );
-	serverCommandHandlers.Register( "chr", nullptr );
-	serverCommandHandlers.Register( "mecu", nullptr );
-	serverCommandHandlers.Register( "meop", nullptr );
-	serverCommandHandlers.Register( "memo", nullptr );
-	serverCommandHandlers.Register( "changing", nullptr );
-	serverCommandHandlers.Register( "cp", nullptr );
-	serverCommandHandlers.Register( "cpf", nullptr );
-	serverCommandHandlers.Register( "aw", nullptr );
-	serverCommandHandlers.Register( "qm", nullptr );
+	// Built-in commands are provided by shared static tables.
+	// Commands that are registered after a new generation tag are removed on Reset().
 
 	serverCommandHandlers.NewGenerationTag();
 
@@ -81,19 +183,46 @@ GenericClientProtocolExecutor::GenericClientProtocolExecutor( Client *client_,
 	serverCommandHandlers.Register( "cpc", nullptr );
 	serverCommandHandlers.Register( "cpa", nullptr );
 
-	// Register persistent client commands
-
-	clientCommandHandlers.Register( "connect", &GPTE::Command_Connect );
-	clientCommandHandlers.Register( "disconnect", &GPTE::Command_Disconnect );
-#ifndef PUBLIC_BUILD
-	clientCommandHandlers.Register( "test_listener", &GPTE::Command_TestListener );
-#endif
-
 	clientCommandHandlers.NewGenerationTag();
 
 	Reset();
 }
 
+void GenericClientProtocolExecutor::ResetSessionFields() {
+	// Should be set by the client later
+	name[0] = 0;
+	password[0] = 0;
+	autoReconnect = false;
+	multiview = false;
+	offline = false;
+	demoRecorder = nullptr;
+	nonDeltaFramesBeforeMessage = 0;
+	holdsRampSlot = false;
+	numRampRetries = 0;
+	rampId = 0;
+	rampSlotReleaseAt = 0;
+	serverTimeUpdatedAt = 0;
+	resolutionRequestId = 0;
+	nextInPool = nullptr;
+}
+
+void GenericClientProtocolExecutor::Recycle( Client *client_ ) {
+	this->client = client_;
+	this->console = client_->GetConsole();
+
+	// Parts of the executor keep their own copies of the console
+	channel.console = console;
+	commandBuffer.console = console;
+	messageParser->client = client_;
+	messageParser->console = console;
+	memset( &messageParser->parseStats, 0, sizeof( messageParser->parseStats ) );
+
+	// Configstrings cleared by Reset() have been marked as dirty for the previous client, its listener is gone
+	worldState->DiscardDirtyConfigStrings();
+
+	ResetSessionFields();
+}
+
 void GenericClientProtocolExecutor::Command_Connect( CommandParser &parser ) {
 	const char *arg = parser.GetArg();
 
@@ -113,13 +242,53 @@ void GenericClientProtocolExecutor::Command_Connect( CommandParser &parser ) {
 }
 
 void GenericClientProtocolExecutor::Command_Connect( const UnresolvedAddress &unresolvedAddress ) {
-	if( !unresolvedAddress.IsResolved() ) {
-		console->Printf( "Cannot execute `connect` command: DNS address resolution is not supported yet\n" );
+	// A newer `connect` command overrides a pending one
+	CancelAddressResolution();
+
+	if( unresolvedAddress.IsResolved() ) {
+		NetworkAddress address( unresolvedAddress.ToResolvedAddress() );
+		Command_Connect( address );
 		return;
 	}
 
-	NetworkAddress address( unresolvedAddress.ToResolvedAddress() );
-	Command_Connect( address );
+	AddressResolver *resolver = system->AddressResolverInstance();
+
+	if( !resolver ) {
+		console->Printf( "Cannot execute `connect` command: an address resolver is not available\n" );
+		return;
+	}
+
+	const char *host = unresolvedAddress.Host();
+	resolutionRequestId = resolver->Resolve( host, unresolvedAddress.HostPort(), this, &OnConnectAddressResolved );
+
+	if( !resolutionRequestId ) {
+		console->Printf( "Cannot execute `connect` command: cannot start resolving `%s`\n", host );
+	}
+}
+
+void GenericClientProtocolExecutor::OnConnectAddressResolved( void *owner, uint32_t requestId,
+															  const NetworkAddress *address ) {
+	auto *executor = (GenericClientProtocolExecutor *)owner;
+
+	if( requestId != executor->resolutionRequestId ) {
+		return;
+	}
+
+	executor->resolutionRequestId = 0;
+
+	if( !address ) {
+		executor->console->Printf( "Cannot execute `connect` command: cannot resolve the host address\n" );
+		return;
+	}
+
+	executor->Command_Connect( *address );
+}
+
+void GenericClientProtocolExecutor::CancelAddressResolution() {
+	if( resolutionRequestId ) {
+		system->AddressResolverInstance()->CancelRequests( this );
+		resolutionRequestId = 0;
+	}
 }
 
 void GenericClientProtocolExecutor::Command_Connect( const NetworkAddress &address ) {
@@ -129,7 +298,8 @@ void GenericClientProtocolExecutor::Command_Connect( const NetworkAddress &addre
 
 	currServerAddress = address;
 	channel.StartListening();
-	DoChallengeRequest();
+	numRampRetries = 0;
+	StartHandshake();
 }
 
 void GenericClientProtocolExecutor::Command_Disconnect( CommandParser &parser ) {
@@ -137,14 +307,187 @@ void GenericClientProtocolExecutor::Command_Disconnect( CommandParser &parser )
 }
 
 void GenericClientProtocolExecutor::Command_Disconnect() {
+	CancelAddressResolution();
+
 	if( clientState == CA_DISCONNECTED ) {
 		return;
 	}
 
+	ReleaseRampSlot( false );
+
+	// Nothing has been sent yet
+	if( clientState == CA_WAITING_FOR_ADMISSION && !numRampRetries ) {
+		SetState( CA_DISCONNECTED );
+		channel.StopListening();
+		return;
+	}
+
+	StopRecording();
 	DoDisconnectRequest();
 	channel.StopListening();
 }
 
+void GenericClientProtocolExecutor::Command_Multiview( CommandParser &parser ) {
+	const char *arg = parser.GetArg();
+
+	if( !arg ) {
+		console->Printf( "Multiview mode is %s\n", multiview ? "on" : "off" );
+		return;
+	}
+
+	char *endptr;
+	long value = strtol( arg, &endptr, 10 );
+
+	if( *endptr ) {
+		console->Printf( "Cannot execute `multiview` command: illegal value `%s`\n", arg );
+		return;
+	}
+
+	const bool newMultiview = value != 0;
+
+	if( newMultiview == multiview ) {
+		return;
+	}
+
+	multiview = newMultiview;
+
+	// Otherwise the mode is going to be requested on entering the game
+	if( clientState >= CA_ENTERING ) {
+		EnqueueCommand( "multiview %d", multiview ? 1 : 0 );
+	}
+}
+
+void GenericClientProtocolExecutor::Command_Record( CommandParser &parser ) {
+	const char *arg = parser.GetArg();
+
+	if( !arg ) {
+		console->Printf( "Usage: record <filename>\n" );
+		return;
+	}
+
+	if( clientState != CA_ACTIVE ) {
+		console->Printf( "Cannot execute `record` command: the client is not in the game\n" );
+		return;
+	}
+
+	if( demoRecorder ) {
+		console->Printf( "Cannot execute `record` command: already recording\n" );
+		return;
+	}
+
+	if( !( demoRecorder = DemoRecorder::New( console, system, arg ) ) ) {
+		return;
+	}
+
+	char buffer[32];
+	snprintf( buffer, sizeof( buffer ), "%u", (unsigned)time( nullptr ) );
+	demoRecorder->SetMetaKeyValue( "localtime", buffer );
+	demoRecorder->SetMetaKeyValue( "multipov", multiview ? "1" : "0" );
+
+	// Messages are not recorded until a non-delta frame (that is requested by the next ack) arrives
+	console->Printf( "Recording to %s\n", arg );
+}
+
+void GenericClientProtocolExecutor::Command_Stop( CommandParser &parser ) {
+	if( !demoRecorder ) {
+		console->Printf( "Not recording a demo\n" );
+		return;
+	}
+
+	StopRecording();
+	console->Printf( "Stopped demo recording\n" );
+}
+
+void GenericClientProtocolExecutor::StopRecording() {
+	if( !demoRecorder ) {
+		return;
+	}
+
+	char buffer[32];
+	snprintf( buffer, sizeof( buffer ), "%u", (unsigned)( ( Millis() - demoRecorder->StartedAt() + 999 ) / 1000 ) );
+	demoRecorder->SetMetaKeyValue( "duration", buffer );
+	messageParser->WriteDemoMetaData( demoRecorder );
+
+	DemoRecorder::Stop( demoRecorder );
+	demoRecorder = nullptr;
+}
+
+void GenericClientProtocolExecutor::StartHandshake() {
+	if( system->ConnectionRampInstance() ) {
+		console->Printf( "Waiting for a connection admission...\n" );
+		SetState( CA_WAITING_FOR_ADMISSION, Millis() );
+		return;
+	}
+
+	DoChallengeRequest();
+}
+
+ConnectionRamp *GenericClientProtocolExecutor::AdmittedRamp() {
+	if( !holdsRampSlot ) {
+		return nullptr;
+	}
+
+	ConnectionRamp *ramp = system->ConnectionRampInstance();
+
+	// The ramp has been disabled or replaced since the admission
+	if( !ramp || ramp->Id() != rampId ) {
+		holdsRampSlot = false;
+		return nullptr;
+	}
+
+	return ramp;
+}
+
+void GenericClientProtocolExecutor::RetryHandshakeLater( ConnectionRamp::Phase phase, bool rejected ) {
+	ReleaseRampSlot( false );
+
+	ConnectionRamp *ramp = system->ConnectionRampInstance();
+
+	// The ramp has been disabled since the admission
+	if( !ramp ) {
+		DoChallengeRequest();
+		return;
+	}
+
+	if( rejected ) {
+		ramp->AddPhaseReject( phase );
+	} else {
+		ramp->AddPhaseTimeout( phase );
+	}
+
+	const unsigned delay = ramp->NextBackoff( numRampRetries++ );
+	console->Printf( "Retrying the connection in %u millis...\n", delay );
+	SetState( CA_WAITING_FOR_ADMISSION, Millis() + delay );
+}
+
+void GenericClientProtocolExecutor::ReleaseRampSlot( bool hasEnteredGame ) {
+	if( ConnectionRamp *ramp = AdmittedRamp() ) {
+		ramp->ReleaseSlot( hasEnteredGame );
+		holdsRampSlot = false;
+	}
+}
+
+void GenericClientProtocolExecutor::CheckRampSlotTimeout() {
+	if( !holdsRampSlot || Millis() < rampSlotReleaseAt ) {
+		return;
+	}
+
+	// Let other clients proceed, but keep trying to complete this handshake
+	if( ConnectionRamp *ramp = AdmittedRamp() ) {
+		if( clientState == CA_CHALLENGING ) {
+			ramp->AddPhaseTimeout( ConnectionRamp::PHASE_CHALLENGE );
+		} else if( clientState == CA_CONNECTING ) {
+			ramp->AddPhaseTimeout( ConnectionRamp::PHASE_CONNECT );
+		} else if( clientState == CA_ENTERING ) {
+			ramp->AddPhaseTimeout( ConnectionRamp::PHASE_ENTER );
+		} else {
+			ramp->AddPhaseTimeout( ConnectionRamp::PHASE_LOAD );
+		}
+	}
+
+	ReleaseRampSlot( false );
+}
+
 void GenericClientProtocolExecutor::DoChallengeRequest() {
 	console->Printf( "Requesting challenge...\n" );
 	Message &message = channel.PrepareNonSequencedOutgoingMessage();
@@ -182,6 +525,7 @@ void GenericClientProtocolExecutor::Command_TestListener( CommandParser &parser
 	client->PrintChatMessage( "Player(1)", "Hello, world!" );
 	client->PrintTeamChatMessage( "Player(1)", "Hello, world!" );
 	client->PrintTVChatMessage( "Player(1)", "Hello, world!" );
+	client->ExecuteTargetedCommand( 0, "pr \"Hello, world!\"" );
 }
 #endif
 
@@ -190,7 +534,7 @@ GenericClientProtocolExecutor *GenericClientProtocolExecutor::New( Console *cons
 		return nullptr;
 	}
 
-	void *mem = malloc( sizeof( GenericClientProtocolExecutor ) );
+	void *mem = QAlloc( sizeof( GenericClientProtocolExecutor ) );
 
 	if( !mem ) {
 		return nullptr;
@@ -199,14 +543,14 @@ GenericClientProtocolExecutor *GenericClientProtocolExecutor::New( Console *cons
 	ClientWorldState *worldState = ClientWorldState::New( protocolVersion );
 
 	if( !worldState ) {
-		free( mem );
+		QFree( mem );
 		return nullptr;
 	}
 
 	MessageParser *messageParser = MessageParser::New( protocolVersion, client, worldState, console );
 
 	if( !messageParser ) {
-		free( mem );
+		QFree( mem );
 		ClientWorldState::Delete( worldState );
 		return nullptr;
 	}
@@ -215,11 +559,17 @@ GenericClientProtocolExecutor *GenericClientProtocolExecutor::New( Console *cons
 }
 
 GenericClientProtocolExecutor::~GenericClientProtocolExecutor() {
+	CancelAddressResolution();
+	StopRecording();
 	ClientWorldState::Delete( worldState );
 	MessageParser::Delete( messageParser );
 }
 
 void GenericClientProtocolExecutor::SendCommandAck( int64_t ackNum ) {
+	if( offline ) {
+		return;
+	}
+
 	if( protocolVersion <= PROTOCOL21 && ackNum > std::numeric_limits<int>::max() ) {
 		console->Printf( "GenericClientProtocolExecutor::SendCommandAck(): integer overflow\n" );
 		return;
@@ -232,23 +582,32 @@ void GenericClientProtocolExecutor::SendCommandAck( int64_t ackNum ) {
 }
 
 void GenericClientProtocolExecutor::SendFrameAck( int64_t lastFrame, uint64_t serverTime ) {
-	Message &message = channel.PrepareSequencedOutgoingMessage();
+	if( offline ) {
+		// Keep the values for tracking a playback time
+		messageParser->lastFrame = lastFrame;
+		messageParser->serverTime = serverTime;
+		return;
+	}
 
-	if( protocolVersion <= PROTOCOL21 ) {
-		if( lastFrame > std::numeric_limits<int>::max() ) {
-			console->Printf( "GenericClientProtocolExecutor::SendFrameAck(): integer overflow on `lastFrame` arg\n" );
-			return;
+	if( demoRecorder && demoRecorder->IsWaitingForNonDeltaFrame() ) {
+		// Request a non-delta frame unless it has been just received
+		if( messageParser->GetParseStats().nonDeltaFrames == nonDeltaFramesBeforeMessage ) {
+			lastFrame = -1;
 		}
+	}
 
-		if( serverTime > std::numeric_limits<int>::max() ) {
-			console->Printf( "GenericClientProtocolExecutor::SendFrameAck(): integer overflow on `serverTime` arg\n" );
-			return;
-		}
+	Message &message = channel.PrepareSequencedOutgoingMessage();
+
+	if( !AddMove( message, lastFrame, serverTime ) ) {
+		return;
+	}
+
+	if( serverTime != messageParser->serverTime ) {
+		serverTimeUpdatedAt = Millis();
 	}
 
 	messageParser->lastFrame = lastFrame;
 	messageParser->serverTime = serverTime;
-	AddMove( message, lastFrame, serverTime );
 	Send();
 }
 
@@ -256,15 +615,53 @@ void GenericClientProtocolExecutor::TryAcknowledge( int64_t ackNum ) {
 	commandBuffer.TryAcknowledge( ackNum );
 }
 
-void GenericClientProtocolExecutor::AddMove( Message &message, int64_t lastFrame, uint64_t serverTime ) {
-	// TODO: Check ucmd handling in 2.1+ versions (not to mention lastFrame/serverTime bits count)
-	assert( protocolVersion <= PROTOCOL21 );
-	message.WriteByte( CLC_MOVE );
-	message.WriteLong( (int)lastFrame );
-	message.WriteLong( 2 );
-	message.WriteByte( 1 );
-	message.WriteByte( 0 );
-	message.WriteLong( (int)serverTime );
+bool GenericClientProtocolExecutor::AddMove( Message &message, int64_t lastFrame, uint64_t serverTime ) {
+	// The encoding is specific to the protocol version the parser has been instantiated for
+	if( !hasSentUserCommands ) {
+		return messageParser->WriteMove( message, lastFrame, serverTime );
+	}
+
+	// Repeat the last input without advancing the head, so a server does not execute it again
+	return messageParser->WriteUserCommands( message, lastFrame, userCommandsHead, &lastUserCommand, 1, serverTime, 0 );
+}
+
+uint64_t GenericClientProtocolExecutor::EstimatedServerTime() const {
+	// Extrapolate the last acknowledged frame time
+	return messageParser->LastServerTime() + ( Millis() - serverTimeUpdatedAt );
+}
+
+void GenericClientProtocolExecutor::SendUserCommands( const UserCommand *commands, unsigned numCommands, unsigned tickMillis ) {
+	if( offline || clientState != CA_ACTIVE || !numCommands ) {
+		return;
+	}
+
+	Message &message = channel.PrepareSequencedOutgoingMessage();
+	const uint32_t head = userCommandsHead + numCommands;
+	const uint64_t serverTime = EstimatedServerTime();
+
+	if( !messageParser->WriteUserCommands( message, messageParser->lastFrame, head, commands, numCommands, serverTime, tickMillis ) ) {
+		return;
+	}
+
+	userCommandsHead = head;
+	hasSentUserCommands = true;
+	lastUserCommand = commands[numCommands - 1];
+	Send();
+}
+
+void GenericClientProtocolExecutor::EnterOfflineMode() {
+	offline = true;
+	multiview = true;
+
+	// Keep these commands registered but ignore them
+	for( const char *command: { "challenge", "client_connect", "cmd", "disconnect", "reject", "forcereconnect", "reconnect" } ) {
+		serverCommandHandlers.Register( command, nullptr );
+	}
+	// Keep the overrides on Reset()
+	serverCommandHandlers.NewGenerationTag();
+
+	// There are no acks in a recorded stream, so the game is considered entered immediately
+	SetState( CA_ACTIVE );
 }
 
 void GenericClientProtocolExecutor::Activate() {
@@ -272,6 +669,11 @@ void GenericClientProtocolExecutor::Activate() {
 		return;
 	}
 
+	if( ConnectionRamp *ramp = AdmittedRamp() ) {
+		ramp->AddPhaseSuccess( ConnectionRamp::PHASE_ENTER );
+		ReleaseRampSlot( true );
+	}
+
 	SetState( CA_ACTIVE );
 }
 
@@ -281,30 +683,100 @@ void GenericClientProtocolExecutor::Delete( GenericClientProtocolExecutor *execu
 	}
 
 	executor->~GenericClientProtocolExecutor();
-	free( executor );
+	QFree( executor );
 }
 
 void GenericClientProtocolExecutor::OnIngoingSequencedMessage( Message &message ) {
+	WakeUp();
+
+	if( !demoRecorder ) {
+		messageParser->Parse( message );
+		NotifyConfigStringsChanged();
+		PublishWorldState();
+		return;
+	}
+
+	const unsigned startPos = message.ReadCount();
+	nonDeltaFramesBeforeMessage = messageParser->GetParseStats().nonDeltaFrames;
+
 	messageParser->Parse( message );
+	NotifyConfigStringsChanged();
+	PublishWorldState();
+
+	// The recording might have been stopped by a command executed during parsing
+	if( !demoRecorder ) {
+		return;
+	}
+
+	if( demoRecorder->IsWaitingForNonDeltaFrame() ) {
+		if( messageParser->GetParseStats().nonDeltaFrames == nonDeltaFramesBeforeMessage ) {
+			return;
+		}
+		messageParser->WriteDemoHeader( demoRecorder );
+		demoRecorder->SetWaitingForNonDeltaFrame( false );
+	}
+
+	demoRecorder->RecordMessage( message.Buffer() + startPos, message.CurrSize() - startPos );
+}
+
+void GenericClientProtocolExecutor::NotifyConfigStringsChanged() {
+	if( !worldState->HasDirtyConfigStrings() ) {
+		return;
+	}
+
+	uint16_t indices[MAX_CONFIGSTRINGS_IN_BATCH];
+	const char *values[MAX_CONFIGSTRINGS_IN_BATCH];
+
+	// There is usually a single batch per message, except the initial configstrings burst
+	while( unsigned numIndices = worldState->TakeDirtyConfigStrings( indices, MAX_CONFIGSTRINGS_IN_BATCH ) ) {
+		for( unsigned i = 0; i < numIndices; ++i ) {
+			values[i] = ConfigString( indices[i] );
+		}
+
+		client->NotifyConfigStringsChanged( indices, values, numIndices );
+	}
+}
+
+void GenericClientProtocolExecutor::PublishWorldState() {
+	if( WorldStatePublisher *publisher = client->WorldStatePublisherInstance() ) {
+		publisher->Publish( *worldState, messageParser->lastFrame, messageParser->serverTime, clientState == CA_ACTIVE );
+	}
 }
 
 void GenericClientProtocolExecutor::OnIngoingNonSequencedMessage( Message &message ) {
+	WakeUp();
+
 	CommandParser parser( message.ReadString() );
 
 	serverCommandHandlers.HandleCommand( parser );
 }
 
 void GenericClientProtocolExecutor::Reset() {
+	// A demo cannot span several connections
+	StopRecording();
+
 	clientState = CA_DISCONNECTED;
+	client->UpdateFrameSchedule( CA_DISCONNECTED, std::numeric_limits<uint64_t>::max() );
+
+	ReleaseRampSlot( false );
+	numRampRetries = 0;
+
+	userCommandsHead = 2;
+	hasSentUserCommands = false;
+
+	scoreboard.Clear();
+	// Force setting the layout on the next update
+	scoreboardLayoutVersion = std::numeric_limits<uint32_t>::max();
+	scoreboardTitlesVersion = std::numeric_limits<uint32_t>::max();
 
 	worldState->Clear();
+	messageParser->Reset();
 
 	configStringsData = worldState->ConfigStringsData();
 	configStringsStride = worldState->ConfigStringsStride();
 	maxConfigStrings = worldState->MaxConfigStrings();
 
-	for( unsigned i = 0; i < maxConfigStrings; ++i )
-		ConfigString( i )[0] = 0;
+	worldState->ClearConfigStrings();
 
 	serverCommandHandlers.Clear( serverCommandHandlers.CurrGenerationTag() );
 	clientCommandHandlers.Clear( clientCommandHandlers.CurrGenerationTag() );
@@ -320,17 +792,54 @@ void GenericClientProtocolExecutor::Frame() {
 
 	commandBuffer.ResendBufferedMessages();
 
+	if( demoRecorder ) {
+		if( demoRecorder->HasFailed() ) {
+			console->Printf( "Demo recording has failed\n" );
+			StopRecording();
+		} else {
+			demoRecorder->Frame( Millis() );
+		}
+	}
+
+	CheckRampSlotTimeout();
+
 	switch( clientState ) {
+		case CA_WAITING_FOR_ADMISSION:
+
+			if( Millis() < resendAt ) {
+				break;
+			}
+
+			if( ConnectionRamp *ramp = system->ConnectionRampInstance() ) {
+				if( !ramp->TryAdmit( Millis() ) ) {
+					break;
+				}
+				holdsRampSlot = true;
+				rampId = ramp->Id();
+				rampSlotReleaseAt = Millis() + ramp->HandshakeTimeout();
+				ramp->AddPhaseAttempt( ConnectionRamp::PHASE_CHALLENGE );
+			}
+			DoChallengeRequest();
+			break;
 		case CA_CHALLENGING:
 
 			if( Millis() >= resendAt ) {
-				DoChallengeRequest();
+				// Admitted clients back off instead of resending requests to a server that does not keep up
+				if( AdmittedRamp() ) {
+					RetryHandshakeLater( ConnectionRamp::PHASE_CHALLENGE, false );
+				} else {
+					DoChallengeRequest();
+				}
 			}
 			break;
 		case CA_CONNECTING:
 
 			if( Millis() >= resendAt ) {
-				DoConnectRequest();
+				if( AdmittedRamp() ) {
+					RetryHandshakeLater( ConnectionRamp::PHASE_CONNECT, false );
+				} else {
+					DoConnectRequest();
+				}
 			}
 			break;
 		case CA_LOADING:
@@ -355,20 +864,109 @@ void GenericClientProtocolExecutor::Frame() {
 	}
 }
 
+void GenericClientProtocolExecutor::WakeUp() {
+	client->UpdateFrameSchedule( clientState, 0 );
+}
+
+uint64_t GenericClientProtocolExecutor::NextFrameAt() const {
+	if( clientState <= CA_DISCONNECTED ) {
+		return std::numeric_limits<uint64_t>::max();
+	}
+
+	// Recordings are written every frame, and a loading client waits for a player number every frame
+	if( demoRecorder || clientState == CA_LOADING ) {
+		return 0;
+	}
+
+	uint64_t at = std::numeric_limits<uint64_t>::max();
+
+	if( commandBuffer.numBuffers ) {
+		const int64_t resendBufferAt = commandBuffer.buffers[commandBuffer.headBufferIndex].lastSentAt + TIMEOUT;
+		at = resendBufferAt > 0 ? (uint64_t)resendBufferAt : 0;
+	}
+
+	if( holdsRampSlot ) {
+		at = std::min( at, rampSlotReleaseAt );
+	}
+
+	switch( clientState ) {
+		// An admission is polled every frame once the delay expires
+		case CA_WAITING_FOR_ADMISSION:
+		case CA_CHALLENGING:
+		case CA_CONNECTING:
+			at = std::min( at, resendAt );
+			break;
+		case CA_ACTIVE:
+			at = std::min( at, lastSentAt + INACTIVE_TIME );
+			break;
+		default:
+			break;
+	}
+
+	return at;
+}
+
 void GenericClientProtocolExecutor::ExecuteCommandFromServer( const char *command ) {
+	client->NotifyServerCommand( command );
+
 	CommandParser commandParser( command );
 
 	serverCommandHandlers.HandleCommand( commandParser );
 }
 
+void GenericClientProtocolExecutor::ExecuteTargetedCommandFromServer( const char *command,
+																	 const uint8_t *targets,
+																	 unsigned numTargetBytes ) {
+	if( !multiview ) {
+		const unsigned clientNum = (unsigned)( worldState->PlayerNum() - 1 );
+
+		if( clientNum / 8 < numTargetBytes && ( targets[clientNum / 8] & ( 1 << ( clientNum % 8 ) ) ) ) {
+			ExecuteCommandFromServer( command );
+		}
+		return;
+	}
+
+	for( unsigned byteNum = 0; byteNum < numTargetBytes; ++byteNum ) {
+		if( !targets[byteNum] ) {
+			continue;
+		}
+
+		for( unsigned bitNum = 0; bitNum < 8; ++bitNum ) {
+			if( targets[byteNum] & ( 1 << bitNum ) ) {
+				client->ExecuteTargetedCommand( (int)( byteNum * 8 + bitNum ), command );
+			}
+		}
+	}
+}
+
 void GenericClientProtocolExecutor::ExecuteCommandFromClient( const char *command ) {
+	WakeUp();
+
 	CommandParser commandParser( command );
 
 	clientCommandHandlers.HandleCommand( commandParser );
 }
 
-CommandHandlersRegistry::CommandHandlersRegistry( GenericClientProtocolExecutor *executor_, const char *tag_ )
-	: executor( executor_ ), tag( tag_ ), currGenerationTag( 0 ) {
+GenericClientProtocolExecutor *GenericClientProtocolExecutor::ForReplay( Client *client ) {
+	return client->CheckExecutor() ? client->protocolExecutor : nullptr;
+}
+
+void GenericClientProtocolExecutor::ResetForReplay( const NetworkAddress &serverAddress ) {
+	Reset();
+
+	channel.currServerAddress = serverAddress;
+	channel.ingoingSequenceNum = 0;
+	channel.outgoingSequenceNum = 0;
+	channel.totalFragmentSize = 0;
+}
+
+void GenericClientProtocolExecutor::ReplayDatagram( const uint8_t *data, unsigned dataSize ) {
+	channel.Receive( channel.currServerAddress, data, dataSize );
+}
+
+CommandHandlersRegistry::CommandHandlersRegistry( GenericClientProtocolExecutor *executor_, const char *tag_,
+												  const StaticCommandTable *builtinCommands_ )
+	: executor( executor_ ), tag( tag_ ), builtinCommands( builtinCommands_ ), currGenerationTag( 0 ) {
 
 	for( unsigned i = 0; i < MAX_HANDLERS; ++i ) {
 		HashEntry *entry = &entriesData[i];
@@ -410,6 +1008,7 @@ void CommandHandlersRegistry::Register( const char *name, CommandHandler handler
 						// It is intended to be used for toggling a command handling on/off
 						// while keeping the command registered.
 						entry->handler = handler;
+						return;
 					} else {
 						// If both handlers are non-null, it is not obvious what numeric tag to use
 						const char *format = "%s: a non-null handler for command `%s` has been already registered\n";
@@ -426,6 +1025,17 @@ void CommandHandlersRegistry::Register( const char *name, CommandHandler handler
 		}
 	}
 
+	// Registered commands might disable or replace ignored built-in commands, but not redefine handled ones
+	if( handler ) {
+		const StaticCommandTable::Entry *builtinEntry = builtinCommands->Find( name, length, hash );
+
+		if( builtinEntry && builtinEntry->handler ) {
+			const char *format = "%s: a non-null handler for command `%s` is built-in\n";
+			executor->console->Printf( format, "CommandHandlersRegistry::Register()", name );
+			abort();
+		}
+	}
+
 	if( firstFreeEntry < 0 ) {
 		executor->console->Printf( "CommandHandlersRegistry::Register(): Too many command handlers\n" );
 		abort();
@@ -478,30 +1088,46 @@ bool CommandHandlersRegistry::HandleCommand( CommandParser &parser ) {
 		return true;
 	}
 
-	const uint32_t hashBinIndex = hash % HASH_TABLE_SIZE;
+	CommandHandler handler;
 
-	if( hashTable[hashBinIndex] >= 0 ) {
-		HashEntry *entry = &entriesData[hashTable[hashBinIndex]];
+	// Check the overlay first (it is usually empty)
+	if( const HashEntry *entry = FindRegistered( commandName, length, hash ) ) {
+		handler = entry->handler;
+	} else if( const StaticCommandTable::Entry *builtinEntry = builtinCommands->Find( commandName, length, hash ) ) {
+		handler = builtinEntry->handler;
+	} else {
+		executor->console->Printf( "%s: unknown command %s\n", tag, commandName );
+		return false;
+	}
 
-		for(;; ) {
-			if( entry->nameHash == hash && entry->nameLength == length ) {
-				if( !strcmp( entry->name, commandName ) ) {
-					if( entry->handler ) {
-						( executor->*( entry->handler ) )( parser );
-					}
-					return true;
-				}
-			}
+	if( handler ) {
+		( executor->*handler )( parser );
+	}
+	return true;
+}
 
-			if( entry->nextInHashBin < 0 ) {
-				break;
-			}
-			entry = &entriesData[entry->nextInHashBin];
-		}
+const CommandHandlersRegistry::HashEntry *CommandHandlersRegistry::FindRegistered( const char *name,
+																				  unsigned nameLength,
+																				  uint32_t nameHash ) const {
+	if( firstUsedEntry < 0 ) {
+		return nullptr;
 	}
 
-	executor->console->Printf( "%s: unknown command %s\n", tag, commandName );
-	return false;
+	const int8_t firstBinEntry = hashTable[nameHash % HASH_TABLE_SIZE];
+
+	if( firstBinEntry < 0 ) {
+		return nullptr;
+	}
+
+	for( const HashEntry *entry = &entriesData[firstBinEntry];; entry = &entriesData[entry->nextInHashBin] ) {
+		if( entry->nameHash == nameHash && entry->nameLength == nameLength && !strcmp( entry->name, name ) ) {
+			return entry;
+		}
+
+		if( entry->nextInHashBin < 0 ) {
+			return nullptr;
+		}
+	}
 }
 
 void CommandHandlersRegistry::Clear( unsigned tag ) {
@@ -565,7 +1191,12 @@ void CommandHandlersRegistry::Clear( unsigned tag ) {
 }
 
 void GenericClientProtocolExecutor::ServerCommand_Challenge( CommandParser &parser ) {
-	const char *token = parser.GetCommand();
+	// A late reply to a request that has timed out must not start a connection outside of the ramp admission
+	if( clientState != CA_CHALLENGING ) {
+		return;
+	}
+
+	const char *token = parser.GetArg();
 
 	if( !token ) {
 		console->Printf( "Cannot execute server `challenge` command: missing an argument\n" );
@@ -573,11 +1204,24 @@ void GenericClientProtocolExecutor::ServerCommand_Challenge( CommandParser &pars
 	}
 
 	QStrncpyz( challenge, token, sizeof( challenge ) );
+
+	ConnectionRamp *ramp = AdmittedRamp();
+
+	if( ramp ) {
+		ramp->AddPhaseSuccess( ConnectionRamp::PHASE_CHALLENGE );
+		ramp->AddPhaseAttempt( ConnectionRamp::PHASE_CONNECT );
+	}
+
 	DoConnectRequest();
 }
 
 void GenericClientProtocolExecutor::ServerCommand_ClientConnect( CommandParser &parser ) {
-	const char *token = parser.GetCommand();
+	// Same as for a challenge, a client that is not connecting has given up the request
+	if( clientState != CA_CONNECTING ) {
+		return;
+	}
+
+	const char *token = parser.GetArg();
 
 	if( !token ) {
 		console->Printf( "Cannot execute server `client_connect` command: missing an argument\n" );
@@ -585,6 +1229,14 @@ void GenericClientProtocolExecutor::ServerCommand_ClientConnect( CommandParser &
 	}
 
 	QStrncpyz( session, token, sizeof( session ) );
+
+	ConnectionRamp *ramp = AdmittedRamp();
+
+	if( ramp ) {
+		ramp->AddPhaseSuccess( ConnectionRamp::PHASE_CONNECT );
+		ramp->AddPhaseAttempt( ConnectionRamp::PHASE_LOAD );
+	}
+
 	ServerCommand_ClientConnect();
 }
 
@@ -597,13 +1249,11 @@ void GenericClientProtocolExecutor::ServerCommand_ClientConnect() {
 void GenericClientProtocolExecutor::ServerCommand_Cs( CommandParser &parser ) {
 	char *endptr;
 	unsigned tokenLength;
+	const unsigned numArgs = parser.NumArgs();
 
-	for(;; ) {
-		const char *numToken = parser.GetArg();
-
-		if( !numToken ) {
-			break;
-		}
+	// Arguments are already split, so a command carrying hundreds of configstrings is handled in a single pass
+	for( unsigned i = 0; i < numArgs; i += 2 ) {
+		const char *numToken = parser.Arg( i );
 		long num = strtol( numToken, &endptr, 10 );
 
 		if( num < 0 || num >= worldState->MaxConfigStrings() || *endptr ) {
@@ -611,14 +1261,16 @@ void GenericClientProtocolExecutor::ServerCommand_Cs( CommandParser &parser ) {
 			// TODO: Force disconnect?
 			break;
 		}
-		const char *valueToken = parser.GetArg( &tokenLength );
+		const char *valueToken = parser.Arg( i + 1, &tokenLength );
 
 		if( !valueToken ) {
 			console->Printf( "Cannot execute server 'cs' command: missing confingstring value for string #%d\n", (int)num );
 			// TODO: Force disconnect?
 			break;
 		}
-		memcpy( ConfigString( (unsigned)num ), valueToken, tokenLength + 1 );
+
+		// Values are truncated to the configstring size, and unchanged ones are not written
+		worldState->SetConfigString( (unsigned)num, valueToken, tokenLength );
 	}
 
 	if( clientState > CA_DISCONNECTED ) {
@@ -672,8 +1324,18 @@ void GenericClientProtocolExecutor::ServerCommand_Precache( CommandParser &parse
 
 void GenericClientProtocolExecutor::Enter() {
 	console->Printf( "Entering the game...\n" );
+
+	if( ConnectionRamp *ramp = AdmittedRamp() ) {
+		ramp->AddPhaseSuccess( ConnectionRamp::PHASE_LOAD );
+		ramp->AddPhaseAttempt( ConnectionRamp::PHASE_ENTER );
+	}
+
 	EnqueueCommand( "begin %d", worldState->SpawnCount() );
-	// multiview code has been removed
+
+	if( multiview ) {
+		EnqueueCommand( "multiview 1" );
+	}
+
 	SetState( CA_ENTERING );
 }
 
@@ -686,14 +1348,15 @@ void GenericClientProtocolExecutor::ServerCommand_Disconnect( CommandParser &par
 }
 
 void GenericClientProtocolExecutor::ServerCommand_Reject( CommandParser &parser ) {
-	if( clientState > CA_CONNECTING ) {
+	// A client that waits for a retry has already handled a failure of the previous request
+	if( clientState > CA_CONNECTING || clientState == CA_WAITING_FOR_ADMISSION ) {
 		return;
 	}
 
 	const char *arg;
 	char *endptr;
 
-	if( !( arg = parser.GetCommand() ) ) {
+	if( !( arg = parser.GetArg() ) ) {
 		console->Printf( "Cannot execute server `reject` command: missing the drop type\n" );
 		return;
 	}
@@ -705,7 +1368,7 @@ void GenericClientProtocolExecutor::ServerCommand_Reject( CommandParser &parser
 		return;
 	}
 
-	if( !( arg = parser.GetCommand() ) ) {
+	if( !( arg = parser.GetArg() ) ) {
 		console->Printf( "Cannot execute server `reject` command: missing the drop flags\n" );
 		return;
 	}
@@ -717,12 +1380,25 @@ void GenericClientProtocolExecutor::ServerCommand_Reject( CommandParser &parser
 		return;
 	}
 
-	if( !( arg = parser.GetCommand() ) ) {
+	if( !( arg = parser.GetArg() ) ) {
 		console->Printf( "Cannot execute server `reject command: missing the drop reason string\n`" );
 		return;
 	}
 
 	console->Printf( "Rejected: %s\n", arg );
+
+	if( ConnectionRamp *ramp = AdmittedRamp() ) {
+		const auto phase = clientState == CA_CHALLENGING ? ConnectionRamp::PHASE_CHALLENGE : ConnectionRamp::PHASE_CONNECT;
+
+		// Retry later without dropping the connection (a server is likely to be just overloaded)
+		if( ( dropFlags & DROP_FLAG_AUTORECONNECT ) || autoReconnect ) {
+			RetryHandshakeLater( phase, true );
+			return;
+		}
+
+		ramp->AddPhaseReject( phase );
+	}
+
 	Command_Disconnect();
 
 	if( ( dropFlags & DROP_FLAG_AUTORECONNECT ) || autoReconnect ) {
@@ -755,10 +1431,8 @@ void GenericClientProtocolExecutor::ServerCommand_Print( CommandParser &parser )
 }
 
 void GenericClientProtocolExecutor::HandleServerChatCommand( CommandParser &parser, ClientChatHandler handler ) {
-	if( const char *token = parser.GetArg() ) {
-		char from[MAX_STRING_CHARS];
-		QStrncpyz( from, token, sizeof( from ) );
-
+	// Tokens remain valid until the parser is destroyed, so the sender name is not copied
+	if( const char *from = parser.GetArg() ) {
 		if( const char *message = parser.GetArg() ) {
 			( client->*handler )( from, message );
 		}
@@ -783,7 +1457,34 @@ void GenericClientProtocolExecutor::ServerCommand_Motd( CommandParser &parser )
 	}
 }
 
+void GenericClientProtocolExecutor::ServerCommand_Scb( CommandParser &parser ) {
+	const char *token = parser.GetArg();
+
+	if( !token ) {
+		return;
+	}
+
+	const unsigned layoutIndex = worldState->scoreboardLayoutConfigString;
+	const unsigned titlesIndex = worldState->scoreboardTitlesConfigString;
+	const uint32_t layoutVersion = worldState->ConfigStringVersion( layoutIndex );
+	const uint32_t titlesVersion = worldState->ConfigStringVersion( titlesIndex );
+
+	if( layoutVersion != scoreboardLayoutVersion || titlesVersion != scoreboardTitlesVersion ) {
+		scoreboard.SetLayout( ConfigString( layoutIndex ), ConfigString( titlesIndex ) );
+		scoreboardLayoutVersion = layoutVersion;
+		scoreboardTitlesVersion = titlesVersion;
+	}
+
+	if( const unsigned numChanged = scoreboard.Update( token ) ) {
+		client->NotifyScoreboardChanged( scoreboard.ChangedClientNums(), scoreboard.ChangedEntries(), numChanged );
+	}
+}
+
 void GenericClientProtocolExecutor::EnqueueCommand( const char *format, ... ) {
+	if( offline ) {
+		return;
+	}
+
 	if( clientState < CA_SETUP ) {
 		console->Printf( "Client::EnqueueCommand(): not connected\n" );
 		return;
@@ -798,4 +1499,7 @@ void GenericClientProtocolExecutor::EnqueueCommand( const char *format, ... ) {
 		commandBuffer.EnqueueCommandForUnreliableConnectionV( format, va );
 	}
 	va_end( va );
+
+	// The buffered command might be resent before the current deadline
+	WakeUp();
 }
\ No newline at end of file
@@ -0,0 +1,227 @@
+#include "scoreboard.h"
+#include "command_parser.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+void Scoreboard::Clear() {
+	memset( entries, 0, sizeof( entries ) );
+	SetDefaultLayout();
+}
+
+void Scoreboard::SetDefaultLayout() {
+	// "Name Clan Score Ping R" of the default deathmatch gametype
+	const ColumnKind defaultColumns[] = { COLUMN_PLAYER_NUM, COLUMN_IGNORED, COLUMN_SCORE, COLUMN_PING, COLUMN_READY };
+
+	memcpy( columns, defaultColumns, sizeof( defaultColumns ) );
+	numColumns = sizeof( defaultColumns ) / sizeof( *defaultColumns );
+}
+
+void Scoreboard::SetLayout( const char *layout, const char *titles ) {
+	char types[MAX_COLUMNS];
+	unsigned numTypes = 0;
+
+	CommandParser layoutParser( layout );
+
+	// Layout tokens are pairs of a column type and a column width
+	for( const char *token = layoutParser.GetCommand(); token && *token; token = layoutParser.GetArg() ) {
+		if( token[0] != '%' || !token[1] ) {
+			continue;
+		}
+
+		if( numTypes == MAX_COLUMNS ) {
+			break;
+		}
+		types[numTypes++] = token[1];
+	}
+
+	if( !numTypes ) {
+		SetDefaultLayout();
+		return;
+	}
+
+	CommandParser titlesParser( titles );
+	const char *title = titlesParser.GetCommand();
+	bool hasScoreColumn = false;
+
+	for( unsigned i = 0; i < numTypes; ++i ) {
+		ColumnKind kind = COLUMN_IGNORED;
+
+		switch( types[i] ) {
+			case 'n':
+				kind = COLUMN_PLAYER_NUM;
+				break;
+			case 'l':
+				kind = COLUMN_PING;
+				break;
+			case 'r':
+				kind = COLUMN_READY;
+				break;
+			case 'i':
+				if( !title ) {
+					break;
+				}
+
+				if( !strcasecmp( title, "Score" ) ) {
+					kind = COLUMN_SCORE;
+				} else if( !strcasecmp( title, "Frags" ) || !strcasecmp( title, "Kills" ) || !strcasecmp( title, "K" ) ) {
+					kind = COLUMN_KILLS;
+				} else if( !strcasecmp( title, "Deaths" ) || !strcasecmp( title, "D" ) ) {
+					kind = COLUMN_DEATHS;
+				} else if( !strcasecmp( title, "Ping" ) ) {
+					kind = COLUMN_PING;
+				}
+				break;
+			default:
+				break;
+		}
+
+		hasScoreColumn |= ( kind == COLUMN_SCORE );
+		columns[i] = kind;
+
+		if( title ) {
+			title = titlesParser.GetArg();
+		}
+	}
+
+	// Gametypes that do not title a score column still put the score first
+	if( !hasScoreColumn ) {
+		for( unsigned i = 0; i < numTypes; ++i ) {
+			if( types[i] == 'i' && columns[i] == COLUMN_IGNORED ) {
+				columns[i] = COLUMN_SCORE;
+				break;
+			}
+		}
+	}
+
+	numColumns = numTypes;
+}
+
+ScoreboardEntry *Scoreboard::NewEntryForToken( const char *token, bool *ghosting ) {
+	char *endptr;
+	long num = strtol( token, &endptr, 10 );
+
+	if( *endptr ) {
+		return nullptr;
+	}
+
+	// Ghosting players are transmitted as -( num + 1 )
+	*ghosting = num < 0;
+
+	if( num < 0 ) {
+		num = -num - 1;
+	}
+
+	if( num >= MAX_SERVER_CLIENTS ) {
+		return nullptr;
+	}
+
+	return &newEntries[num];
+}
+
+unsigned Scoreboard::Update( const char *message ) {
+	memset( newEntries, 0, sizeof( newEntries ) );
+
+	// The payload is a sequence of sections like "&t <team> <score> <ping>", "&p <fields of the layout>" or "&s <num> <ping>".
+	// The command parser splits it into whitespace-separated tokens in a single pass.
+	CommandParser parser( message );
+	const char *token = parser.GetCommand();
+	int team = 0;
+
+	while( token && *token ) {
+		if( token[0] != '&' || !token[1] || token[2] ) {
+			token = parser.GetArg();
+			continue;
+		}
+
+		const char sectionType = token[1];
+		unsigned fieldNum = 0;
+		ScoreboardEntry *entry = nullptr;
+		bool ghosting = false;
+
+		for( token = parser.GetArg(); token && token[0] != '&'; token = parser.GetArg(), fieldNum++ ) {
+			switch( sectionType ) {
+				case 't':
+					if( fieldNum == 0 ) {
+						team = atoi( token );
+					}
+					break;
+				case 'p':
+					if( fieldNum >= numColumns ) {
+						break;
+					}
+
+					switch( columns[fieldNum] ) {
+						case COLUMN_PLAYER_NUM:
+							if( ( entry = NewEntryForToken( token, &ghosting ) ) ) {
+								entry->flags = ScoreboardEntry::FLAG_PRESENT;
+								entry->team = (int8_t)team;
+
+								if( ghosting ) {
+									entry->flags |= ScoreboardEntry::FLAG_GHOSTING;
+								}
+							}
+							break;
+						case COLUMN_SCORE:
+							if( entry ) {
+								entry->score = (int32_t)atoi( token );
+							}
+							break;
+						case COLUMN_KILLS:
+							if( entry ) {
+								entry->kills = (int16_t)atoi( token );
+							}
+							break;
+						case COLUMN_DEATHS:
+							if( entry ) {
+								entry->deaths = (int16_t)atoi( token );
+							}
+							break;
+						case COLUMN_PING:
+							if( entry ) {
+								entry->ping = (int16_t)atoi( token );
+							}
+							break;
+						case COLUMN_READY:
+							if( entry && atoi( token ) ) {
+								entry->flags |= ScoreboardEntry::FLAG_READY;
+							}
+							break;
+						default:
+							break;
+					}
+					break;
+				case 's':
+				case 'w':
+				case 'c':
+					// Spectators, players waiting in a queue, connecting players: "<num> <ping>"
+					if( fieldNum == 0 ) {
+						if( ( entry = NewEntryForToken( token, &ghosting ) ) ) {
+							entry->flags = ScoreboardEntry::FLAG_PRESENT | ScoreboardEntry::FLAG_SPECTATOR;
+						}
+					} else if( fieldNum == 1 && entry ) {
+						entry->ping = (int16_t)atoi( token );
+					}
+					break;
+				default:
+					break;
+			}
+		}
+	}
+
+	unsigned numChanged = 0;
+
+	for( unsigned i = 0; i < MAX_SERVER_CLIENTS; ++i ) {
+		if( !memcmp( &entries[i], &newEntries[i], sizeof( ScoreboardEntry ) ) ) {
+			continue;
+		}
+
+		entries[i] = newEntries[i];
+		changedClientNums[numChanged] = (uint8_t)i;
+		changedEntries[numChanged] = newEntries[i];
+		numChanged++;
+	}
+
+	return numChanged;
+}
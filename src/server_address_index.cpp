@@ -0,0 +1,234 @@
+#include "server_address_index.h"
+#include "allocator.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined( __SSE2__ ) || defined( _M_X64 )
+#include <emmintrin.h>
+#define LIBQFAKECLIENT_USE_SSE2
+#endif
+
+static constexpr size_t NOT_FOUND = ~(size_t)0;
+
+ServerAddressKey ServerAddressKey::FromIpV4Data( const uint8_t *addressBytes, const uint8_t *portBytes ) {
+	ServerAddressKey key;
+	memset( key.bytes, 0, 10 );
+	key.bytes[10] = 0xFF;
+	key.bytes[11] = 0xFF;
+	memcpy( key.bytes + 12, addressBytes, 4 );
+	memcpy( key.bytes + 16, portBytes, 2 );
+	return key;
+}
+
+ServerAddressKey ServerAddressKey::FromIpV6Data( const uint8_t *addressBytes, const uint8_t *portBytes ) {
+	ServerAddressKey key;
+	memcpy( key.bytes, addressBytes, 16 );
+	memcpy( key.bytes + 16, portBytes, 2 );
+	return key;
+}
+
+ServerAddressKey ServerAddressKey::FromAddress( const NetworkAddress &address ) {
+	if( const sockaddr_in *in4 = address.AsIpV4Sockaddr() ) {
+		return FromIpV4Data( (const uint8_t *)&in4->sin_addr.s_addr, (const uint8_t *)&in4->sin_port );
+	}
+
+	if( const sockaddr_in6 *in6 = address.AsIpV6Sockaddr() ) {
+		return FromIpV6Data( (const uint8_t *)&in6->sin6_addr, (const uint8_t *)&in6->sin6_port );
+	}
+
+	ServerAddressKey key;
+	memset( key.bytes, 0, sizeof( key.bytes ) );
+	return key;
+}
+
+uint64_t ServerAddressKey::Hash() const {
+	uint64_t lo, hi;
+	uint16_t port;
+	memcpy( &lo, bytes, 8 );
+	memcpy( &hi, bytes + 8, 8 );
+	memcpy( &port, bytes + 16, 2 );
+
+	uint64_t h = lo * 0x9E3779B97F4A7C15ull;
+	h = ( ( h << 31 ) | ( h >> 33 ) ) ^ hi;
+	h *= 0xC2B2AE3D27D4EB4Full;
+	h ^= port;
+	h *= 0x9E3779B97F4A7C15ull;
+
+	// The MurmurHash3 finalizer, so all bits of the result depend on all bits of the key
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+ServerAddressIndex::ServerAddressIndex()
+	: controlBytes( nullptr ), keys( nullptr ), values( nullptr ), capacity( 0 ), size( 0 ), numDeleted( 0 ) {}
+
+ServerAddressIndex::~ServerAddressIndex() {
+	QFree( controlBytes );
+}
+
+uint32_t ServerAddressIndex::MatchGroup( const uint8_t *group, uint8_t controlByte ) {
+#ifdef LIBQFAKECLIENT_USE_SSE2
+	const __m128i bytes = _mm_loadu_si128( (const __m128i *)group );
+	return (uint32_t)_mm_movemask_epi8( _mm_cmpeq_epi8( bytes, _mm_set1_epi8( (char)controlByte ) ) );
+#else
+	uint32_t mask = 0;
+	for( unsigned i = 0; i < GROUP_SIZE; ++i ) {
+		mask |= (uint32_t)( group[i] == controlByte ) << i;
+	}
+	return mask;
+#endif
+}
+
+uint32_t ServerAddressIndex::MatchFreeSlots( const uint8_t *group ) {
+	// Both marks have the high bit set, while hash bits of used slots do not
+#ifdef LIBQFAKECLIENT_USE_SSE2
+	return (uint32_t)_mm_movemask_epi8( _mm_loadu_si128( (const __m128i *)group ) );
+#else
+	uint32_t mask = 0;
+	for( unsigned i = 0; i < GROUP_SIZE; ++i ) {
+		mask |= (uint32_t)( group[i] >> 7 ) << i;
+	}
+	return mask;
+#endif
+}
+
+size_t ServerAddressIndex::FindSlot( const ServerAddressKey &key, uint64_t hash ) const {
+	const size_t groupMask = capacity / GROUP_SIZE - 1;
+	const auto hashBits = (uint8_t)( hash & 0x7F );
+
+	// Triangular probing visits all groups as the number of groups is a power of two
+	size_t groupIndex = ( hash >> 7 ) & groupMask;
+	for( size_t step = 1; step <= groupMask + 1; ++step ) {
+		const uint8_t *group = controlBytes + groupIndex * GROUP_SIZE;
+
+		for( uint32_t matches = MatchGroup( group, hashBits ); matches; matches &= matches - 1 ) {
+			const size_t slot = groupIndex * GROUP_SIZE + (unsigned)__builtin_ctz( matches );
+			if( keys[slot] == key ) {
+				return slot;
+			}
+		}
+
+		// Insertion never skips a group with empty slots
+		if( MatchGroup( group, EMPTY ) ) {
+			return NOT_FOUND;
+		}
+
+		groupIndex = ( groupIndex + step ) & groupMask;
+	}
+
+	return NOT_FOUND;
+}
+
+size_t ServerAddressIndex::FindFreeSlot( uint64_t hash ) const {
+	const size_t groupMask = capacity / GROUP_SIZE - 1;
+
+	// The load factor limit guarantees there are free slots
+	size_t groupIndex = ( hash >> 7 ) & groupMask;
+	for( size_t step = 1;; ++step ) {
+		if( const uint32_t freeSlots = MatchFreeSlots( controlBytes + groupIndex * GROUP_SIZE ) ) {
+			return groupIndex * GROUP_SIZE + (unsigned)__builtin_ctz( freeSlots );
+		}
+		groupIndex = ( groupIndex + step ) & groupMask;
+	}
+}
+
+bool ServerAddressIndex::Rehash( size_t newCapacity ) {
+	const size_t slotSize = 1 + sizeof( ServerAddressKey ) + sizeof( PolledGameServer * );
+	auto *mem = (uint8_t *)QAlloc( newCapacity * slotSize );
+
+	if( !mem ) {
+		return false;
+	}
+
+	uint8_t *const oldControlBytes = controlBytes;
+	ServerAddressKey *const oldKeys = keys;
+	PolledGameServer **const oldValues = values;
+	const size_t oldCapacity = capacity;
+
+	// Values are aligned as the capacity is a multiple of 8
+	controlBytes = mem;
+	keys = (ServerAddressKey *)( mem + newCapacity );
+	values = (PolledGameServer **)( mem + newCapacity * ( 1 + sizeof( ServerAddressKey ) ) );
+	capacity = newCapacity;
+	numDeleted = 0;
+
+	memset( controlBytes, EMPTY, newCapacity );
+
+	for( size_t i = 0; i < oldCapacity; ++i ) {
+		if( oldControlBytes[i] & 0x80 ) {
+			continue;
+		}
+
+		const size_t slot = FindFreeSlot( oldKeys[i].Hash() );
+		controlBytes[slot] = oldControlBytes[i];
+		keys[slot] = oldKeys[i];
+		values[slot] = oldValues[i];
+	}
+
+	QFree( oldControlBytes );
+	return true;
+}
+
+PolledGameServer *ServerAddressIndex::Find( const ServerAddressKey &key ) const {
+	if( !size ) {
+		return nullptr;
+	}
+
+	const size_t slot = FindSlot( key, key.Hash() );
+	return slot != NOT_FOUND ? values[slot] : nullptr;
+}
+
+bool ServerAddressIndex::Insert( const ServerAddressKey &key, PolledGameServer *server ) {
+	// Keep at least 1/8 of slots empty so probes terminate early
+	if( ( size + numDeleted + 1 ) * 8 > capacity * 7 ) {
+		size_t newCapacity = capacity ? capacity : MIN_CAPACITY;
+		// Grow if the table is mostly live, otherwise just drop deleted marks
+		if( ( size + 1 ) * 2 > newCapacity ) {
+			newCapacity *= 2;
+		}
+		if( !Rehash( newCapacity ) ) {
+			return false;
+		}
+	}
+
+	const uint64_t hash = key.Hash();
+	const size_t slot = FindFreeSlot( hash );
+
+	if( controlBytes[slot] == DELETED ) {
+		numDeleted--;
+	}
+
+	controlBytes[slot] = (uint8_t)( hash & 0x7F );
+	keys[slot] = key;
+	values[slot] = server;
+	size++;
+	return true;
+}
+
+void ServerAddressIndex::Remove( const ServerAddressKey &key ) {
+	if( !size ) {
+		return;
+	}
+
+	const size_t slot = FindSlot( key, key.Hash() );
+
+	if( slot == NOT_FOUND ) {
+		return;
+	}
+
+	// A group that has empty slots has never been full, so no probe continues past it
+	if( MatchGroup( controlBytes + ( slot & ~(size_t)( GROUP_SIZE - 1 ) ), EMPTY ) ) {
+		controlBytes[slot] = EMPTY;
+	} else {
+		controlBytes[slot] = DELETED;
+		numDeleted++;
+	}
+
+	values[slot] = nullptr;
+	size--;
+}
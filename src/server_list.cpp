@@ -1,8 +1,10 @@
 #include "command_parser.h"
+#include "allocator.h"
 #include "server_list.h"
 #include "socket.h"
 
 #include <inttypes.h>
+#include <new>
 #include <stdlib.h>
 
 class AbstractPool
@@ -97,8 +99,8 @@ public:
 			items[i].pool = this;
 		}
 		LinksAt( N - 1 ).PrevInList() = &LinksAt( N - 2 );
-		LinksAt( N + 1 ).NextInList() = nullptr;
-		LinksAt( N + 1 ).parent = &items[N - 1];
+		LinksAt( N - 1 ).NextInList() = nullptr;
+		LinksAt( N - 1 ).parent = &items[N - 1];
 		items[N - 1].pool = this;
 
 		freeItemLinks = &LinksAt( 0 );
@@ -130,6 +132,7 @@ class CompoundPoolChunk : public BasicPool<T, N>
 	CompoundPool<T, N> *parent;
 
 public:
+	// Links in a list of partially used, fully used or empty chunks (depending on the chunk count)
 	Links<CompoundPoolChunk<T, N> > chunkListLinks;
 	CompoundPoolChunk( CompoundPool<T, N> *parent_ )
 		: parent( parent_ ),
@@ -138,83 +141,131 @@ public:
 	void Free( PooledItem *item ) override;
 };
 
+/**
+ * A pool that grows by chunks up to a limit of allocated items.
+ * Chunks are kept in separate lists of partially used, full and empty chunks,
+ * so an allocation is served by a head of a list without scanning chunks.
+ * Partially used chunks are preferred over empty ones, so empty chunks might be released by Compactify().
+ */
 template <typename T, unsigned N>
 class CompoundPool
 {
 	typedef CompoundPoolChunk<T, N> ChunkType;
-	Links<ChunkType> *headChunk;
+	Links<ChunkType> *partialChunksHead;
+	Links<ChunkType> *fullChunksHead;
+	Links<ChunkType> *emptyChunksHead;
+	unsigned numEmptyChunks;
 	unsigned limit;
 	unsigned count;
 
 	friend class CompoundPoolChunk<T, N>;
 
+	static void DeleteChunks( Links<ChunkType> **listHead ) {
+		MutableLinksIterator<ChunkType> iterator( listHead );
+
+		while( iterator.HasNext() ) {
+			ChunkType *chunk = iterator.Next();
+			chunk->~ChunkType();
+			QFree( chunk );
+		}
+	}
+
+	void OnItemFreed( ChunkType *chunk ) {
+		count--;
+
+		if( chunk->count == N - 1 ) {
+			chunk->chunkListLinks.UnlinkFromHead( &fullChunksHead );
+			chunk->chunkListLinks.LinkToHead( &partialChunksHead );
+		} else if( !chunk->count ) {
+			chunk->chunkListLinks.UnlinkFromHead( &partialChunksHead );
+			chunk->chunkListLinks.LinkToHead( &emptyChunksHead );
+			numEmptyChunks++;
+		}
+	}
+
 public:
 	explicit CompoundPool( unsigned limit_ ) {
-		headChunk = nullptr;
+		static_assert( N >= 2, "" );
+		partialChunksHead = nullptr;
+		fullChunksHead = nullptr;
+		emptyChunksHead = nullptr;
+		numEmptyChunks = 0;
 		limit = limit_;
 		count = 0;
 	}
 
 	~CompoundPool() {
-		MutableLinksIterator<ChunkType> iterator( &headChunk );
-
-		while( iterator.HasNext() ) {
-			ChunkType *chunk = iterator.Next();
-			chunk->~ChunkType();
-			free( chunk );
-		}
+		DeleteChunks( &partialChunksHead );
+		DeleteChunks( &fullChunksHead );
+		DeleteChunks( &emptyChunksHead );
 	}
 
+	/**
+	 * Sets a maximal number of allocated items.
+	 * Items that are already allocated are kept even if there are more items than the new limit.
+	 */
+	void SetLimit( unsigned limit_ ) { limit = limit_; }
+
 	T *Alloc() {
-		if( count == limit ) {
+		if( count >= limit ) {
 			return nullptr;
 		}
 
-		MutableLinksIterator<ChunkType> iterator( &headChunk );
-
-		while( iterator.HasNext() ) {
-			ChunkType *chunk = iterator.Next();
+		ChunkType *chunk;
+		if( partialChunksHead ) {
+			chunk = partialChunksHead->Parent();
+		} else if( emptyChunksHead ) {
+			chunk = emptyChunksHead->Parent();
+			chunk->chunkListLinks.UnlinkFromHead( &emptyChunksHead );
+			chunk->chunkListLinks.LinkToHead( &partialChunksHead );
+			numEmptyChunks--;
+		} else {
+			void *mem = QAlloc( sizeof( ChunkType ) );
 
-			if( T *item = chunk->Alloc() ) {
-				count++;
-				return item;
+			if( !mem ) {
+				return nullptr;
 			}
+			chunk = new( mem )ChunkType( this );
+			chunk->chunkListLinks.LinkToHead( &partialChunksHead );
 		}
 
-		void *mem = malloc( sizeof( ChunkType ) );
-
-		if( !mem ) {
-			return nullptr;
-		}
-		auto *newChunk = new( mem )ChunkType( this );
-		newChunk->chunkListLinks.LinkToHead( &headChunk );
-		T *item = newChunk->Alloc();
+		T *item = chunk->Alloc();
 		assert( item );
 		count++;
+
+		if( chunk->count == N ) {
+			chunk->chunkListLinks.UnlinkFromHead( &partialChunksHead );
+			chunk->chunkListLinks.LinkToHead( &fullChunksHead );
+		}
 		return item;
 	}
 
-	void Compactify() {
-		MutableLinksIterator<ChunkType> iterator( &headChunk );
+	/**
+	 * Releases empty chunks that exceed the number of chunks to keep for reuse.
+	 * @param maxChunksToRelease A maximal number of chunks to release by this call (so the call time is bounded).
+	 * @return A number of released chunks.
+	 */
+	unsigned Compactify( unsigned maxChunksToRelease, unsigned numChunksToKeep ) {
+		unsigned numReleasedChunks = 0;
 
-		while( iterator.HasNext() ) {
-			ChunkType *chunk = iterator.Next();
-
-			if( !chunk->count ) {
-				iterator.Remove();
-				chunk->chunkListLinks.UnlinkFromHead( &headChunk );
-				chunk->~ChunkType();
-				free( chunk );
-			}
+		while( numEmptyChunks > numChunksToKeep && numReleasedChunks < maxChunksToRelease ) {
+			ChunkType *chunk = emptyChunksHead->Parent();
+			chunk->chunkListLinks.UnlinkFromHead( &emptyChunksHead );
+			chunk->~ChunkType();
+			QFree( chunk );
+			numEmptyChunks--;
+			numReleasedChunks++;
 		}
+
+		return numReleasedChunks;
 	}
 };
 
 template<typename T, unsigned N>
 void CompoundPoolChunk<T, N>::Free( PooledItem *item ) {
 	BasicPool<T, N>::Free( item );
-	// Make sure the parent count is modified too
-	parent->count--;
+	// Make sure the parent count and lists are modified too
+	parent->OnItemFreed( this );
 }
 
 typedef CompoundPool<ServerInfo, 32> ServerInfoPool;
@@ -1048,107 +1099,48 @@ bool ServerList::ParsePlayerInfo( Links<PlayerInfo> **listHead ) {
 }
 
 PolledGameServer *ServerList::FindServerByAddress( const NetworkAddress &address ) {
-	const uint32_t hash = address.Hash();
-	const unsigned hashBinIndex = hash % HASH_MAP_SIZE;
-
-	MutableLinksIterator<PolledGameServer> iterator( &serversHashBins[hashBinIndex] );
-
-	while( iterator.HasNext() ) {
-		PolledGameServer *server = iterator.Next();
-
-		if( server->addressHash != hash ) {
-			continue;
-		}
-
-		if( server->networkAddress != address ) {
-			continue;
-		}
-		return server;
-	}
-	return nullptr;
+	return serversIndex.Find( ServerAddressKey::FromAddress( address ) );
 }
 
 void ServerList::OnServerIpV4AddressBytesReceived( const uint8_t *addressBytes, const uint8_t *portBytes ) {
-	const uint32_t hash = NetworkAddress::HashForIpV4Data( addressBytes, portBytes );
-	const unsigned hashBinIndex = hash % HASH_MAP_SIZE;
-
-	LinksIterator<PolledGameServer> iterator( serversHashBins[hashBinIndex] );
-
-	while( iterator.HasNext() ) {
-		const auto *server = iterator.Next();
+	const ServerAddressKey key( ServerAddressKey::FromIpV4Data( addressBytes, portBytes ) );
 
-		if( server->addressHash != hash ) {
-			continue;
-		}
-
-		if( !server->networkAddress.MatchesIpV4Data( addressBytes, portBytes ) ) {
-			continue;
-		}
-		return;
+	if( !serversIndex.Find( key ) ) {
+		NetworkAddress address;
+		address.SetFromIpV4Data( addressBytes, portBytes );
+		AddNewServer( key, address );
 	}
-
-	AddNewIpV4Server( addressBytes, portBytes, hash, hashBinIndex );
 }
 
 void ServerList::OnServerIpV6AddressBytesReceived( const uint8_t *addressBytes, const uint8_t *portBytes ) {
-	const uint32_t hash = NetworkAddress::HashForIpV6Data( addressBytes, portBytes );
-	const unsigned hashBinIndex = hash % HASH_MAP_SIZE;
-
-	LinksIterator<PolledGameServer> iterator( serversHashBins[hashBinIndex] );
+	const ServerAddressKey key( ServerAddressKey::FromIpV6Data( addressBytes, portBytes ) );
 
-	while( iterator.HasNext() ) {
-		const auto *server = iterator.Next();
-
-		if( server->addressHash != hash ) {
-			continue;
-		}
-
-		if( !server->networkAddress.MatchesIpV6Data( addressBytes, portBytes ) ) {
-			continue;
-		}
-		return;
+	if( !serversIndex.Find( key ) ) {
+		NetworkAddress address;
+		address.SetFromIpV6Data( addressBytes, portBytes );
+		AddNewServer( key, address );
 	}
-
-	AddNewIpV6Server( addressBytes, portBytes, hash, hashBinIndex );
 }
 
-void ServerList::AddNewIpV4Server( const uint8_t *addressBytes, const uint8_t *portBytes,
-								   uint32_t addressHash, unsigned hashBinIndex ) {
-	if( auto *server = AllocPolledServer() ) {
-		server->networkAddress.SetFromIpV4Data( addressBytes, portBytes );
-		server->serversListLinks.LinkToHead( &serversHead );
-		LinkServerToHashBin( server, addressHash, hashBinIndex );
-	}
-}
+void ServerList::AddNewServer( const ServerAddressKey &key, const NetworkAddress &address ) {
+	auto *server = AllocPolledServer();
 
-void ServerList::AddNewIpV6Server( const uint8_t *addressBytes, const uint8_t *portBytes,
-								   uint32_t addressHash, unsigned hashBinIndex ) {
-	if( auto *server = AllocPolledServer() ) {
-		server->networkAddress.SetFromIpV6Data( addressBytes, portBytes );
-		server->serversListLinks.LinkToHead( &serversHead );
-		LinkServerToHashBin( server, addressHash, hashBinIndex );
+	if( !server ) {
+		return;
 	}
-}
 
-void ServerList::LinkServerToHashBin( PolledGameServer *server, const uint32_t addressHash, unsigned hashBinIndex ) {
-	assert( !serversHashBins[hashBinIndex] || serversHashBins[hashBinIndex]->Parent() != server );
-	server->addressHash = addressHash;
-	server->hashBinIndex = hashBinIndex;
-	server->hashBinLinks.LinkToHead( &serversHashBins[hashBinIndex] );
-}
-
-void ServerList::UnlinkServerFromHashBin( PolledGameServer *server ) {
-	unsigned hashBinIndex = server->hashBinIndex;
+	if( !serversIndex.Insert( key, server ) ) {
+		console->Printf( "ServerList::AddNewServer(): cannot grow the servers index\n" );
+		server->DeleteSelf();
+		return;
+	}
 
-	server->hashBinLinks.UnlinkFromHead( &serversHashBins[hashBinIndex] );
-	assert( !serversHashBins[hashBinIndex] || serversHashBins[hashBinIndex]->Parent() != server );
-	server->hashBinIndex = ~0u;
-	server->addressHash = ~0u;
+	server->networkAddress = address;
+	server->serversListLinks.LinkToHead( &serversHead );
 }
 
 PolledGameServer::PolledGameServer()
 	: serversListLinks( this ),
-	hashBinLinks( this ),
 	lastInfoRequestSentAt( 0 ),
 	lastInfoReceivedAt( 0 ),
 	currInfo( nullptr ),
@@ -1209,34 +1201,35 @@ ServerList::ServerList( System *system_, Socket *ipV4Socket_, Socket *ipV6Socket
 	playerInfoPool( nullptr ),    // to avoid an out-of-order initialization warning
 	lastMasterServersPollAt( 0 ),
 	lastMasterServerIndex( 0 ),
+	lastPoolsCompactionAt( 0 ),
 	showEmptyServers( false ),
 	showPlayerInfo( false ) {
-	memset( serversHashBins, 0, sizeof( serversHashBins ) );
-
 	// Let it crash on segfaults...
-	this->polledServersPool = new( malloc( sizeof( PolledGameServersPool ) ) )PolledGameServersPool( 256 );
-	this->serverInfoPool = new( malloc( sizeof( ServerInfoPool ) ) )ServerInfoPool( 768 );
-	this->playerInfoPool = new( malloc( sizeof( PlayerInfoPool ) ) )PlayerInfoPool( 2048 );
+	this->polledServersPool = new( QAlloc( sizeof( PolledGameServersPool ) ) )PolledGameServersPool( DEFAULT_MAX_SERVERS );
+	this->serverInfoPool = new( QAlloc( sizeof( ServerInfoPool ) ) )ServerInfoPool( DEFAULT_MAX_SERVER_INFOS );
+	this->playerInfoPool = new( QAlloc( sizeof( PlayerInfoPool ) ) )PlayerInfoPool( DEFAULT_MAX_PLAYER_INFOS );
 
-	void *parserMem = malloc( sizeof( ServerInfoParser ) );
+	void *parserMem = QAlloc( sizeof( ServerInfoParser ) );
 	this->serverInfoParser = new( parserMem )ServerInfoParser( &message, system_->SystemConsole() );
 }
 
 ServerList::~ServerList() {
-	listener->~ServerListListener();
-	free( listener );
+	if( listener ) {
+		listener->~ServerListListener();
+		free( listener );
+	}
 
 	this->serverInfoParser->~ServerInfoParser();
-	free( this->serverInfoParser );
+	QFree( this->serverInfoParser );
 
 	AsPolledGameServersPool( this->polledServersPool )->~PolledGameServersPool();
-	free( this->polledServersPool );
+	QFree( this->polledServersPool );
 
 	AsServerInfoPool( this->serverInfoPool )->~ServerInfoPool();
-	free( this->serverInfoPool );
+	QFree( this->serverInfoPool );
 
 	AsPlayerInfoPool( this->playerInfoPool )->~PlayerInfoPool();
-	free( this->playerInfoPool );
+	QFree( this->playerInfoPool );
 
 	system->DeleteSocket( ipV4Socket );
 	system->DeleteSocket( ipV6Socket );
@@ -1248,9 +1241,31 @@ void ServerList::Frame() {
 	EmitPollMasterServersPackets();
 	EmitPollGameServersPackets();
 
-	//AsPolledGameServersPool( this->polledServersPool )->Compactify();
-	//AsServerInfoPool( this->serverInfoPool )->Compactify();
-	//AsPlayerInfoPool( this->playerInfoPool )->Compactify();
+	CompactifyPools();
+}
+
+void ServerList::SetLimits( unsigned maxServers, unsigned maxServerInfos, unsigned maxPlayerInfos ) {
+	AsPolledGameServersPool( this->polledServersPool )->SetLimit( maxServers );
+	AsServerInfoPool( this->serverInfoPool )->SetLimit( maxServerInfos );
+	AsPlayerInfoPool( this->playerInfoPool )->SetLimit( maxPlayerInfos );
+}
+
+void ServerList::CompactifyPools() {
+	const auto millisNow = system->Millis();
+
+	// Servers that time out are usually replaced by ones from a next master server response,
+	// so let empty chunks stay for a while and release few of them per frame after a spike is over
+	if( millisNow - lastPoolsCompactionAt < 1000 ) {
+		return;
+	}
+
+	constexpr unsigned maxChunksPerPool = 4;
+	constexpr unsigned numChunksToKeep = 1;
+	AsPolledGameServersPool( this->polledServersPool )->Compactify( maxChunksPerPool, numChunksToKeep );
+	AsServerInfoPool( this->serverInfoPool )->Compactify( maxChunksPerPool, numChunksToKeep );
+	AsPlayerInfoPool( this->playerInfoPool )->Compactify( maxChunksPerPool, numChunksToKeep );
+
+	lastPoolsCompactionAt = millisNow;
 }
 
 void ServerList::EmitPollMasterServersPackets() {
@@ -1307,7 +1322,7 @@ void ServerList::DropTimedOutServers() {
 
 void ServerList::DropServer( PolledGameServer *server ) {
 	listener->OnServerRemoved( *server );
-	UnlinkServerFromHashBin( server );
+	serversIndex.Remove( ServerAddressKey::FromAddress( server->networkAddress ) );
 	server->DeleteSelf();
 }
 
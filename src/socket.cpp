@@ -1,4 +1,5 @@
 #include "socket.h"
+#include "allocator.h"
 #include "system.h"
 #include "client.h"
 #include "console.h"
@@ -37,7 +38,7 @@ Socket *System::NewSocket( bool useIpV4 ) {
 		return nullptr;
 	}
 
-	void *mem = malloc( sizeof( Socket ) );
+	void *mem = QAlloc( sizeof( Socket ) );
 
 	// If somebody has decided to turn memory overcommit off
 	if( !mem ) {
@@ -62,7 +63,7 @@ Socket *System::NewSocket( bool useIpV4 ) {
 void System::DeleteSocket( Socket *socket ) {
 	close( socket->UnderlyingFd() );
 	socket->~Socket();
-	free( socket );
+	QFree( socket );
 }
 
 void System::NetPollFrame( unsigned maxMillis ) {
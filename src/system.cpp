@@ -1,11 +1,19 @@
 #include "system.h"
+#include "allocator.h"
+#include "address_resolver.h"
+#include "bot_scheduler.h"
+#include "observer_farm.h"
+#include "connection_ramp.h"
 #include "client.h"
+#include "protocol_executor.h"
 #include "server_list.h"
+#include "demo_recorder.h"
 
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 
+#include <limits>
 #include <mutex>
 #include <thread>
 #include <new>
@@ -30,8 +38,9 @@ Client *System::NewClient( Console *console ) {
 
 	for( unsigned i = 0; i < MAX_FAKE_CLIENT_INSTANCES; ++i ) {
 		if( !clients[i] ) {
-			if( void *mem = malloc( sizeof( Client ) ) ) {
+			if( void *mem = QAlloc( sizeof( Client ) ) ) {
 				clients[i] = new(mem)Client( console, this );
+				clients[i]->systemSlot = (int)i;
 				return clients[i];
 			} else {
 				console->Printf( "System::NewClient(): cannot allocate memory for a client\n" );
@@ -54,7 +63,9 @@ void System::DeleteClient( Client *client ) {
 		if( clients[i] == client ) {
 			clients[i] = nullptr;
 			client->~Client();
-			free( client );
+			QFree( client );
+			clientStates[i] = GenericClientProtocolExecutor::CA_DISCONNECTED;
+			clientFrameDeadlines[i] = std::numeric_limits<uint64_t>::max();
 			return;
 		}
 	}
@@ -62,6 +73,63 @@ void System::DeleteClient( Client *client ) {
 	console->Printf( "System::DeleteClient(): unregistered client address\n" );
 }
 
+GenericClientProtocolExecutor *System::AcquireExecutor( Client *client, int protocolVersion ) {
+	SystemMutexLock lock( globalSystemMutex );
+
+	GenericClientProtocolExecutor *prev = nullptr;
+	for( GenericClientProtocolExecutor *executor = firstPooledExecutor; executor; executor = executor->nextInPool ) {
+		if( executor->protocolVersion != protocolVersion ) {
+			prev = executor;
+			continue;
+		}
+
+		if( prev ) {
+			prev->nextInPool = executor->nextInPool;
+		} else {
+			firstPooledExecutor = executor->nextInPool;
+		}
+
+		numPooledExecutors--;
+		executor->Recycle( client );
+		return executor;
+	}
+
+	return GenericClientProtocolExecutor::New( client->GetConsole(), client, this, protocolVersion );
+}
+
+void System::ReleaseExecutor( GenericClientProtocolExecutor *executor ) {
+	SystemMutexLock lock( globalSystemMutex );
+
+	if( numPooledExecutors >= maxPooledExecutors ) {
+		GenericClientProtocolExecutor::Delete( executor );
+		return;
+	}
+
+	// Release everything the executor might hold (sockets, ramp slots, recordings, lookups)
+	executor->CancelAddressResolution();
+	executor->Reset();
+
+	executor->nextInPool = firstPooledExecutor;
+	firstPooledExecutor = executor;
+	numPooledExecutors++;
+}
+
+void System::DeletePooledExecutors( unsigned numToKeep ) {
+	while( numPooledExecutors > numToKeep ) {
+		GenericClientProtocolExecutor *executor = firstPooledExecutor;
+		firstPooledExecutor = executor->nextInPool;
+		numPooledExecutors--;
+		GenericClientProtocolExecutor::Delete( executor );
+	}
+}
+
+void System::SetExecutorPoolCapacity( unsigned capacity ) {
+	SystemMutexLock lock( globalSystemMutex );
+
+	maxPooledExecutors = capacity;
+	DeletePooledExecutors( capacity );
+}
+
 void System::Init( Console *systemConsole ) {
 	System *system = globalSystem.load( std::memory_order_acquire );
 
@@ -109,7 +177,7 @@ System::System( Console *systemConsole ) {
 	millis = 0;
 
 #ifndef WIN32
-	timespec *timestamp = (timespec *)malloc( sizeof( timespec ) );
+	timespec *timestamp = (timespec *)QAlloc( sizeof( timespec ) );
 	this->timestamp = timestamp;
 	clock_gettime( CLOCK_MONOTONIC, timestamp );
 #endif
@@ -119,20 +187,65 @@ System::System( Console *systemConsole ) {
 	// Ensure that the memory is zeroed before first use
 	memset( clients, 0, MAX_FAKE_CLIENT_INSTANCES * sizeof( clients[0] ) );
 
+	for( unsigned i = 0; i < MAX_FAKE_CLIENT_INSTANCES; ++i ) {
+		clientStates[i] = GenericClientProtocolExecutor::CA_DISCONNECTED;
+		clientFrameDeadlines[i] = std::numeric_limits<uint64_t>::max();
+	}
+
+	numMasterServerRequests = 0;
+
+	firstPooledExecutor = nullptr;
+	numPooledExecutors = 0;
+	maxPooledExecutors = MAX_FAKE_CLIENT_INSTANCES;
+
 	serverList = nullptr;
+	pendingMaxServers = ServerList::DEFAULT_MAX_SERVERS;
+	pendingMaxServerInfos = ServerList::DEFAULT_MAX_SERVER_INFOS;
+	pendingMaxPlayerInfos = ServerList::DEFAULT_MAX_PLAYER_INFOS;
+	demoWriter = nullptr;
+	addressResolver = nullptr;
+	botScheduler = nullptr;
+	observerFarm = nullptr;
+	connectionRamp = nullptr;
+	numEnabledConnectionRamps = 0;
+
+	numFrameHooks = 0;
+
+	pendingUserCommandRate = -1;
+	userCommandRate = 0;
+	userCommandTicksStartedAt = 0;
+	numUserCommandTicks = 0;
 }
 
 System::~System() {
+	// Bots and observers refer to clients, delete them first
+	BotScheduler::Delete( botScheduler );
+	botScheduler = nullptr;
+
+	ObserverFarm::Delete( observerFarm );
+	observerFarm = nullptr;
+
 	for( unsigned i = 0; i < MAX_FAKE_CLIENT_INSTANCES; ++i ) {
 		if( !clients[i] ) {
 			continue;
 		}
 
 		clients[i]->~Client();
-		free( clients[i] );
+		QFree( clients[i] );
 		clients[i] = nullptr;
 	}
 
+	// Deleted clients have released their executors to the pool
+	DeletePooledExecutors( 0 );
+
+	// Clients have stopped their recordings, so this waits only for writing pending data
+	DemoWriter::Delete( demoWriter );
+	demoWriter = nullptr;
+
+	// Clients have cancelled their requests, this waits only for the current lookup
+	AddressResolver::Delete( addressResolver );
+	addressResolver = nullptr;
+
 	if( console ) {
 		console->~Console();
 		free( console );
@@ -140,8 +253,32 @@ System::~System() {
 
 	if( serverList ) {
 		serverList->~ServerList();
-		free( serverList );
+		QFree( serverList );
+	}
+
+	DeleteConnectionRamp();
+
+	QFree( timestamp );
+}
+
+DemoWriter *System::DemoWriterInstance() {
+	SystemMutexLock lock( globalSystemMutex );
+
+	if( !demoWriter ) {
+		demoWriter = DemoWriter::New();
 	}
+
+	return demoWriter;
+}
+
+AddressResolver *System::AddressResolverInstance() {
+	SystemMutexLock lock( globalSystemMutex );
+
+	if( !addressResolver ) {
+		addressResolver = AddressResolver::New( this, console );
+	}
+
+	return addressResolver;
 }
 
 void System::Sleep( unsigned millis ) {
@@ -208,6 +345,42 @@ bool System::RemoveListenedSocket( Socket *socket ) {
 	return false;
 }
 
+bool System::AddFrameHook( void *owner, void ( *callback )( void * ) ) {
+	SystemMutexLock lock( globalSystemMutex );
+
+	if( numFrameHooks == MAX_FRAME_HOOKS ) {
+		console->Printf( "Can't add a frame hook: too many hooks\n" );
+		return false;
+	}
+
+	for( unsigned i = 0; i < numFrameHooks; ++i ) {
+		if( frameHooks[i].owner == owner ) {
+			console->Printf( "Can't add a frame hook: the owner already has a hook\n" );
+			return false;
+		}
+	}
+
+	frameHooks[numFrameHooks].owner = owner;
+	frameHooks[numFrameHooks].callback = callback;
+	numFrameHooks++;
+	return true;
+}
+
+bool System::RemoveFrameHook( void *owner ) {
+	SystemMutexLock lock( globalSystemMutex );
+
+	for( unsigned i = 0; i < numFrameHooks; ++i ) {
+		if( frameHooks[i].owner == owner ) {
+			// Keep the order of hooks
+			memmove( &frameHooks[i], &frameHooks[i + 1], ( numFrameHooks - i - 1 ) * sizeof( FrameHook ) );
+			numFrameHooks--;
+			return true;
+		}
+	}
+
+	return false;
+}
+
 void System::Frame( unsigned maxMillis ) {
 	auto threadId = std::this_thread::get_id();
 
@@ -223,28 +396,101 @@ void System::Frame( unsigned maxMillis ) {
 	TimeFrame( maxMillis );
 	NetPollFrame( maxMillis );
 	ClientsFrame( maxMillis );
+	UserCommandsFrame();
+
+	if( addressResolver ) {
+		addressResolver->Frame();
+	}
+
+	if( botScheduler ) {
+		botScheduler->Frame();
+	}
 
 	if( serverList ) {
 		serverList->Frame();
 	}
+
+	if( observerFarm ) {
+		observerFarm->Frame();
+	}
+
+	// Hooks might remove themselves, so the current hook is looked up again after every call
+	for( unsigned i = 0; i < numFrameHooks; ) {
+		const FrameHook hook = frameHooks[i];
+		hook.callback( hook.owner );
+
+		if( i < numFrameHooks && frameHooks[i].owner == hook.owner ) {
+			i++;
+		}
+	}
 }
 
 void System::TimeFrame( unsigned maxMillis ) {
 #ifndef _WIN32
-	timespec prevTimestamp = *(timespec *)this->timestamp;
-	timespec *currTimestamp = (timespec *)this->timestamp;
-	clock_gettime( CLOCK_MONOTONIC, currTimestamp );
-
-	int64_t deltaNanos = currTimestamp->tv_sec * 1000 * 1000 * 1000 + currTimestamp->tv_nsec;
-	deltaNanos -= prevTimestamp.tv_sec * 1000 * 1000 * 1000 + prevTimestamp.tv_nsec;
-	this->millis += ( deltaNanos / ( 1000 * 1000 ) );
+	timespec *prevTimestamp = (timespec *)this->timestamp;
+	timespec currTimestamp;
+	clock_gettime( CLOCK_MONOTONIC, &currTimestamp );
+
+	const int64_t prevNanos = prevTimestamp->tv_sec * 1000 * 1000 * 1000 + prevTimestamp->tv_nsec;
+	const int64_t deltaNanos = currTimestamp.tv_sec * 1000 * 1000 * 1000 + currTimestamp.tv_nsec - prevNanos;
+	const int64_t deltaMillis = deltaNanos / ( 1000 * 1000 );
+	this->millis += deltaMillis;
+
+	// Advance the timestamp only by whole millis, otherwise the clock falls behind if frames are frequent
+	const int64_t consumedNanos = prevNanos + deltaMillis * 1000 * 1000;
+	prevTimestamp->tv_sec = (time_t)( consumedNanos / ( 1000 * 1000 * 1000 ) );
+	prevTimestamp->tv_nsec = (long)( consumedNanos % ( 1000 * 1000 * 1000 ) );
 #endif
 }
 
 void System::ClientsFrame( unsigned maxMillis ) {
-	for( Client *client: clients ) {
-		if( client ) {
-			client->Frame();
+	for( unsigned i = 0; i < MAX_FAKE_CLIENT_INSTANCES; ++i ) {
+		// Empty slots have the maximal deadline as well
+		if( millis < clientFrameDeadlines[i] ) {
+			continue;
+		}
+		clients[i]->Frame();
+	}
+}
+
+void System::SetUserCommandRate( unsigned ticksPerSecond ) {
+	// Tick fields are accessed only in the System thread, so the rate is passed there
+	pendingUserCommandRate = (int)( ticksPerSecond < 1000 ? ticksPerSecond : 1000 );
+}
+
+void System::UserCommandsFrame() {
+	const int pendingRate = pendingUserCommandRate.exchange( -1 );
+
+	if( pendingRate >= 0 ) {
+		userCommandRate = (unsigned)pendingRate;
+		userCommandTicksStartedAt = millis;
+		numUserCommandTicks = 0;
+	}
+
+	if( !userCommandRate ) {
+		return;
+	}
+
+	// A number of ticks that should have been made since the start including the current one
+	const uint64_t numDueTicks = ( millis - userCommandTicksStartedAt ) * userCommandRate / 1000 + 1;
+
+	if( numDueTicks <= numUserCommandTicks ) {
+		return;
+	}
+
+	uint64_t numTicks = numDueTicks - numUserCommandTicks;
+	numUserCommandTicks = numDueTicks;
+
+	// Drop ticks that cannot be caught up after a long stall
+	if( numTicks > MAX_USER_COMMANDS_IN_MOVE ) {
+		numTicks = MAX_USER_COMMANDS_IN_MOVE;
+	}
+
+	const unsigned tickMillis = 1000 / userCommandRate;
+
+	for( unsigned i = 0; i < MAX_FAKE_CLIENT_INSTANCES; ++i ) {
+		if( clientStates[i] == GenericClientProtocolExecutor::CA_ACTIVE ) {
+			clients[i]->UserCommandsFrame( (unsigned)numTicks, tickMillis );
 		}
 	}
 }
@@ -266,6 +512,66 @@ bool System::AddMasterServer( const NetworkAddress &address ) {
 	return true;
 }
 
+bool System::AddMasterServer( const char *addressString ) {
+	UnresolvedAddress unresolvedAddress( addressString );
+
+	if( !unresolvedAddress.IsValidAsString() ) {
+		console->Printf( "System::AddMasterServer(): illegal address `%s`\n", addressString );
+		return false;
+	}
+
+	if( unresolvedAddress.IsResolved() ) {
+		return AddMasterServer( unresolvedAddress.ToResolvedAddress() );
+	}
+
+	SystemMutexLock lock( globalSystemMutex );
+
+	AddressResolver *resolver = AddressResolverInstance();
+
+	if( !resolver ) {
+		return false;
+	}
+
+	if( numMasterServers + numMasterServerRequests >= MAX_MASTER_SERVERS ) {
+		console->Printf( "System::AddMasterServer(): too many master servers\n" );
+		return false;
+	}
+
+	const char *host = unresolvedAddress.Host();
+	const uint32_t requestId = resolver->Resolve( host, unresolvedAddress.HostPort(), this, &OnMasterServerAddressResolved );
+
+	if( !requestId ) {
+		return false;
+	}
+
+	masterServerRequestIds[numMasterServerRequests++] = requestId;
+	return true;
+}
+
+void System::OnMasterServerAddressResolved( void *owner, uint32_t requestId, const NetworkAddress *address ) {
+	System *system = (System *)owner;
+	SystemMutexLock lock( globalSystemMutex );
+
+	unsigned requestNum = 0;
+	while( requestNum < system->numMasterServerRequests && system->masterServerRequestIds[requestNum] != requestId ) {
+		requestNum++;
+	}
+
+	// Ignore completions of requests the system does not wait for
+	if( requestNum == system->numMasterServerRequests ) {
+		return;
+	}
+
+	system->masterServerRequestIds[requestNum] = system->masterServerRequestIds[--system->numMasterServerRequests];
+
+	if( !address ) {
+		system->console->Printf( "System::AddMasterServer(): cannot resolve a master server address\n" );
+		return;
+	}
+
+	system->AddMasterServer( *address );
+}
+
 bool System::RemoveMasterServer( const NetworkAddress &address ) {
 	SystemMutexLock lock( globalSystemMutex );
 
@@ -336,7 +642,7 @@ bool System::StartUpdatingServerList( ServerListListener *listener ) {
 		return false;
 	}
 
-	void *mem = malloc( sizeof( ServerList ) );
+	void *mem = QAlloc( sizeof( ServerList ) );
 
 	if( !mem ) {
 		console->Printf( "System::StartUpdatingServerList(): Can't allocate a memory for a server list\n" );
@@ -353,14 +659,17 @@ bool System::StartUpdatingServerList( ServerListListener *listener ) {
 		assert( bufferSize > 1024 );
 
 		if( !this->AddListenedSocket( socket, serverList, buffer, bufferSize, &ServerList::SocketCallback ) ) {
+			// The listener is not owned by the list on failure
+			this->serverList->listener = nullptr;
 			this->serverList->~ServerList();
-			free( this->serverList );
+			QFree( this->serverList );
 			this->serverList = nullptr;
 			return false;
 		}
 	}
 
 	serverList->SetOptions( pendingShowEmptyServersOption, pendingShowPlayerInfoOption );
+	serverList->SetLimits( pendingMaxServers, pendingMaxServerInfos, pendingMaxPlayerInfos );
 	return true;
 }
 
@@ -372,7 +681,7 @@ void System::StopUpdatingServerList() {
 	}
 
 	serverList->~ServerList();
-	free( serverList );
+	QFree( serverList );
 	serverList = nullptr;
 }
 
@@ -387,4 +696,122 @@ void System::SetServerListUpdateOptions( bool showEmptyServers, bool showPlayerI
 	if( serverList ) {
 		serverList->SetOptions( showEmptyServers, showPlayerInfo );
 	}
-}
\ No newline at end of file
+}
+
+void System::SetServerListLimits( unsigned maxServers, unsigned maxServerInfos, unsigned maxPlayerInfos ) {
+	SystemMutexLock lock( globalSystemMutex );
+
+	pendingMaxServers = maxServers;
+	pendingMaxServerInfos = maxServerInfos;
+	pendingMaxPlayerInfos = maxPlayerInfos;
+
+	if( serverList ) {
+		serverList->SetLimits( maxServers, maxServerInfos, maxPlayerInfos );
+	}
+}
+
+BotScheduler *System::StartBotScheduler( unsigned maxBots, uint64_t seed ) {
+	SystemMutexLock lock( globalSystemMutex );
+
+	if( botScheduler ) {
+		console->Printf( "System::StartBotScheduler(): The bot scheduler has been already started\n" );
+		abort();
+	}
+
+	botScheduler = BotScheduler::New( this, console, maxBots, seed );
+	return botScheduler;
+}
+
+void System::StopBotScheduler() {
+	SystemMutexLock lock( globalSystemMutex );
+
+	BotScheduler::Delete( botScheduler );
+	botScheduler = nullptr;
+}
+
+ObserverFarm *System::StartObserverFarm( const ObserverFarmSettings &settings, ClientEventStream *stream,
+										 ServerListListener *listener ) {
+	SystemMutexLock lock( globalSystemMutex );
+
+	if( observerFarm ) {
+		console->Printf( "System::StartObserverFarm(): The observer farm has been already started\n" );
+		abort();
+	}
+
+	if( !stream ) {
+		console->Printf( "System::StartObserverFarm(): The event stream is null\n" );
+		abort();
+	}
+
+	if( serverList ) {
+		console->Printf( "System::StartObserverFarm(): The server list is already being updated\n" );
+		return nullptr;
+	}
+
+	ObserverFarm *farm = ObserverFarm::New( this, console, stream, settings, pendingMaxServers );
+
+	if( !farm ) {
+		return nullptr;
+	}
+
+	ServerListListener *farmListener = farm->NewServerListListener( listener );
+
+	if( !farmListener || !StartUpdatingServerList( farmListener ) ) {
+		if( farmListener ) {
+			farmListener->~ServerListListener();
+			free( farmListener );
+		}
+		ObserverFarm::Delete( farm );
+		return nullptr;
+	}
+
+	observerFarm = farm;
+	return farm;
+}
+
+void System::StopObserverFarm() {
+	SystemMutexLock lock( globalSystemMutex );
+
+	if( !observerFarm ) {
+		return;
+	}
+
+	// The server list owns a listener that refers to the farm
+	StopUpdatingServerList();
+
+	ObserverFarm::Delete( observerFarm );
+	observerFarm = nullptr;
+}
+
+bool System::EnableConnectionRamp( const ConnectionRampSettings &settings, uint64_t seed ) {
+	SystemMutexLock lock( globalSystemMutex );
+	CheckThread( "System::EnableConnectionRamp()" );
+
+	void *mem = QAlloc( sizeof( ConnectionRamp ) );
+
+	if( !mem ) {
+		console->Printf( "System::EnableConnectionRamp(): Can't allocate a memory for a connection ramp\n" );
+		return false;
+	}
+
+	DeleteConnectionRamp();
+	connectionRamp = new( mem )ConnectionRamp( settings, seed, ++numEnabledConnectionRamps );
+	return true;
+}
+
+void System::DisableConnectionRamp() {
+	SystemMutexLock lock( globalSystemMutex );
+	CheckThread( "System::DisableConnectionRamp()" );
+
+	DeleteConnectionRamp();
+}
+
+void System::DeleteConnectionRamp() {
+	if( !connectionRamp ) {
+		return;
+	}
+
+	connectionRamp->~ConnectionRamp();
+	QFree( connectionRamp );
+	connectionRamp = nullptr;
+}
@@ -0,0 +1,122 @@
+#include "user_command.h"
+#include "allocator.h"
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+UserCommandGenerator::UserCommandGenerator( const UserCommandPattern &pattern_,
+											UserCommand *replayCommands_, unsigned numReplayCommands_ )
+	: pattern( pattern_ ),
+	replayCommands( replayCommands_ ),
+	numReplayCommands( numReplayCommands_ ),
+	randomState( pattern_.seed ),
+	numTicks( 0 ),
+	turnPerTick( 0.0f ),
+	ticksTillTurnChange( 0 ) {
+	// Start looking in a random direction, so many clients do not move in the same way
+	yaw = (float)( 360.0 * NextRandomFraction( &randomState ) );
+
+	if( !pattern.turnChangeTicks ) {
+		pattern.turnChangeTicks = 1;
+	}
+
+	if( !pattern.strafeTicks ) {
+		pattern.strafeTicks = 1;
+	}
+}
+
+UserCommandGenerator::~UserCommandGenerator() {
+	QFree( replayCommands );
+}
+
+UserCommandGenerator *UserCommandGenerator::New( const UserCommandPattern &pattern,
+												 const UserCommand *replayCommands, unsigned numReplayCommands ) {
+	UserCommand *ownReplayCommands = nullptr;
+
+	if( pattern.kind == UserCommandPattern::REPLAY ) {
+		if( !replayCommands || !numReplayCommands ) {
+			return nullptr;
+		}
+
+		if( !( ownReplayCommands = (UserCommand *)QAlloc( numReplayCommands * sizeof( UserCommand ) ) ) ) {
+			return nullptr;
+		}
+
+		memcpy( ownReplayCommands, replayCommands, numReplayCommands * sizeof( UserCommand ) );
+	}
+
+	void *mem = QAlloc( sizeof( UserCommandGenerator ) );
+
+	if( !mem ) {
+		QFree( ownReplayCommands );
+		return nullptr;
+	}
+
+	return new(mem)UserCommandGenerator( pattern, ownReplayCommands, ownReplayCommands ? numReplayCommands : 0 );
+}
+
+void UserCommandGenerator::Delete( UserCommandGenerator *generator ) {
+	if( generator ) {
+		generator->~UserCommandGenerator();
+		QFree( generator );
+	}
+}
+
+void UserCommandGenerator::Generate( UserCommand *commands, unsigned numCommands ) {
+	for( unsigned i = 0; i < numCommands; ++i ) {
+		UserCommand *command = &commands[i];
+
+		switch( pattern.kind ) {
+			case UserCommandPattern::REPLAY:
+				*command = replayCommands[numTicks % numReplayCommands];
+				break;
+			case UserCommandPattern::RANDOM_WALK:
+				GenerateRandomWalk( command );
+				break;
+			case UserCommandPattern::STRAFE:
+				GenerateStrafe( command );
+				break;
+			default:
+				memset( command, 0, sizeof( UserCommand ) );
+				command->angles[1] = UserCommand::AngleToShort( yaw );
+				break;
+		}
+
+		numTicks++;
+	}
+}
+
+void UserCommandGenerator::GenerateRandomWalk( UserCommand *command ) {
+	if( !ticksTillTurnChange ) {
+		turnPerTick = pattern.maxTurnPerTick * (float)( 2.0 * NextRandomFraction( &randomState ) - 1.0 );
+		ticksTillTurnChange = 1 + (unsigned)( NextRandom64( &randomState ) % ( 2 * pattern.turnChangeTicks ) );
+	}
+	ticksTillTurnChange--;
+
+	yaw += turnPerTick;
+	if( yaw >= 360.0f ) {
+		yaw -= 360.0f;
+	} else if( yaw < 0.0f ) {
+		yaw += 360.0f;
+	}
+
+	memset( command, 0, sizeof( UserCommand ) );
+	command->angles[1] = UserCommand::AngleToShort( yaw );
+	command->forwardMove = 127;
+
+	if( pattern.attackProbability > 0.0f && NextRandomFraction( &randomState ) < pattern.attackProbability ) {
+		command->buttons |= UserCommand::BUTTON_ATTACK;
+	}
+}
+
+void UserCommandGenerator::GenerateStrafe( UserCommand *command ) {
+	memset( command, 0, sizeof( UserCommand ) );
+	command->angles[1] = UserCommand::AngleToShort( yaw );
+	command->forwardMove = 127;
+	command->sideMove = ( numTicks / pattern.strafeTicks ) % 2 ? 127 : -127;
+
+	if( pattern.jumpTicks && !( numTicks % pattern.jumpTicks ) ) {
+		command->upMove = 127;
+	}
+}
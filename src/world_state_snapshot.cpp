@@ -0,0 +1,210 @@
+#include "world_state_snapshot.h"
+#include "allocator.h"
+#include "message_parser.h"
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+WorldStateSnapshot::WorldStateSnapshot()
+	: sourceId( 0 ),
+	version( 0 ),
+	lastFrame( -1 ),
+	serverTime( 0 ),
+	protocol( 0 ),
+	playerNum( 0 ),
+	spawnCount( 0 ),
+	hasEnteredGame( false ),
+	hasStats( false ),
+	numConfigStrings( 0 ) {
+	memset( stats, 0, sizeof( stats ) );
+	motd[0] = 0;
+	game[0] = 0;
+	level[0] = 0;
+}
+
+WorldStateSnapshot *WorldStateSnapshot::New() {
+	void *mem = QAlloc( sizeof( WorldStateSnapshot ) );
+
+	if( !mem ) {
+		return nullptr;
+	}
+
+	return new(mem)WorldStateSnapshot;
+}
+
+void WorldStateSnapshot::Delete( WorldStateSnapshot *snapshot ) {
+	if( snapshot ) {
+		snapshot->~WorldStateSnapshot();
+		QFree( snapshot );
+	}
+}
+
+void WorldStateSnapshot::CopyConfigStrings( const char *strings, unsigned stride, const uint32_t *versions,
+											unsigned num, bool copyAll ) {
+	const unsigned length = stride < MAX_CONFIGSTRING_CHARS ? stride : MAX_CONFIGSTRING_CHARS;
+
+	for( unsigned i = 0; i < num; ++i ) {
+		if( !copyAll && configStringVersions[i] == versions[i] ) {
+			continue;
+		}
+
+		memcpy( configStrings[i], strings + i * stride, length );
+		// A reader might copy a string that is being overwritten (the copy is discarded then, but should be terminated)
+		configStrings[i][length - 1] = '\0';
+		configStringVersions[i] = versions[i];
+	}
+
+	numConfigStrings = num;
+}
+
+WorldStatePublisher::WorldStatePublisher()
+	: publishedVersion( 0 ), sourceId( 1 ), isSourceChanged( false ) {
+	for( Buffer &buffer: buffers ) {
+		buffer.sequence.store( 0, std::memory_order_relaxed );
+	}
+}
+
+WorldStatePublisher *WorldStatePublisher::New() {
+	void *mem = QAlloc( sizeof( WorldStatePublisher ) );
+
+	if( !mem ) {
+		return nullptr;
+	}
+
+	return new(mem)WorldStatePublisher;
+}
+
+void WorldStatePublisher::Delete( WorldStatePublisher *publisher ) {
+	if( publisher ) {
+		publisher->~WorldStatePublisher();
+		QFree( publisher );
+	}
+}
+
+static void CopyString( char *dest, const char *src ) {
+	if( src ) {
+		QStrncpyz( dest, src, MAX_STRING_CHARS + 1 );
+	} else {
+		dest[0] = '\0';
+	}
+}
+
+void WorldStatePublisher::Publish( const ClientWorldState &worldState, int64_t lastFrame, uint64_t serverTime,
+								   bool hasEnteredGame ) {
+	if( isSourceChanged ) {
+		isSourceChanged = false;
+
+		if( !++sourceId ) {
+			sourceId = 1;
+		}
+	}
+
+	const uint64_t version = publishedVersion.load( std::memory_order_relaxed ) + 1;
+	Buffer &buffer = buffers[version % 2];
+	WorldStateSnapshot *snapshot = &buffer.snapshot;
+
+	// Make the sequence odd before any data is modified
+	const uint64_t sequence = buffer.sequence.load( std::memory_order_relaxed );
+	buffer.sequence.store( sequence + 1, std::memory_order_relaxed );
+	std::atomic_thread_fence( std::memory_order_release );
+
+	snapshot->version = version;
+	snapshot->lastFrame = lastFrame;
+	snapshot->serverTime = serverTime;
+	snapshot->protocol = worldState.protocol;
+	snapshot->playerNum = worldState.playerNum;
+	snapshot->spawnCount = worldState.spawnCount;
+	snapshot->hasEnteredGame = hasEnteredGame;
+
+	snapshot->hasStats = false;
+
+	if( const short *stats = worldState.PlayerStats( worldState.playerNum - 1 ) ) {
+		unsigned numStats = worldState.statsStride;
+
+		if( numStats > WorldStateSnapshot::MAX_STATS ) {
+			numStats = WorldStateSnapshot::MAX_STATS;
+		}
+
+		memcpy( snapshot->stats, stats, numStats * sizeof( short ) );
+		memset( snapshot->stats + numStats, 0, ( WorldStateSnapshot::MAX_STATS - numStats ) * sizeof( short ) );
+		snapshot->hasStats = true;
+	}
+
+	CopyString( snapshot->motd, worldState.motd );
+	CopyString( snapshot->game, worldState.game );
+	CopyString( snapshot->level, worldState.level );
+
+	unsigned numConfigStrings = worldState.maxConfigStrings;
+
+	if( !worldState.configStrings || !worldState.configStringsStride ) {
+		numConfigStrings = 0;
+	} else if( numConfigStrings > WorldStateSnapshot::MAX_CONFIGSTRINGS ) {
+		numConfigStrings = WorldStateSnapshot::MAX_CONFIGSTRINGS;
+	}
+
+	// The buffer has been written two publications ago, so only configstrings changed since then are copied
+	const bool copyAll = snapshot->sourceId != sourceId;
+	snapshot->CopyConfigStrings( worldState.configStrings, worldState.configStringsStride, worldState.configStringVersions,
+								 numConfigStrings, copyAll );
+	snapshot->sourceId = sourceId;
+
+	buffer.sequence.store( sequence + 2, std::memory_order_release );
+	publishedVersion.store( version, std::memory_order_release );
+}
+
+bool WorldStatePublisher::Read( WorldStateSnapshot *snapshot ) const {
+	for(;; ) {
+		const uint64_t version = publishedVersion.load( std::memory_order_acquire );
+
+		if( !version ) {
+			return false;
+		}
+
+		const Buffer &buffer = buffers[version % 2];
+		const WorldStateSnapshot &source = buffer.snapshot;
+		const uint64_t sequence = buffer.sequence.load( std::memory_order_acquire );
+
+		// The writer has lapped the reader and is writing this buffer again
+		if( sequence & 1 ) {
+			continue;
+		}
+
+		snapshot->version = source.version;
+		snapshot->lastFrame = source.lastFrame;
+		snapshot->serverTime = source.serverTime;
+		snapshot->protocol = source.protocol;
+		snapshot->playerNum = source.playerNum;
+		snapshot->spawnCount = source.spawnCount;
+		snapshot->hasEnteredGame = source.hasEnteredGame;
+		snapshot->hasStats = source.hasStats;
+		memcpy( snapshot->stats, source.stats, sizeof( source.stats ) );
+
+		memcpy( snapshot->motd, source.motd, sizeof( source.motd ) );
+		memcpy( snapshot->game, source.game, sizeof( source.game ) );
+		memcpy( snapshot->level, source.level, sizeof( source.level ) );
+		snapshot->motd[MAX_STRING_CHARS] = '\0';
+		snapshot->game[MAX_STRING_CHARS] = '\0';
+		snapshot->level[MAX_STRING_CHARS] = '\0';
+
+		unsigned numConfigStrings = source.numConfigStrings;
+
+		if( numConfigStrings > WorldStateSnapshot::MAX_CONFIGSTRINGS ) {
+			numConfigStrings = WorldStateSnapshot::MAX_CONFIGSTRINGS;
+		}
+
+		const uint32_t sourceId = source.sourceId;
+		snapshot->CopyConfigStrings( &source.configStrings[0][0], MAX_CONFIGSTRING_CHARS, source.configStringVersions,
+									 numConfigStrings, snapshot->sourceId != sourceId );
+
+		std::atomic_thread_fence( std::memory_order_acquire );
+
+		if( buffer.sequence.load( std::memory_order_relaxed ) == sequence ) {
+			snapshot->sourceId = sourceId;
+			return true;
+		}
+
+		// Configstrings might have been copied along with versions of newer values, copy all of them on retry
+		snapshot->sourceId = 0;
+	}
+}